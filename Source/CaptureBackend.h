@@ -0,0 +1,258 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <expected>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include "Nodos/PluginHelpers.hpp"
+#include "Webcam_generated.h"
+
+namespace nos::webcam
+{
+constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+{
+	return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+// Same layout as Media Foundation subtype GUID's Data1 and V4L2 pixel format codes
+constexpr uint32_t FOURCC_NONE = 0;
+constexpr uint32_t FOURCC_NV12 = MakeFourCC('N', 'V', '1', '2');
+constexpr uint32_t FOURCC_YUY2 = MakeFourCC('Y', 'U', 'Y', '2');
+constexpr uint32_t FOURCC_BGR24 = MakeFourCC('B', 'G', 'R', '3');
+constexpr uint32_t FOURCC_MJPG = MakeFourCC('M', 'J', 'P', 'G');
+
+// Size of a tightly packed frame, 0 for compressed formats
+inline uint32_t GetFrameBufferSize(uint32_t fourCC, nos::fb::vec2u const& resolution)
+{
+	const uint32_t pixels = resolution.x() * resolution.y();
+	switch (fourCC)
+	{
+	case FOURCC_NV12: return pixels * 3 / 2;
+	case FOURCC_YUY2: return pixels * 2;
+	case FOURCC_BGR24: return pixels * 3;
+	default: return 0;
+	}
+}
+
+// Bytes in a tightly packed row of the first plane, 0 for compressed formats
+inline uint32_t GetFrameRowSize(uint32_t fourCC, uint32_t width)
+{
+	switch (fourCC)
+	{
+	case FOURCC_NV12: return width;
+	case FOURCC_YUY2: return width * 2;
+	case FOURCC_BGR24: return width * 3;
+	default: return 0;
+	}
+}
+
+// Size of a frame box filtered down by factor, rounded down to whole chroma samples. Zero for formats that can not be downscaled.
+inline nos::fb::vec2u GetDownscaledResolution(uint32_t fourCC, nos::fb::vec2u const& resolution, uint32_t factor)
+{
+	const uint32_t width = resolution.x() / (2 * factor) * 2;
+	switch (fourCC)
+	{
+	case FOURCC_NV12: return nos::fb::vec2u(width, resolution.y() / (2 * factor) * 2);
+	case FOURCC_YUY2: return nos::fb::vec2u(width, resolution.y() / factor);
+	default: return nos::fb::vec2u(0, 0);
+	}
+}
+
+struct CaptureBackend;
+
+struct WebcamDevice
+{
+	std::string Name;
+	std::string SymLink; // Backend specific unique path of the device
+	CaptureBackend* Backend = nullptr;
+};
+
+enum class WebcamFrameRate : uint32_t
+{
+	WEBCAM_FRAMERATE_1 = 0,
+	WEBCAM_FRAMERATE_5,
+	WEBCAM_FRAMERATE_7_5,
+	WEBCAM_FRAMERATE_10,
+	WEBCAM_FRAMERATE_14_98,
+	WEBCAM_FRAMERATE_15,
+	WEBCAM_FRAMERATE_20,
+	WEBCAM_FRAMERATE_23_98,
+	WEBCAM_FRAMERATE_24,
+	WEBCAM_FRAMERATE_25,
+	WEBCAM_FRAMERATE_29_97,
+	WEBCAM_FRAMERATE_30,
+	WEBCAM_FRAMERATE_47_95,
+	WEBCAM_FRAMERATE_48,
+	WEBCAM_FRAMERATE_50,
+	WEBCAM_FRAMERATE_59_94,
+	WEBCAM_FRAMERATE_60,
+	WEBCAM_FRAMERATE_119_88,
+	WEBCAM_FRAMERATE_120,
+	COUNT
+};
+
+inline nos::fb::vec2u GetFrameRateVec2(WebcamFrameRate const& frameRate)
+{
+	switch (frameRate)
+	{
+		case WebcamFrameRate::WEBCAM_FRAMERATE_1:	    return { 1, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_5:	    return { 5, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_7_5:    return { 10000000, 1333333 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_10:	    return { 10, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_14_98:  return { 5000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_15:     return { 15, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_20:     return { 20, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_23_98:  return { 24000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_24:     return { 24, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_25:     return { 25, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_29_97:  return { 30000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_30:     return { 30, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_47_95:  return { 48000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_48:		return { 48, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_50:     return { 50, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_59_94:  return { 60000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_60:     return { 60, 1 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_119_88: return { 120000, 1001 };
+		case WebcamFrameRate::WEBCAM_FRAMERATE_120:    return { 120, 1 };
+		default: DEBUG_BREAK;					        return { 1, 50 }; break;
+	}
+}
+
+// Finds the table entry closest to frames/seconds, drivers report the same rate with different fractions (e.g. 2/15 and 1333333/10000000)
+inline std::optional<WebcamFrameRate> FindFrameRate(uint64_t frames, uint64_t seconds)
+{
+	if (!frames || !seconds)
+		return std::nullopt;
+	double fps = double(frames) / double(seconds);
+	for (uint32_t i = std::to_underlying(WebcamFrameRate::WEBCAM_FRAMERATE_1); i < std::to_underlying(WebcamFrameRate::COUNT); i++)
+	{
+		nos::fb::vec2u candidate = GetFrameRateVec2(WebcamFrameRate(i));
+		if (std::abs(fps - double(candidate.x()) / double(candidate.y())) < 0.005)
+			return WebcamFrameRate(i);
+	}
+	return std::nullopt;
+}
+
+struct FormatInfo
+{
+	uint32_t StreamIndex = 0;
+	uint32_t FourCC = FOURCC_NONE;
+	nos::fb::vec2u Resolution;
+	WebcamFrameRate FrameRate = WebcamFrameRate::WEBCAM_FRAMERATE_30;
+};
+
+// Orders formats as NV12 > YUY2 > others, then resolution, then frame rate (descending)
+inline bool CompareFormats(FormatInfo const& a, FormatInfo const& b)
+{
+	auto rank = [](uint32_t fourCC) { return fourCC == FOURCC_NV12 ? 0 : fourCC == FOURCC_YUY2 ? 1 : 2; };
+	if (rank(a.FourCC) != rank(b.FourCC))
+		return rank(a.FourCC) < rank(b.FourCC);
+	if (a.FourCC != b.FourCC)
+		return a.FourCC < b.FourCC;
+	if (a.Resolution.x() != b.Resolution.x())
+		return a.Resolution.x() > b.Resolution.x();
+	if (a.Resolution.y() != b.Resolution.y())
+		return a.Resolution.y() > b.Resolution.y();
+	if (std::to_underlying(a.FrameRate) != std::to_underlying(b.FrameRate))
+		return std::to_underlying(a.FrameRate) > std::to_underlying(b.FrameRate);
+	return false;
+}
+
+// A frame owned by the backend until it is requeued
+struct CapturedFrame
+{
+	uint8_t* Data = nullptr;
+	uint32_t Size = 0;
+	uint32_t BufferIndex = 0; // Index in user buffers if UserBuffer is set
+	// Bytes from one row to the next when rows are padded, negative for bottom-up frames with Data at the top row.
+	// 0 for tightly packed frames. Planes follow each other with the same pitch.
+	int32_t Pitch = 0;
+	bool UserBuffer = false;
+	// Capture time on the device clock in nanoseconds, 0 if the backend has none
+	uint64_t DeviceTimestamp = 0;
+	// Device frame counter, gaps mean the device dropped frames
+	std::optional<uint64_t> DeviceSequence;
+	// Backend reported a gap in the stream before this frame without telling how many frames were lost
+	bool Discontinuity = false;
+};
+
+// Host memory owned by the caller that the device can capture into directly, e.g. a persistently mapped upload buffer
+struct UserBuffer
+{
+	uint8_t* Data = nullptr;
+	uint32_t Size = 0;
+};
+
+struct CaptureSession
+{
+	virtual ~CaptureSession() = default;
+	virtual FormatInfo GetFormat() const = 0;
+	// Largest frame the device can deliver, user buffers must be at least this big
+	virtual uint32_t GetMaxFrameSize() const { return GetFrameBufferSize(GetFormat().FourCC, GetFormat().Resolution); }
+	virtual bool SupportsUserBuffers() const { return false; }
+	// Switches the device to capture into the given buffers, or back to its own buffers if empty.
+	// No frames may be outstanding while switching.
+	virtual std::expected<void, std::string> SetUserBuffers(std::vector<UserBuffer> const& buffers) { return std::unexpected("User buffers are not supported"); }
+	// Waits for the next frame from the device. Data stays valid until the frame is requeued.
+	virtual std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) = 0;
+	// Returns the frame's buffer to the device. Can be called from a thread other than the one dequeuing.
+	virtual void Requeue(CapturedFrame const& frame) = 0;
+	// Stops the device from delivering while nobody reads, no frames in device buffers may be outstanding.
+	// Backends that can not stop the device keep it running, frames then pile up in the backend's own queue.
+	virtual void SetStreaming(bool streaming) {}
+	virtual void Close() = 0;
+};
+
+struct CaptureOptions
+{
+	// Buffers the device captures into before the consumer takes them, 0 for the backend default.
+	// Fewer buffers mean fresher frames, more buffers ride out consumer hiccups without drops.
+	uint32_t BufferCount = 0;
+	// Sources that are not live, like recordings, deliver frames as fast as consumers give them back instead of in real time
+	bool Unpaced = false;
+};
+
+enum class DeviceChange
+{
+	Arrived,
+	Removed
+};
+
+// Called from a backend owned thread when a device is plugged in or removed
+using DeviceChangeCallback = std::function<void(std::string const& symLink, DeviceChange change)>;
+
+// Notifications stop when destroyed
+struct DeviceWatcher
+{
+	virtual ~DeviceWatcher() = default;
+};
+
+struct CaptureBackend
+{
+	virtual ~CaptureBackend() = default;
+	virtual const char* GetName() const = 0;
+	virtual std::vector<WebcamDevice> EnumerateDevices() = 0;
+	// Null if the backend can not report hotplug, its device list is then treated as fixed
+	virtual std::unique_ptr<DeviceWatcher> WatchDevices(DeviceChangeCallback callback) { return nullptr; }
+	virtual std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) = 0;
+	virtual std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const& device, FormatInfo const& format, CaptureOptions const& options) = 0;
+};
+
+std::unique_ptr<CaptureBackend> CreateSyntheticCaptureBackend();
+std::unique_ptr<CaptureBackend> CreateReplayCaptureBackend();
+#if defined(_WIN32)
+std::unique_ptr<CaptureBackend> CreateMFCaptureBackend();
+#endif
+#if defined(__linux__)
+std::unique_ptr<CaptureBackend> CreateV4L2CaptureBackend();
+#endif
+} // namespace nos::webcam
@@ -0,0 +1,258 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "CaptureRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace nos::webcam
+{
+// Written around the page cache where the file system allows it, so recording several cameras does not flood memory with
+// dirty pages that the kernel then flushes in bursts on the capture threads' time
+struct CaptureRecorder::RecordingFile
+{
+#if defined(_WIN32)
+	static std::expected<std::unique_ptr<RecordingFile>, std::string> Open(std::string const& path)
+	{
+		auto file = std::make_unique<RecordingFile>();
+		file->Handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+		if (file->Handle == INVALID_HANDLE_VALUE)
+		{
+			file->Direct = false;
+			file->Handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		}
+		if (file->Handle == INVALID_HANDLE_VALUE)
+			return std::unexpected("Failed to create " + path + ": error " + std::to_string(GetLastError()));
+		return file;
+	}
+
+	~RecordingFile()
+	{
+		if (Handle != INVALID_HANDLE_VALUE)
+			CloseHandle(Handle);
+	}
+
+	std::expected<void, std::string> Write(uint8_t const* data, uint64_t size, uint64_t offset)
+	{
+		while (size)
+		{
+			OVERLAPPED overlapped{};
+			overlapped.Offset = DWORD(offset);
+			overlapped.OffsetHigh = DWORD(offset >> 32);
+			DWORD written = 0;
+			if (!WriteFile(Handle, data, DWORD(std::min<uint64_t>(size, 1ull << 30)), &written, &overlapped))
+				return std::unexpected("Failed to write recording: error " + std::to_string(GetLastError()));
+			data += written;
+			size -= written;
+			offset += written;
+		}
+		return {};
+	}
+
+	HANDLE Handle = INVALID_HANDLE_VALUE;
+#else
+	static std::expected<std::unique_ptr<RecordingFile>, std::string> Open(std::string const& path)
+	{
+		auto file = std::make_unique<RecordingFile>();
+		file->Fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+		// tmpfs and some network file systems refuse direct I/O
+		if (file->Fd < 0 && errno == EINVAL)
+		{
+			file->Direct = false;
+			file->Fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		}
+		if (file->Fd < 0)
+			return std::unexpected("Failed to create " + path + ": " + std::strerror(errno));
+		return file;
+	}
+
+	~RecordingFile()
+	{
+		if (Fd >= 0)
+			::close(Fd);
+	}
+
+	std::expected<void, std::string> Write(uint8_t const* data, uint64_t size, uint64_t offset)
+	{
+		while (size)
+		{
+			const ssize_t written = ::pwrite(Fd, data, size, off_t(offset));
+			if (written < 0 && errno == EINTR)
+				continue;
+			// Some file systems only turn direct I/O down on the first write
+			if (written < 0 && errno == EINVAL && Direct)
+			{
+				Direct = false;
+				if (fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) & ~O_DIRECT) == 0)
+					continue;
+			}
+			if (written <= 0)
+				return std::unexpected(std::string("Failed to write recording: ") + std::strerror(written < 0 ? errno : ENOSPC));
+			data += written;
+			size -= written;
+			offset += written;
+		}
+		return {};
+	}
+
+	int Fd = -1;
+#endif
+	bool Direct = true;
+};
+
+CaptureRecorder::AlignedBuffer CaptureRecorder::AllocateAligned(size_t size)
+{
+	// Zeroed so the padding up to the next page is written as zeroes
+	auto* data = static_cast<uint8_t*>(::operator new[](size, std::align_val_t(RECORDING_ALIGNMENT)));
+	std::memset(data, 0, size);
+	return AlignedBuffer(data);
+}
+
+std::expected<std::unique_ptr<CaptureRecorder>, std::string> CaptureRecorder::Create(std::string const& path, std::shared_ptr<DeviceCapture> capture, TWebcamStreamInfo const& info)
+{
+	FormatInfo const& format = capture->OutputFormat;
+	const uint64_t frameSize = GetFrameBufferSize(format.FourCC, format.Resolution);
+	if (!frameSize)
+		return std::unexpected("Compressed frames can not be recorded");
+	RecordingHeader header{};
+	header.Magic = RECORDING_MAGIC;
+	header.Version = RECORDING_VERSION;
+	header.FourCC = format.FourCC;
+	header.Width = format.Resolution.x();
+	header.Height = format.Resolution.y();
+	const nos::fb::vec2u frameRate = GetFrameRateVec2(format.FrameRate);
+	header.FrameRate[0] = frameRate.x();
+	header.FrameRate[1] = frameRate.y();
+	header.StreamIndex = info.stream_index;
+	header.CaptureMode = uint32_t(info.capture_mode);
+	header.FrameSize = frameSize;
+	header.FrameStride = AlignRecordingSize(frameSize);
+	std::strncpy(header.DeviceName, info.device_name.c_str(), sizeof(header.DeviceName) - 1);
+
+	auto file = RecordingFile::Open(path);
+	if (!file)
+		return std::unexpected(file.error());
+	if (!(*file)->Direct)
+		nosEngine.LogW("Recording %s through the page cache, the file system does not support direct I/O", path.c_str());
+	// Header without an index marks the file unfinished until the recorder is done
+	AlignedBuffer page = AllocateAligned(RECORDING_DATA_OFFSET);
+	std::memcpy(page.get(), &header, sizeof(header));
+	if (auto res = (*file)->Write(page.get(), RECORDING_DATA_OFFSET, 0); !res)
+		return std::unexpected(res.error());
+
+	std::unique_ptr<CaptureRecorder> recorder(new CaptureRecorder(path, std::move(*file), capture, header));
+	capture->Subscribe(recorder.get());
+	return recorder;
+}
+
+CaptureRecorder::CaptureRecorder(std::string path, std::unique_ptr<RecordingFile> file, std::shared_ptr<DeviceCapture> capture, RecordingHeader const& header)
+	: Path(std::move(path)), File(std::move(file)), Capture(std::move(capture)), Header(header)
+{
+	Layout = FrameLayout{ .FourCC = Header.FourCC, .Resolution = nos::fb::vec2u(Header.Width, Header.Height) };
+	const size_t bufferCount = std::max<size_t>(STAGING_BYTES / Header.FrameStride, MIN_STAGING_BUFFERS);
+	for (size_t i = 0; i < bufferCount; i++)
+	{
+		Staging.push_back(AllocateAligned(Header.FrameStride));
+		FreeBuffers.push_back(Staging.back().get());
+	}
+	Writer = std::thread([this] { WriteLoop(); });
+}
+
+CaptureRecorder::~CaptureRecorder()
+{
+	Capture->Unsubscribe(this);
+	{
+		std::unique_lock lock(Mutex);
+		Stopping = true;
+	}
+	FrameStaged.notify_one();
+	Writer.join();
+	if (auto res = Finish(); !res)
+		nosEngine.LogE("Recording %s is unusable: %s", Path.c_str(), res.error().c_str());
+	else
+		nosEngine.LogI("Recorded %llu frames of %s to %s, %llu frames dropped by the recorder", (unsigned long long)Header.FrameCount, Header.DeviceName,
+			Path.c_str(), (unsigned long long)Header.DroppedFrames);
+}
+
+void CaptureRecorder::OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops)
+{
+	uint8_t* buffer = nullptr;
+	{
+		std::unique_lock lock(Mutex);
+		if (!FreeBuffers.empty())
+		{
+			buffer = FreeBuffers.back();
+			FreeBuffers.pop_back();
+		}
+	}
+	if (!buffer)
+	{
+		DroppedFrames++;
+		return;
+	}
+	Packer.Copy(buffer, Header.FrameSize, lease->Frame.Data, lease->Frame.Size, FrameLayout{ .FourCC = Layout.FourCC, .Resolution = Layout.Resolution, .Pitch = lease->Frame.Pitch });
+	{
+		std::unique_lock lock(Mutex);
+		Pending.push_back(StagedFrame{ .Data = buffer, .Info = lease->Info });
+	}
+	FrameStaged.notify_one();
+}
+
+void CaptureRecorder::WriteLoop()
+{
+	std::unique_lock lock(Mutex);
+	while (true)
+	{
+		FrameStaged.wait(lock, [this] { return Stopping || !Pending.empty(); });
+		if (Pending.empty())
+			return;
+		StagedFrame frame = Pending.front();
+		Pending.pop_front();
+		lock.unlock();
+		// After a failed write the rest is discarded, the file has no index to find frames past the gap
+		if (WriteError.empty())
+		{
+			if (auto res = File->Write(frame.Data, Header.FrameStride, WriteOffset))
+			{
+				Index.push_back(RecordingIndexEntry{ .Sequence = frame.Info.Sequence, .DeviceTimestamp = frame.Info.DeviceTimestamp, .HostTimestamp = frame.Info.HostTimestamp });
+				WriteOffset += Header.FrameStride;
+			}
+			else
+			{
+				WriteError = res.error();
+				nosEngine.LogE("Recording %s stopped: %s", Path.c_str(), WriteError.c_str());
+			}
+		}
+		lock.lock();
+		FreeBuffers.push_back(frame.Data);
+	}
+}
+
+std::expected<void, std::string> CaptureRecorder::Finish()
+{
+	if (!WriteError.empty())
+		return std::unexpected(WriteError);
+	const uint64_t indexSize = AlignRecordingSize(Index.size() * sizeof(RecordingIndexEntry));
+	if (indexSize)
+	{
+		AlignedBuffer index = AllocateAligned(indexSize);
+		std::memcpy(index.get(), Index.data(), Index.size() * sizeof(RecordingIndexEntry));
+		if (auto res = File->Write(index.get(), indexSize, WriteOffset); !res)
+			return res;
+	}
+	Header.FrameCount = Index.size();
+	Header.IndexOffset = WriteOffset;
+	Header.DroppedFrames = DroppedFrames;
+	AlignedBuffer page = AllocateAligned(RECORDING_DATA_OFFSET);
+	std::memcpy(page.get(), &Header, sizeof(Header));
+	return File->Write(page.get(), RECORDING_DATA_OFFSET, 0);
+}
+} // namespace nos::webcam
@@ -0,0 +1,127 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <expected>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DeviceCapture.h"
+#include "FrameCopy.h"
+
+namespace nos::webcam
+{
+// Recording container: a header page, frames each starting on their own page, then the frame index.
+// Every write covers whole pages at page offsets so it can bypass the page cache.
+constexpr uint32_t RECORDING_MAGIC = MakeFourCC('N', 'C', 'A', 'P');
+constexpr uint32_t RECORDING_VERSION = 1;
+constexpr uint64_t RECORDING_ALIGNMENT = 4096;
+constexpr uint64_t RECORDING_DATA_OFFSET = RECORDING_ALIGNMENT;
+constexpr char RECORDING_EXTENSION[] = ".noscap";
+
+constexpr uint64_t AlignRecordingSize(uint64_t size)
+{
+	return (size + RECORDING_ALIGNMENT - 1) / RECORDING_ALIGNMENT * RECORDING_ALIGNMENT;
+}
+
+// WebcamStreamInfo of the recorded stream and where the frames are
+struct RecordingHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t FourCC;
+	uint32_t Width;
+	uint32_t Height;
+	// Frames per second as FrameRate[0] / FrameRate[1]
+	uint32_t FrameRate[2];
+	uint32_t StreamIndex;
+	uint32_t CaptureMode;
+	uint32_t Reserved;
+	// Bytes of a tightly packed frame, frame i starts at RECORDING_DATA_OFFSET + i * FrameStride
+	uint64_t FrameSize;
+	uint64_t FrameStride;
+	uint64_t FrameCount;
+	// Written when the recording is finished, 0 in a file whose recorder did not finish
+	uint64_t IndexOffset;
+	// Frames the recorder could not keep up with, they show up as gaps in the index sequences
+	uint64_t DroppedFrames;
+	char DeviceName[256];
+};
+static_assert(sizeof(RecordingHeader) <= RECORDING_DATA_OFFSET);
+
+// SampleInfo of a recorded frame
+struct RecordingIndexEntry
+{
+	uint64_t Sequence;
+	uint64_t DeviceTimestamp;
+	uint64_t HostTimestamp;
+	uint64_t Reserved;
+};
+
+// Writes every frame of a device capture into a recording. Frames are packed into page aligned memory on the capture thread,
+// which gives the device buffer back right away, and written from there on the recorder's own thread with direct I/O.
+// Frames arriving while every staging buffer waits for the disk are dropped instead of holding up the capture.
+struct CaptureRecorder : FrameConsumer
+{
+	// Staging memory per recorder, rides out a third of a second of disk stalls at 1080p60 NV12
+	static constexpr size_t STAGING_BYTES = 64ull * 1024 * 1024;
+	static constexpr uint32_t MIN_STAGING_BUFFERS = 4;
+
+	// Starts recording right away, the file is overwritten if it exists
+	static std::expected<std::unique_ptr<CaptureRecorder>, std::string> Create(std::string const& path, std::shared_ptr<DeviceCapture> capture, TWebcamStreamInfo const& info);
+	// Stops the capture feeding the recorder, writes what was staged and finishes the file
+	~CaptureRecorder() override;
+
+	void OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops) override;
+	void Flush() override {}
+
+	std::string const Path;
+
+private:
+	struct StagedFrame
+	{
+		uint8_t* Data = nullptr;
+		SampleInfo Info{};
+	};
+	struct AlignedDeleter
+	{
+		void operator()(uint8_t* data) const { ::operator delete[](data, std::align_val_t(RECORDING_ALIGNMENT)); }
+	};
+	using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedDeleter>;
+	static AlignedBuffer AllocateAligned(size_t size);
+
+	struct RecordingFile;
+
+	CaptureRecorder(std::string path, std::unique_ptr<RecordingFile> file, std::shared_ptr<DeviceCapture> capture, RecordingHeader const& header);
+	void WriteLoop();
+	std::expected<void, std::string> Finish();
+
+	std::unique_ptr<RecordingFile> File;
+	std::shared_ptr<DeviceCapture> Capture;
+	RecordingHeader Header;
+	FrameLayout Layout;
+	// Packs on the capture thread alone, the shared copy workers belong to the readers
+	FrameCopy Packer{ 0 };
+
+	std::vector<AlignedBuffer> Staging;
+	std::mutex Mutex;
+	std::condition_variable FrameStaged;
+	std::vector<uint8_t*> FreeBuffers;
+	std::deque<StagedFrame> Pending;
+	bool Stopping = false;
+	std::thread Writer;
+
+	// Writer thread state
+	std::vector<RecordingIndexEntry> Index;
+	uint64_t WriteOffset = RECORDING_DATA_OFFSET;
+	std::string WriteError;
+	// Capture thread state
+	uint64_t DroppedFrames = 0;
+};
+} // namespace nos::webcam
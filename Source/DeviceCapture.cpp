@@ -0,0 +1,306 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "DeviceCapture.h"
+#include "FrameDecoder.h"
+
+namespace nos::webcam
+{
+FrameLease::FrameLease(std::shared_ptr<DeviceCapture> capture, CapturedFrame const& frame, SampleInfo const& info)
+	: Capture(std::move(capture)), Frame(frame), Info(info)
+{
+}
+
+FrameLease::~FrameLease()
+{
+	Capture->ReleaseLease(Frame);
+}
+
+DeviceCapture::DeviceCapture(WebcamDevice const& device, std::shared_ptr<CaptureSession> session, CaptureOptions const& options)
+	: Device(device), Format(session->GetFormat()), OutputFormat(FrameDecoder::GetOutputFormat(Format)), Options(options), Session(std::move(session))
+{
+	nos::fb::vec2u frameRate = GetFrameRateVec2(Format.FrameRate);
+	FrameInterval = std::chrono::nanoseconds(1'000'000'000ull * frameRate.y() / std::max(frameRate.x(), 1u));
+	if (FrameDecoder::NeedsDecoding(Format.FourCC))
+	{
+		const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency() / 2, 1u, MAX_DECODE_THREADS);
+		Decoder = std::make_unique<FrameDecoder>(Device, Format, Session, threadCount,
+			[this](CapturedFrame const& frame, SampleInfo const& info, uint64_t droppedBefore) { Deliver(frame, info, droppedBefore); });
+	}
+}
+
+DeviceCapture::~DeviceCapture()
+{
+	Stop();
+	Session->Close();
+}
+
+void DeviceCapture::Close()
+{
+	std::unique_lock control(ControlMutex);
+	Stop();
+	// User buffers belong to the reader, only the device's own buffers go away on close.
+	// Frames still read from them keep the session open, the last one given back closes it.
+	if (!WaitForLeases(false))
+	{
+		std::unique_lock lock(LeasesMutex);
+		if (OutstandingLeases[false])
+		{
+			CloseWhenReleased = true;
+			nosEngine.LogW("%s: Closing the device once the frames still in use are given back", Device.Name.c_str());
+			return;
+		}
+	}
+	Session->Close();
+}
+
+void DeviceCapture::Subscribe(FrameConsumer* consumer)
+{
+	std::unique_lock control(ControlMutex);
+	std::unique_lock lock(ConsumersMutex);
+	Consumers.push_back(consumer);
+	lock.unlock();
+	// New consumer is not idle, a paused capture thread has exited already
+	if (Paused && CaptureThread.joinable())
+		CaptureThread.join();
+	if (!CaptureThread.joinable())
+		Start();
+}
+
+void DeviceCapture::Unsubscribe(FrameConsumer* consumer)
+{
+	std::unique_lock control(ControlMutex);
+	std::unique_lock lock(ConsumersMutex);
+	if (std::erase(Consumers, consumer) == 0)
+		return;
+	lock.unlock();
+	consumer->Flush();
+	if (UserBufferOwner == consumer)
+	{
+		// Owner is about to free the buffers, device must stop writing into them
+		if (auto res = SwitchBuffers({}); !res)
+			nosEngine.LogE("%s: Failed to revert to device buffers: %s", Device.Name.c_str(), res.error().c_str());
+		UserBufferOwner = nullptr;
+	}
+	if (GetConsumerCount() == 0)
+		Stop();
+}
+
+std::expected<void, std::string> DeviceCapture::SetUserBuffers(FrameConsumer* owner, std::vector<UserBuffer> const& buffers)
+{
+	std::unique_lock control(ControlMutex);
+	if (Decoder && !buffers.empty())
+		return std::unexpected("Frames are decoded before delivery");
+	if (buffers.empty())
+	{
+		if (UserBufferOwner != owner)
+			return {};
+	}
+	else
+	{
+		std::shared_lock lock(ConsumersMutex);
+		if (Consumers.size() != 1 || Consumers[0] != owner)
+			return std::unexpected("Device is shared by multiple streams");
+	}
+	auto result = SwitchBuffers(buffers);
+	UserBufferOwner = result && !buffers.empty() ? owner : nullptr;
+	return result;
+}
+
+size_t DeviceCapture::GetConsumerCount()
+{
+	std::shared_lock lock(ConsumersMutex);
+	return Consumers.size();
+}
+
+std::expected<void, std::string> DeviceCapture::SwitchBuffers(std::vector<UserBuffer> const& buffers)
+{
+	const bool wasRunning = CaptureThread.joinable();
+	Stop();
+	{
+		std::shared_lock lock(ConsumersMutex);
+		for (auto* consumer : Consumers)
+			consumer->Flush();
+	}
+	// Switching to user buffers unmaps the device's buffers, it does not happen while a frame in them is read.
+	// Switching back lets the owner free its buffers, which other consumers may still be reading; the owner itself
+	// has already let go of its frames. The device has to stop writing into them either way.
+	std::expected<void, std::string> result;
+	if (!buffers.empty() && !WaitForLeases(false))
+		result = std::unexpected("Frames in device buffers are still in use");
+	else
+	{
+		if (buffers.empty() && GetConsumerCount())
+			WaitForLeases(true);
+		result = Session->SetUserBuffers(buffers);
+	}
+	if (wasRunning)
+		Start();
+	return result;
+}
+
+bool DeviceCapture::WaitForLeases(bool userBuffers)
+{
+	std::unique_lock lock(LeasesMutex);
+	uint32_t& outstanding = OutstandingLeases[userBuffers];
+	if (LeasesReleased.wait_for(lock, LEASE_RELEASE_TIMEOUT, [&outstanding] { return outstanding == 0; }))
+		return true;
+	nosEngine.LogW("%s: %u frames still in use while releasing capture buffers", Device.Name.c_str(), outstanding);
+	return false;
+}
+
+void DeviceCapture::Wake()
+{
+	if (!Paused)
+		return;
+	std::unique_lock control(ControlMutex);
+	if (!Paused || !CaptureThread.joinable())
+		return;
+	// Thread has already left the capture loop after pausing
+	CaptureThread.join();
+	Start();
+}
+
+void DeviceCapture::Start()
+{
+	if (Paused)
+	{
+		Session->SetStreaming(true);
+		// The gap while paused is not frames the device lost
+		LastDeviceSequence = std::nullopt;
+		LastDeviceTimestamp = 0;
+		Paused = false;
+		nosEngine.LogI("%s: Resumed capture", Device.Name.c_str());
+	}
+	StopRequested = false;
+	CaptureThread = std::thread([this] { CaptureLoop(); });
+}
+
+void DeviceCapture::Stop()
+{
+	StopRequested = true;
+	if (CaptureThread.joinable())
+		CaptureThread.join();
+	// Frames being decoded still belong to the device
+	if (Decoder)
+		Decoder->Drain();
+}
+
+void DeviceCapture::CaptureLoop()
+{
+	while (!StopRequested)
+	{
+		if (AreConsumersIdle() && TryPause())
+			return;
+		auto frame = Session->Dequeue(std::chrono::milliseconds(100));
+		if (!frame)
+			continue;
+		const uint64_t deviceDrops = CountDeviceDrops(*frame);
+		NextSequence += deviceDrops;
+		SampleInfo info{
+			.Sequence = NextSequence++,
+			.DeviceTimestamp = frame->DeviceTimestamp,
+			.HostTimestamp = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()),
+		};
+		if (Decoder)
+			Decoder->Submit(*frame, info, deviceDrops);
+		else
+			Deliver(*frame, info, deviceDrops);
+	}
+}
+
+bool DeviceCapture::AreConsumersIdle()
+{
+	const auto now = std::chrono::steady_clock::now();
+	std::shared_lock lock(ConsumersMutex);
+	return !Consumers.empty() && std::all_of(Consumers.begin(), Consumers.end(), [now](FrameConsumer* consumer) { return consumer->IsIdle(now); });
+}
+
+bool DeviceCapture::TryPause()
+{
+	// Whoever holds the lock may be waiting to join this thread, try again on the next frame
+	std::unique_lock control(ControlMutex, std::try_to_lock);
+	if (!control || StopRequested)
+		return false;
+	// Set before the last check, a consumer reading from now on either is seen here or sees the flag and wakes the device
+	Paused = true;
+	if (!AreConsumersIdle())
+	{
+		Paused = false;
+		return false;
+	}
+	if (Decoder)
+		Decoder->Drain();
+	{
+		std::shared_lock lock(ConsumersMutex);
+		for (auto* consumer : Consumers)
+			consumer->Flush();
+	}
+	// Device buffers go away when the device stops, user buffers stay with their owner.
+	// A frame that is still read keeps the device running, pausing is tried again on the next frame.
+	if (!WaitForLeases(false))
+	{
+		Paused = false;
+		return false;
+	}
+	Session->SetStreaming(false);
+	Paused = true;
+	nosEngine.LogI("%s: Paused capture, no stream has read a frame recently", Device.Name.c_str());
+	return true;
+}
+
+void DeviceCapture::Deliver(CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops)
+{
+	{
+		std::unique_lock lock(LeasesMutex);
+		OutstandingLeases[frame.UserBuffer]++;
+	}
+	// Consumers share the frame, it goes back to the device once the last one is done with it
+	auto lease = std::make_shared<FrameLease>(shared_from_this(), frame, info);
+	std::shared_lock lock(ConsumersMutex);
+	for (auto* consumer : Consumers)
+		consumer->OnFrame(lease, deviceDrops);
+}
+
+uint64_t DeviceCapture::CountDeviceDrops(CapturedFrame const& frame)
+{
+	uint64_t dropped = 0;
+	if (frame.DeviceSequence && LastDeviceSequence && *frame.DeviceSequence > *LastDeviceSequence)
+		dropped = *frame.DeviceSequence - *LastDeviceSequence - 1;
+	else if (!frame.DeviceSequence && frame.DeviceTimestamp > LastDeviceTimestamp && LastDeviceTimestamp && FrameInterval.count())
+	{
+		// No frame counter, round the timestamp gap to whole frame intervals
+		const uint64_t interval = FrameInterval.count();
+		const uint64_t frames = (frame.DeviceTimestamp - LastDeviceTimestamp + interval / 2) / interval;
+		dropped = frames > 1 ? frames - 1 : 0;
+	}
+	if (frame.Discontinuity)
+		dropped = std::max<uint64_t>(dropped, 1);
+	if (frame.DeviceSequence)
+		LastDeviceSequence = frame.DeviceSequence;
+	if (frame.DeviceTimestamp)
+		LastDeviceTimestamp = frame.DeviceTimestamp;
+	return dropped;
+}
+
+void DeviceCapture::ReleaseLease(CapturedFrame const& frame)
+{
+	bool closing;
+	{
+		std::unique_lock lock(LeasesMutex);
+		closing = CloseWhenReleased;
+	}
+	if (Decoder)
+		Decoder->Release(frame.BufferIndex);
+	else if (!closing)
+		Session->Requeue(frame);
+	std::unique_lock lock(LeasesMutex);
+	const bool last = --OutstandingLeases[frame.UserBuffer] == 0;
+	LeasesReleased.notify_all();
+	// Close left the session open for this frame
+	if (!CloseWhenReleased || !last || frame.UserBuffer)
+		return;
+	CloseWhenReleased = false;
+	lock.unlock();
+	Session->Close();
+}
+} // namespace nos::webcam
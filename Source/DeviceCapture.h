@@ -0,0 +1,131 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <array>
+
+#include "CaptureBackend.h"
+
+namespace nos::webcam
+{
+struct SampleInfo
+{
+	// Frame number in the stream, frames that were lost take up numbers too so gaps are visible
+	uint64_t Sequence = 0;
+	// Capture time on the device clock in nanoseconds, 0 if the backend has none
+	uint64_t DeviceTimestamp = 0;
+	// std::chrono::steady_clock time in nanoseconds when the capture thread received the frame
+	uint64_t HostTimestamp = 0;
+	// Frames lost between the previously read sample and this one, by the device or by the reader falling behind. Set by ReadSample.
+	uint32_t DroppedFrames = 0;
+};
+
+struct DeviceCapture;
+struct FrameDecoder;
+
+// One captured frame shared by every consumer of the device, goes back to the device when the last reference drops.
+// Holds the capture and with it the session, so the buffer the frame is in stays mapped while the lease lives.
+struct FrameLease
+{
+	FrameLease(std::shared_ptr<DeviceCapture> capture, CapturedFrame const& frame, SampleInfo const& info);
+	~FrameLease();
+	FrameLease(const FrameLease&) = delete;
+	FrameLease& operator=(const FrameLease&) = delete;
+
+	std::shared_ptr<DeviceCapture> Capture;
+	CapturedFrame Frame;
+	SampleInfo Info;
+};
+
+struct FrameConsumer
+{
+	virtual ~FrameConsumer() = default;
+	// Called on the capture thread for each frame. deviceDrops is the number of frames the device lost right before this one.
+	virtual void OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops) = 0;
+	// Releases queued frames so the device can get its buffers back
+	virtual void Flush() = 0;
+	// Capture pauses while every consumer is idle, checked on the capture thread
+	virtual bool IsIdle(std::chrono::steady_clock::time_point now) const { return false; }
+};
+
+// A physical camera opened in one format, captured on its own thread and fanned out to every subscribed consumer
+struct DeviceCapture : std::enable_shared_from_this<DeviceCapture>
+{
+	// How long switching buffers waits for consumers to give back frames they are still reading
+	static constexpr auto LEASE_RELEASE_TIMEOUT = std::chrono::milliseconds(500);
+	static constexpr uint32_t MAX_DECODE_THREADS = 4;
+
+	DeviceCapture(WebcamDevice const& device, std::shared_ptr<CaptureSession> session, CaptureOptions const& options);
+	~DeviceCapture();
+
+	// Capture runs while there is at least one consumer that is not idle
+	void Subscribe(FrameConsumer* consumer);
+	// Reverts user buffers the consumer imported. Consumer gets no frames after this returns.
+	void Unsubscribe(FrameConsumer* consumer);
+	// Only possible while the owner is the sole consumer, other consumers would otherwise read memory the owner frees.
+	// Not possible for compressed formats, consumers get decoded frames. Empty list reverts to device owned buffers.
+	std::expected<void, std::string> SetUserBuffers(FrameConsumer* owner, std::vector<UserBuffer> const& buffers);
+	size_t GetConsumerCount();
+	// Restarts a capture paused for idle consumers, called by a consumer before it waits for a frame
+	void Wake();
+	bool IsPaused() const { return Paused; }
+	bool IsDecoding() const { return Decoder != nullptr; }
+	// Releases the device, right away or once the frames still held by readers are given back
+	void Close();
+
+	WebcamDevice const Device;
+	FormatInfo const Format;
+	// What consumers receive, differs from Format when frames are decoded
+	FormatInfo const OutputFormat;
+	CaptureOptions const Options;
+	std::shared_ptr<CaptureSession> const Session;
+
+private:
+	friend struct FrameLease;
+	void Start();
+	void Stop();
+	void CaptureLoop();
+	// Called on the capture thread, true if the device was stopped and the thread should exit
+	bool TryPause();
+	bool AreConsumersIdle();
+	void Deliver(CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops);
+	uint64_t CountDeviceDrops(CapturedFrame const& frame);
+	std::expected<void, std::string> SwitchBuffers(std::vector<UserBuffer> const& buffers);
+	// Waits for frames in device buffers, or in user buffers if userBuffers is set. False if some are still held after the timeout.
+	bool WaitForLeases(bool userBuffers);
+	void ReleaseLease(CapturedFrame const& frame);
+
+	// Serializes subscription and buffer changes
+	std::mutex ControlMutex;
+	std::shared_mutex ConsumersMutex;
+	std::vector<FrameConsumer*> Consumers;
+	FrameConsumer* UserBufferOwner = nullptr;
+
+	std::thread CaptureThread;
+	std::atomic_bool StopRequested = false;
+	// Device stopped by the capture thread because every consumer was idle, cleared by Start
+	std::atomic_bool Paused = false;
+	std::chrono::nanoseconds FrameInterval{};
+	// Set for compressed formats, frames go through it before reaching consumers
+	std::unique_ptr<FrameDecoder> Decoder;
+
+	std::mutex LeasesMutex;
+	std::condition_variable LeasesReleased;
+	// Frames held by consumers, indexed by CapturedFrame::UserBuffer
+	std::array<uint32_t, 2> OutstandingLeases{};
+	// Close found frames in device buffers still held, the last one given back closes the session
+	bool CloseWhenReleased = false;
+
+	// Capture thread state for numbering frames and detecting gaps
+	uint64_t NextSequence = 0;
+	std::optional<uint64_t> LastDeviceSequence;
+	uint64_t LastDeviceTimestamp = 0;
+};
+} // namespace nos::webcam
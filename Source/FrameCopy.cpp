@@ -0,0 +1,293 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "FrameCopy.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace nos::webcam
+{
+namespace
+{
+struct Plane
+{
+	uint8_t const* Data = nullptr;
+	int64_t Pitch = 0;
+	size_t RowSize = 0;
+	uint32_t Rows = 0;
+};
+
+// Bypasses the cache for the destination, the source is still read through it
+void CopyStreaming(uint8_t* dst, uint8_t const* src, size_t size)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	constexpr size_t MIN_STREAMING_SIZE = 256;
+	if (size >= MIN_STREAMING_SIZE)
+	{
+		const size_t head = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+		std::memcpy(dst, src, head);
+		dst += head, src += head, size -= head;
+		for (; size >= 64; dst += 64, src += 64, size -= 64)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 16));
+			const __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 32));
+			const __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 48));
+			_mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+		}
+	}
+#endif
+	std::memcpy(dst, src, size);
+}
+
+void FinishStreaming()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	// Streaming stores are weakly ordered, make them visible before the frame is handed on
+	_mm_sfence();
+#endif
+}
+
+// Splits the source into planes, falls back to a single linear plane for compressed or unknown formats
+uint32_t GetPlanes(uint8_t const* src, size_t srcSize, FrameLayout const& layout, Plane (&planes)[2])
+{
+	const uint32_t width = layout.Resolution.x(), height = layout.Resolution.y();
+	const size_t rowSize = GetFrameRowSize(layout.FourCC, width);
+	if (!rowSize || !height)
+	{
+		planes[0] = { src, int64_t(srcSize), srcSize, 1 };
+		return 1;
+	}
+	const int64_t pitch = layout.Pitch ? layout.Pitch : int64_t(rowSize);
+	const uint32_t rows = layout.FourCC == FOURCC_NV12 ? height + height / 2 : height;
+	// Bottom-up buffers start below src, only the backend knows their extent
+	if (pitch > 0 && (pitch < int64_t(rowSize) || size_t(pitch) * (rows - 1) + rowSize > srcSize))
+	{
+		planes[0] = { src, int64_t(srcSize), srcSize, 1 };
+		return 1;
+	}
+	planes[0] = { src, pitch, rowSize, height };
+	if (layout.FourCC != FOURCC_NV12)
+		return 1;
+	// Chroma rows follow the luma plane
+	planes[1] = { src + pitch * height, pitch, rowSize, height / 2 };
+	return 2;
+}
+
+// Narrows the planes of an uncompressed frame to the region, NV12 chroma rows hold a U and V byte for every two pixels
+void CropPlanes(FrameLayout const& layout, FrameRegion const& region, Plane (&planes)[2], uint32_t planeCount)
+{
+	const size_t pixelSize = GetFrameRowSize(layout.FourCC, 1);
+	planes[0].Data += int64_t(region.Y) * planes[0].Pitch + int64_t(region.X * pixelSize);
+	planes[0].RowSize = region.Width * pixelSize;
+	planes[0].Rows = region.Height;
+	if (planeCount < 2)
+		return;
+	planes[1].Data += int64_t(region.Y / 2) * planes[1].Pitch + region.X;
+	planes[1].RowSize = region.Width;
+	planes[1].Rows = region.Height / 2;
+}
+
+// Copies bytes [begin, end) of the packed frame, hashes them instead or as well when asked
+void CopyBand(uint8_t* dst, Plane const* planes, uint32_t planeCount, size_t begin, size_t end, FrameHasher* hasher)
+{
+	size_t planeStart = 0;
+	for (uint32_t p = 0; p < planeCount && begin < end; p++)
+	{
+		Plane const& plane = planes[p];
+		const size_t planeEnd = planeStart + plane.RowSize * plane.Rows;
+		while (begin < end && begin < planeEnd)
+		{
+			const size_t offset = begin - planeStart;
+			const size_t row = offset / plane.RowSize, column = offset % plane.RowSize;
+			const size_t count = std::min(plane.RowSize - column, end - begin);
+			uint8_t const* src = plane.Data + int64_t(row) * plane.Pitch + column;
+			if (dst)
+				CopyStreaming(dst + begin, src, count);
+			// Rows are still in cache from the copy
+			if (hasher)
+				hasher->Update(src, count);
+			begin += count;
+		}
+		planeStart = planeEnd;
+	}
+}
+} // namespace
+
+// Bands are claimed by whoever gets to them first, so the caller finishes on its own if the workers are busy
+struct BandedJob
+{
+	uint32_t BandCount = 0;
+	std::atomic_uint32_t NextBand = 0;
+	std::atomic_uint32_t DoneBands = 0;
+
+	virtual ~BandedJob() = default;
+	virtual void RunBand(uint32_t band) = 0;
+
+	void Run()
+	{
+		for (uint32_t band = NextBand++; band < BandCount; band = NextBand++)
+		{
+			RunBand(band);
+			if (++DoneBands == BandCount)
+				DoneBands.notify_all();
+		}
+	}
+
+	void Wait()
+	{
+		for (uint32_t done = DoneBands; done < BandCount; done = DoneBands)
+			DoneBands.wait(done);
+	}
+};
+
+namespace
+{
+struct CopyJob : BandedJob
+{
+	// Null when only hashing
+	uint8_t* Dst = nullptr;
+	// One hash per band when hashing, the bands of a frame size are always the same
+	std::vector<uint64_t> BandHashes;
+	Plane Planes[2];
+	uint32_t PlaneCount = 0;
+	size_t Size = 0;
+
+	void RunBand(uint32_t band) override
+	{
+		// Band edges on cache lines so two threads never write the same line
+		auto edge = [this](uint32_t index) { return index == BandCount ? Size : (Size * index / BandCount) & ~size_t(63); };
+		std::optional<FrameHasher> hasher;
+		if (!BandHashes.empty())
+			hasher.emplace();
+		CopyBand(Dst, Planes, PlaneCount, edge(band), edge(band + 1), hasher ? &*hasher : nullptr);
+		if (hasher)
+			BandHashes[band] = hasher->Finish();
+		FinishStreaming();
+	}
+};
+
+// Each band is a run of row pairs, written to its rows of both NV12 planes
+struct RepackJob : BandedJob
+{
+	uint8_t* Dst = nullptr;
+	uint8_t const* Src = nullptr;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	int64_t Pitch = 0;
+
+	void RunBand(uint32_t band) override
+	{
+		const uint32_t pairs = Height / 2;
+		const uint32_t first = pairs * band / BandCount, last = pairs * (band + 1) / BandCount;
+		// Sizes were checked before the frame was split
+		(void)ConvertYUY2ToNV12(Src + int64_t(first) * 2 * Pitch, Width, (last - first) * 2, Dst + size_t(first) * 2 * Width,
+			Dst + size_t(Width) * Height + size_t(first) * Width, int32_t(Pitch));
+	}
+};
+
+} // namespace
+
+FrameRegion AlignFrameRegion(uint32_t fourCC, nos::fb::vec2u const& resolution, FrameRegion const& region)
+{
+	const uint32_t width = resolution.x(), height = resolution.y();
+	if (!region.Width || !region.Height)
+		return FrameRegion{ .Width = width, .Height = height };
+	const uint32_t alignX = fourCC == FOURCC_NV12 || fourCC == FOURCC_YUY2 ? 2 : 1;
+	const uint32_t alignY = fourCC == FOURCC_NV12 ? 2 : 1;
+	const uint32_t x0 = std::min(region.X, width) / alignX * alignX;
+	const uint32_t y0 = std::min(region.Y, height) / alignY * alignY;
+	const uint32_t x1 = uint32_t(std::min<uint64_t>((uint64_t(region.X) + region.Width + alignX - 1) / alignX * alignX, width));
+	const uint32_t y1 = uint32_t(std::min<uint64_t>((uint64_t(region.Y) + region.Height + alignY - 1) / alignY * alignY, height));
+	if (x1 <= x0 || y1 <= y0)
+		return FrameRegion{ .X = x0, .Y = y0 };
+	return FrameRegion{ .X = x0, .Y = y0, .Width = x1 - x0, .Height = y1 - y0 };
+}
+
+FrameCopy::FrameCopy(uint32_t workerCount) : WorkerCount(workerCount), Workers(workerCount)
+{
+}
+
+uint32_t FrameCopy::GetDefaultWorkerCount()
+{
+	return std::clamp(std::thread::hardware_concurrency(), 1u, MAX_THREAD_COUNT) - 1;
+}
+
+uint32_t FrameCopy::GetThreadCount(size_t size) const
+{
+	return uint32_t(std::clamp<size_t>(size / MIN_BAND_SIZE, 1, WorkerCount + 1));
+}
+
+size_t FrameCopy::Copy(uint8_t* dst, size_t dstSize, uint8_t const* src, size_t srcSize, FrameLayout const& layout, std::optional<FrameRegion> const& region, uint64_t* hash)
+{
+	auto job = std::make_shared<CopyJob>();
+	job->Dst = dst;
+	job->PlaneCount = GetPlanes(src, srcSize, layout, job->Planes);
+	// Planes come back as one linear block when the layout is not understood, that block can not be cropped
+	if (region && GetFrameRowSize(layout.FourCC, layout.Resolution.x()) && job->Planes[0].Rows == layout.Resolution.y())
+		CropPlanes(layout, *region, job->Planes, job->PlaneCount);
+	for (uint32_t p = 0; p < job->PlaneCount; p++)
+		job->Size += job->Planes[p].RowSize * job->Planes[p].Rows;
+	job->Size = std::min(job->Size, dstSize);
+	job->BandCount = GetThreadCount(job->Size);
+	if (hash)
+		job->BandHashes.resize(job->BandCount);
+	RunBands(job);
+	if (hash)
+	{
+		FrameHasher combined;
+		combined.Update(reinterpret_cast<uint8_t const*>(job->BandHashes.data()), job->BandHashes.size() * sizeof(uint64_t));
+		*hash = combined.Finish();
+	}
+	return job->Size;
+}
+
+std::expected<size_t, std::string> FrameCopy::Repack(uint8_t* dst, uint8_t const* src, uint32_t width, uint32_t height, int32_t pitch)
+{
+	if (width % 2 || height % 2)
+		return std::unexpected("NV12 needs even width and height");
+	auto job = std::make_shared<RepackJob>();
+	job->Dst = dst;
+	job->Src = src;
+	job->Width = width;
+	job->Height = height;
+	job->Pitch = pitch ? pitch : int64_t(width) * 2;
+	const size_t size = GetFrameBufferSize(FOURCC_NV12, nos::fb::vec2u(width, height));
+	// No more bands than row pairs
+	job->BandCount = std::min(GetThreadCount(size), std::max(height / 2, 1u));
+	RunBands(job);
+	return size;
+}
+
+void FrameCopy::RunBands(std::shared_ptr<BandedJob> const& job)
+{
+	// Bands only depend on the frame size so hashes compare, the threads working on them are shared out between the frames copied
+	// at the same time. With as many streams as threads each copies its own frame, handing bands over would only add waiting.
+	const uint32_t concurrentFrames = ++ActiveFrames;
+	const uint32_t threadCount = std::min(job->BandCount, std::max((WorkerCount + 1) / concurrentFrames, 1u));
+	for (uint32_t i = 1; i < threadCount; i++)
+		Workers.Submit([job] { job->Run(); });
+	job->Run();
+	job->Wait();
+	ActiveFrames--;
+}
+
+uint64_t FrameCopy::Hash(uint8_t const* src, size_t srcSize, FrameLayout const& layout, std::optional<FrameRegion> const& region)
+{
+	uint64_t hash = 0;
+	Copy(nullptr, SIZE_MAX, src, srcSize, layout, region, &hash);
+	return hash;
+}
+} // namespace nos::webcam
@@ -0,0 +1,86 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "CaptureBackend.h"
+#include "TaskPool.h"
+
+namespace nos::webcam
+{
+// Where a frame's rows are, planes follow each other with the same pitch
+struct FrameLayout
+{
+	uint32_t FourCC = FOURCC_NONE;
+	nos::fb::vec2u Resolution;
+	// Bytes from one row of the first plane to the next, negative when rows are stored bottom-up. 0 for tightly packed rows.
+	int32_t Pitch = 0;
+};
+
+// Rectangle of a frame in pixels
+struct FrameRegion
+{
+	uint32_t X = 0;
+	uint32_t Y = 0;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+
+	bool operator==(FrameRegion const&) const = default;
+};
+
+// Grows the region to whole chroma samples, 2x2 pixels in NV12 and 2x1 in YUY2, and clips it to the frame.
+// An empty region selects the whole frame, one outside the frame comes back empty.
+FrameRegion AlignFrameRegion(uint32_t fourCC, nos::fb::vec2u const& resolution, FrameRegion const& region);
+
+struct BandedJob;
+
+// Copies frames into tightly packed upload memory. Large frames are split into bands copied in parallel on a shared
+// set of workers and the calling thread, with streaming stores since the CPU does not read the destination again.
+struct FrameCopy
+{
+	static constexpr uint32_t MAX_THREAD_COUNT = 8;
+	// Smaller bands cost more to hand over than they save
+	static constexpr size_t MIN_BAND_SIZE = 1024 * 1024;
+
+	explicit FrameCopy(uint32_t workerCount);
+
+	// One worker less than the cores, copying threads join the workers. None on a single core, where bands handed over would only
+	// wait for the copying thread.
+	static uint32_t GetDefaultWorkerCount();
+
+	// Copies up to dstSize bytes of the packed frame, returns the number of bytes written.
+	// src points at the top row, srcSize is the size of the whole source buffer including any padding.
+	// With a region aligned by AlignFrameRegion, only its rows and columns of each plane are packed, as a frame of the region's size.
+	// Compressed frames are always copied whole.
+	// With hash set, the copied bytes are hashed by the thread that copies them right after reading them, which costs far less
+	// than reading the frame again. Hashes are comparable between copies of the same size on the same FrameCopy.
+	size_t Copy(uint8_t* dst, size_t dstSize, uint8_t const* src, size_t srcSize, FrameLayout const& layout, std::optional<FrameRegion> const& region = std::nullopt,
+		uint64_t* hash = nullptr);
+	// Hash Copy would give for the same frame, without copying it
+	uint64_t Hash(uint8_t const* src, size_t srcSize, FrameLayout const& layout, std::optional<FrameRegion> const& region = std::nullopt);
+	// Repacks a YUY2 frame into NV12 in bands of row pairs on the same threads, returns the number of bytes written.
+	// src and pitch as in ConvertYUY2ToNV12.
+	std::expected<size_t, std::string> Repack(uint8_t* dst, uint8_t const* src, uint32_t width, uint32_t height, int32_t pitch = 0);
+
+	// Number of threads, the caller included, a frame of this size is copied with at most. Fewer work on it while other frames
+	// are copied at the same time.
+	uint32_t GetThreadCount(size_t size) const;
+
+private:
+	// Runs the job's bands on the workers and the calling thread, returns once all of them are done
+	void RunBands(std::shared_ptr<BandedJob> const& job);
+
+	uint32_t WorkerCount;
+	std::atomic_uint32_t ActiveFrames = 0;
+	TaskPool Workers;
+};
+} // namespace nos::webcam
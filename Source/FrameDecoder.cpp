@@ -0,0 +1,143 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "FrameDecoder.h"
+#include "nosUtil/Stopwatch.hpp"
+
+namespace nos::webcam
+{
+FrameDecoder::FrameDecoder(WebcamDevice const& device, FormatInfo const& input, std::shared_ptr<CaptureSession> session, uint32_t threadCount, DeliverFn deliver)
+	: Device(device), Input(input), Output(GetOutputFormat(input)), OutputSize(GetFrameBufferSize(Output.FourCC, Output.Resolution)),
+	Session(std::move(session)), Deliver(std::move(deliver)), ThreadCount(threadCount), Workers(threadCount)
+{
+	Buffers.resize(threadCount + HELD_BUFFER_COUNT);
+	for (uint32_t i = 0; i < Buffers.size(); i++)
+	{
+		Buffers[i].resize(OutputSize);
+		FreeBuffers.push_back(i);
+	}
+}
+
+FrameDecoder::~FrameDecoder()
+{
+	Drain();
+	if (const uint64_t count = DecodeTime.Count)
+	{
+		const double meanMs = double(DecodeTime.TotalNanoseconds) / double(count) / 1e6;
+		nosEngine.LogI("%s: Decoded %llu frames on %u threads, %.2f ms per frame, up to %.0f fps, %llu failed", Device.Name.c_str(),
+			(unsigned long long)count, ThreadCount, meanMs, ThreadCount * 1000.0 / meanMs, (unsigned long long)FailedFrames.load());
+	}
+}
+
+bool FrameDecoder::NeedsDecoding(uint32_t fourCC)
+{
+	return fourCC == FOURCC_MJPG;
+}
+
+FormatInfo FrameDecoder::GetOutputFormat(FormatInfo const& input)
+{
+	FormatInfo output = input;
+	if (NeedsDecoding(input.FourCC))
+		output.FourCC = FOURCC_NV12;
+	return output;
+}
+
+void FrameDecoder::Submit(CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops)
+{
+	uint64_t order;
+	{
+		std::unique_lock lock(OrderMutex);
+		order = NextSubmit++;
+	}
+	std::optional<uint32_t> bufferIndex;
+	{
+		std::unique_lock lock(BuffersMutex);
+		if (!FreeBuffers.empty())
+		{
+			bufferIndex = FreeBuffers.back();
+			FreeBuffers.pop_back();
+		}
+	}
+	if (!bufferIndex)
+	{
+		// Consumers or workers are behind, give the frame back to the device right away
+		Session->Requeue(frame);
+		Complete(order, Result{ .Source = frame, .Info = info, .DeviceDrops = deviceDrops });
+		return;
+	}
+	Workers.Submit([this, order, index = *bufferIndex, frame, info, deviceDrops] { Decode(order, index, frame, info, deviceDrops); });
+}
+
+void FrameDecoder::Decode(uint64_t order, uint32_t bufferIndex, CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops)
+{
+	std::unique_ptr<JpegDecoder> decoder;
+	{
+		std::unique_lock lock(BuffersMutex);
+		if (!FreeDecoders.empty())
+		{
+			decoder = std::move(FreeDecoders.back());
+			FreeDecoders.pop_back();
+		}
+	}
+	if (!decoder)
+		decoder = CreateJpegDecoder();
+
+	Result result{ .Source = frame, .Info = info, .DeviceDrops = deviceDrops };
+	nos::util::Stopwatch sw;
+	std::expected<void, std::string> decoded = std::unexpected("JPEG decoding is not supported");
+	if (decoder)
+		decoded = decoder->DecodeToNV12(frame.Data, frame.Size, Input.Resolution, Buffers[bufferIndex].data());
+	DecodeTime.Record(sw.Elapsed());
+	Session->Requeue(frame);
+	if (decoded)
+		result.BufferIndex = bufferIndex;
+	else if (FailedFrames++ == 0)
+		nosEngine.LogW("%s: Failed to decode frame: %s", Device.Name.c_str(), decoded.error().c_str());
+
+	{
+		std::unique_lock lock(BuffersMutex);
+		if (decoder)
+			FreeDecoders.push_back(std::move(decoder));
+		if (!result.BufferIndex)
+			FreeBuffers.push_back(bufferIndex);
+	}
+	Complete(order, std::move(result));
+}
+
+void FrameDecoder::Complete(uint64_t order, Result&& result)
+{
+	std::unique_lock lock(OrderMutex);
+	Completed.emplace(order, std::move(result));
+	for (auto it = Completed.begin(); it != Completed.end() && it->first == NextDeliver; it = Completed.erase(it), NextDeliver++)
+	{
+		Result const& done = it->second;
+		if (!done.BufferIndex)
+		{
+			CarriedDrops += done.DeviceDrops + 1;
+			continue;
+		}
+		CapturedFrame frame = done.Source;
+		frame.Data = Buffers[*done.BufferIndex].data();
+		frame.Size = OutputSize;
+		frame.Pitch = 0;
+		frame.BufferIndex = *done.BufferIndex;
+		frame.UserBuffer = false;
+		// Delivered under the lock, consumers expect frames one at a time
+		Deliver(frame, done.Info, CarriedDrops + done.DeviceDrops);
+		CarriedDrops = 0;
+	}
+	if (NextDeliver == NextSubmit)
+		Drained.notify_all();
+}
+
+void FrameDecoder::Drain()
+{
+	std::unique_lock lock(OrderMutex);
+	Drained.wait(lock, [this] { return NextDeliver == NextSubmit; });
+}
+
+void FrameDecoder::Release(uint32_t bufferIndex)
+{
+	std::unique_lock lock(BuffersMutex);
+	FreeBuffers.push_back(bufferIndex);
+}
+} // namespace nos::webcam
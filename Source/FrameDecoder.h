@@ -0,0 +1,84 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "DeviceCapture.h"
+#include "JpegDecoder.h"
+#include "StreamStats.h"
+#include "TaskPool.h"
+
+namespace nos::webcam
+{
+// Decodes compressed device frames into NV12 on a pool of workers, so decoding one frame overlaps capturing the next.
+// Frames come out in capture order; a frame that fails to decode, or finds no free output buffer, is dropped.
+struct FrameDecoder
+{
+	// Decoded frames held by consumers on top of the ones being decoded
+	static constexpr uint32_t HELD_BUFFER_COUNT = 6;
+
+	// Called in capture order, one frame at a time. droppedBefore counts device drops plus frames this stage dropped.
+	using DeliverFn = std::function<void(CapturedFrame const& decoded, SampleInfo const& info, uint64_t droppedBefore)>;
+
+	FrameDecoder(WebcamDevice const& device, FormatInfo const& input, std::shared_ptr<CaptureSession> session, uint32_t threadCount, DeliverFn deliver);
+	~FrameDecoder();
+
+	static bool NeedsDecoding(uint32_t fourCC);
+	// Format consumers see for the given device format
+	static FormatInfo GetOutputFormat(FormatInfo const& input);
+
+	// Takes over the device frame, it is requeued once decoded
+	void Submit(CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops);
+	// Waits until every submitted frame is delivered or dropped
+	void Drain();
+	// Decoded buffer is free to reuse
+	void Release(uint32_t bufferIndex);
+
+	// Time spent decoding one frame on a worker
+	LatencyHistogram DecodeTime;
+
+private:
+	struct Result
+	{
+		// Only the metadata, the device buffer is already requeued
+		CapturedFrame Source;
+		SampleInfo Info;
+		uint64_t DeviceDrops = 0;
+		// Unset if the frame was dropped
+		std::optional<uint32_t> BufferIndex;
+	};
+	void Decode(uint64_t order, uint32_t bufferIndex, CapturedFrame const& frame, SampleInfo const& info, uint64_t deviceDrops);
+	void Complete(uint64_t order, Result&& result);
+
+	WebcamDevice const Device;
+	FormatInfo const Input;
+	FormatInfo const Output;
+	uint32_t const OutputSize;
+	std::shared_ptr<CaptureSession> const Session;
+	DeliverFn const Deliver;
+	uint32_t const ThreadCount;
+
+	std::mutex BuffersMutex;
+	std::vector<std::vector<uint8_t>> Buffers;
+	std::vector<uint32_t> FreeBuffers;
+	std::vector<std::unique_ptr<JpegDecoder>> FreeDecoders;
+
+	// Completed frames wait here until every earlier frame is done
+	std::mutex OrderMutex;
+	std::condition_variable Drained;
+	std::map<uint64_t, Result> Completed;
+	uint64_t NextSubmit = 0;
+	uint64_t NextDeliver = 0;
+	uint64_t CarriedDrops = 0;
+	std::atomic_uint64_t FailedFrames = 0;
+
+	// Last so workers stop before the state above goes away
+	TaskPool Workers;
+};
+} // namespace nos::webcam
@@ -0,0 +1,65 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "CaptureBackend.h"
+
+namespace nos::webcam
+{
+// Closest rate from the frame rate table so 29.97 becomes 30000/1001, other rates are kept to a thousandth
+inline nos::fb::vec2u GetRationalFrameRate(double fps)
+{
+	for (uint32_t i = std::to_underlying(WebcamFrameRate::WEBCAM_FRAMERATE_1); i < std::to_underlying(WebcamFrameRate::COUNT); i++)
+	{
+		nos::fb::vec2u candidate = GetFrameRateVec2(WebcamFrameRate(i));
+		if (std::abs(fps - double(candidate.x()) / double(candidate.y())) < 0.005)
+			return candidate;
+	}
+	return { uint32_t(std::max(std::llround(fps * 1000.0), 1ll)), 1000 };
+}
+
+// Tick times of a fixed frame rate on the monotonic clock. Every tick is computed from the start time, so
+// fractional rates never drift and a late tick does not push the following ones back.
+struct FramePacer
+{
+	using Clock = std::chrono::steady_clock;
+
+	// rate is frames per second as x / y
+	explicit FramePacer(nos::fb::vec2u rate, Clock::time_point start = Clock::now())
+		: Frames(std::max(rate.x(), 1u)), Seconds(std::max(rate.y(), 1u)), Start(start) {}
+
+	Clock::time_point GetTickTime(uint64_t tick) const
+	{
+		// Split to keep tick * Seconds * 1e9 from overflowing
+		const uint64_t scaled = tick * Seconds;
+		const uint64_t ns = scaled / Frames * 1'000'000'000ull + scaled % Frames * 1'000'000'000ull / Frames;
+		return Start + std::chrono::nanoseconds(ns);
+	}
+
+	// First tick at or after time
+	uint64_t GetTickAt(Clock::time_point time) const
+	{
+		if (time <= Start)
+			return 0;
+		const uint64_t ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(time - Start).count());
+		uint64_t tick = uint64_t(double(ns) * Frames / (double(Seconds) * 1e9));
+		// Floating point estimate can be off by one either way
+		while (tick && GetTickTime(tick - 1) >= time)
+			tick--;
+		while (GetTickTime(tick) < time)
+			tick++;
+		return tick;
+	}
+
+	std::chrono::nanoseconds GetInterval() const { return std::chrono::nanoseconds(Seconds * 1'000'000'000ull / Frames); }
+
+	uint64_t const Frames;
+	uint64_t const Seconds;
+	Clock::time_point const Start;
+};
+} // namespace nos::webcam
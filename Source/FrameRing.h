@@ -0,0 +1,95 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace nos::webcam
+{
+// Bounded single-producer/single-consumer ring.
+// TryPush must only be called from one thread (the capture thread) and TryPop from one other thread (the reader).
+template <typename T>
+struct SPSCRing
+{
+	explicit SPSCRing(size_t capacity) : Slots(capacity + 1) {}
+
+	SPSCRing(const SPSCRing&) = delete;
+	SPSCRing& operator=(const SPSCRing&) = delete;
+
+	bool TryPush(T&& value)
+	{
+		const size_t tail = Tail.load(std::memory_order_relaxed);
+		const size_t next = Next(tail);
+		if (next == Head.load(std::memory_order_acquire))
+			return false;
+		Slots[tail].emplace(std::move(value));
+		Tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	std::optional<T> TryPop()
+	{
+		const size_t head = Head.load(std::memory_order_relaxed);
+		if (head == Tail.load(std::memory_order_acquire))
+			return std::nullopt;
+		std::optional<T> value = std::move(Slots[head]);
+		Slots[head].reset();
+		Head.store(Next(head), std::memory_order_release);
+		return value;
+	}
+
+	size_t Size() const
+	{
+		const size_t head = Head.load(std::memory_order_acquire);
+		const size_t tail = Tail.load(std::memory_order_acquire);
+		return tail >= head ? tail - head : Slots.size() - head + tail;
+	}
+
+	size_t Capacity() const { return Slots.size() - 1; }
+	bool Empty() const { return Size() == 0; }
+
+private:
+	size_t Next(size_t index) const { return index + 1 == Slots.size() ? 0 : index + 1; }
+
+	std::vector<std::optional<T>> Slots;
+	alignas(64) std::atomic<size_t> Head = 0; // Written by consumer
+	alignas(64) std::atomic<size_t> Tail = 0; // Written by producer
+};
+
+// Single slot where a new value replaces the unread one, so the reader always gets the latest.
+// Put and Take may be called from any thread.
+template <typename T>
+struct LatestMailbox
+{
+	LatestMailbox() = default;
+	~LatestMailbox() { delete Slot.exchange(nullptr); }
+
+	LatestMailbox(const LatestMailbox&) = delete;
+	LatestMailbox& operator=(const LatestMailbox&) = delete;
+
+	// Returns true if an unread value was replaced
+	bool Put(T&& value)
+	{
+		std::unique_ptr<T> replaced(Slot.exchange(new T(std::move(value)), std::memory_order_acq_rel));
+		return replaced != nullptr;
+	}
+
+	std::optional<T> Take()
+	{
+		std::unique_ptr<T> latest(Slot.exchange(nullptr, std::memory_order_acq_rel));
+		if (!latest)
+			return std::nullopt;
+		return std::move(*latest);
+	}
+
+	bool Empty() const { return Slot.load(std::memory_order_acquire) == nullptr; }
+
+private:
+	std::atomic<T*> Slot = nullptr;
+};
+} // namespace nos::webcam
@@ -0,0 +1,89 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "FrameSender.h"
+
+#include <Nodos/PluginHelpers.hpp>
+#include "nosUtil/Stopwatch.hpp"
+
+namespace nos::webcam
+{
+FrameSender::FrameSender(std::string name, size_t frameSize, nos::fb::vec2u frameRate, SendFn send)
+	: Name(std::move(name)), FrameSize(frameSize), FrameRate(frameRate), Send(std::move(send))
+{
+	for (auto& slot : Slots)
+		slot.resize(frameSize);
+	Thread = std::thread([this] { Run(); });
+}
+
+FrameSender::~FrameSender()
+{
+	{
+		std::unique_lock lock(StopMutex);
+		Stopping = true;
+	}
+	StopRequested.notify_all();
+	Thread.join();
+	if (const uint64_t count = SendTime.Count)
+		nosEngine.LogI("%s: Sent %llu of %llu frames, %llu dropped, %llu repeated, %.2f ms per send", Name.c_str(),
+			(unsigned long long)SentFrames.load(), (unsigned long long)PublishedFrames.load(), (unsigned long long)DroppedFrames.load(),
+			(unsigned long long)RepeatedFrames.load(), double(SendTime.TotalNanoseconds) / double(count) / 1e6);
+	if (const uint64_t count = TickJitter.Count)
+		nosEngine.LogI("%s: Output jitter %.1f us mean, p99 under %llu us, max %.1f us, %llu ticks missed", Name.c_str(),
+			double(TickJitter.TotalNanoseconds) / double(count) / 1e3, (unsigned long long)LatencyHistogram::GetPercentile(TickJitter.GetBuckets(), 0.99),
+			double(TickJitter.MaxNanoseconds) / 1e3, (unsigned long long)MissedTicks.load());
+}
+
+void FrameSender::Publish()
+{
+	PublishTimes[WriteSlot] = FramePacer::Clock::now();
+	const uint32_t previous = ReadySlot.exchange(WriteSlot | NEW_FRAME, std::memory_order_acq_rel);
+	if (previous & NEW_FRAME)
+		DroppedFrames++;
+	WriteSlot = previous & ~NEW_FRAME;
+	PublishedFrames++;
+}
+
+void FrameSender::Run()
+{
+	FramePacer pacer(FrameRate);
+	bool hasFrame = false;
+	uint64_t tick = 0;
+	std::unique_lock lock(StopMutex);
+	while (!StopRequested.wait_until(lock, pacer.GetTickTime(tick), [this] { return Stopping; }))
+	{
+		lock.unlock();
+		const auto tickTime = pacer.GetTickTime(tick);
+		TickJitter.Record(FramePacer::Clock::now() - tickTime);
+		bool newFrame = false;
+		if (ReadySlot.load(std::memory_order_relaxed) & NEW_FRAME)
+		{
+			const uint32_t previous = SendSlot;
+			SendSlot = ReadySlot.exchange(previous, std::memory_order_acq_rel) & ~NEW_FRAME;
+			newFrame = true;
+			// Published after this tick while the thread was waking up, it belongs to the next tick.
+			// Give it back unless the producer has already reused the previous slot for a newer frame.
+			uint32_t expected = previous;
+			if (PublishTimes[SendSlot] > tickTime && hasFrame && ReadySlot.compare_exchange_strong(expected, SendSlot | NEW_FRAME, std::memory_order_acq_rel))
+			{
+				SendSlot = previous;
+				newFrame = false;
+			}
+		}
+		if (newFrame || hasFrame)
+		{
+			if (!newFrame)
+				RepeatedFrames++;
+			hasFrame = true;
+			nos::util::Stopwatch sw;
+			Send(Slots[SendSlot].data());
+			SendTime.Record(sw.Elapsed());
+			SentFrames++;
+		}
+		// Ticks that passed during a long send are skipped, never sent in a burst
+		const uint64_t next = std::max(tick + 1, pacer.GetTickAt(FramePacer::Clock::now()));
+		MissedTicks += next - tick - 1;
+		tick = next;
+		lock.lock();
+	}
+}
+} // namespace nos::webcam
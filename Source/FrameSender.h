@@ -0,0 +1,77 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StreamStats.h"
+#include "FramePacer.h"
+
+namespace nos::webcam
+{
+// Decouples a frame producer from a consumer that may stall. The producer fills one of three slots and publishes it
+// without waiting; a sender thread sends one frame per tick of the output rate. A frame first goes out on the first
+// tick at or after it was published, so when the producer runs at a different rate frames are repeated or skipped
+// by their timing alone, not by when the sender thread happens to wake up.
+struct FrameSender
+{
+	// Called on the sender thread, may block
+	using SendFn = std::function<void(uint8_t const* frame)>;
+
+	// frameRate is frames per second as x / y
+	FrameSender(std::string name, size_t frameSize, nos::fb::vec2u frameRate, SendFn send);
+	~FrameSender();
+
+	FrameSender(const FrameSender&) = delete;
+	FrameSender& operator=(const FrameSender&) = delete;
+
+	// Slot for the next frame, owned by the producer until it is published. Only one producer thread.
+	uint8_t* GetWriteSlot() { return Slots[WriteSlot].data(); }
+	size_t GetFrameSize() const { return FrameSize; }
+	// Hands the write slot over, an older frame that is still waiting is dropped
+	void Publish();
+
+	std::atomic_uint64_t PublishedFrames = 0;
+	std::atomic_uint64_t SentFrames = 0;
+	// Replaced by a newer frame before it was sent
+	std::atomic_uint64_t DroppedFrames = 0;
+	// Sent again because nothing new was published in time
+	std::atomic_uint64_t RepeatedFrames = 0;
+	// Time the consumer took to take a frame
+	LatencyHistogram SendTime;
+	// How late each send started after its tick
+	LatencyHistogram TickJitter;
+	// Ticks passed without sending because a send ran over
+	std::atomic_uint64_t MissedTicks = 0;
+
+private:
+	static constexpr uint32_t NEW_FRAME = 4; // Flag in ReadySlot, other bits are the slot index
+
+	void Run();
+
+	std::string Name;
+	size_t FrameSize;
+	nos::fb::vec2u FrameRate;
+	SendFn Send;
+	std::array<std::vector<uint8_t>, 3> Slots;
+	// Written before a slot is published, read after it is taken
+	std::array<FramePacer::Clock::time_point, 3> PublishTimes;
+	uint32_t WriteSlot = 0; // Producer's
+	uint32_t SendSlot = 1; // Sender thread's
+	std::atomic_uint32_t ReadySlot = 2;
+	std::mutex StopMutex;
+	std::condition_variable StopRequested;
+	bool Stopping = false;
+	std::thread Thread;
+};
+} // namespace nos::webcam
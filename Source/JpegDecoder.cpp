@@ -0,0 +1,209 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "JpegDecoder.h"
+
+#if defined(NOSWEBCAM_WITH_JPEG)
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include <jpeglib.h>
+
+namespace nos::webcam
+{
+// Reads the DCT output planes as they are (raw data mode), skipping libjpeg's upsampling and color conversion.
+// libjpeg-turbo does the entropy decoding and IDCT with SIMD, what is left here is resampling the chroma into NV12.
+struct LibJpegDecoder : JpegDecoder
+{
+	struct ErrorManager
+	{
+		jpeg_error_mgr Base;
+		std::jmp_buf Jump;
+	};
+
+	LibJpegDecoder()
+	{
+		Info.err = jpeg_std_error(&Error.Base);
+		Error.Base.error_exit = &LibJpegDecoder::OnError;
+		// Webcams often send slightly corrupt frames, the decoded image is still usable
+		Error.Base.emit_message = [](j_common_ptr, int) {};
+		jpeg_create_decompress(&Info);
+	}
+
+	~LibJpegDecoder() override
+	{
+		jpeg_destroy_decompress(&Info);
+	}
+
+	static void OnError(j_common_ptr info)
+	{
+		std::longjmp(reinterpret_cast<ErrorManager*>(info->err)->Jump, 1);
+	}
+
+	std::expected<void, std::string> DecodeToNV12(uint8_t const* data, uint32_t size, nos::fb::vec2u const& resolution, uint8_t* nv12) override
+	{
+		if (setjmp(Error.Jump))
+		{
+			char message[JMSG_LENGTH_MAX];
+			Error.Base.format_message(reinterpret_cast<j_common_ptr>(&Info), message);
+			jpeg_abort_decompress(&Info);
+			return std::unexpected(std::string(message));
+		}
+		jpeg_mem_src(&Info, const_cast<unsigned char*>(data), size);
+		jpeg_read_header(&Info, TRUE);
+		if (Info.image_width != resolution.x() || Info.image_height != resolution.y())
+		{
+			jpeg_abort_decompress(&Info);
+			return std::unexpected("JPEG is " + std::to_string(Info.image_width) + "x" + std::to_string(Info.image_height) + ", expected " +
+				std::to_string(resolution.x()) + "x" + std::to_string(resolution.y()));
+		}
+		const bool gray = Info.jpeg_color_space == JCS_GRAYSCALE && Info.num_components == 1;
+		if (!gray && (Info.jpeg_color_space != JCS_YCbCr || Info.num_components != 3 ||
+			Info.comp_info[1].h_samp_factor != Info.comp_info[2].h_samp_factor || Info.comp_info[1].v_samp_factor != Info.comp_info[2].v_samp_factor))
+		{
+			jpeg_abort_decompress(&Info);
+			return std::unexpected("Unsupported JPEG color space");
+		}
+		Info.raw_data_out = TRUE;
+		Info.out_color_space = Info.jpeg_color_space;
+		jpeg_start_decompress(&Info);
+
+		// One iMCU row per read, components with lower vertical sampling fill fewer rows
+		const uint32_t imcuRows = Info.total_iMCU_rows;
+		for (int c = 0; c < Info.num_components; c++)
+		{
+			auto const& comp = Info.comp_info[c];
+			Strides[c] = comp.width_in_blocks * DCTSIZE;
+			Planes[c].resize(size_t(Strides[c]) * comp.v_samp_factor * DCTSIZE * imcuRows);
+			Rows[c].resize(comp.v_samp_factor * DCTSIZE);
+		}
+		std::array<JSAMPARRAY, 3> rows{};
+		for (uint32_t imcu = 0; Info.output_scanline < Info.output_height; imcu++)
+		{
+			for (int c = 0; c < Info.num_components; c++)
+			{
+				for (size_t r = 0; r < Rows[c].size(); r++)
+					Rows[c][r] = Planes[c].data() + (imcu * Rows[c].size() + r) * Strides[c];
+				rows[c] = Rows[c].data();
+			}
+			jpeg_read_raw_data(&Info, rows.data(), Info.max_v_samp_factor * DCTSIZE);
+		}
+		// Component info is freed by finishing
+		const uint32_t ratioX = gray ? 1 : Info.max_h_samp_factor / Info.comp_info[1].h_samp_factor;
+		const uint32_t ratioY = gray ? 1 : Info.max_v_samp_factor / Info.comp_info[1].v_samp_factor;
+		jpeg_finish_decompress(&Info);
+
+		const uint32_t width = resolution.x(), height = resolution.y();
+		for (uint32_t y = 0; y < height; y++)
+			std::memcpy(nv12 + size_t(y) * width, Planes[0].data() + size_t(y) * Strides[0], width);
+		uint8_t* uv = nv12 + size_t(width) * height;
+		if (gray)
+		{
+			std::memset(uv, 128, size_t(width) * height / 2);
+			return {};
+		}
+		WriteChroma(uv, width / 2, height / 2, ratioX, ratioY);
+		return {};
+	}
+
+	// ratioX/ratioY are the chroma subsampling factors of the JPEG, NV12 wants 2x2
+	void WriteChroma(uint8_t* uv, uint32_t width, uint32_t height, uint32_t ratioX, uint32_t ratioY)
+	{
+		uint8_t const* cb = Planes[1].data();
+		uint8_t const* cr = Planes[2].data();
+		const size_t stride = Strides[1];
+		if (ratioX == 2 && ratioY == 2)
+		{
+			// 4:2:0, only interleaving
+			for (uint32_t y = 0; y < height; y++)
+			{
+				uint8_t const* cbRow = cb + y * stride;
+				uint8_t const* crRow = cr + y * stride;
+				uint8_t* out = uv + size_t(y) * width * 2;
+				for (uint32_t x = 0; x < width; x++)
+				{
+					out[2 * x] = cbRow[x];
+					out[2 * x + 1] = crRow[x];
+				}
+			}
+			return;
+		}
+		if (ratioX == 2 && ratioY == 1)
+		{
+			// 4:2:2, the usual MJPEG layout, average row pairs
+			for (uint32_t y = 0; y < height; y++)
+			{
+				uint8_t const* cb0 = cb + 2 * y * stride;
+				uint8_t const* cr0 = cr + 2 * y * stride;
+				uint8_t* out = uv + size_t(y) * width * 2;
+				for (uint32_t x = 0; x < width; x++)
+				{
+					out[2 * x] = uint8_t((cb0[x] + cb0[x + stride] + 1) >> 1);
+					out[2 * x + 1] = uint8_t((cr0[x] + cr0[x + stride] + 1) >> 1);
+				}
+			}
+			return;
+		}
+		// Anything else: box filter chroma at full rate, pick the nearest sample when it is coarser than NV12
+		const uint32_t spanX = ratioX < 2 ? 2 / std::max(ratioX, 1u) : 1;
+		const uint32_t spanY = ratioY < 2 ? 2 / std::max(ratioY, 1u) : 1;
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const size_t srcY = size_t(y) * 2 / std::max(ratioY, 1u);
+			uint8_t* out = uv + size_t(y) * width * 2;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const size_t srcX = size_t(x) * 2 / std::max(ratioX, 1u);
+				uint32_t sumCb = 0, sumCr = 0;
+				for (uint32_t dy = 0; dy < spanY; dy++)
+					for (uint32_t dx = 0; dx < spanX; dx++)
+					{
+						sumCb += cb[(srcY + dy) * stride + srcX + dx];
+						sumCr += cr[(srcY + dy) * stride + srcX + dx];
+					}
+				const uint32_t count = spanX * spanY;
+				out[2 * x] = uint8_t((sumCb + count / 2) / count);
+				out[2 * x + 1] = uint8_t((sumCr + count / 2) / count);
+			}
+		}
+	}
+
+	jpeg_decompress_struct Info{};
+	ErrorManager Error{};
+	// Decoded planes padded to whole blocks, reused between frames
+	std::array<std::vector<uint8_t>, 3> Planes;
+	std::array<size_t, 3> Strides{};
+	std::array<std::vector<JSAMPROW>, 3> Rows;
+};
+
+bool IsJpegDecodeSupported()
+{
+	return true;
+}
+
+std::unique_ptr<JpegDecoder> CreateJpegDecoder()
+{
+	return std::make_unique<LibJpegDecoder>();
+}
+} // namespace nos::webcam
+
+#else
+
+namespace nos::webcam
+{
+bool IsJpegDecodeSupported()
+{
+	return false;
+}
+
+std::unique_ptr<JpegDecoder> CreateJpegDecoder()
+{
+	return nullptr;
+}
+} // namespace nos::webcam
+
+#endif
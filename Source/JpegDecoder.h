@@ -0,0 +1,27 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <memory>
+#include <expected>
+#include <string>
+
+#include "CaptureBackend.h"
+
+namespace nos::webcam
+{
+// Decodes one JPEG at a time, use one decoder per thread
+struct JpegDecoder
+{
+	virtual ~JpegDecoder() = default;
+	// Writes a tightly packed NV12 frame of the given resolution, chroma is resampled from whatever subsampling the JPEG uses
+	virtual std::expected<void, std::string> DecodeToNV12(uint8_t const* data, uint32_t size, nos::fb::vec2u const& resolution, uint8_t* nv12) = 0;
+};
+
+// False when built without a JPEG library, MJPEG formats are then not offered
+bool IsJpegDecodeSupported();
+// Null if not supported
+std::unique_ptr<JpegDecoder> CreateJpegDecoder();
+} // namespace nos::webcam
@@ -0,0 +1,413 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#if defined(_WIN32)
+
+#include "CaptureBackend.h"
+
+#define COBJMACROS 1
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <wrl.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <mfcaptureengine.h>
+#include <cfgmgr32.h>
+#include <ks.h>
+#include <ksmedia.h>
+#include <locale>
+#include <codecvt>
+#include <mutex>
+#include <array>
+
+namespace nos::webcam
+{
+template<typename T>
+using ComPtr = Microsoft::WRL::ComPtr<T>;
+
+template<typename T>
+struct RAIICoTask
+{
+	T Ptr;
+	RAIICoTask(T ptr = {}) : Ptr(ptr) {}
+	~RAIICoTask()
+	{
+		CoTaskMemFree(*this);
+	}
+
+	T& operator*() { return Ptr; }
+	T operator->() { return Ptr; }
+	operator T() { return Ptr; }
+	T* operator&() { return &Ptr; }
+
+};
+
+// Source reader is free threaded but each thread touching it needs COM
+struct ThreadComInitializer
+{
+	ThreadComInitializer() { CoInitializeEx(NULL, COINIT_MULTITHREADED); }
+	~ThreadComInitializer() { CoUninitialize(); }
+};
+
+std::string GetLastErrorAsString(HRESULT err)
+{
+	if (err == 0) {
+		return std::string();
+	}
+	LPSTR messageBuffer = nullptr;
+	size_t size = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL, err, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&messageBuffer, 0, NULL);
+	std::string message(messageBuffer, size);
+	LocalFree(messageBuffer);
+	return message;
+}
+
+static std::wstring ToWide(std::string const& str)
+{
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+	return converter.from_bytes(str);
+}
+
+static std::string ToNarrow(std::wstring const& str)
+{
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+	return converter.to_bytes(str);
+}
+
+static FormatInfo FormatInfoFromMediaType(IMFMediaType* mediaType, uint32_t streamIndex)
+{
+	FormatInfo info{};
+	info.StreamIndex = streamIndex;
+	GUID subType{};
+	mediaType->GetGUID(MF_MT_SUBTYPE, &subType);
+	info.FourCC = subType.Data1;
+	UINT64 frameSize = 0;
+	mediaType->GetUINT64(MF_MT_FRAME_SIZE, &frameSize);
+	UINT64 frameRate = 0;
+	mediaType->GetUINT64(MF_MT_FRAME_RATE, &frameRate);
+
+	info.Resolution = nos::fb::vec2u(frameSize >> 32, frameSize & 0xFFFFFFFF);
+	if (auto found = FindFrameRate(frameRate >> 32, frameRate & 0xFFFFFFFF))
+		info.FrameRate = *found;
+	return info;
+}
+
+static GUID GetSubTypeFromFourCC(uint32_t fourCC)
+{
+	GUID base = MFVideoFormat_Base;
+	base.Data1 = fourCC;
+	return base;
+}
+
+static HRESULT CreateSourceReader(WebcamDevice const& device, ComPtr<IMFSourceReader>& outReader)
+{
+	HRESULT hr;
+	ComPtr<IMFMediaSource> pDevice = NULL;
+	ComPtr<IMFAttributes> pAttrDevice = NULL;
+
+	hr = MFCreateAttributes(&pAttrDevice, 1);
+	if (FAILED(hr)) return hr;
+
+	std::wstring symLink = ToWide(device.SymLink);
+	pAttrDevice->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+	pAttrDevice->SetString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, symLink.c_str());
+
+	hr = MFCreateDeviceSource(pAttrDevice.Get(), &pDevice);
+	if (FAILED(hr)) return hr;
+
+	return MFCreateSourceReaderFromMediaSource(pDevice.Get(), NULL, &outReader);
+}
+
+HRESULT EnumerateTypesForStream(IMFSourceReader* pReader, DWORD dwStreamIndex, std::vector<FormatInfo>& types)
+{
+	HRESULT hr = S_OK;
+	DWORD dwMediaTypeIndex = 0;
+
+	while (SUCCEEDED(hr))
+	{
+		IMFMediaType* pType = NULL;
+		hr = pReader->GetNativeMediaType(dwStreamIndex, dwMediaTypeIndex, &pType);
+		if (hr == MF_E_NO_MORE_TYPES)
+		{
+			hr = S_OK;
+			break;
+		}
+		else if (SUCCEEDED(hr))
+		{
+			FormatInfo mediaInfo = FormatInfoFromMediaType(pType, dwStreamIndex);
+			if (mediaInfo.FourCC == FOURCC_YUY2 || mediaInfo.FourCC == FOURCC_NV12 || mediaInfo.FourCC == FOURCC_MJPG)
+				types.push_back(mediaInfo);
+			pType->Release();
+		}
+		++dwMediaTypeIndex;
+	}
+	return hr;
+}
+
+struct MFCaptureSession : CaptureSession
+{
+	// Source reader keeps its own queue, the buffer count only limits samples held by the consumer
+	static constexpr uint32_t DEFAULT_SAMPLES_IN_FLIGHT = 8;
+
+	struct SampleSlot
+	{
+		ComPtr<IMFSample> Sample{};
+		ComPtr<IMFMediaBuffer> Buffer{};
+		ComPtr<IMF2DBuffer> Buffer2D{}; // Set when locked as 2D
+	};
+
+	MFCaptureSession(ComPtr<IMFSourceReader> reader, FormatInfo const& format, uint32_t maxSamplesInFlight) : Reader(reader), Format(format), Slots(maxSamplesInFlight) {}
+	~MFCaptureSession() override { Close(); }
+
+	FormatInfo GetFormat() const override { return Format; }
+
+	// Synchronous source reader can not time out, returns as soon as the device delivers a sample
+	std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) override
+	{
+		thread_local ThreadComInitializer comInitializer;
+		if (Closed)
+			return std::nullopt;
+		DWORD streamIndex;
+		DWORD flags;
+		LONGLONG llTimeStamp;
+		ComPtr<IMFSample> pSample = NULL;
+		HRESULT hr = Reader->ReadSample(Format.StreamIndex, 0, &streamIndex, &flags, &llTimeStamp, &pSample);
+		if (FAILED(hr))
+			return std::nullopt;
+		// Stream ticks mark a gap in the stream, the next sample follows missing frames
+		if (flags & MF_SOURCE_READERF_STREAMTICK)
+			PendingDiscontinuity = true;
+		if (!pSample || (flags & (MF_SOURCE_READERF_ENDOFSTREAM | MF_SOURCE_READERF_STREAMTICK)))
+			return std::nullopt;
+
+		std::unique_lock lock(SlotsMutex);
+		auto it = std::find_if(Slots.begin(), Slots.end(), [](SampleSlot const& slot) { return !slot.Sample; });
+		if (it == Slots.end())
+			return std::nullopt;
+		CapturedFrame frame{};
+		frame.BufferIndex = uint32_t(it - Slots.begin());
+		if (FAILED(pSample->GetBufferByIndex(0, &it->Buffer)))
+			return std::nullopt;
+		DWORD size = 0;
+		// 2D locking gives the native layout without the buffer making a packed copy of padded or bottom-up frames
+		BYTE* scanline0 = nullptr;
+		LONG pitch = 0;
+		const LONG rowSize = LONG(GetFrameRowSize(Format.FourCC, Format.Resolution.x()));
+		if (rowSize && SUCCEEDED(it->Buffer.As(&it->Buffer2D)) && SUCCEEDED(it->Buffer2D->Lock2D(&scanline0, &pitch)))
+		{
+			frame.Data = scanline0;
+			frame.Pitch = pitch == rowSize ? 0 : int32_t(pitch);
+		}
+		else
+		{
+			it->Buffer2D = nullptr;
+			it->Buffer->Lock((BYTE**)&frame.Data, NULL, NULL);
+		}
+		it->Buffer->GetCurrentLength(&size);
+		frame.Size = size;
+		frame.DeviceTimestamp = uint64_t(llTimeStamp) * 100; // 100ns units
+		UINT32 discontinuity = FALSE;
+		pSample->GetUINT32(MFSampleExtension_Discontinuity, &discontinuity);
+		frame.Discontinuity = std::exchange(PendingDiscontinuity, false) || discontinuity;
+		it->Sample = pSample;
+		return frame;
+	}
+
+	void Requeue(CapturedFrame const& frame) override
+	{
+		std::unique_lock lock(SlotsMutex);
+		if (frame.BufferIndex >= Slots.size())
+			return;
+		auto& slot = Slots[frame.BufferIndex];
+		if (slot.Buffer2D)
+			slot.Buffer2D->Unlock2D();
+		else if (slot.Buffer)
+			slot.Buffer->Unlock();
+		slot = {};
+	}
+
+	// The synchronous source reader keeps the device started, only samples it queued while nobody read are dropped
+	void SetStreaming(bool streaming) override
+	{
+		if (!streaming && !Closed && Reader)
+			Reader->Flush(Format.StreamIndex);
+	}
+
+	void Close() override
+	{
+		if (Closed.exchange(true))
+			return;
+		if (Reader)
+			Reader->Flush(Format.StreamIndex);
+	}
+
+	ComPtr<IMFSourceReader> Reader{};
+	FormatInfo Format;
+	std::atomic_bool Closed = false;
+	bool PendingDiscontinuity = false; // Only touched by the dequeuing thread
+	std::mutex SlotsMutex;
+	std::vector<SampleSlot> Slots;
+};
+
+// Device interface notifications for the camera category, symbolic links match MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK
+struct MFDeviceWatcher : DeviceWatcher
+{
+	MFDeviceWatcher(DeviceChangeCallback callback) : Callback(std::move(callback)) {}
+	~MFDeviceWatcher() override
+	{
+		// Waits for callbacks in flight
+		if (Notification)
+			CM_Unregister_Notification(Notification);
+	}
+
+	bool Register()
+	{
+		CM_NOTIFY_FILTER filter{};
+		filter.cbSize = sizeof(filter);
+		filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+		filter.u.DeviceInterface.ClassGuid = KSCATEGORY_VIDEO_CAMERA;
+		CONFIGRET res = CM_Register_Notification(&filter, this, &MFDeviceWatcher::OnNotification, &Notification);
+		if (res != CR_SUCCESS)
+		{
+			nosEngine.LogW("Media Foundation: Hotplug notifications unavailable (CONFIGRET %lu)", res);
+			Notification = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	static DWORD CALLBACK OnNotification(HCMNOTIFICATION, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA data, DWORD)
+	{
+		if (action != CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL && action != CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL)
+			return ERROR_SUCCESS;
+		// Runs on a system thread pool thread, the callback re-enumerates through Media Foundation
+		thread_local ThreadComInitializer comInitializer;
+		auto* watcher = static_cast<MFDeviceWatcher*>(context);
+		watcher->Callback(ToNarrow(data->u.DeviceInterface.SymbolicLink),
+			action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL ? DeviceChange::Arrived : DeviceChange::Removed);
+		return ERROR_SUCCESS;
+	}
+
+	DeviceChangeCallback Callback;
+	HCMNOTIFICATION Notification = nullptr;
+};
+
+struct MFCaptureBackend : CaptureBackend
+{
+	MFCaptureBackend()
+	{
+		HRESULT hr = CoInitialize(NULL);
+		hr = MFStartup(MF_VERSION, MFSTARTUP_NOSOCKET);
+	}
+	~MFCaptureBackend() override
+	{
+		MFShutdown();
+		CoUninitialize();
+	}
+
+	const char* GetName() const override { return "Media Foundation"; }
+
+	std::unique_ptr<DeviceWatcher> WatchDevices(DeviceChangeCallback callback) override
+	{
+		auto watcher = std::make_unique<MFDeviceWatcher>(std::move(callback));
+		if (!watcher->Register())
+			return nullptr;
+		return watcher;
+	}
+
+	std::vector<WebcamDevice> EnumerateDevices() override
+	{
+		UINT32 count;
+		RAIICoTask<IMFActivate**> devices = nullptr;
+		std::vector<WebcamDevice> result;
+		ComPtr<IMFAttributes> attr = 0;
+
+		HRESULT hr;
+
+		hr = MFCreateAttributes(&attr, 1);
+		if (FAILED(hr)) return result;
+
+		hr = attr->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+		if (FAILED(hr)) return result;
+
+		hr = MFEnumDeviceSources(attr.Get(), &devices, &count);
+		if (FAILED(hr)) return result;
+
+		for (UINT32 i = 0; i < count; i++)
+		{
+			UINT32 length;
+			RAIICoTask<LPWSTR> name;
+			RAIICoTask<LPWSTR> symlink;
+
+			hr = devices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &name, &length);
+			if (FAILED(hr)) continue;
+
+			hr = devices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, &symlink, &length);
+			if (FAILED(hr)) continue;
+
+			result.push_back(WebcamDevice{ .Name = ToNarrow(*name), .SymLink = ToNarrow(*symlink) });
+
+			devices[i]->Release();
+		}
+
+		return result;
+	}
+
+	std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) override
+	{
+		std::vector<FormatInfo> types;
+		ComPtr<IMFSourceReader> reader = NULL;
+		if (FAILED(CreateSourceReader(device, reader)))
+			return types;
+
+		HRESULT hr = S_OK;
+		DWORD dwStreamIndex = 0;
+		while (SUCCEEDED(hr))
+		{
+			hr = EnumerateTypesForStream(reader.Get(), dwStreamIndex, types);
+			if (hr == MF_E_INVALIDSTREAMNUMBER)
+			{
+				break;
+			}
+			++dwStreamIndex;
+		}
+		return types;
+	}
+
+	std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const& device, FormatInfo const& formatInfo, CaptureOptions const& options) override
+	{
+		HRESULT hr;
+		ComPtr<IMFSourceReader> reader = NULL;
+		hr = CreateSourceReader(device, reader);
+		if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
+
+		ComPtr<IMFMediaType> pTypeFormat;
+		hr = MFCreateMediaType(&pTypeFormat);
+		if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
+		hr = pTypeFormat->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+		hr = pTypeFormat->SetGUID(MF_MT_SUBTYPE, GetSubTypeFromFourCC(formatInfo.FourCC));
+		hr = pTypeFormat->SetUINT64(MF_MT_FRAME_SIZE, ((UINT64)formatInfo.Resolution.x() << 32) | formatInfo.Resolution.y());
+		nos::fb::vec2u frameRate = GetFrameRateVec2(formatInfo.FrameRate);
+		hr = pTypeFormat->SetUINT64(MF_MT_FRAME_RATE, ((UINT64)frameRate.x() << 32) | frameRate.y());
+		hr = pTypeFormat->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
+
+		hr = reader->SetCurrentMediaType(formatInfo.StreamIndex, NULL, pTypeFormat.Get());
+		if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
+
+		ComPtr<IMFMediaType> pGetMediaType;
+		hr = reader->GetCurrentMediaType(formatInfo.StreamIndex, &pGetMediaType);
+		if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
+
+		return std::make_shared<MFCaptureSession>(reader, FormatInfoFromMediaType(pGetMediaType.Get(), formatInfo.StreamIndex),
+			options.BufferCount ? options.BufferCount : MFCaptureSession::DEFAULT_SAMPLES_IN_FLIGHT);
+	}
+};
+
+std::unique_ptr<CaptureBackend> CreateMFCaptureBackend()
+{
+	return std::make_unique<MFCaptureBackend>();
+}
+} // namespace nos::webcam
+
+#endif // _WIN32
@@ -0,0 +1,357 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "PixelConvert.h"
+#include "PixelKernels.h"
+#include "CaptureBackend.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace nos::webcam
+{
+static void ScalarAverage2x1Kernel(uint8_t const* src, uint8_t* dst, uint32_t count) { ScalarAverage2x1(src, dst, count); }
+static void ScalarAverage2x2Kernel(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count) { ScalarAverage2x2(row0, row1, dst, count); }
+static void ScalarRGBAToBGRKernel(uint8_t const* src, uint8_t* dst, uint32_t count) { ScalarRGBAToBGR(src, dst, count); }
+static void ScalarYUY2ToNV12Kernel(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count) { ScalarYUY2ToNV12(row0, row1, y0, y1, uv, count); }
+static void ScalarDotKernel(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& c) { ScalarDot(src, dst, count, c); }
+static void ScalarHashStripesKernel(uint8_t const* data, size_t count, uint64_t* acc) { ScalarHashStripes(data, count, acc); }
+static void ScalarBoxDownscaleKernel(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout) { ScalarBoxDownscale(rows, dst, count, factor, layout); }
+
+static PixelKernels const* GetScalarKernels()
+{
+	static constexpr PixelKernels kernels{ ScalarRGBAToBGRKernel, ScalarDotKernel, ScalarAverage2x1Kernel, ScalarAverage2x2Kernel, ScalarYUY2ToNV12Kernel, ScalarBoxDownscaleKernel, ScalarHashStripesKernel };
+	return &kernels;
+}
+
+static PixelKernels const* GetKernels(PixelIsa isa)
+{
+	PixelKernels const* kernels = nullptr;
+	if (IsPixelIsaSupported(isa))
+	{
+		switch (isa)
+		{
+		case PixelIsa::SSE41: kernels = GetSSE41Kernels(); break;
+		case PixelIsa::AVX2: kernels = GetAVX2Kernels(); break;
+		case PixelIsa::NEON: kernels = GetNeonKernels(); break;
+		default: break;
+		}
+	}
+	return kernels ? kernels : GetScalarKernels();
+}
+
+const char* GetPixelIsaName(PixelIsa isa)
+{
+	switch (isa)
+	{
+	case PixelIsa::Scalar: return "Scalar";
+	case PixelIsa::SSE41: return "SSE4.1";
+	case PixelIsa::AVX2: return "AVX2";
+	case PixelIsa::NEON: return "NEON";
+	default: return "Unknown";
+	}
+}
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+static bool CpuSupports(PixelIsa isa)
+{
+	int info[4];
+	__cpuid(info, 1);
+	const bool sse41 = info[2] & (1 << 19);
+	if (isa == PixelIsa::SSE41)
+		return sse41;
+	// AVX state must also be enabled by the OS
+	const bool osxsave = info[2] & (1 << 27);
+	if (!sse41 || !osxsave || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return info[1] & (1 << 5);
+}
+#elif defined(__x86_64__) || defined(__i386__)
+static bool CpuSupports(PixelIsa isa)
+{
+	return isa == PixelIsa::SSE41 ? __builtin_cpu_supports("sse4.1") : __builtin_cpu_supports("avx2");
+}
+#endif
+
+bool IsPixelIsaSupported(PixelIsa isa)
+{
+	switch (isa)
+	{
+	case PixelIsa::Scalar: return true;
+#if defined(__x86_64__) || defined(_M_X64)
+	case PixelIsa::SSE41:
+	case PixelIsa::AVX2: return CpuSupports(isa);
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+	// Part of the base ARMv8 instruction set
+	case PixelIsa::NEON: return true;
+#endif
+	default: return false;
+	}
+}
+
+PixelIsa GetBestPixelIsa()
+{
+	static const PixelIsa best = [] {
+		for (PixelIsa isa : { PixelIsa::AVX2, PixelIsa::NEON, PixelIsa::SSE41 })
+			if (IsPixelIsaSupported(isa))
+				return isa;
+		return PixelIsa::Scalar;
+	}();
+	return best;
+}
+
+// Stripes between scrambles of the hash lanes
+static constexpr size_t HASH_BLOCK_STRIPES = 32;
+static constexpr uint64_t HASH_PRIME = 0x9E3779B185EBCA87ull;
+
+static uint64_t AvalancheHash(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xC2B2AE3D27D4EB4Full;
+	hash ^= hash >> 29;
+	hash *= 0x165667B19E3779F9ull;
+	return hash ^ (hash >> 32);
+}
+
+FrameHasher::FrameHasher(PixelIsa isa) : Kernels(GetKernels(isa)), Lanes{ HASH_KEYS[0], HASH_KEYS[1], HASH_KEYS[2], HASH_KEYS[3] }
+{
+	static_assert(sizeof(Pending) == HASH_STRIPE_SIZE);
+}
+
+void FrameHasher::Accumulate(uint8_t const* data, size_t stripes)
+{
+	while (stripes)
+	{
+		const size_t count = std::min(stripes, HASH_BLOCK_STRIPES - BlockStripes);
+		Kernels->HashStripes(data, count, Lanes);
+		data += count * HASH_STRIPE_SIZE;
+		stripes -= count;
+		BlockStripes += count;
+		if (BlockStripes == HASH_BLOCK_STRIPES)
+		{
+			// Brings the high bits the products pile up back down before they overflow away
+			for (uint32_t l = 0; l < 4; l++)
+				Lanes[l] = (Lanes[l] ^ (Lanes[l] >> 47) ^ HASH_KEYS[l]) * HASH_PRIME;
+			BlockStripes = 0;
+		}
+	}
+}
+
+void FrameHasher::Update(uint8_t const* data, size_t size)
+{
+	Length += size;
+	if (PendingSize)
+	{
+		const size_t count = std::min(size, HASH_STRIPE_SIZE - PendingSize);
+		std::memcpy(Pending + PendingSize, data, count);
+		PendingSize += count;
+		data += count;
+		size -= count;
+		if (PendingSize < HASH_STRIPE_SIZE)
+			return;
+		Accumulate(Pending, 1);
+		PendingSize = 0;
+	}
+	const size_t stripes = size / HASH_STRIPE_SIZE;
+	Accumulate(data, stripes);
+	PendingSize = size - stripes * HASH_STRIPE_SIZE;
+	if (PendingSize)
+		std::memcpy(Pending, data + stripes * HASH_STRIPE_SIZE, PendingSize);
+}
+
+uint64_t FrameHasher::Finish() const
+{
+	FrameHasher last = *this;
+	if (PendingSize)
+	{
+		// Zero padded, the length tells apart inputs that only differ in trailing zeroes
+		std::memset(last.Pending + PendingSize, 0, HASH_STRIPE_SIZE - PendingSize);
+		last.Accumulate(last.Pending, 1);
+	}
+	uint64_t hash = Length * HASH_PRIME;
+	for (uint32_t l = 0; l < 4; l++)
+		hash = AvalancheHash(hash ^ last.Lanes[l]);
+	return hash;
+}
+
+struct YuvMatrix
+{
+	YuvCoefficients Y, U, V;
+};
+
+static YuvMatrix GetYuvMatrix(WebcamColorMatrix matrix, WebcamColorRange range)
+{
+	const double kr = matrix == WebcamColorMatrix::BT601 ? 0.299 : 0.2126;
+	const double kb = matrix == WebcamColorMatrix::BT601 ? 0.114 : 0.0722;
+	const double kg = 1.0 - kr - kb;
+	const bool full = range == WebcamColorRange::FULL;
+	const double yScale = full ? 1.0 : 219.0 / 255.0;
+	const double cScale = full ? 1.0 : 224.0 / 255.0;
+	const int32_t yOffset = full ? 0 : 16;
+	constexpr double one = 1 << YuvCoefficients::COEFFICIENT_BITS;
+	constexpr int32_t half = 1 << (YuvCoefficients::COEFFICIENT_BITS - 1);
+	auto make = [&](double r, double g, double b, double scale, int32_t offset) {
+		return YuvCoefficients{
+			.R = int16_t(std::lround(r * scale * one)),
+			.G = int16_t(std::lround(g * scale * one)),
+			.B = int16_t(std::lround(b * scale * one)),
+			.Offset = (offset << YuvCoefficients::COEFFICIENT_BITS) + half,
+		};
+	};
+	return YuvMatrix{
+		.Y = make(kr, kg, kb, yScale, yOffset),
+		.U = make(-kr / (2 * (1 - kb)), -kg / (2 * (1 - kb)), 0.5, cScale, 128),
+		.V = make(0.5, -kg / (2 * (1 - kr)), -kb / (2 * (1 - kr)), cScale, 128),
+	};
+}
+
+// Chroma of a row, one RGBA pixel per two source pixels, and its U and V planes
+struct ChromaRow
+{
+	void Resize(uint32_t count)
+	{
+		Averaged.resize(size_t(count) * 4);
+		U.resize(count);
+		V.resize(count);
+	}
+	std::vector<uint8_t> Averaged, U, V;
+};
+
+void ConvertRGBAToBGR24(uint8_t const* rgba, uint32_t width, uint32_t height, uint8_t* bgr, PixelIsa isa)
+{
+	// Tightly packed rows are one long row
+	GetKernels(isa)->RGBAToBGR(rgba, bgr, width * height);
+}
+
+std::expected<void, std::string> ConvertRGBAToNV12(uint8_t const* rgba, uint32_t width, uint32_t height, WebcamColorMatrix matrix, WebcamColorRange range, uint8_t* nv12, PixelIsa isa)
+{
+	if (width % 2 || height % 2)
+		return std::unexpected("NV12 needs even width and height");
+	PixelKernels const& kernels = *GetKernels(isa);
+	const YuvMatrix coefficients = GetYuvMatrix(matrix, range);
+	const uint32_t chromaWidth = width / 2;
+	thread_local ChromaRow chroma;
+	chroma.Resize(chromaWidth);
+	uint8_t* uv = nv12 + size_t(width) * height;
+	for (uint32_t y = 0; y < height; y += 2)
+	{
+		uint8_t const* row0 = rgba + size_t(y) * width * 4;
+		uint8_t const* row1 = row0 + size_t(width) * 4;
+		kernels.Dot(row0, nv12 + size_t(y) * width, width, coefficients.Y);
+		kernels.Dot(row1, nv12 + size_t(y + 1) * width, width, coefficients.Y);
+		kernels.Average2x2(row0, row1, chroma.Averaged.data(), chromaWidth);
+		kernels.Dot(chroma.Averaged.data(), chroma.U.data(), chromaWidth, coefficients.U);
+		kernels.Dot(chroma.Averaged.data(), chroma.V.data(), chromaWidth, coefficients.V);
+		uint8_t* uvRow = uv + size_t(y / 2) * width;
+		for (uint32_t x = 0; x < chromaWidth; x++)
+		{
+			uvRow[2 * x] = chroma.U[x];
+			uvRow[2 * x + 1] = chroma.V[x];
+		}
+	}
+	return {};
+}
+
+std::expected<void, std::string> ConvertRGBAToYUY2(uint8_t const* rgba, uint32_t width, uint32_t height, WebcamColorMatrix matrix, WebcamColorRange range, uint8_t* yuy2, PixelIsa isa)
+{
+	if (width % 2)
+		return std::unexpected("YUY2 needs an even width");
+	PixelKernels const& kernels = *GetKernels(isa);
+	const YuvMatrix coefficients = GetYuvMatrix(matrix, range);
+	const uint32_t chromaWidth = width / 2;
+	thread_local ChromaRow chroma;
+	thread_local std::vector<uint8_t> luma;
+	chroma.Resize(chromaWidth);
+	luma.resize(width);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		uint8_t const* row = rgba + size_t(y) * width * 4;
+		kernels.Dot(row, luma.data(), width, coefficients.Y);
+		kernels.Average2x1(row, chroma.Averaged.data(), chromaWidth);
+		kernels.Dot(chroma.Averaged.data(), chroma.U.data(), chromaWidth, coefficients.U);
+		kernels.Dot(chroma.Averaged.data(), chroma.V.data(), chromaWidth, coefficients.V);
+		uint8_t* out = yuy2 + size_t(y) * width * 2;
+		for (uint32_t x = 0; x < chromaWidth; x++)
+		{
+			out[4 * x] = luma[2 * x];
+			out[4 * x + 1] = chroma.U[x];
+			out[4 * x + 2] = luma[2 * x + 1];
+			out[4 * x + 3] = chroma.V[x];
+		}
+	}
+	return {};
+}
+
+std::expected<void, std::string> ConvertYUY2ToNV12(uint8_t const* yuy2, uint32_t width, uint32_t height, uint8_t* nv12, int32_t pitch, PixelIsa isa)
+{
+	return ConvertYUY2ToNV12(yuy2, width, height, nv12, nv12 + size_t(width) * height, pitch, isa);
+}
+
+std::expected<void, std::string> ConvertYUY2ToNV12(uint8_t const* yuy2, uint32_t width, uint32_t height, uint8_t* luma, uint8_t* chroma, int32_t pitch, PixelIsa isa)
+{
+	if (width % 2 || height % 2)
+		return std::unexpected("NV12 needs even width and height");
+	PixelKernels const& kernels = *GetKernels(isa);
+	const int64_t stride = pitch ? pitch : int64_t(width) * 2;
+	// Each row pair is read once while it is in cache and written to all three destinations
+	for (uint32_t y = 0; y < height; y += 2)
+	{
+		uint8_t const* row0 = yuy2 + int64_t(y) * stride;
+		kernels.YUY2ToNV12(row0, row0 + stride, luma + size_t(y) * width, luma + size_t(y + 1) * width, chroma + size_t(y / 2) * width, width);
+	}
+#if defined(__x86_64__) || defined(_M_X64)
+	// The x86 kernels write with streaming stores, which are weakly ordered. Make them visible before the frame is handed on.
+	_mm_sfence();
+#endif
+	return {};
+}
+
+// Writes outRows rows of outRowSize bytes, each from factor source rows
+static void DownscalePlane(PixelKernels const& kernels, uint8_t const* src, int64_t stride, uint32_t outRows, uint32_t outRowSize, uint32_t factor, RowLayout layout, uint8_t* dst)
+{
+	for (uint32_t y = 0; y < outRows; y++)
+	{
+		uint8_t const* rows[4] = {};
+		for (uint32_t r = 0; r < factor; r++)
+			rows[r] = src + (int64_t(y) * factor + r) * stride;
+		kernels.BoxDownscale(rows, dst + size_t(y) * outRowSize, outRowSize, factor, layout);
+	}
+}
+
+std::expected<void, std::string> DownscaleNV12(uint8_t const* luma, uint8_t const* chroma, uint32_t width, uint32_t height, int32_t pitch, uint32_t factor, uint8_t* dst, PixelIsa isa)
+{
+	if (factor != 2 && factor != 4)
+		return std::unexpected("Downscale factor must be 2 or 4");
+	const nos::fb::vec2u size = GetDownscaledResolution(FOURCC_NV12, nos::fb::vec2u(width, height), factor);
+	if (!size.x() || !size.y())
+		return std::unexpected("Frame is too small to downscale");
+	PixelKernels const& kernels = *GetKernels(isa);
+	const int64_t stride = pitch ? pitch : int64_t(width);
+	DownscalePlane(kernels, luma, stride, size.y(), size.x(), factor, RowLayout::Plane, dst);
+	// Chroma rows hold U and V for every two pixels, so they shrink by the same factor
+	DownscalePlane(kernels, chroma, stride, size.y() / 2, size.x(), factor, RowLayout::Interleaved, dst + size_t(size.x()) * size.y());
+	return {};
+}
+
+std::expected<void, std::string> DownscaleYUY2(uint8_t const* yuy2, uint32_t width, uint32_t height, int32_t pitch, uint32_t factor, uint8_t* dst, PixelIsa isa)
+{
+	if (factor != 2 && factor != 4)
+		return std::unexpected("Downscale factor must be 2 or 4");
+	const nos::fb::vec2u size = GetDownscaledResolution(FOURCC_YUY2, nos::fb::vec2u(width, height), factor);
+	if (!size.x() || !size.y())
+		return std::unexpected("Frame is too small to downscale");
+	const int64_t stride = pitch ? pitch : int64_t(width) * 2;
+	DownscalePlane(*GetKernels(isa), yuy2, stride, size.y(), size.x() * 2, factor, RowLayout::YUY2, dst);
+	return {};
+}
+} // namespace nos::webcam
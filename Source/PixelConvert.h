@@ -0,0 +1,72 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <string>
+
+#include "Webcam_generated.h"
+
+namespace nos::webcam
+{
+// Instruction sets the conversion kernels are built for, picked at runtime from what the CPU supports
+enum class PixelIsa
+{
+	Scalar,
+	SSE41,
+	AVX2,
+	NEON
+};
+
+const char* GetPixelIsaName(PixelIsa isa);
+bool IsPixelIsaSupported(PixelIsa isa);
+// Fastest supported instruction set, detected once
+PixelIsa GetBestPixelIsa();
+
+struct PixelKernels;
+
+// Streaming 64 bit hash for telling frames apart, not for anything an attacker controls. 32 byte stripes are folded into four
+// lanes with the vector units and the lanes are scrambled every kilobyte. The result is the same on every instruction set
+// and however the input is split between Update calls.
+struct FrameHasher
+{
+	explicit FrameHasher(PixelIsa isa = GetBestPixelIsa());
+	void Update(uint8_t const* data, size_t size);
+	uint64_t Finish() const;
+
+private:
+	void Accumulate(uint8_t const* data, size_t stripes);
+
+	PixelKernels const* Kernels;
+	uint64_t Lanes[4];
+	// Bytes of an incomplete stripe waiting for the next Update
+	uint8_t Pending[32] = {};
+	size_t PendingSize = 0;
+	size_t BlockStripes = 0;
+	uint64_t Length = 0;
+};
+
+// Sources are tightly packed RGBA8 frames, alpha is ignored. Every instruction set gives bit exact results of the scalar one.
+void ConvertRGBAToBGR24(uint8_t const* rgba, uint32_t width, uint32_t height, uint8_t* bgr, PixelIsa isa = GetBestPixelIsa());
+// Width and height must be even, chroma is the rounded average of each 2x2 block
+std::expected<void, std::string> ConvertRGBAToNV12(uint8_t const* rgba, uint32_t width, uint32_t height, WebcamColorMatrix matrix, WebcamColorRange range, uint8_t* nv12, PixelIsa isa = GetBestPixelIsa());
+// Width must be even, chroma is the rounded average of each horizontal pair
+std::expected<void, std::string> ConvertRGBAToYUY2(uint8_t const* rgba, uint32_t width, uint32_t height, WebcamColorMatrix matrix, WebcamColorRange range, uint8_t* yuy2, PixelIsa isa = GetBestPixelIsa());
+// Single pass repack, chroma of each row pair is averaged. Width and height must be even.
+// pitch is the source row stride, negative for bottom-up frames with yuy2 at the top row, 0 for packed rows.
+std::expected<void, std::string> ConvertYUY2ToNV12(uint8_t const* yuy2, uint32_t width, uint32_t height, uint8_t* nv12, int32_t pitch = 0, PixelIsa isa = GetBestPixelIsa());
+// Same with the NV12 planes given apart, so a frame can be repacked in bands of row pairs
+std::expected<void, std::string> ConvertYUY2ToNV12(uint8_t const* yuy2, uint32_t width, uint32_t height, uint8_t* luma, uint8_t* chroma, int32_t pitch = 0, PixelIsa isa = GetBestPixelIsa());
+
+// Box filters a frame down by factor 2 or 4, each output sample is the rounded average of its factor x factor block. At 2x this
+// is what bilinear sampling between the source pixels gives, at 4x it also covers the pixels bilinear sampling would skip.
+// The output is tightly packed and as large as GetDownscaledResolution gives, source pixels past it are left out.
+// luma and chroma are the NV12 planes, which may be cropped from a larger frame, pitch is the row stride of both.
+std::expected<void, std::string> DownscaleNV12(uint8_t const* luma, uint8_t const* chroma, uint32_t width, uint32_t height, int32_t pitch, uint32_t factor, uint8_t* dst, PixelIsa isa = GetBestPixelIsa());
+// pitch as in ConvertYUY2ToNV12
+std::expected<void, std::string> DownscaleYUY2(uint8_t const* yuy2, uint32_t width, uint32_t height, int32_t pitch, uint32_t factor, uint8_t* dst, PixelIsa isa = GetBestPixelIsa());
+} // namespace nos::webcam
@@ -0,0 +1,169 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "PixelKernels.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(NOSWEBCAM_NEON_EMULATION)
+
+#if defined(NOSWEBCAM_NEON_EMULATION)
+// Tests build these kernels on other architectures too, with scalar stand-ins for the intrinsics
+#include "NeonEmulation.h"
+#else
+#include <arm_neon.h>
+#endif
+
+namespace nos::webcam
+{
+static void RGBAToBGRNeon(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+		const uint8x16x3_t bgr = { pixels.val[2], pixels.val[1], pixels.val[0] };
+		vst3q_u8(dst + i * 3, bgr);
+	}
+	ScalarRGBAToBGR(src + i * 4, dst + i * 3, count - i);
+}
+
+static inline uint16x4_t Dot4Neon(uint16x4_t r, uint16x4_t g, uint16x4_t b, YuvCoefficients const& c)
+{
+	int32x4_t sum = vdupq_n_s32(c.Offset);
+	sum = vmlal_n_s16(sum, vreinterpret_s16_u16(r), c.R);
+	sum = vmlal_n_s16(sum, vreinterpret_s16_u16(g), c.G);
+	sum = vmlal_n_s16(sum, vreinterpret_s16_u16(b), c.B);
+	return vqmovun_s32(vshrq_n_s32(sum, YuvCoefficients::COEFFICIENT_BITS));
+}
+
+static inline uint8x8_t Dot8Neon(uint8x8_t r, uint8x8_t g, uint8x8_t b, YuvCoefficients const& c)
+{
+	const uint16x8_t r16 = vmovl_u8(r), g16 = vmovl_u8(g), b16 = vmovl_u8(b);
+	const uint16x4_t lo = Dot4Neon(vget_low_u16(r16), vget_low_u16(g16), vget_low_u16(b16), c);
+	const uint16x4_t hi = Dot4Neon(vget_high_u16(r16), vget_high_u16(g16), vget_high_u16(b16), c);
+	return vqmovn_u16(vcombine_u16(lo, hi));
+}
+
+static void DotNeon(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& c)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+		const uint8x8_t lo = Dot8Neon(vget_low_u8(pixels.val[0]), vget_low_u8(pixels.val[1]), vget_low_u8(pixels.val[2]), c);
+		const uint8x8_t hi = Dot8Neon(vget_high_u8(pixels.val[0]), vget_high_u8(pixels.val[1]), vget_high_u8(pixels.val[2]), c);
+		vst1q_u8(dst + i, vcombine_u8(lo, hi));
+	}
+	ScalarDot(src + i * 4, dst + i, count - i, c);
+}
+
+static void Average2x1Neon(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// Pixels as 32 bit words, split into even and odd ones
+		const uint32x4x2_t pairs = vld2q_u32(reinterpret_cast<uint32_t const*>(src + i * 8));
+		vst1q_u8(dst + i * 4, vrhaddq_u8(vreinterpretq_u8_u32(pairs.val[0]), vreinterpretq_u8_u32(pairs.val[1])));
+	}
+	ScalarAverage2x1(src + i * 8, dst + i * 4, count - i);
+}
+
+static void Average2x2Neon(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const uint32x4x2_t top = vld2q_u32(reinterpret_cast<uint32_t const*>(row0 + i * 8));
+		const uint32x4x2_t bottom = vld2q_u32(reinterpret_cast<uint32_t const*>(row1 + i * 8));
+		const uint8x16_t even = vrhaddq_u8(vreinterpretq_u8_u32(top.val[0]), vreinterpretq_u8_u32(bottom.val[0]));
+		const uint8x16_t odd = vrhaddq_u8(vreinterpretq_u8_u32(top.val[1]), vreinterpretq_u8_u32(bottom.val[1]));
+		vst1q_u8(dst + i * 4, vrhaddq_u8(even, odd));
+	}
+	ScalarAverage2x2(row0 + i * 8, row1 + i * 8, dst + i * 4, count - i);
+}
+
+static void YUY2ToNV12Neon(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		// Even bytes are luma, odd bytes are chroma in U V order
+		const uint8x16x2_t top = vld2q_u8(row0 + i * 2);
+		const uint8x16x2_t bottom = vld2q_u8(row1 + i * 2);
+		vst1q_u8(y0 + i, top.val[0]);
+		vst1q_u8(y1 + i, bottom.val[0]);
+		vst1q_u8(uv + i, vrhaddq_u8(top.val[1], bottom.val[1]));
+	}
+	ScalarYUY2ToNV12(row0 + i * 2, row1 + i * 2, y0 + i, y1 + i, uv + i, count - i);
+}
+
+// Sums of the neighbouring samples the table lookup lined up, 8 words per 16 source bytes
+static inline uint16x8_t BoxPairsNeon(uint8_t const* row, uint8x16_t shuffle)
+{
+	return vpaddlq_u8(vqtbl1q_u8(vld1q_u8(row), shuffle));
+}
+
+static void BoxDownscaleNeon(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout)
+{
+	const uint8x16_t shuffle = vld1q_u8(GetBoxShuffle(factor, layout));
+	uint32_t i = 0;
+	if (factor == 2)
+	{
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x8_t averages[2];
+			for (int k = 0; k < 2; k++)
+				averages[k] = vrshrn_n_u16(vaddq_u16(BoxPairsNeon(rows[0] + i * 2 + k * 16, shuffle), BoxPairsNeon(rows[1] + i * 2 + k * 16, shuffle)), 2);
+			vst1q_u8(dst + i, vcombine_u8(averages[0], averages[1]));
+		}
+	}
+	else
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			uint16x4_t averages[2];
+			for (int k = 0; k < 2; k++)
+			{
+				uint16x8_t pairs = BoxPairsNeon(rows[0] + i * 4 + k * 16, shuffle);
+				for (int r = 1; r < 4; r++)
+					pairs = vaddq_u16(pairs, BoxPairsNeon(rows[r] + i * 4 + k * 16, shuffle));
+				averages[k] = vrshrn_n_u32(vpaddlq_u16(pairs), 4);
+			}
+			vst1_u8(dst + i, vmovn_u16(vcombine_u16(averages[0], averages[1])));
+		}
+	}
+	ScalarBoxDownscaleTail(rows, dst, count, factor, layout, i);
+}
+
+static void HashStripesNeon(uint8_t const* data, size_t count, uint64_t* acc)
+{
+	uint64x2_t lanes[2] = { vld1q_u64(acc), vld1q_u64(acc + 2) };
+	const uint64x2_t keys[2] = { vld1q_u64(HASH_KEYS), vld1q_u64(HASH_KEYS + 2) };
+	for (size_t s = 0; s < count; s++, data += HASH_STRIPE_SIZE)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			const uint64x2_t d = vreinterpretq_u64_u8(vld1q_u8(data + k * 16));
+			const uint64x2_t keyed = veorq_u64(d, keys[k]);
+			const uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+			lanes[k] = vaddq_u64(lanes[k], vaddq_u64(vextq_u64(d, d, 1), product));
+		}
+	}
+	vst1q_u64(acc, lanes[0]);
+	vst1q_u64(acc + 2, lanes[1]);
+}
+
+PixelKernels const* GetNeonKernels()
+{
+	static constexpr PixelKernels kernels{ RGBAToBGRNeon, DotNeon, Average2x1Neon, Average2x2Neon, YUY2ToNV12Neon, BoxDownscaleNeon, HashStripesNeon };
+	return &kernels;
+}
+} // namespace nos::webcam
+
+#else
+
+namespace nos::webcam
+{
+PixelKernels const* GetNeonKernels() { return nullptr; }
+} // namespace nos::webcam
+
+#endif
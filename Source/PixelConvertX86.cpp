@@ -0,0 +1,420 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "PixelKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+#include <optional>
+
+namespace nos::webcam
+{
+NOSWEBCAM_TARGET("sse4.1") static void RGBAToBGRSSE41(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	uint32_t i = 0;
+	// Each store writes 4 bytes past its 12, stop while the next pixels still cover them
+	for (; i + 6 <= count; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 4)), shuffle));
+	ScalarRGBAToBGR(src + i * 4, dst + i * 3, count - i);
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void DotSSE41(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& c)
+{
+	const __m128i coefficients = _mm_setr_epi16(c.R, c.G, c.B, 0, c.R, c.G, c.B, 0);
+	const __m128i offset = _mm_set1_epi32(c.Offset);
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i sums[4];
+		for (int k = 0; k < 4; k++)
+		{
+			const __m128i pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + (i + k * 4) * 4));
+			// r*R + g*G and b*B + a*0 per pixel, then one sum per pixel
+			const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+			const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+			sums[k] = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), offset), YuvCoefficients::COEFFICIENT_BITS);
+		}
+		const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+	}
+	ScalarDot(src + i * 4, dst + i, count - i, c);
+}
+
+NOSWEBCAM_TARGET("sse4.1") static inline __m128i AveragePairsSSE41(__m128i a, __m128i b)
+{
+	const __m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+	const __m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+	const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_avg_epu8(even, odd);
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void Average2x1SSE41(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 8));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i * 8 + 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), AveragePairsSSE41(a, b));
+	}
+	ScalarAverage2x1(src + i * 8, dst + i * 4, count - i);
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void Average2x2SSE41(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i a = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + i * 8)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + i * 8)));
+		const __m128i b = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + i * 8 + 16)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + i * 8 + 16)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), AveragePairsSSE41(a, b));
+	}
+	ScalarAverage2x2(row0 + i * 8, row1 + i * 8, dst + i * 4, count - i);
+}
+
+// Repacked rows go to upload memory the CPU does not read again, streaming stores keep them out of the cache like FrameCopy does.
+// Rows shorter than this are written through the cache.
+constexpr uint32_t MIN_STREAMING_COUNT = 256;
+// Streaming stores need aligned addresses, starting on a cache line lets every run of them fill whole lines
+constexpr uintptr_t STREAMING_ALIGNMENT = 64;
+
+// Pixels to write before y0, y1 and uv are all aligned, nullopt when they never are at once.
+// Each destination gets a byte per pixel, so all three line up after the same number of pixels if they start equally misaligned.
+static std::optional<uint32_t> GetStreamingHead(uint8_t const* y0, uint8_t const* y1, uint8_t const* uv, uint32_t count)
+{
+	constexpr uintptr_t alignment = STREAMING_ALIGNMENT;
+	const uintptr_t misalignment = reinterpret_cast<uintptr_t>(y0) & (alignment - 1);
+	if (count < MIN_STREAMING_COUNT || (reinterpret_cast<uintptr_t>(y1) & (alignment - 1)) != misalignment ||
+		(reinterpret_cast<uintptr_t>(uv) & (alignment - 1)) != misalignment)
+		return std::nullopt;
+	const uint32_t head = uint32_t((alignment - misalignment) & (alignment - 1));
+	// Chroma is written per pixel pair
+	if (head % 2)
+		return std::nullopt;
+	return head;
+}
+
+template <bool Streaming>
+NOSWEBCAM_TARGET("sse4.1") static inline void StoreSSE41(uint8_t* dst, __m128i value)
+{
+	if constexpr (Streaming)
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst), value);
+	else
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), value);
+}
+
+// Luma of 16 YUY2 pixels
+NOSWEBCAM_TARGET("sse4.1") static inline __m128i LumaSSE41(uint8_t const* row)
+{
+	const __m128i lumaMask = _mm_set1_epi16(0x00FF);
+	return _mm_packus_epi16(_mm_and_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row)), lumaMask),
+		_mm_and_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row + 16)), lumaMask));
+}
+
+// NV12 chroma of 16 pixels of two YUY2 rows. Rows are averaged before the chroma is picked out of them, one pack instead of two.
+// Chroma bytes are already in U V order.
+NOSWEBCAM_TARGET("sse4.1") static inline __m128i ChromaSSE41(uint8_t const* row0, uint8_t const* row1)
+{
+	const __m128i a = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1)));
+	const __m128i b = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + 16)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + 16)));
+	return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+// Converts whole blocks of 16 pixels, returns how many pixels it converted. Each destination row is written in a loop of its own,
+// which reads and writes a single stream like a copy. Rows of up to 4K pixels stay in the L1 cache for the later loops.
+template <bool Streaming>
+NOSWEBCAM_TARGET("sse4.1") static uint32_t YUY2ToNV12BlocksSSE41(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	const uint32_t blocks = count / 16 * 16;
+	for (uint32_t i = 0; i < blocks; i += 16)
+		StoreSSE41<Streaming>(y0 + i, LumaSSE41(row0 + i * 2));
+	for (uint32_t i = 0; i < blocks; i += 16)
+		StoreSSE41<Streaming>(y1 + i, LumaSSE41(row1 + i * 2));
+	for (uint32_t i = 0; i < blocks; i += 16)
+		StoreSSE41<Streaming>(uv + i, ChromaSSE41(row0 + i * 2, row1 + i * 2));
+	return blocks;
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void YUY2ToNV12SSE41(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	uint32_t i = 0;
+	if (auto head = GetStreamingHead(y0, y1, uv, count))
+	{
+		ScalarYUY2ToNV12(row0, row1, y0, y1, uv, *head);
+		i = *head;
+		i += YUY2ToNV12BlocksSSE41<true>(row0 + i * 2, row1 + i * 2, y0 + i, y1 + i, uv + i, count - i);
+	}
+	else
+		i = YUY2ToNV12BlocksSSE41<false>(row0, row1, y0, y1, uv, count);
+	ScalarYUY2ToNV12(row0 + i * 2, row1 + i * 2, y0 + i, y1 + i, uv + i, count - i);
+}
+
+// Sums of the neighbouring samples the shuffle lined up, 8 words per 16 source bytes
+NOSWEBCAM_TARGET("sse4.1") static inline __m128i BoxPairsSSE41(uint8_t const* row, __m128i shuffle)
+{
+	return _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(row)), shuffle), _mm_set1_epi8(1));
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void BoxDownscaleSSE41(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout)
+{
+	const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<__m128i const*>(GetBoxShuffle(factor, layout)));
+	uint32_t i = 0;
+	if (factor == 2)
+	{
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i sums[2];
+			for (int k = 0; k < 2; k++)
+			{
+				const __m128i block = _mm_add_epi16(BoxPairsSSE41(rows[0] + i * 2 + k * 16, shuffle), BoxPairsSSE41(rows[1] + i * 2 + k * 16, shuffle));
+				sums[k] = _mm_srli_epi16(_mm_add_epi16(block, _mm_set1_epi16(2)), 2);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(sums[0], sums[1]));
+		}
+	}
+	else
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i sums[2];
+			for (int k = 0; k < 2; k++)
+			{
+				__m128i pairs = BoxPairsSSE41(rows[0] + i * 4 + k * 16, shuffle);
+				for (int r = 1; r < 4; r++)
+					pairs = _mm_add_epi16(pairs, BoxPairsSSE41(rows[r] + i * 4 + k * 16, shuffle));
+				const __m128i block = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+				sums[k] = _mm_srli_epi32(_mm_add_epi32(block, _mm_set1_epi32(8)), 4);
+			}
+			const __m128i words = _mm_packs_epi32(sums[0], sums[1]);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(words, words));
+		}
+	}
+	ScalarBoxDownscaleTail(rows, dst, count, factor, layout, i);
+}
+
+NOSWEBCAM_TARGET("sse4.1") static void HashStripesSSE41(uint8_t const* data, size_t count, uint64_t* acc)
+{
+	__m128i lanes[2] = { _mm_loadu_si128(reinterpret_cast<__m128i const*>(acc)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(acc + 2)) };
+	const __m128i keys[2] = { _mm_loadu_si128(reinterpret_cast<__m128i const*>(HASH_KEYS)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(HASH_KEYS + 2)) };
+	for (size_t s = 0; s < count; s++, data += HASH_STRIPE_SIZE)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			const __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + k * 16));
+			const __m128i keyed = _mm_xor_si128(d, keys[k]);
+			const __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+			lanes[k] = _mm_add_epi64(lanes[k], _mm_add_epi64(_mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)), product));
+		}
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(acc), lanes[0]);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2), lanes[1]);
+}
+
+// Packing works within lanes, the permute puts the quadwords back in order
+NOSWEBCAM_TARGET("avx2") static inline __m256i PackAVX2(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+template <bool Streaming>
+NOSWEBCAM_TARGET("avx2") static inline void StoreAVX2(uint8_t* dst, __m256i value)
+{
+	if constexpr (Streaming)
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(dst), value);
+	else
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), value);
+}
+
+NOSWEBCAM_TARGET("avx2") static inline __m256i LumaAVX2(uint8_t const* row)
+{
+	const __m256i lumaMask = _mm256_set1_epi16(0x00FF);
+	return PackAVX2(_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row)), lumaMask),
+		_mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row + 32)), lumaMask));
+}
+
+NOSWEBCAM_TARGET("avx2") static inline __m256i ChromaAVX2(uint8_t const* row0, uint8_t const* row1)
+{
+	const __m256i a = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1)));
+	const __m256i b = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0 + 32)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1 + 32)));
+	return PackAVX2(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+}
+
+// As YUY2ToNV12BlocksSSE41, in blocks of 32 pixels
+template <bool Streaming>
+NOSWEBCAM_TARGET("avx2") static uint32_t YUY2ToNV12BlocksAVX2(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	const uint32_t blocks = count / 32 * 32;
+	for (uint32_t i = 0; i < blocks; i += 32)
+		StoreAVX2<Streaming>(y0 + i, LumaAVX2(row0 + i * 2));
+	for (uint32_t i = 0; i < blocks; i += 32)
+		StoreAVX2<Streaming>(y1 + i, LumaAVX2(row1 + i * 2));
+	for (uint32_t i = 0; i < blocks; i += 32)
+		StoreAVX2<Streaming>(uv + i, ChromaAVX2(row0 + i * 2, row1 + i * 2));
+	return blocks;
+}
+
+NOSWEBCAM_TARGET("avx2") static void YUY2ToNV12AVX2(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	uint32_t i = 0;
+	if (auto head = GetStreamingHead(y0, y1, uv, count))
+	{
+		// The head is under 64 pixels, too short for the SSE4.1 kernel to stream
+		YUY2ToNV12SSE41(row0, row1, y0, y1, uv, *head);
+		i = *head;
+		i += YUY2ToNV12BlocksAVX2<true>(row0 + i * 2, row1 + i * 2, y0 + i, y1 + i, uv + i, count - i);
+	}
+	else
+		i = YUY2ToNV12BlocksAVX2<false>(row0, row1, y0, y1, uv, count);
+	YUY2ToNV12SSE41(row0 + i * 2, row1 + i * 2, y0 + i, y1 + i, uv + i, count - i);
+}
+
+NOSWEBCAM_TARGET("avx2") static inline __m256i DotLanesAVX2(__m256i pixels, __m256i coefficients, __m256i offset)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), coefficients);
+	const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), coefficients);
+	// Each 128 bit lane holds its own 4 pixels in order
+	return _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), offset), YuvCoefficients::COEFFICIENT_BITS);
+}
+
+NOSWEBCAM_TARGET("avx2") static void DotAVX2(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& c)
+{
+	const __m256i coefficients = _mm256_setr_epi16(c.R, c.G, c.B, 0, c.R, c.G, c.B, 0, c.R, c.G, c.B, 0, c.R, c.G, c.B, 0);
+	const __m256i offset = _mm256_set1_epi32(c.Offset);
+	// Packing works within lanes, dwords 0, 4, 1, 5 hold pixels 0-3, 4-7, 8-11, 12-15
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m256i a = DotLanesAVX2(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i * 4)), coefficients, offset);
+		const __m256i b = DotLanesAVX2(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i * 4 + 32)), coefficients, offset);
+		const __m256i words = _mm256_packs_epi32(a, b);
+		const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(words, words), order);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(bytes));
+	}
+	ScalarDot(src + i * 4, dst + i, count - i, c);
+}
+
+NOSWEBCAM_TARGET("avx2") static inline __m256i AveragePairsAVX2(__m256i a, __m256i b)
+{
+	const __m256 fa = _mm256_castsi256_ps(a), fb = _mm256_castsi256_ps(b);
+	// Shuffles stay within lanes, the permute puts the pairs back in order
+	const __m256i even = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+	const __m256i odd = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_avg_epu8(even, odd);
+}
+
+NOSWEBCAM_TARGET("avx2") static void Average2x1AVX2(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i * 8));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i * 8 + 32));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), AveragePairsAVX2(a, b));
+	}
+	ScalarAverage2x1(src + i * 8, dst + i * 4, count - i);
+}
+
+NOSWEBCAM_TARGET("avx2") static void Average2x2AVX2(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count)
+{
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i a = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0 + i * 8)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1 + i * 8)));
+		const __m256i b = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0 + i * 8 + 32)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1 + i * 8 + 32)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), AveragePairsAVX2(a, b));
+	}
+	ScalarAverage2x2(row0 + i * 8, row1 + i * 8, dst + i * 4, count - i);
+}
+
+NOSWEBCAM_TARGET("avx2") static inline __m256i BoxPairsAVX2(uint8_t const* row, __m256i shuffle)
+{
+	return _mm256_maddubs_epi16(_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(row)), shuffle), _mm256_set1_epi8(1));
+}
+
+NOSWEBCAM_TARGET("avx2") static void BoxDownscaleAVX2(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout)
+{
+	// The pattern repeats every 16 bytes, so the in-lane shuffle applies it to both lanes
+	const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(GetBoxShuffle(factor, layout))));
+	uint32_t i = 0;
+	if (factor == 2)
+	{
+		for (; i + 32 <= count; i += 32)
+		{
+			__m256i sums[2];
+			for (int k = 0; k < 2; k++)
+			{
+				const __m256i block = _mm256_add_epi16(BoxPairsAVX2(rows[0] + i * 2 + k * 32, shuffle), BoxPairsAVX2(rows[1] + i * 2 + k * 32, shuffle));
+				sums[k] = _mm256_srli_epi16(_mm256_add_epi16(block, _mm256_set1_epi16(2)), 2);
+			}
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), PackAVX2(sums[0], sums[1]));
+		}
+	}
+	else
+	{
+		// Dwords 0, 4, 1, 5 hold output bytes 0-3, 4-7, 8-11, 12-15 after packing
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m256i sums[2];
+			for (int k = 0; k < 2; k++)
+			{
+				__m256i pairs = BoxPairsAVX2(rows[0] + i * 4 + k * 32, shuffle);
+				for (int r = 1; r < 4; r++)
+					pairs = _mm256_add_epi16(pairs, BoxPairsAVX2(rows[r] + i * 4 + k * 32, shuffle));
+				const __m256i block = _mm256_madd_epi16(pairs, _mm256_set1_epi16(1));
+				sums[k] = _mm256_srli_epi32(_mm256_add_epi32(block, _mm256_set1_epi32(8)), 4);
+			}
+			const __m256i words = _mm256_packs_epi32(sums[0], sums[1]);
+			const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(words, words), order);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(bytes));
+		}
+	}
+	uint8_t const* tail[4] = {};
+	for (uint32_t r = 0; r < factor; r++)
+		tail[r] = rows[r] + size_t(i) * factor;
+	BoxDownscaleSSE41(tail, dst + i, count - i, factor, layout);
+}
+
+NOSWEBCAM_TARGET("avx2") static void HashStripesAVX2(uint8_t const* data, size_t count, uint64_t* acc)
+{
+	__m256i lanes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(acc));
+	const __m256i keys = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(HASH_KEYS));
+	for (size_t s = 0; s < count; s++, data += HASH_STRIPE_SIZE)
+	{
+		const __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data));
+		const __m256i keyed = _mm256_xor_si256(d, keys);
+		const __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+		// Neighbouring lanes are swapped within each 128 bit half
+		lanes = _mm256_add_epi64(lanes, _mm256_add_epi64(_mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)), product));
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), lanes);
+}
+
+PixelKernels const* GetSSE41Kernels()
+{
+	static constexpr PixelKernels kernels{ RGBAToBGRSSE41, DotSSE41, Average2x1SSE41, Average2x2SSE41, YUY2ToNV12SSE41, BoxDownscaleSSE41, HashStripesSSE41 };
+	return &kernels;
+}
+
+PixelKernels const* GetAVX2Kernels()
+{
+	// BGR shuffling is bound by stores, the 128 bit version is as fast
+	static constexpr PixelKernels kernels{ RGBAToBGRSSE41, DotAVX2, Average2x1AVX2, Average2x2AVX2, YUY2ToNV12AVX2, BoxDownscaleAVX2, HashStripesAVX2 };
+	return &kernels;
+}
+} // namespace nos::webcam
+
+#else
+
+namespace nos::webcam
+{
+PixelKernels const* GetSSE41Kernels() { return nullptr; }
+PixelKernels const* GetAVX2Kernels() { return nullptr; }
+} // namespace nos::webcam
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Lets a single translation unit hold kernels for several instruction sets, MSVC allows intrinsics without it
+#if defined(__GNUC__) || defined(__clang__)
+#define NOSWEBCAM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NOSWEBCAM_TARGET(isa)
+#endif
+
+namespace nos::webcam
+{
+// Fixed point weights of one output channel: clamp((R * r + G * g + B * b + Offset) >> COEFFICIENT_BITS, 0, 255)
+struct YuvCoefficients
+{
+	static constexpr int COEFFICIENT_BITS = 14;
+	int16_t R = 0, G = 0, B = 0;
+	int32_t Offset = 0;
+};
+
+// How the channels of a row being downscaled are laid out
+enum class RowLayout
+{
+	// One channel, e.g. NV12 luma
+	Plane,
+	// Two channels in alternating bytes, NV12 chroma
+	Interleaved,
+	// Y U Y V, chroma is shared by each pixel pair
+	YUY2,
+};
+
+// Per lane keys of the frame hash, from the fractional digits of pi
+constexpr uint64_t HASH_KEYS[4] = { 0x243F6A8885A308D3ull, 0x13198A2E03707344ull, 0xA4093822299F31D0ull, 0x082EFA98EC4E6C89ull };
+constexpr size_t HASH_STRIPE_SIZE = 32;
+
+// Row primitives the converters are built from, all pixels are RGBA8 unless stated otherwise
+struct PixelKernels
+{
+	void (*RGBAToBGR)(uint8_t const* src, uint8_t* dst, uint32_t count);
+	void (*Dot)(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& coefficients);
+	// count is the number of output pixels, each the rounded average of a horizontal pair
+	void (*Average2x1)(uint8_t const* src, uint8_t* dst, uint32_t count);
+	// Averages rows first, then pairs, rounding up at each step
+	void (*Average2x2)(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count);
+	// Splits two YUY2 rows of count pixels into their luma rows and one NV12 chroma row, chroma rows are averaged
+	void (*YUY2ToNV12)(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count);
+	// Averages factor x factor blocks of each channel, factor is 2 or 4. rows holds factor source rows, count is the number of
+	// output bytes, each the rounded sum of its block divided by factor * factor.
+	void (*BoxDownscale)(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout);
+	// Folds count 32 byte stripes into the four 64 bit lanes of acc, each lane adds its neighbour's data and the product of
+	// the halves of its own keyed data
+	void (*HashStripes)(uint8_t const* data, size_t count, uint64_t* acc);
+};
+
+inline uint8_t RoundedAverage(uint8_t a, uint8_t b)
+{
+	return uint8_t((a + b + 1) >> 1);
+}
+
+// Scalar versions are the reference, SIMD kernels use them for row tails
+inline void ScalarRGBAToBGR(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		dst[i * 3] = src[i * 4 + 2];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4];
+	}
+}
+
+inline void ScalarDot(uint8_t const* src, uint8_t* dst, uint32_t count, YuvCoefficients const& c)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const int32_t value = (c.R * src[i * 4] + c.G * src[i * 4 + 1] + c.B * src[i * 4 + 2] + c.Offset) >> YuvCoefficients::COEFFICIENT_BITS;
+		dst[i] = uint8_t(std::clamp(value, 0, 255));
+	}
+}
+
+inline void ScalarAverage2x1(uint8_t const* src, uint8_t* dst, uint32_t count)
+{
+	for (uint32_t i = 0; i < count * 4; i++)
+		dst[i] = RoundedAverage(src[(i / 4) * 8 + i % 4], src[(i / 4) * 8 + 4 + i % 4]);
+}
+
+inline void ScalarAverage2x2(uint8_t const* row0, uint8_t const* row1, uint8_t* dst, uint32_t count)
+{
+	for (uint32_t i = 0; i < count * 4; i++)
+	{
+		const uint32_t even = (i / 4) * 8 + i % 4;
+		dst[i] = RoundedAverage(RoundedAverage(row0[even], row1[even]), RoundedAverage(row0[even + 4], row1[even + 4]));
+	}
+}
+
+inline void ScalarYUY2ToNV12(uint8_t const* row0, uint8_t const* row1, uint8_t* y0, uint8_t* y1, uint8_t* uv, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		y0[i] = row0[i * 2];
+		y1[i] = row1[i * 2];
+		uv[i] = RoundedAverage(row0[i * 2 + 1], row1[i * 2 + 1]);
+	}
+}
+
+inline void ScalarBoxDownscale(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout)
+{
+	const uint32_t half = factor * factor / 2, shift = factor == 4 ? 4 : 2;
+	auto average = [&](auto&& column) {
+		uint32_t sum = half;
+		for (uint32_t r = 0; r < factor; r++)
+			for (uint32_t k = 0; k < factor; k++)
+				sum += rows[r][column(k)];
+		return uint8_t(sum >> shift);
+	};
+	for (uint32_t j = 0; j < count; j++)
+	{
+		switch (layout)
+		{
+		case RowLayout::Plane: dst[j] = average([&](uint32_t k) { return j * factor + k; }); break;
+		case RowLayout::Interleaved: dst[j] = average([&](uint32_t k) { return ((j / 2) * factor + k) * 2 + j % 2; }); break;
+		case RowLayout::YUY2:
+		{
+			const uint32_t pair = j / 4, channel = j % 4;
+			if (channel % 2 == 0)
+				// Luma of output pixel 2 * pair + channel / 2
+				dst[j] = average([&](uint32_t k) { return ((2 * pair + channel / 2) * factor + k) * 2; });
+			else
+				// U or V of source pairs pair * factor + k
+				dst[j] = average([&](uint32_t k) { return (pair * factor + k) * 4 + channel; });
+			break;
+		}
+		}
+	}
+}
+
+inline void ScalarHashStripes(uint8_t const* data, size_t count, uint64_t* acc)
+{
+	for (size_t s = 0; s < count; s++, data += HASH_STRIPE_SIZE)
+	{
+		uint64_t lanes[4];
+		std::memcpy(lanes, data, sizeof(lanes));
+		for (uint32_t l = 0; l < 4; l++)
+		{
+			const uint64_t keyed = lanes[l] ^ HASH_KEYS[l];
+			acc[l] += lanes[l ^ 1] + (keyed & 0xFFFFFFFF) * (keyed >> 32);
+		}
+	}
+}
+
+// Byte order that puts the samples each output byte averages next to each other, repeated for every 16 source bytes
+inline uint8_t const* GetBoxShuffle(uint32_t factor, RowLayout layout)
+{
+	static constexpr uint8_t shuffles[3][2][16] = {
+		{ { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }, { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 } },
+		{ { 0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15 }, { 0, 2, 4, 6, 1, 3, 5, 7, 8, 10, 12, 14, 9, 11, 13, 15 } },
+		{ { 0, 2, 1, 5, 4, 6, 3, 7, 8, 10, 9, 13, 12, 14, 11, 15 }, { 0, 2, 4, 6, 1, 5, 9, 13, 8, 10, 12, 14, 3, 7, 11, 15 } },
+	};
+	return shuffles[size_t(layout)][factor == 4];
+}
+
+// Finishes a box downscale from output byte done, which SIMD kernels stop at on a 16 source byte boundary
+inline void ScalarBoxDownscaleTail(uint8_t const* const* rows, uint8_t* dst, uint32_t count, uint32_t factor, RowLayout layout, uint32_t done)
+{
+	uint8_t const* tail[4] = {};
+	for (uint32_t r = 0; r < factor; r++)
+		tail[r] = rows[r] + size_t(done) * factor;
+	ScalarBoxDownscale(tail, dst + done, count - done, factor, layout);
+}
+
+// Null when the instruction set is not built for this architecture
+PixelKernels const* GetSSE41Kernels();
+PixelKernels const* GetAVX2Kernels();
+PixelKernels const* GetNeonKernels();
+} // namespace nos::webcam
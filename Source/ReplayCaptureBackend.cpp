@@ -0,0 +1,352 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "CaptureBackend.h"
+#include "CaptureRecorder.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace nos::webcam
+{
+static constexpr char REPLAY_DEVICE_PREFIX[] = "Replay: ";
+// Recordings in this folder are listed as devices, the temporary folder's nosWebcam folder if not set
+static constexpr char REPLAY_FOLDER_VARIABLE[] = "NOS_WEBCAM_REPLAY_DIR";
+
+static std::filesystem::path GetReplayFolder()
+{
+	if (const char* folder = std::getenv(REPLAY_FOLDER_VARIABLE); folder && *folder)
+		return folder;
+	std::error_code ec;
+	return std::filesystem::temp_directory_path(ec) / "nosWebcam";
+}
+
+// Read only view of a whole recording
+struct MappedRecording
+{
+	static std::expected<std::unique_ptr<MappedRecording>, std::string> Open(std::string const& path)
+	{
+		auto recording = std::make_unique<MappedRecording>();
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return std::unexpected("Failed to open " + path + ": error " + std::to_string(GetLastError()));
+		LARGE_INTEGER size{};
+		GetFileSizeEx(file, &size);
+		recording->Size = uint64_t(size.QuadPart);
+		if (recording->Size >= RECORDING_DATA_OFFSET)
+			recording->Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (recording->Mapping)
+			recording->Data = static_cast<uint8_t*>(MapViewOfFile(recording->Mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!recording->Data)
+			return std::unexpected("Failed to map " + path);
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return std::unexpected("Failed to open " + path + ": " + std::strerror(errno));
+		struct stat st{};
+		void* mapped = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && uint64_t(st.st_size) >= RECORDING_DATA_OFFSET)
+			mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED)
+			return std::unexpected("Failed to map " + path);
+		recording->Data = static_cast<uint8_t*>(mapped);
+		recording->Size = uint64_t(st.st_size);
+		madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+#endif
+		if (auto res = recording->Validate(); !res)
+			return std::unexpected(path + ": " + res.error());
+		return recording;
+	}
+
+	~MappedRecording()
+	{
+#if defined(_WIN32)
+		if (Data)
+			UnmapViewOfFile(Data);
+		if (Mapping)
+			CloseHandle(Mapping);
+#else
+		if (Data)
+			munmap(Data, Size);
+#endif
+	}
+
+	std::expected<void, std::string> Validate() const
+	{
+		RecordingHeader const& header = GetHeader();
+		if (header.Magic != RECORDING_MAGIC || header.Version != RECORDING_VERSION)
+			return std::unexpected("Not a recording of a supported version");
+		if (!header.IndexOffset)
+			return std::unexpected("Recording was not finished");
+		if (!header.FrameCount || header.FrameSize != GetFrameBufferSize(header.FourCC, nos::fb::vec2u(header.Width, header.Height)) ||
+			header.FrameStride < header.FrameSize || header.IndexOffset < RECORDING_DATA_OFFSET + header.FrameCount * header.FrameStride ||
+			header.IndexOffset + header.FrameCount * sizeof(RecordingIndexEntry) > Size)
+			return std::unexpected("Recording is truncated or has no frames");
+		return {};
+	}
+
+	RecordingHeader const& GetHeader() const { return *reinterpret_cast<RecordingHeader const*>(Data); }
+	RecordingIndexEntry const& GetEntry(uint64_t frame) const { return reinterpret_cast<RecordingIndexEntry const*>(Data + GetHeader().IndexOffset)[frame]; }
+	uint8_t* GetFrame(uint64_t frame) const { return Data + RECORDING_DATA_OFFSET + frame * GetHeader().FrameStride; }
+
+	// Starts reading frames from disk ahead of the one being delivered
+	void Prefetch(uint64_t frame, uint64_t count) const
+	{
+		const uint64_t end = std::min(frame + count, GetHeader().FrameCount);
+		if (frame >= end)
+			return;
+#if defined(_WIN32)
+		WIN32_MEMORY_RANGE_ENTRY range{ .VirtualAddress = GetFrame(frame), .NumberOfBytes = size_t((end - frame) * GetHeader().FrameStride) };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		madvise(GetFrame(frame), (end - frame) * GetHeader().FrameStride, MADV_WILLNEED);
+#endif
+	}
+
+	uint8_t* Data = nullptr;
+	uint64_t Size = 0;
+#if defined(_WIN32)
+	HANDLE Mapping = nullptr;
+#endif
+};
+
+// Delivers the frames of a recording straight from the mapped file, in a loop. Paced by the recorded host timestamps,
+// so the drops and jitter of the recorded device come back too, or as fast as the consumers give frames back.
+struct ReplayCaptureSession : CaptureSession
+{
+	// Frames handed out at once, stands in for the device buffers
+	static constexpr uint32_t DEFAULT_BUFFER_COUNT = 4;
+	// Fewer than a stream queues, an unpaced replay then waits for a QUEUED reader instead of outrunning it into drops
+	static constexpr uint32_t DEFAULT_UNPACED_BUFFER_COUNT = 2;
+	static constexpr uint64_t PREFETCH_FRAMES = 4;
+
+	ReplayCaptureSession(std::unique_ptr<MappedRecording> recording, FormatInfo const& format, CaptureOptions const& options)
+		: Recording(std::move(recording)), Format(format), BufferCount(options.BufferCount ? options.BufferCount : options.Unpaced ? DEFAULT_UNPACED_BUFFER_COUNT : DEFAULT_BUFFER_COUNT), Unpaced(options.Unpaced)
+	{
+		RecordingHeader const& header = Recording->GetHeader();
+		const uint64_t first = Recording->GetEntry(0).HostTimestamp;
+		// One frame interval between the last frame and the first one of the next loop
+		LoopDuration = Recording->GetEntry(header.FrameCount - 1).HostTimestamp - first + 1'000'000'000ull * header.FrameRate[1] / std::max(header.FrameRate[0], 1u);
+		LoopSequences = Recording->GetEntry(header.FrameCount - 1).Sequence - Recording->GetEntry(0).Sequence + 1;
+		StartTime = std::chrono::steady_clock::now();
+		Recording->Prefetch(0, PREFETCH_FRAMES);
+	}
+
+	FormatInfo GetFormat() const override { return Format; }
+
+	std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) override
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::unique_lock lock(Mutex);
+		if (!FrameReturned.wait_until(lock, deadline, [this] { return Closed || InFlight < BufferCount; }) || Closed)
+			return std::nullopt;
+		lock.unlock();
+
+		RecordingHeader const& header = Recording->GetHeader();
+		if (!Unpaced)
+		{
+			auto now = std::chrono::steady_clock::now();
+			// Like a device, frames the consumer was too late for are skipped rather than delivered in a burst
+			while (GetDueTime(NextFrame + 1) <= now)
+				NextFrame++;
+			const auto due = GetDueTime(NextFrame);
+			if (due > deadline)
+			{
+				std::this_thread::sleep_until(deadline);
+				return std::nullopt;
+			}
+			std::this_thread::sleep_until(due);
+		}
+		const uint64_t loop = NextFrame / header.FrameCount;
+		const uint64_t index = NextFrame % header.FrameCount;
+		RecordingIndexEntry const& entry = Recording->GetEntry(index);
+		RecordingIndexEntry const& first = Recording->GetEntry(0);
+		CapturedFrame frame{};
+		frame.Data = Recording->GetFrame(index);
+		frame.Size = uint32_t(header.FrameSize);
+		// Recorded devices without a clock stay without one
+		frame.DeviceTimestamp = entry.DeviceTimestamp ? entry.DeviceTimestamp + loop * LoopDuration : 0;
+		frame.DeviceSequence = entry.Sequence - first.Sequence + loop * LoopSequences;
+		NextFrame++;
+		Recording->Prefetch(NextFrame % header.FrameCount + PREFETCH_FRAMES - 1, 1);
+		lock.lock();
+		InFlight++;
+		return frame;
+	}
+
+	void Requeue(CapturedFrame const& frame) override
+	{
+		{
+			std::unique_lock lock(Mutex);
+			InFlight--;
+		}
+		FrameReturned.notify_one();
+	}
+
+	void SetStreaming(bool streaming) override
+	{
+		// Picks up where it stopped instead of skipping the frames recorded in between
+		if (streaming)
+			StartTime = std::chrono::steady_clock::now() - (GetDueTime(NextFrame) - StartTime);
+	}
+
+	void Close() override
+	{
+		{
+			std::unique_lock lock(Mutex);
+			Closed = true;
+		}
+		FrameReturned.notify_all();
+	}
+
+	std::chrono::steady_clock::time_point GetDueTime(uint64_t frame) const
+	{
+		const uint64_t loop = frame / Recording->GetHeader().FrameCount;
+		const uint64_t offset = Recording->GetEntry(frame % Recording->GetHeader().FrameCount).HostTimestamp - Recording->GetEntry(0).HostTimestamp;
+		return StartTime + std::chrono::nanoseconds(loop * LoopDuration + offset);
+	}
+
+	std::unique_ptr<MappedRecording> Recording;
+	FormatInfo Format;
+	uint32_t BufferCount;
+	bool Unpaced;
+	std::mutex Mutex;
+	std::condition_variable FrameReturned;
+	uint32_t InFlight = 0;
+	bool Closed = false;
+	// Capture thread state
+	std::chrono::steady_clock::time_point StartTime;
+	uint64_t LoopDuration = 0;
+	uint64_t LoopSequences = 0;
+	uint64_t NextFrame = 0;
+};
+
+// Polls the replay folder, recordings are usually copied in by hand
+struct ReplayFolderWatcher : DeviceWatcher
+{
+	static constexpr auto POLL_INTERVAL = std::chrono::seconds(1);
+
+	ReplayFolderWatcher(std::function<std::set<std::string>()> list, DeviceChangeCallback callback) : List(std::move(list)), Callback(std::move(callback))
+	{
+		Known = List();
+		Thread = std::thread([this] { Run(); });
+	}
+
+	~ReplayFolderWatcher() override
+	{
+		{
+			std::unique_lock lock(Mutex);
+			Stopping = true;
+		}
+		StopRequested.notify_one();
+		Thread.join();
+	}
+
+	void Run()
+	{
+		std::unique_lock lock(Mutex);
+		while (!StopRequested.wait_for(lock, POLL_INTERVAL, [this] { return Stopping; }))
+		{
+			std::set<std::string> current = List();
+			for (auto const& path : current)
+				if (!Known.contains(path))
+					Callback(path, DeviceChange::Arrived);
+			for (auto const& path : Known)
+				if (!current.contains(path))
+					Callback(path, DeviceChange::Removed);
+			Known = std::move(current);
+		}
+	}
+
+	std::function<std::set<std::string>()> List;
+	DeviceChangeCallback Callback;
+	std::set<std::string> Known;
+	std::mutex Mutex;
+	std::condition_variable StopRequested;
+	bool Stopping = false;
+	std::thread Thread;
+};
+
+struct ReplayCaptureBackend : CaptureBackend
+{
+	const char* GetName() const override { return "Replay"; }
+
+	static std::set<std::string> ListRecordings()
+	{
+		std::set<std::string> paths;
+		std::error_code ec;
+		for (auto const& entry : std::filesystem::directory_iterator(GetReplayFolder(), ec))
+			if (entry.is_regular_file(ec) && entry.path().extension() == RECORDING_EXTENSION)
+				paths.insert(entry.path().string());
+		return paths;
+	}
+
+	std::unique_ptr<DeviceWatcher> WatchDevices(DeviceChangeCallback callback) override
+	{
+		return std::make_unique<ReplayFolderWatcher>(&ListRecordings, std::move(callback));
+	}
+
+	std::vector<WebcamDevice> EnumerateDevices() override
+	{
+		std::vector<WebcamDevice> devices;
+		for (auto const& path : ListRecordings())
+			devices.push_back(WebcamDevice{ .Name = REPLAY_DEVICE_PREFIX + std::filesystem::path(path).stem().string(), .SymLink = path });
+		return devices;
+	}
+
+	static FormatInfo GetRecordedFormat(RecordingHeader const& header)
+	{
+		FormatInfo format{ .FourCC = header.FourCC, .Resolution = nos::fb::vec2u(header.Width, header.Height) };
+		// Recordings are made from devices so the rate is one of the listed ones
+		if (auto frameRate = FindFrameRate(header.FrameRate[0], header.FrameRate[1]))
+			format.FrameRate = *frameRate;
+		format.StreamIndex = header.StreamIndex;
+		return format;
+	}
+
+	std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) override
+	{
+		auto recording = MappedRecording::Open(device.SymLink);
+		if (!recording)
+		{
+			nosEngine.LogW("Replay: %s", recording.error().c_str());
+			return {};
+		}
+		return { GetRecordedFormat((*recording)->GetHeader()) };
+	}
+
+	std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const& device, FormatInfo const& format, CaptureOptions const& options) override
+	{
+		auto recording = MappedRecording::Open(device.SymLink);
+		if (!recording)
+			return std::unexpected(recording.error());
+		const FormatInfo recorded = GetRecordedFormat((*recording)->GetHeader());
+		if (recorded.FourCC != format.FourCC || !(recorded.Resolution == format.Resolution) || recorded.FrameRate != format.FrameRate)
+			return std::unexpected("Recording has only the format it was recorded in");
+		return std::make_shared<ReplayCaptureSession>(std::move(*recording), recorded, options);
+	}
+};
+
+std::unique_ptr<CaptureBackend> CreateReplayCaptureBackend()
+{
+	return std::make_unique<ReplayCaptureBackend>();
+}
+} // namespace nos::webcam
@@ -0,0 +1,271 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+// Frames of a virtual camera in POSIX shared memory, and the library for processes that read them.
+// Depends on nothing but the C++ standard library and Linux, so consumers can include this file on its own.
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <string>
+
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+
+namespace nos::webcam
+{
+constexpr uint32_t SHARED_FRAME_MAGIC = 0x4d43574e; // "NWCM"
+constexpr uint32_t SHARED_FRAME_VERSION = 2;
+// Reader processes that can have a camera open at the same time
+constexpr uint32_t SHARED_FRAME_READER_SLOT_COUNT = 64;
+
+// Start of the shared memory object. Slot headers follow it, then the frame data of each slot on its own pages.
+struct SharedFrameHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t FourCC;
+	// Frames per second as FrameRate[0] / FrameRate[1]
+	uint32_t FrameRate[2];
+	uint32_t SlotCount;
+	uint64_t FrameSize;
+	uint64_t DataOffset;
+	uint64_t SlotStride;
+	int32_t ProducerPid;
+	// Cleared when the camera is deleted, readers still mapping the memory see it go away
+	std::atomic_uint32_t Alive;
+	// Number of the newest complete frame, starting from 1
+	alignas(64) std::atomic_uint64_t LatestFrame;
+	// Futex word, changes on every frame and when the camera goes away
+	alignas(64) std::atomic_uint32_t FrameSignal;
+	// Readers sleeping on FrameSignal, the producer skips the wake syscall when there are none
+	std::atomic_uint32_t Waiters;
+	// Process id of the reader in each slot, 0 when free. A reader that crashed keeps its slot until its process is found gone.
+	alignas(64) std::atomic_int32_t ReaderPids[SHARED_FRAME_READER_SLOT_COUNT];
+};
+
+// Seqlock of one slot: odd while the producer writes it
+struct alignas(64) SharedFrameSlot
+{
+	std::atomic_uint64_t Sequence;
+	std::atomic_uint64_t FrameNumber;
+	// steady_clock nanoseconds when the frame was written, comparable between processes
+	std::atomic_uint64_t Timestamp;
+};
+
+static_assert(std::atomic_uint32_t::is_always_lock_free && std::atomic_uint64_t::is_always_lock_free, "Shared memory needs address-free atomics");
+
+// Name of the shared memory object for a camera, shm_open allows a single leading slash
+inline std::string GetSharedFrameName(std::string const& cameraName)
+{
+	std::string name = "/nos.webcam.";
+	for (char c : cameraName)
+		name += std::isalnum((unsigned char)c) || c == '-' || c == '.' ? c : '_';
+	return name;
+}
+
+inline SharedFrameSlot* GetSharedFrameSlots(SharedFrameHeader* header)
+{
+	return reinterpret_cast<SharedFrameSlot*>(reinterpret_cast<uint8_t*>(header) + ((sizeof(SharedFrameHeader) + 63) & ~size_t(63)));
+}
+
+inline uint8_t* GetSharedFrameData(SharedFrameHeader* header, uint32_t slot)
+{
+	return reinterpret_cast<uint8_t*>(header) + header->DataOffset + slot * header->SlotStride;
+}
+
+// Processes of other users can not be signalled but exist. Readers and producer must share a pid namespace.
+inline bool IsSharedFrameProcessAlive(int32_t pid)
+{
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Readers whose processes are alive, the slots of the others are freed
+inline uint32_t CountSharedFrameReaders(SharedFrameHeader* header)
+{
+	uint32_t count = 0;
+	for (auto& slot : header->ReaderPids)
+	{
+		int32_t pid = slot.load(std::memory_order_acquire);
+		if (!pid)
+			continue;
+		if (IsSharedFrameProcessAlive(pid))
+			count++;
+		else
+			slot.compare_exchange_strong(pid, 0, std::memory_order_acq_rel);
+	}
+	return count;
+}
+
+inline uint64_t GetSharedFrameTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Not FUTEX_PRIVATE, the word is shared between processes
+inline long SharedFutexWait(std::atomic_uint32_t* word, uint32_t expected, timespec const* timeout)
+{
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+inline long SharedFutexWakeAll(std::atomic_uint32_t* word)
+{
+	return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+// Reads frames of a camera created by another process. Not thread safe, use one reader per thread.
+class SharedFrameReader
+{
+public:
+	enum class ReadStatus
+	{
+		Frame,
+		Timeout,
+		// The camera was deleted, open it again to follow a new one with the same name
+		Closed,
+	};
+
+	struct Result
+	{
+		ReadStatus Status = ReadStatus::Timeout;
+		uint64_t FrameNumber = 0;
+		uint64_t Timestamp = 0;
+		// Frames the producer wrote since the previous read that were never read
+		uint64_t Skipped = 0;
+	};
+
+	static std::expected<std::unique_ptr<SharedFrameReader>, std::string> Open(std::string const& cameraName)
+	{
+		const std::string name = GetSharedFrameName(cameraName);
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0)
+			return std::unexpected("No camera named " + cameraName + ": " + std::strerror(errno));
+		struct stat st{};
+		if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedFrameHeader))
+		{
+			close(fd);
+			return std::unexpected("Camera " + cameraName + " is not ready");
+		}
+		void* mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED)
+			return std::unexpected(std::string("Failed to map camera: ") + std::strerror(errno));
+		auto* header = static_cast<SharedFrameHeader*>(mapped);
+		// The producer sets Alive after the rest of the header
+		if (!header->Alive.load(std::memory_order_acquire))
+		{
+			munmap(mapped, st.st_size);
+			return std::unexpected("Camera " + cameraName + " is not ready");
+		}
+		if (header->Magic != SHARED_FRAME_MAGIC || header->Version != SHARED_FRAME_VERSION ||
+			header->DataOffset + uint64_t(header->SlotCount) * header->SlotStride > uint64_t(st.st_size))
+		{
+			munmap(mapped, st.st_size);
+			return std::unexpected("Camera " + cameraName + " has an incompatible layout");
+		}
+		const int32_t pid = getpid();
+		for (auto& slot : header->ReaderPids)
+		{
+			int32_t owner = slot.load(std::memory_order_acquire);
+			if ((!owner || !IsSharedFrameProcessAlive(owner)) && slot.compare_exchange_strong(owner, pid, std::memory_order_acq_rel))
+				return std::unique_ptr<SharedFrameReader>(new SharedFrameReader(header, st.st_size, &slot));
+		}
+		munmap(mapped, st.st_size);
+		return std::unexpected("Camera " + cameraName + " has " + std::to_string(SHARED_FRAME_READER_SLOT_COUNT) + " readers already");
+	}
+
+	~SharedFrameReader()
+	{
+		ReaderPid->store(0, std::memory_order_release);
+		munmap(Header, MappedSize);
+	}
+
+	SharedFrameReader(const SharedFrameReader&) = delete;
+	SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+
+	uint32_t GetWidth() const { return Header->Width; }
+	uint32_t GetHeight() const { return Header->Height; }
+	uint32_t GetFourCC() const { return Header->FourCC; }
+	uint32_t GetFrameRateNumerator() const { return Header->FrameRate[0]; }
+	uint32_t GetFrameRateDenominator() const { return Header->FrameRate[1]; }
+	size_t GetFrameSize() const { return Header->FrameSize; }
+
+	// Copies the newest frame that has not been read yet into out, which holds GetFrameSize() bytes.
+	// Sleeps up to timeout for one when there is none.
+	Result Read(uint8_t* out, std::chrono::nanoseconds timeout)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (true)
+		{
+			const uint32_t signal = Header->FrameSignal.load(std::memory_order_acquire);
+			if (!Header->Alive.load(std::memory_order_acquire))
+				return { .Status = ReadStatus::Closed };
+			const uint64_t latest = Header->LatestFrame.load(std::memory_order_acquire);
+			if (latest > LastFrame)
+			{
+				Result result = TryCopy(latest, out);
+				if (result.Status == ReadStatus::Frame)
+					return result;
+				// Overwritten while copying, a newer frame is complete by now
+				continue;
+			}
+			const auto left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::nanoseconds(0))
+				return { .Status = ReadStatus::Timeout };
+			const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+			const timespec wait{ .tv_sec = time_t(ns / 1'000'000'000), .tv_nsec = long(ns % 1'000'000'000) };
+			Header->Waiters.fetch_add(1, std::memory_order_seq_cst);
+			// Returns right away if a frame was signalled after the load above
+			SharedFutexWait(&Header->FrameSignal, signal, &wait);
+			Header->Waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	SharedFrameReader(SharedFrameHeader* header, size_t mappedSize, std::atomic_int32_t* readerPid) : Header(header), MappedSize(mappedSize), ReaderPid(readerPid) {}
+
+	Result TryCopy(uint64_t frame, uint8_t* out)
+	{
+		const uint32_t slot = uint32_t(frame % Header->SlotCount);
+		SharedFrameSlot& meta = GetSharedFrameSlots(Header)[slot];
+		const uint64_t before = meta.Sequence.load(std::memory_order_acquire);
+		if (before & 1)
+			return {};
+		const uint64_t number = meta.FrameNumber.load(std::memory_order_relaxed);
+		const uint64_t timestamp = meta.Timestamp.load(std::memory_order_relaxed);
+		std::memcpy(out, GetSharedFrameData(Header, slot), Header->FrameSize);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (meta.Sequence.load(std::memory_order_relaxed) != before || number < frame)
+			return {};
+		Result result{ .Status = ReadStatus::Frame, .FrameNumber = number, .Timestamp = timestamp, .Skipped = LastFrame ? number - LastFrame - 1 : 0 };
+		LastFrame = number;
+		return result;
+	}
+
+	SharedFrameHeader* Header;
+	size_t MappedSize;
+	// This reader's slot in Header->ReaderPids
+	std::atomic_int32_t* ReaderPid;
+	uint64_t LastFrame = 0;
+};
+} // namespace nos::webcam
+
+#endif // __linux__
@@ -0,0 +1,156 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#if defined(__linux__)
+
+#include "VirtualCamera.h"
+#include "CaptureBackend.h"
+#include "SharedFrameRing.h"
+
+namespace nos::webcam
+{
+// Frames a reader can be behind before the slot it copies from is overwritten, minus one
+constexpr uint32_t SHARED_FRAME_SLOT_COUNT = 4;
+
+struct SharedMemorySink : VirtualCameraSink
+{
+	SharedMemorySink(std::string name, SharedFrameHeader* header, size_t mappedSize) : Name(std::move(name)), Header(header), MappedSize(mappedSize) {}
+
+	~SharedMemorySink() override
+	{
+		// Unlinked first so a camera with the same name can be created while readers still map this one
+		shm_unlink(Name.c_str());
+		Header->Alive.store(0, std::memory_order_release);
+		Header->FrameSignal.fetch_add(1, std::memory_order_seq_cst);
+		SharedFutexWakeAll(&Header->FrameSignal);
+		munmap(Header, MappedSize);
+	}
+
+	void SendFrame(uint8_t const* frame) override
+	{
+		const uint64_t number = NextFrame++;
+		const uint32_t slot = uint32_t(number % Header->SlotCount);
+		SharedFrameSlot& meta = GetSharedFrameSlots(Header)[slot];
+		const uint64_t sequence = meta.Sequence.load(std::memory_order_relaxed);
+		meta.Sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		meta.FrameNumber.store(number, std::memory_order_relaxed);
+		meta.Timestamp.store(GetSharedFrameTime(), std::memory_order_relaxed);
+		std::memcpy(GetSharedFrameData(Header, slot), frame, Header->FrameSize);
+		meta.Sequence.store(sequence + 2, std::memory_order_release);
+
+		Header->LatestFrame.store(number, std::memory_order_release);
+		Header->FrameSignal.fetch_add(1, std::memory_order_seq_cst);
+		if (Header->Waiters.load(std::memory_order_seq_cst))
+			SharedFutexWakeAll(&Header->FrameSignal);
+	}
+
+	std::optional<uint32_t> GetReaderCount() const override
+	{
+		return CountSharedFrameReaders(Header);
+	}
+
+	std::string Name;
+	SharedFrameHeader* Header;
+	size_t MappedSize;
+	uint64_t NextFrame = 1;
+};
+
+// One shared memory object per camera under /dev/shm, read with SharedFrameReader
+struct SharedMemoryTransport : OutputTransport
+{
+	static constexpr uint32_t MAX_CAMERA_COUNT = 16;
+
+	const char* GetName() const override { return "Shared memory"; }
+	uint32_t GetMaxCameraCount() const override { return MAX_CAMERA_COUNT; }
+	const char* GetCameraLimitReason() const override { return "each maps its own frame slots"; }
+
+	std::expected<std::unique_ptr<VirtualCameraSink>, std::string> CreateCamera(VirtualCameraConfig const& config) override
+	{
+		uint32_t fourCC = FOURCC_NONE;
+		switch (config.Format)
+		{
+		case WebcamTextureFormat::BGR24: fourCC = FOURCC_BGR24; break;
+		case WebcamTextureFormat::NV12: fourCC = FOURCC_NV12; break;
+		case WebcamTextureFormat::YUY2: fourCC = FOURCC_YUY2; break;
+		default: return std::unexpected("Unsupported camera format");
+		}
+		const std::string name = GetSharedFrameName(config.Name);
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (fd < 0 && errno == EEXIST)
+		{
+			if (auto res = RemoveStale(name, config.Name); !res)
+				return std::unexpected(res.error());
+			fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+		}
+		if (fd < 0)
+			return std::unexpected(std::string("Failed to create shared memory: ") + std::strerror(errno));
+
+		const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+		const size_t frameSize = GetFrameSize(config);
+		const size_t metaSize = ((sizeof(SharedFrameHeader) + 63) & ~size_t(63)) + sizeof(SharedFrameSlot) * SHARED_FRAME_SLOT_COUNT;
+		const size_t dataOffset = (metaSize + pageSize - 1) / pageSize * pageSize;
+		const size_t slotStride = (frameSize + pageSize - 1) / pageSize * pageSize;
+		const size_t totalSize = dataOffset + slotStride * SHARED_FRAME_SLOT_COUNT;
+		void* mapped = MAP_FAILED;
+		if (ftruncate(fd, off_t(totalSize)) == 0)
+			mapped = mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		const int error = errno;
+		close(fd);
+		if (mapped == MAP_FAILED)
+		{
+			shm_unlink(name.c_str());
+			return std::unexpected(std::string("Failed to map shared memory: ") + std::strerror(error));
+		}
+
+		// ftruncate zero fills, so every counter and slot sequence starts at 0
+		auto* header = static_cast<SharedFrameHeader*>(mapped);
+		const nos::fb::vec2u rate = GetRationalFrameRate(config.FrameRate);
+		header->Magic = SHARED_FRAME_MAGIC;
+		header->Version = SHARED_FRAME_VERSION;
+		header->Width = config.Resolution.x();
+		header->Height = config.Resolution.y();
+		header->FourCC = fourCC;
+		header->FrameRate[0] = rate.x();
+		header->FrameRate[1] = rate.y();
+		header->SlotCount = SHARED_FRAME_SLOT_COUNT;
+		header->FrameSize = frameSize;
+		header->DataOffset = dataOffset;
+		header->SlotStride = slotStride;
+		header->ProducerPid = getpid();
+		header->Alive.store(1, std::memory_order_release);
+		return std::make_unique<SharedMemorySink>(name, header, totalSize);
+	}
+
+	// An object left behind by a process that died can be replaced, a live one keeps its name
+	static std::expected<void, std::string> RemoveStale(std::string const& name, std::string const& cameraName)
+	{
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return {};
+		pid_t owner = 0;
+		struct stat st{};
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SharedFrameHeader))
+		{
+			if (void* mapped = mmap(nullptr, sizeof(SharedFrameHeader), PROT_READ, MAP_SHARED, fd, 0); mapped != MAP_FAILED)
+			{
+				owner = static_cast<SharedFrameHeader*>(mapped)->ProducerPid;
+				munmap(mapped, sizeof(SharedFrameHeader));
+			}
+		}
+		close(fd);
+		if (owner > 0 && owner != getpid() && IsSharedFrameProcessAlive(owner))
+			return std::unexpected("Camera name " + cameraName + " is used by process " + std::to_string(owner));
+		if (owner == getpid())
+			return std::unexpected("Camera name " + cameraName + " is used by another WebcamOut node");
+		shm_unlink(name.c_str());
+		return {};
+	}
+};
+
+std::unique_ptr<OutputTransport> CreateSharedMemoryTransport()
+{
+	return std::make_unique<SharedMemoryTransport>();
+}
+} // namespace nos::webcam
+
+#endif // __linux__
@@ -0,0 +1,60 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#if defined(_WIN32)
+
+#include "VirtualCamera.h"
+
+#include <SenderAPI.h>
+
+namespace nos::webcam
+{
+extern bool IS_SOFTCAM_DRIVER_FOUND;
+
+struct SoftcamSink : VirtualCameraSink
+{
+	explicit SoftcamSink(scCamera camera) : Camera(camera) {}
+	~SoftcamSink() override { scDeleteCamera(Camera); }
+
+	void SendFrame(uint8_t const* frame) override
+	{
+		scSendFrame(Camera, frame);
+	}
+
+	scCamera Camera;
+};
+
+// The Softcam DirectShow filter is registered once and reads a single shared frame buffer, so there is one camera per
+// machine. More would need a filter registered under its own CLSID for each camera, which Softcam does not do.
+struct SoftcamTransport : OutputTransport
+{
+	const char* GetName() const override { return "Softcam"; }
+	uint32_t GetMaxCameraCount() const override { return 1; }
+	const char* GetCameraLimitReason() const override { return "its driver shows a single camera per machine"; }
+
+	std::expected<std::unique_ptr<VirtualCameraSink>, std::string> CreateCamera(VirtualCameraConfig const& config) override
+	{
+		if (!IS_SOFTCAM_DRIVER_FOUND)
+			return std::unexpected("Softcam driver not found");
+		softcamTextureFormat format = SOFTCAM_TEXTURE_FORMAT_UNKNOWN;
+		switch (config.Format)
+		{
+		case WebcamTextureFormat::BGR24: format = SOFTCAM_TEXTURE_FORMAT_BGR24; break;
+		case WebcamTextureFormat::NV12: format = SOFTCAM_TEXTURE_FORMAT_NV12; break;
+		case WebcamTextureFormat::YUY2: format = SOFTCAM_TEXTURE_FORMAT_YUY2; break;
+		default: return std::unexpected("Unsupported camera format");
+		}
+		scCamera camera = scCreateCamera(config.Resolution.x(), config.Resolution.y(), config.FrameRate, format);
+		// Fails while another process sends to the camera
+		if (!camera)
+			return std::unexpected("Camera creation failed, another application may be using the Softcam camera");
+		return std::make_unique<SoftcamSink>(camera);
+	}
+};
+
+std::unique_ptr<OutputTransport> CreateSoftcamTransport()
+{
+	return std::make_unique<SoftcamTransport>();
+}
+} // namespace nos::webcam
+
+#endif // _WIN32
@@ -0,0 +1,105 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+
+namespace nos::webcam
+{
+// Log2 bucketed histogram of durations, updated lock-free from any thread.
+// Bucket 0 counts durations under 1us, bucket i counts [2^(i-1), 2^i) us.
+struct LatencyHistogram
+{
+	static constexpr size_t BUCKET_COUNT = 24; // Last bucket takes everything above ~4s
+
+	void Record(std::chrono::nanoseconds duration)
+	{
+		const uint64_t ns = uint64_t(std::max<int64_t>(duration.count(), 0));
+		const size_t bucket = std::min<size_t>(std::bit_width(ns / 1000), BUCKET_COUNT - 1);
+		Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+		Count.fetch_add(1, std::memory_order_relaxed);
+		TotalNanoseconds.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t max = MaxNanoseconds.load(std::memory_order_relaxed);
+		while (ns > max && !MaxNanoseconds.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+			;
+	}
+
+	std::array<uint64_t, BUCKET_COUNT> GetBuckets() const
+	{
+		std::array<uint64_t, BUCKET_COUNT> buckets{};
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+			buckets[i] = Buckets[i].load(std::memory_order_relaxed);
+		return buckets;
+	}
+
+	// Upper bound of the bucket the percentile falls in, in microseconds
+	static uint64_t GetPercentile(std::array<uint64_t, BUCKET_COUNT> const& buckets, double percentile)
+	{
+		uint64_t total = 0;
+		for (auto count : buckets)
+			total += count;
+		if (!total)
+			return 0;
+		const uint64_t rank = uint64_t(std::ceil(percentile * double(total)));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+				return 1ull << i;
+		}
+		return 1ull << (BUCKET_COUNT - 1);
+	}
+
+	std::array<std::atomic_uint64_t, BUCKET_COUNT> Buckets{};
+	std::atomic_uint64_t Count = 0;
+	std::atomic_uint64_t TotalNanoseconds = 0;
+	std::atomic_uint64_t MaxNanoseconds = 0;
+};
+
+// Per stream counters, written by the capture thread and the reader node, read by the stream node
+struct StreamStats
+{
+	// Frames the device handed to the capture thread
+	std::atomic_uint64_t CapturedFrames = 0;
+	// Frames the reader picked up
+	std::atomic_uint64_t DeliveredFrames = 0;
+	// Frames lost by the device or discarded because the reader fell behind
+	std::atomic_uint64_t DroppedFrames = 0;
+	// Reads that found no new frame in time, downstream keeps showing the previous one
+	std::atomic_uint64_t StaleReads = 0;
+
+	// Time spent waiting in WebcamStream::ReadSample
+	LatencyHistogram ReadSample;
+	// Time from the capture thread receiving a frame to the reader picking it up
+	LatencyHistogram CaptureToRead;
+	// Mapping BufferToWrite in the reader, pipelined uploads write into the reader's own buffers instead
+	LatencyHistogram Map;
+	// Waiting for the GPU to finish reading the reader's next own upload buffer, only on the pipelined path
+	LatencyHistogram UploadWait;
+	// Submitting the fence that tells when the GPU has read what the reader handed on
+	LatencyHistogram UploadSubmit;
+	// Reader from having a frame to handing it on, for comparing upload paths
+	LatencyHistogram Execute;
+	// Copying the frame into the upload buffer, only on the copy path
+	LatencyHistogram Copy;
+	// Copying only the reader's region of interest, Copy covers whole frames
+	LatencyHistogram RegionCopy;
+	// Box filtering the reader's frames down before upload, it takes the place of the copy
+	LatencyHistogram Downscale;
+	// Hashing a frame with Skip Unchanged on before it is converted, plain copies hash while copying
+	LatencyHistogram Hash;
+	// Bytes handed to the upload, and what the same frames would have taken in full
+	std::atomic_uint64_t UploadedBytes = 0;
+	std::atomic_uint64_t FullFrameBytes = 0;
+	// Reader frames identical to the previous one, passed on without being uploaded again
+	std::atomic_uint64_t RepeatedFrames = 0;
+};
+} // namespace nos::webcam
@@ -0,0 +1,290 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "CaptureBackend.h"
+
+#include <thread>
+#include <atomic>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <algorithm>
+
+namespace nos::webcam
+{
+static constexpr char SYNTHETIC_DEVICE_NAME[] = "Synthetic Pattern";
+static constexpr char SYNTHETIC_DEVICE_PATH[] = "synthetic://pattern";
+
+struct Rgb
+{
+	uint8_t R, G, B;
+};
+
+// BT.709 limited range
+static void RgbToYuv(Rgb c, uint8_t& y, uint8_t& u, uint8_t& v)
+{
+	const float r = c.R / 255.f, g = c.G / 255.f, b = c.B / 255.f;
+	const float luma = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	y = uint8_t(16.f + 219.f * luma + .5f);
+	u = uint8_t(128.f + 224.f * (b - luma) / 1.8556f + .5f);
+	v = uint8_t(128.f + 224.f * (r - luma) / 1.5748f + .5f);
+}
+
+// Color bars with a white bar sweeping across, so that consecutive precomputed frames differ
+static Rgb PatternColor(uint32_t x, uint32_t width, uint32_t phase, uint32_t phaseCount)
+{
+	static constexpr std::array<Rgb, 8> bars = { {
+		{ 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+		{ 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 }, { 16, 16, 16 }
+	} };
+	const uint32_t sweepWidth = std::max(width / 32, 2u);
+	const uint32_t sweepX = uint32_t(uint64_t(width - sweepWidth) * phase / std::max(phaseCount - 1, 1u));
+	if (x >= sweepX && x < sweepX + sweepWidth)
+		return { 255, 255, 255 };
+	return bars[uint64_t(x) * bars.size() / width];
+}
+
+static void FillPattern(uint8_t* dst, uint32_t fourCC, uint32_t width, uint32_t height, uint32_t phase, uint32_t phaseCount)
+{
+	switch (fourCC)
+	{
+	case FOURCC_NV12:
+	{
+		uint8_t* uvPlane = dst + size_t(width) * height;
+		for (uint32_t x = 0; x < width; x += 2)
+		{
+			uint8_t y0, y1, u, v;
+			RgbToYuv(PatternColor(x, width, phase, phaseCount), y0, u, v);
+			RgbToYuv(PatternColor(x + 1, width, phase, phaseCount), y1, u, v);
+			dst[x] = y0;
+			dst[x + 1] = y1;
+			uvPlane[x] = u;
+			uvPlane[x + 1] = v;
+		}
+		for (uint32_t row = 1; row < height; row++)
+			memcpy(dst + size_t(row) * width, dst, width);
+		for (uint32_t row = 1; row < height / 2; row++)
+			memcpy(uvPlane + size_t(row) * width, uvPlane, width);
+		break;
+	}
+	case FOURCC_YUY2:
+	{
+		for (uint32_t x = 0; x < width; x += 2)
+		{
+			uint8_t y0, y1, u, v;
+			RgbToYuv(PatternColor(x, width, phase, phaseCount), y0, u, v);
+			RgbToYuv(PatternColor(x + 1, width, phase, phaseCount), y1, u, v);
+			dst[x * 2 + 0] = y0;
+			dst[x * 2 + 1] = u;
+			dst[x * 2 + 2] = y1;
+			dst[x * 2 + 3] = v;
+		}
+		for (uint32_t row = 1; row < height; row++)
+			memcpy(dst + size_t(row) * width * 2, dst, size_t(width) * 2);
+		break;
+	}
+	case FOURCC_BGR24:
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+			Rgb c = PatternColor(x, width, phase, phaseCount);
+			dst[x * 3 + 0] = c.B;
+			dst[x * 3 + 1] = c.G;
+			dst[x * 3 + 2] = c.R;
+		}
+		for (uint32_t row = 1; row < height; row++)
+			memcpy(dst + size_t(row) * width * 3, dst, size_t(width) * 3);
+		break;
+	}
+	}
+}
+
+// Writes value as a row of black/white blocks at the top left of the frame, one block per bit (MSB first).
+// Only touches BITS * BLOCK_SIZE^2 pixels so stamping is negligible next to the frame size.
+static void StampBits(uint8_t* dst, uint32_t fourCC, uint32_t width, uint32_t height, uint32_t row, uint64_t value)
+{
+	static constexpr uint32_t BITS = 64;
+	static constexpr uint32_t BLOCK_SIZE = 8;
+	if (width < BITS * BLOCK_SIZE || height < (row + 1) * BLOCK_SIZE)
+		return;
+	for (uint32_t bit = 0; bit < BITS; bit++)
+	{
+		const bool set = (value >> (BITS - 1 - bit)) & 1;
+		const uint32_t x0 = bit * BLOCK_SIZE;
+		for (uint32_t y = row * BLOCK_SIZE; y < (row + 1) * BLOCK_SIZE; y++)
+		{
+			switch (fourCC)
+			{
+			case FOURCC_NV12:
+				memset(dst + size_t(y) * width + x0, set ? 235 : 16, BLOCK_SIZE);
+				if (y % 2 == 0)
+					memset(dst + size_t(width) * height + size_t(y / 2) * width + x0, 128, BLOCK_SIZE);
+				break;
+			case FOURCC_YUY2:
+				for (uint32_t x = x0; x < x0 + BLOCK_SIZE; x++)
+				{
+					dst[(size_t(y) * width + x) * 2 + 0] = set ? 235 : 16;
+					dst[(size_t(y) * width + x) * 2 + 1] = 128;
+				}
+				break;
+			case FOURCC_BGR24:
+				memset(dst + (size_t(y) * width + x0) * 3, set ? 255 : 0, BLOCK_SIZE * 3);
+				break;
+			}
+		}
+	}
+}
+
+struct SyntheticCaptureSession : CaptureSession
+{
+	// Frames are precomputed at open and rotated through, generation cost per frame is only the stamp.
+	// Each precomputed frame doubles as a device buffer.
+	static constexpr uint32_t DEFAULT_BUFFER_COUNT = 4;
+	static constexpr uint32_t MIN_BUFFER_COUNT = 2;
+
+	SyntheticCaptureSession(FormatInfo const& format, uint32_t bufferCount) : Format(format)
+	{
+		const uint32_t frameSize = GetFrameBufferSize(format.FourCC, format.Resolution);
+		Patterns.resize(bufferCount);
+		for (uint32_t i = 0; i < bufferCount; i++)
+		{
+			Patterns[i].resize(frameSize);
+			FillPattern(Patterns[i].data(), format.FourCC, format.Resolution.x(), format.Resolution.y(), i, bufferCount);
+		}
+		PatternsInFlight.resize(bufferCount, false);
+		nos::fb::vec2u frameRate = GetFrameRateVec2(format.FrameRate);
+		FrameInterval = std::chrono::nanoseconds(1'000'000'000ull * frameRate.y() / std::max(frameRate.x(), 1u));
+		StartTime = std::chrono::steady_clock::now();
+		NextFrameTime = StartTime;
+	}
+
+	FormatInfo GetFormat() const override { return Format; }
+	bool SupportsUserBuffers() const override { return true; }
+
+	std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) override
+	{
+		if (Closed)
+			return std::nullopt;
+		auto now = std::chrono::steady_clock::now();
+		if (NextFrameTime > now + timeout)
+		{
+			std::this_thread::sleep_for(timeout);
+			return std::nullopt;
+		}
+		// Like a real device, frames the consumer was too late for are skipped rather than delivered in a burst
+		if (now > NextFrameTime + FrameInterval)
+		{
+			const uint64_t missed = (now - NextFrameTime) / FrameInterval;
+			NextFrameTime += missed * FrameInterval;
+			FrameCounter += missed;
+		}
+		std::this_thread::sleep_until(NextFrameTime);
+		const uint64_t frameNumber = FrameCounter++;
+		const auto timestamp = NextFrameTime - StartTime;
+		NextFrameTime += FrameInterval;
+
+		std::unique_lock lock(BuffersMutex);
+		const uint32_t patternIndex = uint32_t(frameNumber % Patterns.size());
+		CapturedFrame frame{};
+		if (UserBuffers.empty())
+		{
+			// Consumer still holds this frame, the frame is lost like a device running out of buffers
+			if (PatternsInFlight[patternIndex])
+				return std::nullopt;
+			frame.Data = Patterns[patternIndex].data();
+			frame.BufferIndex = patternIndex;
+		}
+		else
+		{
+			// Stands in for the device DMA into user memory
+			auto it = std::find(UserBuffersInFlight.begin(), UserBuffersInFlight.end(), false);
+			if (it == UserBuffersInFlight.end())
+				return std::nullopt;
+			frame.BufferIndex = uint32_t(it - UserBuffersInFlight.begin());
+			frame.Data = UserBuffers[frame.BufferIndex].Data;
+			frame.UserBuffer = true;
+			memcpy(frame.Data, Patterns[patternIndex].data(), Patterns[patternIndex].size());
+		}
+		(frame.UserBuffer ? UserBuffersInFlight : PatternsInFlight)[frame.BufferIndex] = true;
+		frame.Size = uint32_t(Patterns[patternIndex].size());
+		frame.DeviceTimestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp).count();
+		frame.DeviceSequence = frameNumber;
+		StampBits(frame.Data, Format.FourCC, Format.Resolution.x(), Format.Resolution.y(), 0, frameNumber);
+		StampBits(frame.Data, Format.FourCC, Format.Resolution.x(), Format.Resolution.y(), 1, frame.DeviceTimestamp);
+		return frame;
+	}
+
+	void Requeue(CapturedFrame const& frame) override
+	{
+		std::unique_lock lock(BuffersMutex);
+		auto& inFlight = frame.UserBuffer ? UserBuffersInFlight : PatternsInFlight;
+		if (frame.BufferIndex < inFlight.size())
+			inFlight[frame.BufferIndex] = false;
+	}
+
+	void Close() override { Closed = true; }
+
+	void SetStreaming(bool streaming) override
+	{
+		// Like a device that was stopped, the frames in between were never captured
+		if (streaming)
+			NextFrameTime = std::chrono::steady_clock::now();
+	}
+
+	std::expected<void, std::string> SetUserBuffers(std::vector<UserBuffer> const& buffers) override
+	{
+		for (auto const& buffer : buffers)
+			if (buffer.Size < GetMaxFrameSize())
+				return std::unexpected("User buffer is smaller than the frame size");
+		std::unique_lock lock(BuffersMutex);
+		UserBuffers = buffers;
+		UserBuffersInFlight.assign(buffers.size(), false);
+		return {};
+	}
+
+	FormatInfo Format;
+	std::vector<std::vector<uint8_t>> Patterns;
+	std::vector<bool> PatternsInFlight;
+	std::vector<UserBuffer> UserBuffers;
+	std::vector<bool> UserBuffersInFlight;
+	std::mutex BuffersMutex;
+	std::chrono::nanoseconds FrameInterval{};
+	std::chrono::steady_clock::time_point StartTime;
+	std::chrono::steady_clock::time_point NextFrameTime;
+	uint64_t FrameCounter = 0;
+	std::atomic_bool Closed = false;
+};
+
+struct SyntheticCaptureBackend : CaptureBackend
+{
+	const char* GetName() const override { return "Synthetic"; }
+
+	std::vector<WebcamDevice> EnumerateDevices() override
+	{
+		return { WebcamDevice{ .Name = SYNTHETIC_DEVICE_NAME, .SymLink = SYNTHETIC_DEVICE_PATH } };
+	}
+
+	std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) override
+	{
+		static const std::array<nos::fb::vec2u, 4> resolutions = { nos::fb::vec2u(3840, 2160), nos::fb::vec2u(1920, 1080), nos::fb::vec2u(1280, 720), nos::fb::vec2u(640, 480) };
+		std::vector<FormatInfo> formats;
+		for (uint32_t fourCC : { FOURCC_NV12, FOURCC_YUY2, FOURCC_BGR24 })
+			for (auto const& resolution : resolutions)
+				for (uint32_t i = 0; i < std::to_underlying(WebcamFrameRate::COUNT); i++)
+					formats.push_back(FormatInfo{ .FourCC = fourCC, .Resolution = resolution, .FrameRate = WebcamFrameRate(i) });
+		return formats;
+	}
+
+	std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const& device, FormatInfo const& format, CaptureOptions const& options) override
+	{
+		if (format.Resolution.x() % 2 || format.Resolution.y() % 2 || !GetFrameBufferSize(format.FourCC, format.Resolution))
+			return std::unexpected("Synthetic device does not support the requested format");
+		const uint32_t bufferCount = options.BufferCount ? std::max(options.BufferCount, SyntheticCaptureSession::MIN_BUFFER_COUNT) : SyntheticCaptureSession::DEFAULT_BUFFER_COUNT;
+		return std::make_shared<SyntheticCaptureSession>(format, bufferCount);
+	}
+};
+
+std::unique_ptr<CaptureBackend> CreateSyntheticCaptureBackend()
+{
+	return std::make_unique<SyntheticCaptureBackend>();
+}
+} // namespace nos::webcam
@@ -0,0 +1,76 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nos::webcam
+{
+// Fixed set of worker threads for blocking device work (probing, opening) that must not run on the editor thread
+struct TaskPool
+{
+	explicit TaskPool(uint32_t threadCount)
+	{
+		for (uint32_t i = 0; i < threadCount; i++)
+			Threads.emplace_back([this] { Run(); });
+	}
+
+	// Tasks not started yet are dropped, running ones are waited for
+	~TaskPool()
+	{
+		{
+			std::unique_lock lock(Mutex);
+			Stopping = true;
+			Tasks.clear();
+		}
+		TasksChanged.notify_all();
+		for (auto& thread : Threads)
+			thread.join();
+	}
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	void Submit(std::function<void()> task)
+	{
+		{
+			std::unique_lock lock(Mutex);
+			if (Stopping)
+				return;
+			Tasks.push_back(std::move(task));
+		}
+		TasksChanged.notify_one();
+	}
+
+private:
+	void Run()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock lock(Mutex);
+				TasksChanged.wait(lock, [this] { return Stopping || !Tasks.empty(); });
+				if (Stopping)
+					return;
+				task = std::move(Tasks.front());
+				Tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::mutex Mutex;
+	std::condition_variable TasksChanged;
+	std::deque<std::function<void()>> Tasks;
+	bool Stopping = false;
+	std::vector<std::thread> Threads;
+};
+} // namespace nos::webcam
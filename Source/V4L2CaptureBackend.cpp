@@ -0,0 +1,512 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#if defined(__linux__)
+
+#include "V4L2CaptureBackend.h"
+
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+namespace nos::webcam
+{
+// Watches /dev with inotify, udev creates and removes the video nodes there on hotplug
+struct InotifyDeviceWatcher : DeviceWatcher
+{
+	InotifyDeviceWatcher(int inotifyFd, DeviceChangeCallback callback) : InotifyFd(inotifyFd), StopFd(eventfd(0, EFD_CLOEXEC)), Callback(std::move(callback))
+	{
+		Thread = std::thread([this] { Run(); });
+	}
+
+	~InotifyDeviceWatcher() override
+	{
+		uint64_t one = 1;
+		if (write(StopFd, &one, sizeof(one)) < 0)
+			nosEngine.LogE("V4L2: %s", std::strerror(errno));
+		Thread.join();
+		::close(StopFd);
+		::close(InotifyFd);
+	}
+
+	void Run()
+	{
+		alignas(inotify_event) char buffer[4096];
+		pollfd fds[2] = { { .fd = InotifyFd, .events = POLLIN }, { .fd = StopFd, .events = POLLIN } };
+		while (::poll(fds, 2, -1) >= 0 || errno == EINTR)
+		{
+			if (fds[1].revents & POLLIN)
+				return;
+			if (!(fds[0].revents & POLLIN))
+				continue;
+			ssize_t length = read(InotifyFd, buffer, sizeof(buffer));
+			for (char* ptr = buffer; length > 0 && ptr < buffer + length;)
+			{
+				auto* event = reinterpret_cast<inotify_event*>(ptr);
+				ptr += sizeof(inotify_event) + event->len;
+				if (!event->len || !std::string_view(event->name).starts_with("video"))
+					continue;
+				// udev fixes up permissions after creating the node, the device can only be opened after that
+				const bool arrived = event->mask & (IN_CREATE | IN_ATTRIB);
+				Callback(std::string("/dev/") + event->name, arrived ? DeviceChange::Arrived : DeviceChange::Removed);
+			}
+		}
+	}
+
+	int InotifyFd;
+	int StopFd;
+	DeviceChangeCallback Callback;
+	std::thread Thread;
+};
+
+struct SystemV4L2DeviceIo : V4L2DeviceIo
+{
+	std::vector<std::string> ListDeviceNodes() override
+	{
+		std::vector<std::string> nodes;
+		std::error_code ec;
+		for (auto const& entry : std::filesystem::directory_iterator("/dev", ec))
+			if (entry.path().filename().string().starts_with("video"))
+				nodes.push_back(entry.path().string());
+		std::sort(nodes.begin(), nodes.end());
+		return nodes;
+	}
+	int Open(const char* path, int flags) override { return ::open(path, flags); }
+	int Close(int fd) override { return ::close(fd); }
+	int Ioctl(int fd, unsigned long request, void* arg) override { return ::ioctl(fd, request, arg); }
+	void* Mmap(size_t length, int prot, int flags, int fd, off_t offset) override { return ::mmap(nullptr, length, prot, flags, fd, offset); }
+	int Munmap(void* addr, size_t length) override { return ::munmap(addr, length); }
+	int Poll(pollfd* fds, nfds_t count, int timeoutMs) override { return ::poll(fds, count, timeoutMs); }
+	std::unique_ptr<DeviceWatcher> WatchDeviceNodes(DeviceChangeCallback callback) override
+	{
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0 || inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+		{
+			nosEngine.LogW("V4L2: Hotplug notifications unavailable: %s", std::strerror(errno));
+			if (fd >= 0)
+				::close(fd);
+			return nullptr;
+		}
+		return std::make_unique<InotifyDeviceWatcher>(fd, std::move(callback));
+	}
+};
+
+std::shared_ptr<V4L2DeviceIo> CreateSystemV4L2DeviceIo()
+{
+	return std::make_shared<SystemV4L2DeviceIo>();
+}
+
+static int Xioctl(V4L2DeviceIo& io, int fd, unsigned long request, void* arg)
+{
+	int ret;
+	do
+		ret = io.Ioctl(fd, request, arg);
+	while (ret == -1 && errno == EINTR);
+	return ret;
+}
+
+static std::string ErrnoString(const char* what)
+{
+	return std::string(what) + ": " + std::strerror(errno);
+}
+
+static uint32_t GetFourCCFromV4L2PixelFormat(uint32_t pixelFormat)
+{
+	switch (pixelFormat)
+	{
+	case V4L2_PIX_FMT_NV12: return FOURCC_NV12;
+	case V4L2_PIX_FMT_YUYV: return FOURCC_YUY2;
+	case V4L2_PIX_FMT_MJPEG: return FOURCC_MJPG;
+	default: return FOURCC_NONE;
+	}
+}
+
+static uint32_t GetV4L2PixelFormatFromFourCC(uint32_t fourCC)
+{
+	switch (fourCC)
+	{
+	case FOURCC_NV12: return V4L2_PIX_FMT_NV12;
+	case FOURCC_YUY2: return V4L2_PIX_FMT_YUYV;
+	case FOURCC_MJPG: return V4L2_PIX_FMT_MJPEG;
+	default: return 0;
+	}
+}
+
+struct ScopedFd
+{
+	ScopedFd(V4L2DeviceIo& io, int fd) : Io(io), Fd(fd) {}
+	~ScopedFd() { if (Fd >= 0) Io.Close(Fd); }
+	int Release() { return std::exchange(Fd, -1); }
+	V4L2DeviceIo& Io;
+	int Fd;
+};
+
+struct V4L2CaptureSession : CaptureSession
+{
+	struct MappedBuffer
+	{
+		void* Start = nullptr;
+		size_t Length = 0;
+	};
+
+	V4L2CaptureSession(std::shared_ptr<V4L2DeviceIo> io, int fd, FormatInfo const& format, uint32_t sizeImage, int32_t pitch, uint32_t bufferCount)
+		: Io(std::move(io)), Fd(fd), Format(format), SizeImage(sizeImage), Pitch(pitch), BufferCount(bufferCount) {}
+	~V4L2CaptureSession() override { Close(); }
+
+	FormatInfo GetFormat() const override { return Format; }
+	uint32_t GetMaxFrameSize() const override { return SizeImage; }
+	// Consumers of user buffers expect packed rows
+	bool SupportsUserBuffers() const override { return Pitch == 0; }
+
+	std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) override
+	{
+		if (Closed)
+			return std::nullopt;
+		pollfd pfd{ .fd = Fd, .events = POLLIN };
+		if (Io->Poll(&pfd, 1, int(timeout.count())) <= 0 || !(pfd.revents & POLLIN))
+			return std::nullopt;
+
+		std::unique_lock lock(FdMutex);
+		v4l2_buffer buf{};
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = Memory;
+		if (Closed || Xioctl(*Io, Fd, VIDIOC_DQBUF, &buf) == -1)
+			return std::nullopt;
+		CapturedFrame frame{};
+		frame.BufferIndex = buf.index;
+		frame.UserBuffer = Memory == V4L2_MEMORY_USERPTR;
+		if (buf.index >= GetBufferCount())
+			return std::nullopt;
+		if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		{
+			QueueBuffer(buf.index);
+			return std::nullopt;
+		}
+		HeldBuffers[buf.index] = true;
+		frame.Data = frame.UserBuffer ? UserBuffers[buf.index].Data : static_cast<uint8_t*>(Buffers[buf.index].Start);
+		frame.Size = buf.bytesused;
+		frame.Pitch = Pitch;
+		frame.DeviceTimestamp = uint64_t(buf.timestamp.tv_sec) * 1'000'000'000ull + uint64_t(buf.timestamp.tv_usec) * 1'000ull;
+		frame.DeviceSequence = ExtendSequence(buf.sequence);
+		return frame;
+	}
+
+	void Requeue(CapturedFrame const& frame) override
+	{
+		std::unique_lock lock(FdMutex);
+		// Frames from before a buffer switch are not known to the device anymore
+		if (Closed || frame.UserBuffer != (Memory == V4L2_MEMORY_USERPTR) || frame.BufferIndex >= HeldBuffers.size() || !HeldBuffers[frame.BufferIndex])
+			return;
+		HeldBuffers[frame.BufferIndex] = false;
+		// Queued with the rest when streaming starts again
+		if (!Streaming)
+			return;
+		if (!QueueBuffer(frame.BufferIndex))
+			nosEngine.LogE("V4L2: %s", ErrnoString("VIDIOC_QBUF").c_str());
+	}
+
+	void SetStreaming(bool streaming) override
+	{
+		std::unique_lock lock(FdMutex);
+		if (Closed || streaming == Streaming)
+			return;
+		if (!streaming)
+		{
+			StopStreaming();
+			return;
+		}
+		if (auto started = StartStreaming(); !started)
+			nosEngine.LogE("V4L2: %s", started.error().c_str());
+	}
+
+	void Close() override
+	{
+		std::unique_lock lock(FdMutex);
+		if (Closed.exchange(true))
+			return;
+		StopStreaming();
+		Io->Close(Fd);
+		Fd = -1;
+	}
+
+	std::expected<void, std::string> SetUserBuffers(std::vector<UserBuffer> const& buffers) override
+	{
+		std::unique_lock lock(FdMutex);
+		if (Closed)
+			return std::unexpected("V4L2: Session is closed");
+		for (auto const& buffer : buffers)
+			if (buffer.Size < SizeImage)
+				return std::unexpected("V4L2: User buffer is smaller than the frame size");
+		StopStreaming();
+		UserBuffers = buffers;
+		HeldBuffers.clear();
+		if (auto started = StartStreaming(); !started)
+		{
+			// Driver can't capture into user memory, keep going with its own buffers
+			StopStreaming();
+			UserBuffers.clear();
+			HeldBuffers.clear();
+			if (auto restarted = StartStreaming(); !restarted)
+				nosEngine.LogE("V4L2: %s", restarted.error().c_str());
+			return std::unexpected(started.error());
+		}
+		return {};
+	}
+
+	// Call with FdMutex held or before the session is shared
+	std::expected<void, std::string> StartStreaming()
+	{
+		Memory = UserBuffers.empty() ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+		v4l2_requestbuffers req{};
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = Memory;
+		req.count = UserBuffers.empty() ? BufferCount : uint32_t(UserBuffers.size());
+		if (Xioctl(*Io, Fd, VIDIOC_REQBUFS, &req) == -1)
+			return std::unexpected(ErrnoString("VIDIOC_REQBUFS"));
+		if (req.count < 2 || (Memory == V4L2_MEMORY_USERPTR && req.count < UserBuffers.size()))
+			return std::unexpected("V4L2: Not enough capture buffers");
+
+		if (Memory == V4L2_MEMORY_MMAP)
+		{
+			for (uint32_t i = 0; i < req.count; i++)
+			{
+				v4l2_buffer buf{};
+				buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				buf.memory = V4L2_MEMORY_MMAP;
+				buf.index = i;
+				if (Xioctl(*Io, Fd, VIDIOC_QUERYBUF, &buf) == -1)
+					return std::unexpected(ErrnoString("VIDIOC_QUERYBUF"));
+				void* start = Io->Mmap(buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, buf.m.offset);
+				if (start == MAP_FAILED)
+					return std::unexpected(ErrnoString("mmap"));
+				Buffers.push_back({ start, buf.length });
+			}
+		}
+		// Mapped buffers are new, user buffers may still be read by whoever held them while the device was stopped
+		if (Memory == V4L2_MEMORY_MMAP || HeldBuffers.size() != GetBufferCount())
+			HeldBuffers.assign(GetBufferCount(), false);
+		for (uint32_t i = 0; i < GetBufferCount(); i++)
+			if (!HeldBuffers[i] && !QueueBuffer(i))
+				return std::unexpected(ErrnoString("VIDIOC_QBUF"));
+		v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (Xioctl(*Io, Fd, VIDIOC_STREAMON, &type) == -1)
+			return std::unexpected(ErrnoString("VIDIOC_STREAMON"));
+		SequenceRestarted = true;
+		Streaming = true;
+		return {};
+	}
+
+	void StopStreaming()
+	{
+		Streaming = false;
+		v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		Xioctl(*Io, Fd, VIDIOC_STREAMOFF, &type);
+		for (auto& buffer : Buffers)
+			Io->Munmap(buffer.Start, buffer.Length);
+		Buffers.clear();
+		v4l2_requestbuffers req{};
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = Memory;
+		req.count = 0;
+		Xioctl(*Io, Fd, VIDIOC_REQBUFS, &req);
+	}
+
+	bool QueueBuffer(uint32_t index)
+	{
+		v4l2_buffer buf{};
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = Memory;
+		buf.index = index;
+		if (Memory == V4L2_MEMORY_USERPTR)
+		{
+			buf.m.userptr = reinterpret_cast<unsigned long>(UserBuffers[index].Data);
+			buf.length = UserBuffers[index].Size;
+		}
+		return Xioctl(*Io, Fd, VIDIOC_QBUF, &buf) != -1;
+	}
+
+	// Driver sequence is 32 bits and restarts on STREAMON, extend it to a counter that lives as long as the session
+	uint64_t ExtendSequence(uint32_t sequence)
+	{
+		if (!ExtendedSequence)
+			ExtendedSequence = sequence;
+		else
+			*ExtendedSequence += SequenceRestarted ? 1 : uint32_t(sequence - LastRawSequence);
+		SequenceRestarted = false;
+		LastRawSequence = sequence;
+		return *ExtendedSequence;
+	}
+
+	uint32_t GetBufferCount() const { return uint32_t(Memory == V4L2_MEMORY_USERPTR ? UserBuffers.size() : Buffers.size()); }
+
+	std::shared_ptr<V4L2DeviceIo> Io;
+	int Fd = -1;
+	FormatInfo Format;
+	uint32_t SizeImage = 0;
+	int32_t Pitch = 0; // Set when the driver pads rows
+	uint32_t BufferCount = 0;
+	uint32_t Memory = V4L2_MEMORY_MMAP;
+	std::vector<MappedBuffer> Buffers;
+	std::vector<UserBuffer> UserBuffers;
+	// Dequeued and not given back yet, by buffer index
+	std::vector<bool> HeldBuffers;
+	bool Streaming = false;
+	std::optional<uint64_t> ExtendedSequence;
+	uint32_t LastRawSequence = 0;
+	bool SequenceRestarted = false;
+	std::mutex FdMutex;
+	std::atomic_bool Closed = false;
+};
+
+struct V4L2CaptureBackend : CaptureBackend
+{
+	static constexpr uint32_t DEFAULT_BUFFER_COUNT = 4;
+	static constexpr uint32_t MIN_BUFFER_COUNT = 2;
+
+	V4L2CaptureBackend(std::shared_ptr<V4L2DeviceIo> io) : Io(std::move(io)) {}
+
+	const char* GetName() const override { return "V4L2"; }
+
+	std::unique_ptr<DeviceWatcher> WatchDevices(DeviceChangeCallback callback) override
+	{
+		return Io->WatchDeviceNodes(std::move(callback));
+	}
+
+	std::vector<WebcamDevice> EnumerateDevices() override
+	{
+		std::vector<WebcamDevice> result;
+		for (auto const& path : Io->ListDeviceNodes())
+		{
+			ScopedFd fd(*Io, Io->Open(path.c_str(), O_RDWR | O_NONBLOCK));
+			if (fd.Fd < 0)
+				continue;
+			v4l2_capability cap{};
+			if (Xioctl(*Io, fd.Fd, VIDIOC_QUERYCAP, &cap) == -1)
+				continue;
+			uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+			// Metadata nodes of UVC cameras are listed as video devices too
+			if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+				continue;
+			result.push_back(WebcamDevice{ .Name = reinterpret_cast<const char*>(cap.card), .SymLink = path });
+		}
+		return result;
+	}
+
+	std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) override
+	{
+		std::vector<FormatInfo> formats;
+		ScopedFd fd(*Io, Io->Open(device.SymLink.c_str(), O_RDWR | O_NONBLOCK));
+		if (fd.Fd < 0)
+			return formats;
+
+		v4l2_fmtdesc fmt{};
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		for (fmt.index = 0; Xioctl(*Io, fd.Fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++)
+		{
+			uint32_t fourCC = GetFourCCFromV4L2PixelFormat(fmt.pixelformat);
+			if (fourCC == FOURCC_NONE)
+				continue;
+			v4l2_frmsizeenum size{};
+			size.pixel_format = fmt.pixelformat;
+			for (size.index = 0; Xioctl(*Io, fd.Fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++)
+			{
+				if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+					break;
+				EnumerateFrameIntervals(fd.Fd, fourCC, fmt.pixelformat, size.discrete.width, size.discrete.height, formats);
+			}
+		}
+		return formats;
+	}
+
+	void EnumerateFrameIntervals(int fd, uint32_t fourCC, uint32_t pixelFormat, uint32_t width, uint32_t height, std::vector<FormatInfo>& formats)
+	{
+		auto add = [&](WebcamFrameRate frameRate) {
+			formats.push_back(FormatInfo{ .FourCC = fourCC, .Resolution = nos::fb::vec2u(width, height), .FrameRate = frameRate });
+		};
+		v4l2_frmivalenum interval{};
+		interval.pixel_format = pixelFormat;
+		interval.width = width;
+		interval.height = height;
+		for (interval.index = 0; Xioctl(*Io, fd, VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0; interval.index++)
+		{
+			if (interval.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+			{
+				// Interval is seconds per frame
+				if (auto frameRate = FindFrameRate(interval.discrete.denominator, interval.discrete.numerator))
+					add(*frameRate);
+				continue;
+			}
+			// Continuous/stepwise ranges: offer every table rate inside the range
+			double minFps = double(interval.stepwise.max.denominator) / std::max(interval.stepwise.max.numerator, 1u);
+			double maxFps = double(interval.stepwise.min.denominator) / std::max(interval.stepwise.min.numerator, 1u);
+			for (uint32_t i = 0; i < std::to_underlying(WebcamFrameRate::COUNT); i++)
+			{
+				nos::fb::vec2u rate = GetFrameRateVec2(WebcamFrameRate(i));
+				double fps = double(rate.x()) / rate.y();
+				if (fps >= minFps && fps <= maxFps)
+					add(WebcamFrameRate(i));
+			}
+			break;
+		}
+	}
+
+	std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const& device, FormatInfo const& formatInfo, CaptureOptions const& options) override
+	{
+		ScopedFd fd(*Io, Io->Open(device.SymLink.c_str(), O_RDWR | O_NONBLOCK));
+		if (fd.Fd < 0)
+			return std::unexpected(ErrnoString(device.SymLink.c_str()));
+
+		v4l2_format fmt{};
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		fmt.fmt.pix.width = formatInfo.Resolution.x();
+		fmt.fmt.pix.height = formatInfo.Resolution.y();
+		fmt.fmt.pix.pixelformat = GetV4L2PixelFormatFromFourCC(formatInfo.FourCC);
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		if (Xioctl(*Io, fd.Fd, VIDIOC_S_FMT, &fmt) == -1)
+			return std::unexpected(ErrnoString("VIDIOC_S_FMT"));
+		if (fmt.fmt.pix.width != formatInfo.Resolution.x() || fmt.fmt.pix.height != formatInfo.Resolution.y() ||
+			GetFourCCFromV4L2PixelFormat(fmt.fmt.pix.pixelformat) != formatInfo.FourCC)
+			return std::unexpected("V4L2: Device did not accept the requested format");
+
+		v4l2_streamparm parm{};
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		nos::fb::vec2u frameRate = GetFrameRateVec2(formatInfo.FrameRate);
+		parm.parm.capture.timeperframe.numerator = frameRate.y();
+		parm.parm.capture.timeperframe.denominator = frameRate.x();
+		// Not every driver supports setting the rate, format is still usable at its default rate
+		if (Xioctl(*Io, fd.Fd, VIDIOC_S_PARM, &parm) == -1)
+			nosEngine.LogW("V4L2: %s", ErrnoString("VIDIOC_S_PARM").c_str());
+
+		const uint32_t rowSize = GetFrameRowSize(formatInfo.FourCC, formatInfo.Resolution.x());
+		const int32_t pitch = rowSize && fmt.fmt.pix.bytesperline > rowSize ? int32_t(fmt.fmt.pix.bytesperline) : 0;
+		auto session = std::make_shared<V4L2CaptureSession>(Io, fd.Release(), formatInfo, fmt.fmt.pix.sizeimage, pitch, options.BufferCount ? std::max(options.BufferCount, MIN_BUFFER_COUNT) : DEFAULT_BUFFER_COUNT);
+		if (auto started = session->StartStreaming(); !started)
+			return std::unexpected(started.error());
+		return session;
+	}
+
+	std::shared_ptr<V4L2DeviceIo> Io;
+};
+
+std::unique_ptr<CaptureBackend> CreateV4L2CaptureBackend(std::shared_ptr<V4L2DeviceIo> io)
+{
+	return std::make_unique<V4L2CaptureBackend>(std::move(io));
+}
+
+std::unique_ptr<CaptureBackend> CreateV4L2CaptureBackend()
+{
+	return CreateV4L2CaptureBackend(CreateSystemV4L2DeviceIo());
+}
+} // namespace nos::webcam
+
+#endif // __linux__
@@ -0,0 +1,35 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/types.h>
+
+#include "CaptureBackend.h"
+
+namespace nos::webcam
+{
+// Syscalls used by the V4L2 backend. Kept behind an interface so that the backend can be driven by a mocked device.
+struct V4L2DeviceIo
+{
+	virtual ~V4L2DeviceIo() = default;
+	virtual std::vector<std::string> ListDeviceNodes() = 0;
+	virtual int Open(const char* path, int flags) = 0;
+	virtual int Close(int fd) = 0;
+	virtual int Ioctl(int fd, unsigned long request, void* arg) = 0;
+	virtual void* Mmap(size_t length, int prot, int flags, int fd, off_t offset) = 0;
+	virtual int Munmap(void* addr, size_t length) = 0;
+	virtual int Poll(pollfd* fds, nfds_t count, int timeoutMs) = 0;
+	// Reports device nodes appearing in and disappearing from /dev
+	virtual std::unique_ptr<DeviceWatcher> WatchDeviceNodes(DeviceChangeCallback callback) = 0;
+};
+
+std::shared_ptr<V4L2DeviceIo> CreateSystemV4L2DeviceIo();
+std::unique_ptr<CaptureBackend> CreateV4L2CaptureBackend(std::shared_ptr<V4L2DeviceIo> io);
+} // namespace nos::webcam
+
+#endif // __linux__
@@ -0,0 +1,106 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "VirtualCamera.h"
+
+#include <cfloat>
+
+namespace nos::webcam
+{
+std::unique_ptr<VirtualCameraRegistry> VirtualCameraRegistry::Instance = nullptr;
+
+bool operator==(VirtualCameraConfig const& a, VirtualCameraConfig const& b)
+{
+	return a.Name == b.Name && a.Resolution == b.Resolution && a.FrameRate == b.FrameRate && a.Format == b.Format;
+}
+
+size_t GetFrameSize(VirtualCameraConfig const& config)
+{
+	const size_t pixels = size_t(config.Resolution.x()) * config.Resolution.y();
+	switch (config.Format)
+	{
+	case WebcamTextureFormat::NV12: return pixels * 3 / 2;
+	case WebcamTextureFormat::YUY2: return pixels * 2;
+	case WebcamTextureFormat::BGR24: return pixels * 3;
+	default: return 0;
+	}
+}
+
+VirtualCamera::VirtualCamera(VirtualCameraConfig const& config, std::unique_ptr<VirtualCameraSink> sink)
+	: Config(config), Sink(std::move(sink)),
+	Sender(config.Name, GetFrameSize(config), GetRationalFrameRate(config.FrameRate), [this](uint8_t const* frame) {
+		if (!HasNoReaders())
+			Sink->SendFrame(frame);
+	})
+{
+}
+
+bool VirtualCamera::HasNoReaders() const
+{
+	const std::optional<uint32_t> readers = Sink->GetReaderCount();
+	return readers && *readers == 0;
+}
+
+void VirtualCameraRegistry::Start()
+{
+	Instance = std::make_unique<VirtualCameraRegistry>();
+#if defined(_WIN32)
+	Instance->Transport = CreateSoftcamTransport();
+#endif
+#if defined(__linux__)
+	Instance->Transport = CreateSharedMemoryTransport();
+#endif
+}
+
+void VirtualCameraRegistry::Stop()
+{
+	if (!Instance)
+		return;
+	std::unique_lock lock(Instance->Mutex);
+	Instance->Cameras.clear();
+	lock.unlock();
+	Instance.reset();
+}
+
+VirtualCameraRegistry& VirtualCameraRegistry::GetInstance()
+{
+	return *Instance;
+}
+
+std::expected<std::shared_ptr<VirtualCamera>, std::string> VirtualCameraRegistry::Acquire(nosUUID const& owner, VirtualCameraConfig const& config)
+{
+	if (!Transport)
+		return std::unexpected("Virtual camera output is not supported on this platform");
+	if (!config.Resolution.x() || !config.Resolution.y() || config.FrameRate < FLT_MIN || !GetFrameSize(config))
+		return std::unexpected("Invalid parameter for camera");
+	std::unique_lock lock(Mutex);
+	// Old camera goes first, the transport may only have room for one
+	Cameras.erase(owner);
+	if (Cameras.size() >= Transport->GetMaxCameraCount())
+	{
+		const uint32_t max = Transport->GetMaxCameraCount();
+		std::string error = std::string(Transport->GetName()) + " supports " + (max == 1 ? "one camera" : std::to_string(max) + " cameras") + ", " +
+			Transport->GetCameraLimitReason() + ". " + (max == 1 ? "It is used by another WebcamOut node" : "All are used by other WebcamOut nodes");
+		nosEngine.LogW("%s: No camera for %s. %s", Transport->GetName(), config.Name.c_str(), error.c_str());
+		return std::unexpected(std::move(error));
+	}
+	auto sink = Transport->CreateCamera(config);
+	if (!sink)
+		return std::unexpected(sink.error());
+	auto camera = std::make_shared<VirtualCamera>(config, std::move(*sink));
+	Cameras[owner] = camera;
+	nosEngine.LogI("%s: Created %ux%u %s camera, %zu active", Transport->GetName(), config.Resolution.x(), config.Resolution.y(), config.Name.c_str(), Cameras.size());
+	return camera;
+}
+
+void VirtualCameraRegistry::Release(nosUUID const& owner)
+{
+	std::unique_lock lock(Mutex);
+	Cameras.erase(owner);
+}
+
+size_t VirtualCameraRegistry::GetCameraCount()
+{
+	std::unique_lock lock(Mutex);
+	return Cameras.size();
+}
+} // namespace nos::webcam
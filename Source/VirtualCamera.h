@@ -0,0 +1,93 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "Nodos/PluginHelpers.hpp"
+#include "Webcam_generated.h"
+#include "FrameSender.h"
+
+namespace nos::webcam
+{
+struct VirtualCameraConfig
+{
+	std::string Name;
+	nos::fb::vec2u Resolution;
+	float FrameRate = 0.0f;
+	WebcamTextureFormat Format = WebcamTextureFormat::NONE;
+};
+
+bool operator==(VirtualCameraConfig const& a, VirtualCameraConfig const& b);
+// Size of one tightly packed frame, 0 if the format can not be output
+size_t GetFrameSize(VirtualCameraConfig const& config);
+
+// One camera device of a transport, gone when destroyed
+struct VirtualCameraSink
+{
+	virtual ~VirtualCameraSink() = default;
+	// Called from the camera's sender thread only
+	virtual void SendFrame(uint8_t const* frame) = 0;
+	// Applications that have the camera open, nullopt if the transport can not tell
+	virtual std::optional<uint32_t> GetReaderCount() const { return std::nullopt; }
+};
+
+// Makes frames visible to other applications as camera devices
+struct OutputTransport
+{
+	virtual ~OutputTransport() = default;
+	virtual const char* GetName() const = 0;
+	// Cameras that can exist at the same time
+	virtual uint32_t GetMaxCameraCount() const = 0;
+	// Why there can be no more than GetMaxCameraCount() cameras, shown on the nodes that get none
+	virtual const char* GetCameraLimitReason() const = 0;
+	virtual std::expected<std::unique_ptr<VirtualCameraSink>, std::string> CreateCamera(VirtualCameraConfig const& config) = 0;
+};
+
+#if defined(_WIN32)
+std::unique_ptr<OutputTransport> CreateSoftcamTransport();
+#endif
+#if defined(__linux__)
+std::unique_ptr<OutputTransport> CreateSharedMemoryTransport();
+#endif
+
+// A camera published by one node, with its own frame slots and sender thread
+struct VirtualCamera
+{
+	VirtualCamera(VirtualCameraConfig const& config, std::unique_ptr<VirtualCameraSink> sink);
+	// Frames are neither converted nor sent while nobody watches
+	bool HasNoReaders() const;
+
+	VirtualCameraConfig const Config;
+	// Declared first so the sender thread stops before the sink goes away
+	std::unique_ptr<VirtualCameraSink> const Sink;
+	FrameSender Sender;
+};
+
+// Owns every virtual camera of the process, one per writer node
+struct VirtualCameraRegistry
+{
+	static void Start();
+	static void Stop();
+	static VirtualCameraRegistry& GetInstance();
+
+	// Replaces the owner's camera with one for the new config
+	std::expected<std::shared_ptr<VirtualCamera>, std::string> Acquire(nosUUID const& owner, VirtualCameraConfig const& config);
+	void Release(nosUUID const& owner);
+	size_t GetCameraCount();
+
+private:
+	static std::unique_ptr<VirtualCameraRegistry> Instance;
+	// Null when the platform has no virtual camera support
+	std::unique_ptr<OutputTransport> Transport;
+	std::mutex Mutex;
+	std::unordered_map<nosUUID, std::shared_ptr<VirtualCamera>> Cameras;
+};
+} // namespace nos::webcam
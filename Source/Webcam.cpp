@@ -11,7 +11,10 @@
 
 #include "nosUtil/Stopwatch.hpp"
 #include "WebcamStream.h"
+#include "VirtualCamera.h"
+#if defined(_WIN32)
 #include "softcam.h"
+#endif
 
 NOS_INIT_WITH_MIN_REQUIRED_MINOR(0)
 NOS_VULKAN_INIT();
@@ -36,6 +39,7 @@ nosResult RegisterWebcamStream(nosNodeFunctions* function);
 nosResult RegisterWebcamWriter(nosNodeFunctions* function);
 
 static constexpr char WARNING_FAILED_TO_FIND_DRIVER[] = "Failed to find Softcam driver for WebcamWriter node. Webcam output feature won't work.";
+#if defined(_WIN32)
 bool CheckSoftcamDriver() {
     // Initialize COM library
     HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
@@ -68,6 +72,9 @@ bool CheckSoftcamDriver() {
     CoUninitialize();
     return true;
 }
+#else
+bool CheckSoftcamDriver() { return false; }
+#endif
 
 struct WebcamPluginFunctions : nos::PluginFunctions
 {
@@ -88,6 +95,7 @@ struct WebcamPluginFunctions : nos::PluginFunctions
         }
 
 		WebcamStreamManager::Start();
+		VirtualCameraRegistry::Start();
 
 		NOS_RETURN_ON_FAILURE(RegisterWebcamReader(outList[(int)WebcamNodes::WebcamReader]))
 		NOS_RETURN_ON_FAILURE(RegisterWebcamStream(outList[(int)WebcamNodes::WebcamStream]))
@@ -97,6 +105,7 @@ struct WebcamPluginFunctions : nos::PluginFunctions
 
 	nosResult OnPreUnloadPlugin() override
 	{
+		VirtualCameraRegistry::Stop();
 		WebcamStreamManager::Stop();
 		return NOS_RESULT_SUCCESS;
 	}
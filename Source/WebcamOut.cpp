@@ -2,9 +2,10 @@
 #include <nosVulkanSubsystem/Helpers.hpp>
 
 #include "WebcamStream.h"
+#include "PixelConvert.h"
+#include "VirtualCamera.h"
 #include "nosUtil/Stopwatch.hpp"
 #include "Webcam_generated.h"
-#include <SenderAPI.h>
 
 namespace nos::webcam
 {
@@ -13,6 +14,10 @@ NOS_REGISTER_NAME(Resolution);
 NOS_REGISTER_NAME(Format);
 NOS_REGISTER_NAME(Run);
 NOS_REGISTER_NAME_SPACED(FrameRate, "Frame Rate");
+NOS_REGISTER_NAME_SPACED(InputFormat, "Input Format");
+NOS_REGISTER_NAME_SPACED(ColorMatrix, "Color Matrix");
+NOS_REGISTER_NAME_SPACED(ColorRange, "Color Range");
+NOS_REGISTER_NAME_SPACED(CameraName, "Camera Name");
 
 float getFormatSizePerPixel(WebcamTextureFormat format) {
 	switch (format)
@@ -32,17 +37,21 @@ struct WebcamWriterNode : public NodeContext
 {
 	using NodeContext::NodeContext;
 
-	// Camera's active properties
-	static scCamera CamHandle;
-	static nos::fb::UUID ActiveNodeId;
-	static float ActiveFrameRate;
-	static nos::fb::vec2u ActiveResolution;
-	static WebcamTextureFormat ActiveFormat;
+	// Camera of this node, registered under its id
+	std::shared_ptr<VirtualCamera> Camera;
 
 	// Node specifics
-	float FrameRate;
+	float FrameRate = 60.0f;
 	nos::fb::vec2u Resolution;
 	WebcamTextureFormat Format;
+	std::string CameraName;
+	WebcamWriterInput Input = WebcamWriterInput::NATIVE;
+	WebcamColorMatrix ColorMatrix = WebcamColorMatrix::BT709;
+	WebcamColorRange ColorRange = WebcamColorRange::LIMITED;
+	// Engine thread time spent per frame
+	LatencyHistogram ExecuteTime;
+	// Frames skipped because no application had the camera open
+	uint64_t UnwatchedFrames = 0;
 
 	WebcamWriterNode(const nosFbNode* node) : nos::NodeContext(node) {
 		AddPinValueWatcher(NSN_FrameRate, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
@@ -57,33 +66,62 @@ struct WebcamWriterNode : public NodeContext
 			{
 				Format = *InterpretPinValue<WebcamTextureFormat>(newVal);
 			});
+		AddPinValueWatcher(NSN_CameraName, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				CameraName = InterpretPinValue<char>(newVal);
+			});
+		AddPinValueWatcher(NSN_InputFormat, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				Input = *InterpretPinValue<WebcamWriterInput>(newVal);
+				if (Camera)
+					UpdateFormatStatus();
+			});
+		AddPinValueWatcher(NSN_ColorMatrix, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				ColorMatrix = *InterpretPinValue<WebcamColorMatrix>(newVal);
+			});
+		AddPinValueWatcher(NSN_ColorRange, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				ColorRange = *InterpretPinValue<WebcamColorRange>(newVal);
+			});
 		RecreateCamera();
 	}
 	~WebcamWriterNode() {
-		if (CamHandle)
-			scDeleteCamera(CamHandle);
+		if (const uint64_t count = ExecuteTime.Count)
+			nosEngine.LogI("WebcamOut: %.3f ms per frame on the engine thread over %llu frames, p99 under %llu us", double(ExecuteTime.TotalNanoseconds) / double(count) / 1e6,
+				(unsigned long long)count, (unsigned long long)LatencyHistogram::GetPercentile(ExecuteTime.GetBuckets(), 0.99));
+		if (UnwatchedFrames)
+			nosEngine.LogI("WebcamOut: Skipped %llu frames nobody was watching", (unsigned long long)UnwatchedFrames);
+		DestroyCamera();
 	}
 
 	void GetScheduleInfo(nosScheduleInfo* out) override
 	{
+		// Frame duration is the inverse of the rate, so 29.97 is exactly 1001/30000
+		const nos::fb::vec2u rate = GetRationalFrameRate(FrameRate);
 		*out = nosScheduleInfo{
 			.Importance = 1,
-			.DeltaSeconds = {1, 60},
+			.DeltaSeconds = {rate.y(), rate.x()},
 			.Type = NOS_SCHEDULE_TYPE_ON_DEMAND,
 		};
 
-		if (!CamHandle)
+		if (!Camera)
 			RecreateCamera();
 	}
-	int colorV = 0;
+
+	VirtualCameraConfig GetCameraConfig() const
+	{
+		return VirtualCameraConfig{ .Name = CameraName, .Resolution = Resolution, .FrameRate = FrameRate, .Format = Format };
+	}
 
 	bool IsCameraDifferent() {
-		return ActiveFrameRate != FrameRate || ActiveResolution != Resolution || ActiveFormat != Format;
+		return !Camera || !(Camera->Config == GetCameraConfig());
 	}
 
 	void OnPinValueChanged(nos::Name pinName, nosUUID pinId, nosBuffer value) override
 	{
-		if (pinName == NSN_Source || pinName == NSN_Run)
+		// Conversion settings do not change the camera
+		if (pinName == NSN_Source || pinName == NSN_Run || pinName == NSN_InputFormat || pinName == NSN_ColorMatrix || pinName == NSN_ColorRange)
 			return;
 		if (pinName == NSN_FrameRate)
 			FrameRate = *nos::Buffer(value).As<float>();
@@ -91,24 +129,31 @@ struct WebcamWriterNode : public NodeContext
 			Resolution = *nos::Buffer(value).As<nos::fb::vec2u>();
 		if (pinName == NSN_Format)
 			Format = *nos::Buffer(value).As<WebcamTextureFormat>();
+		if (pinName == NSN_CameraName)
+			CameraName = static_cast<const char*>(value.Data);
 
-		if (ActiveNodeId == NodeId)
-			RecreateCamera();
-	}
-
-	void OnPinDisconnected(nos::Name pinName) override
-	{
-		if (pinName == NSN_Source || pinName == NSN_Run)
-			if(ActiveNodeId == NodeId)
-				ActiveNodeId = {};
+		RecreateCamera();
 	}
 
 	nosResult ExecuteNode(nosNodeExecuteParams* params) override
 	{
-		if(!CamHandle || IsCameraDifferent())
+		if(IsCameraDifferent())
 			return NOS_RESULT_FAILED;
+		nosScheduleNodeParams schedule{
+			.NodeId = NodeId,
+			.AddScheduleCount = 1
+		};
+		if (Camera->HasNoReaders())
+		{
+			// Keeps running so the first frame after an application opens the camera is fresh
+			UnwatchedFrames++;
+			nosEngine.ScheduleNode(&schedule);
+			return NOS_RESULT_SUCCESS;
+		}
+		nos::util::Stopwatch executeWatch;
 		nos::NodeExecuteParams execParams(params);
 		unsigned int outBufferSize = Resolution.x() * Resolution.y() * getFormatSizePerPixel(Format);
+		const unsigned int inBufferSize = Input == WebcamWriterInput::RGBA8 ? Resolution.x() * Resolution.y() * 4 : outBufferSize;
 		
 		nosResourceShareInfo inputBuffer{};
 		for (size_t i = 0; i < params->PinCount; ++i)
@@ -118,94 +163,95 @@ struct WebcamWriterNode : public NodeContext
 				inputBuffer = vkss::ConvertToResourceInfo(*InterpretPinValue<sys::vulkan::Buffer>(*pin.Data));
 		}
 
-		if (!inputBuffer.Memory.Handle || inputBuffer.Memory.Size < outBufferSize)
+		if (!inputBuffer.Memory.Handle || inputBuffer.Memory.Size < inBufferSize)
 		{
 			nosEngine.LogE("WebcamOut: Invalid input buffer");
 			return NOS_RESULT_FAILED;
 		}
 
 		auto buffer = nosVulkan->Map(&inputBuffer);
-		scSendFrame(reinterpret_cast<scCamera>(CamHandle), buffer);
+		FrameSender& sender = Camera->Sender;
+		uint8_t* slot = sender.GetWriteSlot();
+		if (Input == WebcamWriterInput::RGBA8)
+		{
+			if (auto res = ConvertFrame(buffer, slot); !res)
+			{
+				nosEngine.LogE("WebcamOut: %s", res.error().c_str());
+				return NOS_RESULT_FAILED;
+			}
+		}
+		else
+			memcpy(slot, buffer, std::min<size_t>(outBufferSize, sender.GetFrameSize()));
+		sender.Publish();
 
-		nosScheduleNodeParams schedule{
-			.NodeId = NodeId,
-			.AddScheduleCount = 1
-		};
 		nosEngine.ScheduleNode(&schedule);
+		ExecuteTime.Record(executeWatch.Elapsed());
 		return NOS_RESULT_SUCCESS;
 	}
 
-	void OnPathStart() override
+	std::expected<void, std::string> ConvertFrame(uint8_t const* rgba, uint8_t* out)
 	{
-		if (!CamHandle)
-			RecreateCamera();
-		if (ActiveNodeId != NodeId && ActiveNodeId != nos::fb::UUID()) {
-			SetNodeStatusMessage("Another WebcamOut node is already active", nos::fb::NodeStatusMessageType::FAILURE);
-			return;
-		}
-
-		nosScheduleNodeParams schedule{ .NodeId = NodeId, .AddScheduleCount = 1 };
-		nosEngine.ScheduleNode(&schedule);
-		ActiveNodeId = NodeId;
-		ClearNodeStatusMessages();
-	}
-	
-	softcamTextureFormat GetSoftcamFormatFromWebcamFormat(WebcamTextureFormat format) {
-		switch (format)
+		switch (Format)
 		{
 		case WebcamTextureFormat::BGR24:
-			return SOFTCAM_TEXTURE_FORMAT_BGR24;
+			ConvertRGBAToBGR24(rgba, Resolution.x(), Resolution.y(), out);
+			return {};
 		case WebcamTextureFormat::NV12:
-			return SOFTCAM_TEXTURE_FORMAT_NV12;
+			return ConvertRGBAToNV12(rgba, Resolution.x(), Resolution.y(), ColorMatrix, ColorRange, out);
 		case WebcamTextureFormat::YUY2:
-			return SOFTCAM_TEXTURE_FORMAT_YUY2;
+			return ConvertRGBAToYUY2(rgba, Resolution.x(), Resolution.y(), ColorMatrix, ColorRange, out);
 		default:
-			return SOFTCAM_TEXTURE_FORMAT_UNKNOWN;
+			return std::unexpected("Unsupported camera format");
 		}
 	}
+
+	// Formats other than BGR24 are only known to work when converted here
+	bool IsFormatTested() const
+	{
+		return Format == WebcamTextureFormat::BGR24 || Input == WebcamWriterInput::RGBA8;
+	}
+
+	void UpdateFormatStatus()
+	{
+		if (IsFormatTested())
+			ClearNodeStatusMessages();
+		else
+			SetNodeStatusMessage("Not tested format", nos::fb::NodeStatusMessageType::WARNING);
+	}
+
+	void OnPathStart() override
+	{
+		if (!Camera)
+			RecreateCamera();
+		if (!Camera)
+			return;
+
+		nosScheduleNodeParams schedule{ .NodeId = NodeId, .AddScheduleCount = 1 };
+		nosEngine.ScheduleNode(&schedule);
+	}
 	
 	void RecreateCamera() {
-		if (!IS_SOFTCAM_DRIVER_FOUND)
-		{
-			SetNodeStatusMessage("Softcam driver not found", nos::fb::NodeStatusMessageType::FAILURE);
-			return;
-		}
-		if (!IsCameraDifferent() && CamHandle)
-			return;
-		if(CamHandle)
-			DestroyCamera();
-		if (!Resolution.x() || !Resolution.y() || FrameRate < FLT_MIN || Format == WebcamTextureFormat::NONE) {
-			SetNodeStatusMessage("Invalid parameter for camera", nos::fb::NodeStatusMessageType::FAILURE);
+		if (!IsCameraDifferent())
 			return;
-		}
-		if (Format != WebcamTextureFormat::BGR24) {
-			SetNodeStatusMessage("Not tested format", nos::fb::NodeStatusMessageType::WARNING);
-		}
-
-		CamHandle = scCreateCamera(Resolution.x(), Resolution.y(), FrameRate, GetSoftcamFormatFromWebcamFormat(Format));
-		if (!CamHandle)
+		DestroyCamera();
+		auto camera = VirtualCameraRegistry::GetInstance().Acquire(NodeId, GetCameraConfig());
+		if (!camera)
 		{
-			SetNodeStatusMessage("Camera creation failed", nos::fb::NodeStatusMessageType::FAILURE);
+			SetNodeStatusMessage(camera.error(), nos::fb::NodeStatusMessageType::FAILURE);
 			return;
 		}
-		else if (Format == WebcamTextureFormat::BGR24)
-			ClearNodeStatusMessages();
-
-		ActiveResolution = Resolution;
-		ActiveFrameRate = FrameRate;
-		ActiveFormat = Format;
+		Camera = std::move(*camera);
+		UpdateFormatStatus();
 		nosEngine.SendPathRestart(NodeId);
 	}
 	void DestroyCamera() {
-		scDeleteCamera(CamHandle);
-		CamHandle = nullptr;
+		if (!Camera)
+			return;
+		Camera.reset();
+		VirtualCameraRegistry::GetInstance().Release(NodeId);
 	}
 };
-scCamera WebcamWriterNode::CamHandle = nullptr;
-nos::fb::UUID WebcamWriterNode::ActiveNodeId = {};
-float WebcamWriterNode::ActiveFrameRate = 0.0f;
-nos::fb::vec2u WebcamWriterNode::ActiveResolution = {0, 0};
-WebcamTextureFormat WebcamWriterNode::ActiveFormat = WebcamTextureFormat::NONE;
+
 nosResult RegisterWebcamWriter(nosNodeFunctions* outFunc)
 {
 	NOS_BIND_NODE_CLASS(NOS_NAME_STATIC("nos.webcam.WebcamWriter"), nos::webcam::WebcamWriterNode, outFunc);
@@ -2,18 +2,98 @@
 #include <nosVulkanSubsystem/Helpers.hpp>
 
 #include "WebcamStream.h"
+#include "PixelConvert.h"
 #include "nosUtil/Stopwatch.hpp"
 #include "Webcam_generated.h"
 
+#include <algorithm>
+#include <deque>
+
 namespace nos::webcam
 {
 NOS_REGISTER_NAME(StreamInfo);
 NOS_REGISTER_NAME(BufferToWrite);
 NOS_REGISTER_NAME(Output);
+NOS_REGISTER_NAME(FrameInfo);
+NOS_REGISTER_NAME_SPACED(ConvertToNV12, "Convert To NV12");
+NOS_REGISTER_NAME_SPACED(OutputFormat, "Output Format");
+NOS_REGISTER_NAME_SPACED(OutputResolution, "Output Resolution");
+NOS_REGISTER_NAME_SPACED(ROIOffset, "ROI Offset");
+NOS_REGISTER_NAME_SPACED(ROISize, "ROI Size");
+NOS_REGISTER_NAME(Downscale);
+NOS_REGISTER_NAME_SPACED(SkipUnchanged, "Skip Unchanged");
+NOS_REGISTER_NAME_SPACED(PipelinedUpload, "Pipelined Upload");
 
 struct WebcamReaderNode : public NodeContext
 {
-	using NodeContext::NodeContext;
+	// Upload buffers the device captures into when the backend supports it
+	static constexpr uint32_t IMPORTED_BUFFER_COUNT = 8;
+	// Imported frames waiting for the GPU to finish reading them, the device keeps the other half to capture into
+	static constexpr size_t MAX_HELD_SAMPLES = IMPORTED_BUFFER_COUNT / 2;
+	// Upload buffers of the reader for pipelined uploads, enough for one being written by the CPU, one being read by the GPU
+	// and one to spare for a late GPU. With Skip Unchanged the spare holds the last frame for repeats.
+	static constexpr uint32_t STAGING_SLOT_COUNT = 3;
+	static constexpr uint64_t GPU_WAIT_TIMEOUT_NS = 1'000'000'000;
+
+	// What the last frame uploaded with Skip Unchanged on looked like
+	struct UploadedFrame
+	{
+		uint32_t FourCC = FOURCC_NONE;
+		nos::fb::vec2u Resolution;
+		FrameRegion Area;
+		uint32_t Factor = 1;
+		bool Repack = false;
+		uint64_t Hash = 0;
+		// Upload buffer of the reader holding the frame, kept out of the ring and handed on again for repeats
+		uint32_t Slot = 0;
+	};
+
+	// Mapped once when created and handed on the Output pin in place of BufferToWrite.
+	// Not written again before the read fences submitted after it was handed on signal.
+	struct StagingSlot
+	{
+		nosResourceShareInfo Buffer{};
+		uint8_t* Mapped = nullptr;
+		// Handed on since the last read fence was submitted
+		bool HandedOn = false;
+		// One per time it was handed on, a repeated frame hands the same slot on again
+		std::vector<nosGPUEvent> Reads;
+	};
+
+	// Frame the device captured into an upload buffer, its buffer goes back to the device once Read signals
+	struct HeldSample
+	{
+		StreamSample Sample;
+		std::optional<nosGPUEvent> Read;
+	};
+
+	WebcamReaderNode(const nosFbNode* node) : NodeContext(node)
+	{
+		AddPinValueWatcher(NSN_ConvertToNV12, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				ConvertToNV12 = *InterpretPinValue<bool>(newVal);
+				// Frames captured into upload buffers skip the CPU, decide again on the next frame
+				ImportTriedStream.reset();
+			});
+		AddPinValueWatcher(NSN_SkipUnchanged, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				SkipUnchanged = *InterpretPinValue<bool>(newVal);
+				LastUpload.reset();
+				ClearOwnedBufferError();
+			});
+		AddPinValueWatcher(NSN_PipelinedUpload, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				PipelinedUpload = *InterpretPinValue<bool>(newVal);
+				ClearOwnedBufferError();
+			});
+	}
+
+	~WebcamReaderNode() override
+	{
+		ReleaseImportedBuffers();
+		ReleaseStaging();
+	}
+
 	// Execution
 	virtual nosResult ExecuteNode(nosNodeExecuteParams* params)
 	{
@@ -22,33 +102,543 @@ struct WebcamReaderNode : public NodeContext
 		auto* streamInfo = execParams.GetPinData<webcam::WebcamStreamInfo>(NSN_StreamInfo);
 		if (!streamInfo || !streamInfo->id())
 			return NOS_RESULT_FAILED;
-		
+
 		auto stream = WebcamStreamManager::GetInstance().GetStream(*streamInfo->id());
 		if(!stream)
 			return NOS_RESULT_FAILED;
+		const bool repack = ConvertToNV12 && stream->Format.FourCC == FOURCC_YUY2;
+		nos::fb::vec2u const& resolution = stream->Format.Resolution;
+		// Repacked frames are NV12, whose chroma is subsampled vertically too
+		const uint32_t outFourCC = repack ? FOURCC_NV12 : stream->Format.FourCC;
+		auto region = GetRegion(execParams, outFourCC, resolution);
+		if (!region)
+		{
+			nosEngine.LogE("WebcamReader: %s", region.error().c_str());
+			return NOS_RESULT_FAILED;
+		}
+		const bool cropped = region->has_value();
+		const FrameRegion area = cropped ? **region : FrameRegion{ .Width = resolution.x(), .Height = resolution.y() };
+		const uint32_t factor = GetDownscaleFactor(execParams, stream->Format.FourCC);
+		nos::fb::vec2u outResolution(area.Width, area.Height);
+		if (factor > 1)
+		{
+			outResolution = GetDownscaledResolution(outFourCC, outResolution, factor);
+			if (!outResolution.x() || !outResolution.y())
+			{
+				nosEngine.LogE("WebcamReader: %ux%u frame is too small to downscale by %u", area.Width, area.Height, factor);
+				return NOS_RESULT_FAILED;
+			}
+		}
+		const bool reduced = cropped || factor > 1;
+		// Compared by stream rather than id, a format switch replaces the stream under the same id.
+		// Frames captured into upload buffers are whole, turning the region or downscaling on or off decides again.
+		// Repacked frames are written by the CPU, so YUY2 streams with Convert To NV12 on give up importing too.
+		if (ImportTriedStream.lock() != stream || reduced != ImportTriedReduced)
+		{
+			ImportTriedStream = stream;
+			ImportTriedReduced = reduced;
+			if (repack || reduced)
+				ReleaseImportedBuffers();
+			else
+				TryImportBuffers(stream);
+		}
+		// What the last execution handed on is fenced before anything is reused
+		nos::util::Stopwatch fenceWatch;
+		auto fenced = FenceOutputs();
+		if (!fenced)
+		{
+			nosEngine.LogE("WebcamReader: %s", fenced.error().c_str());
+			return NOS_RESULT_FAILED;
+		}
+		if (*fenced)
+			stream->Stats.UploadSubmit.Record(fenceWatch.Elapsed());
+		if (auto res = ReleaseReadSamples(); !res)
+		{
+			nosEngine.LogE("WebcamReader: %s", res.error().c_str());
+			return NOS_RESULT_FAILED;
+		}
 		auto sample = stream->ReadSample();
-		// First sample is not valid, try again
 		if (sample.Size == 0)
+			return NOS_RESULT_FAILED;
+		nos::util::Stopwatch executeWatch;
+		SetOutputFormat(execParams, repack ? WebcamTextureFormat::NV12 : GetFormatEnumFromFourCC(stream->Format.FourCC));
+		SetOutputResolution(execParams, outResolution);
+		const uint32_t fullSize = GetFrameBufferSize(outFourCC, resolution);
+		stream->Stats.FullFrameBytes += fullSize ? fullSize : sample.Size;
+
+		if (sample.Frame.UserBuffer && sample.Frame.BufferIndex < ImportedBuffers.size())
 		{
-			sample = stream->ReadSample();
-			if (sample.Size == 0)
-				return NOS_RESULT_FAILED;
+			stream->Stats.UploadedBytes += sample.Size;
+			// Device wrote the frame straight into one of our upload buffers, pass it on without touching the CPU
+			nosResourceShareInfo output = ImportedBuffers[sample.Frame.BufferIndex];
+			SetFrameInfo(execParams, *stream, sample.Info, false);
+			// Read by the UploadBuffer after this node, fenced when the reader runs again
+			HeldSamples.push_back({ .Sample = std::move(sample) });
+			// Frames in upload buffers are never read by the CPU, so they are not checked for changes
+			LastUpload.reset();
+			return EmitOutput(execParams, *stream, output, executeWatch);
 		}
+
 		nosResourceShareInfo bufToWrite = vkss::ConvertToResourceInfo(*execParams.GetPinData<nos::sys::vulkan::Buffer>(NSN_BufferToWrite));
-		if (bufToWrite.Info.Buffer.Size != sample.Size)
+		const uint32_t packedSize = GetFrameBufferSize(stream->Format.FourCC, resolution);
+		const uint32_t outSize = GetFrameBufferSize(outFourCC, outResolution);
+		if (repack)
+		{
+			// A buffer sized for YUY2 also fits the repacked frame
+			if (bufToWrite.Info.Buffer.Size < outSize || sample.Size < GetFrameBufferSize(FOURCC_YUY2, resolution))
+			{
+				nosEngine.LogE("Buffer size mismatch!");
+				return NOS_RESULT_FAILED;
+			}
+		}
+		else if (reduced)
+		{
+			// Buffers sized for the whole frame are fine, the smaller frame is packed at the start
+			if (bufToWrite.Info.Buffer.Size < outSize)
+			{
+				nosEngine.LogE("Buffer size mismatch!");
+				return NOS_RESULT_FAILED;
+			}
+		}
+		else if (bufToWrite.Info.Buffer.Size != (packedSize ? packedSize : sample.Size))
 			nosEngine.LogE("Buffer size mismatch!");
-		
-		uint8_t* mapped = nosVulkan->Map(&bufToWrite);
-		if (mapped == nullptr) 
+
+		FrameLayout layout{ .FourCC = stream->Format.FourCC, .Resolution = resolution, .Pitch = sample.Frame.Pitch };
+		UploadedFrame upload{ .FourCC = layout.FourCC, .Resolution = resolution, .Area = area, .Factor = factor, .Repack = repack };
+		// Conversions read the frame in their own order, it is hashed on its own and an unchanged frame skips the conversion too
+		if (SkipUnchanged && (factor > 1 || repack))
 		{
-			nosEngine.LogE("Failed to map buffer!");
-			return NOS_RESULT_FAILED;
+			nos::util::Stopwatch hashWatch;
+			upload.Hash = WebcamStreamManager::GetFrameCopy().Hash(sample.Data, sample.Size, layout, *region);
+			stream->Stats.Hash.Record(hashWatch.Elapsed());
+			if (IsRepeat(upload))
+				return EmitRepeat(execParams, *stream, sample.Info, executeWatch);
+		}
+
+		// Pipelined frames are written into an upload buffer of the reader that is handed on in place of BufferToWrite,
+		// so the CPU fills the next one while the GPU reads this one. Otherwise BufferToWrite is mapped and written.
+		// Skip Unchanged needs them too, BufferToWrite belongs to its provider and may be rewritten before a repeat.
+		StagingSlot* slot = nullptr;
+		uint8_t* mapped = nullptr;
+		if ((PipelinedUpload || SkipUnchanged) && !OwnedBufferError)
+		{
+			// The slot holding the last upload is skipped until a changed frame takes its place
+			if (LastUpload && LastUpload->Slot == NextStagingSlot)
+				NextStagingSlot = (NextStagingSlot + 1) % STAGING_SLOT_COUNT;
+			const uint32_t nextIndex = NextStagingSlot;
+			StagingSlot& next = Staging[nextIndex];
+			nos::util::Stopwatch waitWatch;
+			if (auto res = WaitForSlotRead(next); !res)
+			{
+				nosEngine.LogE("WebcamReader: %s", res.error().c_str());
+				return NOS_RESULT_FAILED;
+			}
+			stream->Stats.UploadWait.Record(waitWatch.Elapsed());
+			if (auto res = PrepareStagingSlot(next, repack || reduced ? outSize : bufToWrite.Info.Buffer.Size); res)
+			{
+				slot = &next;
+				mapped = slot->Mapped;
+				upload.Slot = nextIndex;
+				NextStagingSlot = (nextIndex + 1) % STAGING_SLOT_COUNT;
+			}
+			else
+			{
+				// Frames go through BufferToWrite until a pin that needs the reader's buffers is toggled
+				OwnedBufferError = res.error();
+				const std::string message = "Uploading through BufferToWrite, pipelined uploads and skipping unchanged frames are off: " + res.error();
+				nosEngine.LogW("WebcamReader: %s", message.c_str());
+				SetNodeStatusMessage(message, nos::fb::NodeStatusMessageType::WARNING);
+			}
+		}
+		if (!slot)
+		{
+			// Turned off, the reader's upload buffers are not needed anymore. This forgets the last upload too.
+			ReleaseStaging();
+			nos::util::Stopwatch mapWatch;
+			mapped = nosVulkan->Map(&bufToWrite);
+			stream->Stats.Map.Record(mapWatch.Elapsed());
+			if (mapped == nullptr)
+			{
+				nosEngine.LogE("Failed to map buffer!");
+				return NOS_RESULT_FAILED;
+			}
+		}
+
+		nos::util::Stopwatch copyWatch;
+		size_t uploaded = outSize;
+		if (factor > 1)
+		{
+			if (auto res = DownscaleSample(sample, stream->Format.FourCC, resolution, area, factor, repack, outResolution, mapped); !res)
+			{
+				nosEngine.LogE("WebcamReader: %s", res.error().c_str());
+				return NOS_RESULT_FAILED;
+			}
+		}
+		else if (repack)
+		{
+			// Repacking while copying, NV12 is a quarter smaller to upload than YUY2
+			const int64_t pitch = sample.Frame.Pitch ? sample.Frame.Pitch : int64_t(resolution.x()) * 2;
+			uint8_t const* src = cropped ? sample.Data + int64_t((*region)->Y) * pitch + int64_t((*region)->X) * 2 : sample.Data;
+			if (auto res = WebcamStreamManager::GetFrameCopy().Repack(mapped, src, outResolution.x(), outResolution.y(), int32_t(pitch)); !res)
+			{
+				nosEngine.LogE("WebcamReader: %s", res.error().c_str());
+				return NOS_RESULT_FAILED;
+			}
 		}
-		
-		memcpy(mapped, sample.Data, std::min(uint32_t(sample.Size), bufToWrite.Info.Buffer.Size));
-		nosEngine.SetPinValue(execParams[NSN_Output].Id, nos::Buffer::From(vkss::ConvertBufferInfo(bufToWrite)));
+		else
+			uploaded = WebcamStreamManager::GetFrameCopy().Copy(mapped, slot ? slot->Buffer.Info.Buffer.Size : cropped ? outSize : bufToWrite.Info.Buffer.Size, sample.Data,
+				sample.Size, layout, *region, SkipUnchanged ? &upload.Hash : nullptr);
+		(factor > 1 ? stream->Stats.Downscale : cropped ? stream->Stats.RegionCopy : stream->Stats.Copy).Record(copyWatch.Elapsed());
+		// A plain copy is hashed while copying, the copied frame is dropped when the previous upload already holds it
+		if (SkipUnchanged && IsRepeat(upload))
+			return EmitRepeat(execParams, *stream, sample.Info, executeWatch);
+		nosResourceShareInfo output = bufToWrite;
+		if (slot)
+		{
+			slot->HandedOn = true;
+			output = slot->Buffer;
+		}
+		stream->Stats.UploadedBytes += uploaded;
+		SetFrameInfo(execParams, *stream, sample.Info, false);
+		if (SkipUnchanged && slot)
+			LastUpload = upload;
+		return EmitOutput(execParams, *stream, output, executeWatch);
+	}
+
+	nosResult EmitOutput(nos::NodeExecuteParams& execParams, WebcamStream& stream, nosResourceShareInfo const& output, nos::util::Stopwatch const& executeWatch)
+	{
+		stream.Stats.Execute.Record(executeWatch.Elapsed());
+		nosEngine.SetPinValue(execParams[NSN_Output].Id, nos::Buffer::From(vkss::ConvertBufferInfo(output)));
 		return NOS_RESULT_SUCCESS;
 	}
+
+	bool IsRepeat(UploadedFrame const& upload) const
+	{
+		return LastUpload && LastUpload->Hash == upload.Hash && LastUpload->FourCC == upload.FourCC && LastUpload->Resolution == upload.Resolution &&
+			LastUpload->Area == upload.Area && LastUpload->Factor == upload.Factor && LastUpload->Repack == upload.Repack;
+	}
+
+	// Passes on the buffer the same content was uploaded in, flagged so consumers can skip their own work too
+	nosResult EmitRepeat(nos::NodeExecuteParams& execParams, WebcamStream& stream, SampleInfo const& info, nos::util::Stopwatch const& executeWatch)
+	{
+		stream.Stats.RepeatedFrames++;
+		SetFrameInfo(execParams, stream, info, true);
+		StagingSlot& held = Staging[LastUpload->Slot];
+		held.HandedOn = true;
+		return EmitOutput(execParams, stream, held.Buffer, executeWatch);
+	}
+
+	void ClearOwnedBufferError()
+	{
+		// Toggling a pin that needs the reader's buffers tries again after a failure
+		if (OwnedBufferError)
+			ClearNodeStatusMessages();
+		OwnedBufferError.reset();
+	}
+
+	void SetFrameInfo(nos::NodeExecuteParams& execParams, WebcamStream const& stream, SampleInfo const& info, bool repeat)
+	{
+		TWebcamFrameInfo frameInfo{};
+		frameInfo.sequence = info.Sequence;
+		frameInfo.device_timestamp_ns = info.DeviceTimestamp;
+		frameInfo.host_timestamp_ns = info.HostTimestamp;
+		frameInfo.dropped_frames = info.DroppedFrames;
+		frameInfo.total_dropped_frames = stream.Stats.DroppedFrames;
+		const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		frameInfo.age_ns = now > info.HostTimestamp ? now - info.HostTimestamp : 0;
+		frameInfo.repeat = repeat;
+		nosEngine.SetPinValue(execParams[NSN_FrameInfo].Id, nos::Buffer::From(frameInfo));
+	}
+
+	void SetOutputFormat(nos::NodeExecuteParams& execParams, WebcamTextureFormat format)
+	{
+		if (format == LastOutputFormat)
+			return;
+		LastOutputFormat = format;
+		nosEngine.SetPinValue(execParams[NSN_OutputFormat].Id, nos::Buffer::From(format));
+	}
+
+	void SetOutputResolution(nos::NodeExecuteParams& execParams, nos::fb::vec2u const& resolution)
+	{
+		if (LastOutputResolution && *LastOutputResolution == resolution)
+			return;
+		LastOutputResolution = resolution;
+		nosEngine.SetPinValue(execParams[NSN_OutputResolution].Id, nos::Buffer::From(resolution));
+	}
+
+	// Read every frame so the region can follow a tracked target. Empty when no region is set or it covers the whole frame.
+	static std::expected<std::optional<FrameRegion>, std::string> GetRegion(nos::NodeExecuteParams& execParams, uint32_t fourCC, nos::fb::vec2u const& resolution)
+	{
+		auto* offset = execParams.GetPinData<nos::fb::vec2u>(NSN_ROIOffset);
+		auto* size = execParams.GetPinData<nos::fb::vec2u>(NSN_ROISize);
+		// Compressed frames are uploaded whole
+		if (!offset || !size || !size->x() || !size->y() || !GetFrameRowSize(fourCC, 1))
+			return std::nullopt;
+		FrameRegion region = AlignFrameRegion(fourCC, resolution, FrameRegion{ .X = offset->x(), .Y = offset->y(), .Width = size->x(), .Height = size->y() });
+		if (!region.Width)
+			return std::unexpected("ROI is outside the " + GetResolutionString(resolution) + " frame");
+		if (region.Width == resolution.x() && region.Height == resolution.y())
+			return std::nullopt;
+		return region;
+	}
+
+	// Read every frame like the region. Only NV12 and YUY2 frames are downscaled, others are uploaded at full size.
+	static uint32_t GetDownscaleFactor(nos::NodeExecuteParams& execParams, uint32_t fourCC)
+	{
+		auto* downscale = execParams.GetPinData<WebcamDownscale>(NSN_Downscale);
+		if (!downscale || (fourCC != FOURCC_NV12 && fourCC != FOURCC_YUY2))
+			return 1;
+		switch (*downscale)
+		{
+		case WebcamDownscale::HALF: return 2;
+		case WebcamDownscale::QUARTER: return 4;
+		default: return 1;
+		}
+	}
+
+	// Box filters the area of the frame into the upload buffer, repacking afterwards shuffles a frame already a fraction the size
+	std::expected<void, std::string> DownscaleSample(StreamSample const& sample, uint32_t fourCC, nos::fb::vec2u const& resolution, FrameRegion const& area,
+		uint32_t factor, bool repack, nos::fb::vec2u const& outResolution, uint8_t* mapped)
+	{
+		const uint32_t rowSize = GetFrameRowSize(fourCC, resolution.x());
+		const int64_t pitch = sample.Frame.Pitch ? sample.Frame.Pitch : int64_t(rowSize);
+		const uint32_t rows = fourCC == FOURCC_NV12 ? resolution.y() + resolution.y() / 2 : resolution.y();
+		// Bottom-up frames start below Data, only the backend knows their extent
+		if (pitch > 0 && (pitch < int64_t(rowSize) || uint64_t(pitch) * (rows - 1) + rowSize > sample.Size))
+			return std::unexpected("Frame is smaller than its " + GetResolutionString(resolution) + " format");
+		if (fourCC == FOURCC_NV12)
+		{
+			uint8_t const* luma = sample.Data + int64_t(area.Y) * pitch + area.X;
+			uint8_t const* chroma = sample.Data + pitch * resolution.y() + int64_t(area.Y / 2) * pitch + area.X;
+			return DownscaleNV12(luma, chroma, area.Width, area.Height, int32_t(pitch), factor, mapped);
+		}
+		uint8_t const* src = sample.Data + int64_t(area.Y) * pitch + int64_t(area.X) * 2;
+		if (!repack)
+			return DownscaleYUY2(src, area.Width, area.Height, int32_t(pitch), factor, mapped);
+		// Only the rows that make up whole NV12 chroma rows
+		Downscaled.resize(GetFrameBufferSize(FOURCC_YUY2, outResolution));
+		if (auto res = DownscaleYUY2(src, area.Width, outResolution.y() * factor, int32_t(pitch), factor, Downscaled.data()); !res)
+			return res;
+		return ConvertYUY2ToNV12(Downscaled.data(), outResolution.x(), outResolution.y(), mapped);
+	}
+
+	// The wait is normally over by the time the ring comes around, it only blocks when the GPU falls behind
+	std::expected<void, std::string> WaitForSlotRead(StagingSlot& slot)
+	{
+		if (slot.HandedOn)
+			return std::unexpected("Upload buffer was handed on without a read fence");
+		// Fences still pending are kept when a wait fails, the slot must not be written while the GPU may still read it
+		while (!slot.Reads.empty())
+		{
+			if (nosVulkan->WaitGpuEvent(&slot.Reads.front(), GPU_WAIT_TIMEOUT_NS) != NOS_RESULT_SUCCESS)
+				return std::unexpected("Upload buffer is still being read by the GPU");
+			slot.Reads.erase(slot.Reads.begin());
+		}
+		return {};
+	}
+
+	// Consumers see the whole buffer, so it is sized for exactly what this frame uploads
+	static std::expected<void, std::string> PrepareStagingSlot(StagingSlot& slot, uint32_t size)
+	{
+		if (slot.Mapped && slot.Buffer.Info.Buffer.Size == size)
+			return {};
+		DestroyStagingSlot(slot);
+		slot.Buffer.Info.Type = NOS_RESOURCE_TYPE_BUFFER;
+		slot.Buffer.Info.Buffer.Size = size;
+		slot.Buffer.Info.Buffer.Usage = nosBufferUsage(NOS_BUFFER_USAGE_TRANSFER_SRC);
+		slot.Buffer.Info.Buffer.MemoryFlags = nosMemoryFlags(NOS_MEMORY_FLAGS_HOST_VISIBLE);
+		if (nosVulkan->CreateResource(&slot.Buffer) != NOS_RESULT_SUCCESS)
+		{
+			slot.Buffer = {};
+			return std::unexpected("Failed to create a " + std::to_string(size) + " byte upload buffer");
+		}
+		slot.Mapped = nosVulkan->Map(&slot.Buffer);
+		if (!slot.Mapped)
+		{
+			DestroyStagingSlot(slot);
+			return std::unexpected("Failed to map an upload buffer");
+		}
+		return {};
+	}
+
+	static void DestroyStagingSlot(StagingSlot& slot)
+	{
+		if (slot.Buffer.Info.Buffer.Size)
+			nosVulkan->DestroyResource(&slot.Buffer);
+		slot.Buffer = {};
+		slot.Mapped = nullptr;
+	}
+
+	void ReleaseStaging()
+	{
+		if (std::none_of(Staging.begin(), Staging.end(), [](StagingSlot const& slot) { return slot.Mapped; }))
+			return;
+		if (!FenceOutputs())
+			nosEngine.LogE("WebcamReader: Failed to fence the last output");
+		for (auto& slot : Staging)
+		{
+			if (auto res = WaitForSlotRead(slot); !res)
+			{
+				nosEngine.LogE("WebcamReader: %s, leaking it", res.error().c_str());
+				continue;
+			}
+			DestroyStagingSlot(slot);
+		}
+		Staging = std::vector<StagingSlot>(STAGING_SLOT_COUNT);
+		NextStagingSlot = 0;
+		// A repeat would hand on a destroyed buffer
+		LastUpload.reset();
+	}
+
+	// Submitted behind the GPU work recorded so far. The UploadBuffer that reads an output of this node submits its copy
+	// before the path runs the node again, so a fence submitted then signals once that output has been read.
+	static std::expected<nosGPUEvent, std::string> SubmitReadFence()
+	{
+		nosCmd cmd{};
+		if (nosVulkan->Begin("WebcamReader Read Fence", &cmd) != NOS_RESULT_SUCCESS)
+			return std::unexpected("Failed to begin the read fence command buffer");
+		nosGPUEvent event{};
+		nosCmdEndParams end{};
+		end.ForceSubmit = NOS_TRUE;
+		end.OutGPUEventHandle = &event;
+		if (nosVulkan->End(cmd, &end) != NOS_RESULT_SUCCESS)
+			return std::unexpected("Failed to submit the read fence");
+		return event;
+	}
+
+	// Gives the buffer handed on last time its fence, it is the only one without. Returns how many fences were submitted.
+	std::expected<uint32_t, std::string> FenceOutputs()
+	{
+		uint32_t fenced = 0;
+		for (auto& held : HeldSamples)
+		{
+			if (held.Read)
+				continue;
+			auto event = SubmitReadFence();
+			if (!event)
+				return std::unexpected(event.error());
+			held.Read = *event;
+			fenced++;
+		}
+		for (auto& slot : Staging)
+		{
+			if (!slot.HandedOn)
+				continue;
+			auto event = SubmitReadFence();
+			if (!event)
+				return std::unexpected(event.error());
+			slot.Reads.push_back(*event);
+			slot.HandedOn = false;
+			fenced++;
+		}
+		return fenced;
+	}
+
+	// Gives the device back the buffers the GPU is done with, call after FenceOutputs.
+	// Only waits when the GPU falls so far behind that the device would run out of buffers to capture into.
+	std::expected<void, std::string> ReleaseReadSamples()
+	{
+		while (!HeldSamples.empty())
+		{
+			const bool full = HeldSamples.size() >= MAX_HELD_SAMPLES;
+			if (nosVulkan->WaitGpuEvent(&*HeldSamples.front().Read, full ? GPU_WAIT_TIMEOUT_NS : 0) != NOS_RESULT_SUCCESS)
+			{
+				if (full)
+					return std::unexpected("Captured frames are still being read by the GPU");
+				break;
+			}
+			HeldSamples.pop_front();
+		}
+		return {};
+	}
+
+	void TryImportBuffers(std::shared_ptr<WebcamStream> const& stream)
+	{
+		ReleaseImportedBuffers();
+		if (!stream->SupportsUserBuffers())
+			return;
+		const uint32_t bufferSize = stream->Session->GetMaxFrameSize();
+		std::vector<UserBuffer> userBuffers;
+		for (uint32_t i = 0; i < IMPORTED_BUFFER_COUNT; i++)
+		{
+			nosResourceShareInfo buffer{};
+			buffer.Info.Type = NOS_RESOURCE_TYPE_BUFFER;
+			buffer.Info.Buffer.Size = bufferSize;
+			buffer.Info.Buffer.Usage = nosBufferUsage(NOS_BUFFER_USAGE_TRANSFER_SRC);
+			buffer.Info.Buffer.MemoryFlags = nosMemoryFlags(NOS_MEMORY_FLAGS_HOST_VISIBLE);
+			if (nosVulkan->CreateResource(&buffer) != NOS_RESULT_SUCCESS)
+				break;
+			ImportedBuffers.push_back(buffer);
+			// Mapped once for the lifetime of the buffer
+			uint8_t* mapped = nosVulkan->Map(&buffer);
+			if (!mapped)
+				break;
+			userBuffers.push_back(UserBuffer{ .Data = mapped, .Size = bufferSize });
+		}
+		if (userBuffers.size() == IMPORTED_BUFFER_COUNT)
+		{
+			if (auto res = stream->ImportUserBuffers(userBuffers))
+			{
+				ImportedStream = stream;
+				return;
+			}
+			else
+				nosEngine.LogW("WebcamReader: Zero-copy capture unavailable, frames will be copied: %s", res.error().c_str());
+		}
+		DestroyImportedBuffers();
+	}
+
+	void ReleaseImportedBuffers()
+	{
+		// Neither the GPU nor the device may use the buffers once they are destroyed
+		const bool read = WaitForHeldSamples();
+		HeldSamples.clear();
+		if (auto stream = ImportedStream.lock())
+			stream->ImportUserBuffers({});
+		ImportedStream.reset();
+		if (!read)
+		{
+			nosEngine.LogE("WebcamReader: Upload buffers are still being read by the GPU, leaking them");
+			ImportedBuffers.clear();
+			return;
+		}
+		DestroyImportedBuffers();
+	}
+
+	bool WaitForHeldSamples()
+	{
+		if (!FenceOutputs())
+			return false;
+		for (auto& held : HeldSamples)
+			if (nosVulkan->WaitGpuEvent(&*held.Read, GPU_WAIT_TIMEOUT_NS) != NOS_RESULT_SUCCESS)
+				return false;
+		return true;
+	}
+
+	void DestroyImportedBuffers()
+	{
+		for (auto& buffer : ImportedBuffers)
+			nosVulkan->DestroyResource(&buffer);
+		ImportedBuffers.clear();
+	}
+
+	bool ConvertToNV12 = false;
+	bool SkipUnchanged = false;
+	bool PipelinedUpload = false;
+	// Why the reader's own upload buffers could not be used, shown as the node's status until a pin needing them is toggled
+	std::optional<std::string> OwnedBufferError;
+	std::vector<StagingSlot> Staging = std::vector<StagingSlot>(STAGING_SLOT_COUNT);
+	uint32_t NextStagingSlot = 0;
+	std::optional<UploadedFrame> LastUpload;
+	std::optional<WebcamTextureFormat> LastOutputFormat;
+	std::optional<nos::fb::vec2u> LastOutputResolution;
+	std::weak_ptr<WebcamStream> ImportTriedStream;
+	bool ImportTriedReduced = false;
+	std::weak_ptr<WebcamStream> ImportedStream;
+	std::vector<nosResourceShareInfo> ImportedBuffers;
+	std::deque<HeldSample> HeldSamples;
+	// Downscaled YUY2 frame waiting to be repacked
+	std::vector<uint8_t> Downscaled;
 };
 nosResult RegisterWebcamReader(nosNodeFunctions* outFunc)
 {
@@ -1,24 +1,21 @@
 // Copyright MediaZ Teknoloji A.S. All Rights Reserved.
 
 #include "WebcamStream.h"
-
-#define COBJMACROS 1
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <mfapi.h>
-#include <mfidl.h>
-#include <mfreadwrite.h>
-#include <mferror.h>
-#include <mfcaptureengine.h>
-#include <locale>
-#include <codecvt>
+#include "nosUtil/Stopwatch.hpp"
 
 namespace nos::webcam
 {
-WebcamStream::WebcamStream(WebcamDevice const& device, ComPtr<IMFSourceReader> reader, uint32_t streamIndex) : Device(device), Reader(reader), StreamIndex(streamIndex)
+WebcamStream::WebcamStream(std::shared_ptr<DeviceCapture> capture, StreamOptions const& options, std::optional<nosUUID> streamId)
+	: Device(capture->Device), Format(capture->OutputFormat), Options(options), Capture(std::move(capture))
 {
-	StreamId = nosEngine.GenerateID();
-	Reader->GetCurrentMediaType(streamIndex, &MediaType);
+	StreamId = streamId ? *streamId : nosEngine.GenerateID();
+	Session = Capture->Session;
+	nos::fb::vec2u frameRate = GetFrameRateVec2(Format.FrameRate);
+	MaxReadWait = std::chrono::nanoseconds(2'000'000'000ull * frameRate.y() / std::max(frameRate.x(), 1u));
+	// Counts as read when opened, the device is not paused before the first reader had a chance
+	LastReadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	IdleTimeoutNs = std::chrono::nanoseconds(options.IdleTimeout).count();
+	Capture->Subscribe(this);
 }
 
 WebcamStream::~WebcamStream()
@@ -26,143 +23,196 @@ WebcamStream::~WebcamStream()
 	CloseStream();
 }
 
-StreamSample WebcamStream::ReadSample()
+void WebcamStream::OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops)
 {
-	if (!Reader)
-		return StreamSample(nullptr);
-	HRESULT hr;
-	DWORD streamIndex;
-	DWORD flags;
-	LONGLONG llTimeStamp;
-	ComPtr<IMFSample> pSample = NULL;
-	hr = Reader->ReadSample(
-		StreamIndex,
-		0,
-		&streamIndex,
-		&flags,
-		&llTimeStamp,
-		&pSample
-	);
-	if (FAILED(hr))
-		return StreamSample(nullptr);
-	if (flags & MF_SOURCE_READERF_ENDOFSTREAM)
-		return StreamSample(nullptr);
-	if (flags & MF_SOURCE_READERF_STREAMTICK)
-		return StreamSample(nullptr);
-	return StreamSample(pSample);
+	Stats.CapturedFrames++;
+	Stats.DroppedFrames += deviceDrops;
+	StreamSample sample{ .Lease = lease, .Frame = lease->Frame, .Info = lease->Info, .Data = lease->Frame.Data, .Size = lease->Frame.Size };
+	if (Options.Mode == WebcamCaptureMode::LATEST_FRAME)
+	{
+		// Unread older sample is replaced, the device gets its buffer back once no other stream holds it
+		if (LatestSample.Put(std::move(sample)))
+			Stats.DroppedFrames++;
+		else
+			SamplesReady.release();
+		return;
+	}
+	// Reader is behind the camera, drop the newest frame instead of blocking the device and other streams
+	if (Samples.TryPush(std::move(sample)))
+		SamplesReady.release();
+	else
+		Stats.DroppedFrames++;
 }
 
-void WebcamStream::CloseStream()
+void WebcamStream::Flush()
 {
-	if (Reader)
-		Reader->Flush(StreamIndex);
-	Reader.Reset();
+	// The reader never sees these so they count as dropped
+	while (SamplesReady.try_acquire())
+		if (TakeSample())
+			Stats.DroppedFrames++;
 }
 
-TWebcamStreamInfo WebcamStream::GetStreamInfo() const
+std::optional<StreamSample> WebcamStream::TakeSample()
 {
-	TWebcamStreamInfo streamInfo{};
-	streamInfo.id = std::make_unique<fb::UUID>(StreamId);
-	streamInfo.device_name = Device.Name;
-	FormatInfo formatInfo = FormatInfo::FromMediaType(MediaType.Get(), StreamIndex);
-	streamInfo.format = GetFormatEnumFromSubType(formatInfo.SubType);
-	streamInfo.resolution = std::make_unique<fb::vec2u>(formatInfo.Resolution);
-	streamInfo.frame_rate = std::make_unique<fb::vec2u>(GetFrameRateVec2(formatInfo.FrameRate));
-	streamInfo.stream_index = StreamIndex;
-	return streamInfo;
+	if (Options.Mode == WebcamCaptureMode::LATEST_FRAME)
+		return LatestSample.Take();
+	std::unique_lock lock(TakeMutex);
+	return Samples.TryPop();
 }
 
-FormatInfo FormatInfo::FromMediaType(IMFMediaType* mediaType, uint32_t streamIndex)
+bool WebcamStream::IsIdle(std::chrono::steady_clock::time_point now) const
 {
-	FormatInfo info{};
-	info.StreamIndex = streamIndex;
-	mediaType->GetGUID(MF_MT_MAJOR_TYPE, &info.MajorType);
-	mediaType->GetGUID(MF_MT_SUBTYPE, &info.SubType);
-	UINT64 frameSize = 0;
-	mediaType->GetUINT64(MF_MT_FRAME_SIZE, &frameSize);
-	UINT64 frameRate = 0;
-	mediaType->GetUINT64(MF_MT_FRAME_RATE, &frameRate);
-
-	info.Resolution = nos::fb::vec2u(frameSize >> 32, frameSize & 0xFFFFFFFF);
-	auto frameRateVec2 = nos::fb::vec2u(frameRate >> 32, frameRate & 0xFFFFFFFF);
-	for(uint32_t i = std::to_underlying(WebcamFrameRate::WEBCAM_FRAMERATE_1); i < std::to_underlying(WebcamFrameRate::COUNT); i++)
-		if (frameRateVec2 == GetFrameRateVec2(WebcamFrameRate(i)))
-		{
-			info.FrameRate = WebcamFrameRate(i);
-			break;
-		}
+	const int64_t timeout = IdleTimeoutNs;
+	return timeout > 0 && std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() - LastReadTime > timeout;
+}
 
-	return info;
+void WebcamStream::SetIdleTimeout(std::chrono::milliseconds timeout)
+{
+	Options.IdleTimeout = timeout;
+	IdleTimeoutNs = std::chrono::nanoseconds(timeout).count();
 }
 
-StreamSample::StreamSample(ComPtr<IMFSample> sample) : Sample(sample)
+StreamSample WebcamStream::ReadSample()
 {
-	if (sample != 0)
+	LastReadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	Capture->Wake();
+	nos::util::Stopwatch sw;
+	bool ready = SamplesReady.try_acquire_for(MaxReadWait);
+	Stats.ReadSample.Record(sw.Elapsed());
+	auto sample = ready ? TakeSample() : std::nullopt;
+	if (!sample)
+	{
+		Stats.StaleReads++;
+		return StreamSample();
+	}
+	if (LastReadSequence && sample->Info.Sequence > *LastReadSequence)
+		sample->Info.DroppedFrames = uint32_t(std::min<uint64_t>(sample->Info.Sequence - *LastReadSequence - 1, UINT32_MAX));
+	LastReadSequence = sample->Info.Sequence;
+	LastSampleTime = sample->Info.HostTimestamp;
+	if (GapStart)
 	{
-		sample->GetBufferByIndex(0, &Buffer);
-		Buffer->Lock((BYTE**)&Data, NULL, NULL);
-		Buffer->GetCurrentLength(&Size);
+		if (*GapStart && sample->Info.HostTimestamp > *GapStart)
+		{
+			nos::fb::vec2u frameRate = GetFrameRateVec2(Format.FrameRate);
+			const double gapMs = double(sample->Info.HostTimestamp - *GapStart) / 1e6;
+			const double frames = gapMs * frameRate.x() / (1000.0 * std::max(frameRate.y(), 1u));
+			nosEngine.LogI("%s: Switched to %s %s @ %s, %.1f frames without a new frame (%.1f ms)", Device.Name.c_str(), GetFormatNameFromFourCC(Format.FourCC).c_str(),
+				GetResolutionString(Format.Resolution).c_str(), GetFrameRateString(Format.FrameRate), std::max(frames - 1.0, 0.0), gapMs);
+		}
+		GapStart = std::nullopt;
 	}
+	Stats.DeliveredFrames++;
+	const auto now = std::chrono::steady_clock::now().time_since_epoch();
+	Stats.CaptureToRead.Record(now - std::chrono::nanoseconds(sample->Info.HostTimestamp));
+	return std::move(*sample);
 }
 
-StreamSample::StreamSample(StreamSample&& other) noexcept = default;
-StreamSample& StreamSample::operator=(StreamSample&& other) noexcept = default;
+std::expected<void, std::string> WebcamStream::ImportUserBuffers(std::vector<UserBuffer> const& buffers)
+{
+	if (Closed)
+		return std::unexpected("Stream is closed");
+	if (!SupportsUserBuffers())
+		return std::unexpected("Capture backend does not support user buffers");
+	return Capture->SetUserBuffers(this, buffers);
+}
 
-StreamSample::~StreamSample()
+bool WebcamStream::SupportsUserBuffers() const
 {
-	if (Buffer != 0)
-	{
-		Buffer->Unlock();
-	}
+	return Session->SupportsUserBuffers() && !Capture->IsDecoding();
 }
 
-std::optional<GUID> GetSubTypeFromFormatName(std::string const& formatName)
+std::expected<void, std::string> WebcamStream::StartRecording(std::string const& path)
 {
-	if (formatName.size() != 4 || formatName == "NONE")
-	{
-		return std::nullopt;
-	}
-	GUID base = MFVideoFormat_Base;
-	base.Data1 = *reinterpret_cast<const DWORD*>(formatName.c_str());
-	return base;
+	std::unique_lock lock(RecorderMutex);
+	if (Closed)
+		return std::unexpected("Stream is closed");
+	// Finished first, the new recording may go to the same file
+	Recorder.reset();
+	auto recorder = CaptureRecorder::Create(path, Capture, GetStreamInfo());
+	if (!recorder)
+		return std::unexpected(recorder.error());
+	Recorder = std::move(*recorder);
+	return {};
 }
 
-template<typename T>
-struct RAIICoTask
+void WebcamStream::StopRecording()
 {
-	T Ptr;
-	RAIICoTask(T ptr = {}) : Ptr(ptr) {}
-	~RAIICoTask()
-	{
-		CoTaskMemFree(*this);
-	}
+	std::unique_lock lock(RecorderMutex);
+	Recorder.reset();
+}
+
+void WebcamStream::CloseStream()
+{
+	if (Closed.exchange(true))
+		return;
+	// Device closes once its last consumer is gone, the recorder is one of them
+	StopRecording();
+	Capture->Unsubscribe(this);
+	Flush();
+}
 
-	T& operator*() { return Ptr; }
-	T operator->() { return Ptr; }
-	operator T() { return Ptr; }
-	T* operator&() { return &Ptr; }
+TWebcamStreamInfo WebcamStream::GetStreamInfo() const
+{
+	TWebcamStreamInfo streamInfo{};
+	streamInfo.id = std::make_unique<fb::UUID>(StreamId);
+	streamInfo.device_name = Device.Name;
+	streamInfo.format = GetFormatEnumFromFourCC(Format.FourCC);
+	streamInfo.resolution = std::make_unique<fb::vec2u>(Format.Resolution);
+	streamInfo.frame_rate = std::make_unique<fb::vec2u>(GetFrameRateVec2(Format.FrameRate));
+	streamInfo.stream_index = Format.StreamIndex;
+	streamInfo.capture_mode = Options.Mode;
+	return streamInfo;
+}
 
-};
 void WebcamStreamManager::Start()
 {
-	HRESULT hr = CoInitialize(NULL);
-	hr = MFStartup(MF_VERSION, MFSTARTUP_NOSOCKET);
+	std::vector<std::unique_ptr<CaptureBackend>> backends;
+#if defined(_WIN32)
+	backends.push_back(CreateMFCaptureBackend());
+#endif
+#if defined(__linux__)
+	backends.push_back(CreateV4L2CaptureBackend());
+#endif
+	backends.push_back(CreateSyntheticCaptureBackend());
+	backends.push_back(CreateReplayCaptureBackend());
+	Start(std::move(backends));
+}
+
+void WebcamStreamManager::Start(std::vector<std::unique_ptr<CaptureBackend>> backends)
+{
 	Instance = std::make_unique<WebcamStreamManager>();
+	Instance->Tasks = std::make_unique<TaskPool>(TASK_THREAD_COUNT);
+	Instance->Copier = std::make_unique<FrameCopy>(FrameCopy::GetDefaultWorkerCount());
+	Instance->Backends = std::move(backends);
+	for (auto& backend : Instance->Backends)
+	{
+		// Watch before listing so a device plugged in meanwhile is not missed
+		auto* manager = Instance.get();
+		auto* backendPtr = backend.get();
+		if (auto watcher = backend->WatchDevices([manager, backendPtr](std::string const& symLink, DeviceChange change) { manager->OnDeviceChange(backendPtr, symLink, change); }))
+			Instance->Watchers.push_back(std::move(watcher));
+		Instance->RefreshDevices(backendPtr);
+	}
+	Instance->ProbeAllDevices();
 }
 void WebcamStreamManager::Stop()
 {
 	if (Instance)
 	{
+		Instance->Watchers.clear();
+		Instance->Tasks.reset();
 		std::unique_lock lock(Instance->OpenStreamsMutex);
 		for (auto& stream : Instance->OpenStreams)
 		{
 			stream.second->CloseStream();
 		}
 		Instance->OpenStreams.clear();
+		lock.unlock();
+		for (auto& [key, capture] : Instance->Captures)
+			capture->Close();
+		Instance->Captures.clear();
 		Instance.reset();
 	}
-	MFShutdown();
-	CoUninitialize();
 }
 
 std::unique_ptr<WebcamStreamManager> WebcamStreamManager::Instance = nullptr;
@@ -170,209 +220,272 @@ WebcamStreamManager& WebcamStreamManager::GetInstance()
 {
 	return *Instance;
 }
+
 std::vector<WebcamDevice> WebcamStreamManager::EnumerateDevices()
 {
-	using namespace std;
-
-	UINT32 count;
-	RAIICoTask<IMFActivate**> devices = nullptr;
 	std::vector<WebcamDevice> result;
-	ComPtr<IMFAttributes> attr = 0;
-
-	HRESULT hr;
-
-	hr = MFCreateAttributes(&attr, 1);
-	if (FAILED(hr)) return result;
-
-	hr = attr->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
-	if (FAILED(hr)) return result;
-
-	hr = MFEnumDeviceSources(attr.Get(), &devices, &count);
-	if (FAILED(hr)) return result;
-
-
-	for (UINT32 i = 0; i < count; i++)
+	if (!Instance)
+		return result;
+	std::shared_lock lock(Instance->CacheMutex);
+	for (auto& backend : Instance->Backends)
 	{
-		UINT32 length;
-		RAIICoTask<LPWSTR> name;
-		RAIICoTask<LPWSTR> symlink;
-
-		hr = devices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &name, &length);
-
-		if (FAILED(hr)) continue;
-
-		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-		std::string nameNarrow = converter.to_bytes(*name);
-
-		hr = devices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, &symlink, &length);
-		if (FAILED(hr)) continue;
-		
-		uint32_t repeatCount = 0;
-		for (auto& device : result) {
-			if (device.Name.find(nameNarrow) != std::string::npos)
-				repeatCount++;
+		auto it = Instance->BackendDevices.find(backend.get());
+		if (it == Instance->BackendDevices.end())
+			continue;
+		for (auto device : it->second)
+		{
+			uint32_t repeatCount = 0;
+			for (auto& existing : result)
+				if (existing.Name.find(device.Name) != std::string::npos)
+					repeatCount++;
+			if (repeatCount)
+				device.Name += " (" + std::to_string(repeatCount) + ")"; // If there are multiple devices with the same name, append a number to the name
+			result.push_back(std::move(device));
 		}
-		if(repeatCount)
-			nameNarrow += " (" + std::to_string(repeatCount) + ")"; // If there are multiple devices with the same name, append a number to the name
-			
-		result.emplace_back(nameNarrow, std::wstring(symlink));
-
-		devices[i]->Release();
 	}
-
 	return result;
 }
 
-
-HRESULT EnumerateTypesForStream(IMFSourceReader* pReader, DWORD dwStreamIndex, std::vector<FormatInfo>& types)
+std::vector<FormatInfo> WebcamStreamManager::EnumerateFormats(WebcamDevice const& device)
 {
-	HRESULT hr = S_OK;
-	DWORD dwMediaTypeIndex = 0;
-
-	while (SUCCEEDED(hr))
+	if (!device.Backend || !Instance)
+		return {};
+	const std::string key = GetCaptureKey(device);
+	std::promise<std::vector<FormatInfo>> probe;
 	{
-		IMFMediaType* pType = NULL;
-		hr = pReader->GetNativeMediaType(dwStreamIndex, dwMediaTypeIndex, &pType);
-		if (hr == MF_E_NO_MORE_TYPES)
+		std::unique_lock lock(Instance->CacheMutex);
+		if (auto it = Instance->CachedFormats.find(key); it != Instance->CachedFormats.end())
+			return it->second;
+		if (auto it = Instance->PendingProbes.find(key); it != Instance->PendingProbes.end())
 		{
-			hr = S_OK;
-			break;
+			auto pending = it->second;
+			lock.unlock();
+			return pending.get();
 		}
-		else if (SUCCEEDED(hr))
-		{
-			FormatInfo mediaInfo = FormatInfo::FromMediaType(pType, dwStreamIndex);
-			if (mediaInfo.SubType == MFVideoFormat_YUY2 || mediaInfo.SubType == MFVideoFormat_NV12)
-				types.push_back(mediaInfo);
-			pType->Release();
-		}
-		++dwMediaTypeIndex;
+		Instance->PendingProbes[key] = probe.get_future().share();
 	}
-	return hr;
-}
-
-std::vector<FormatInfo> EnumerateMediaTypes(IMFSourceReader* pReader)
-{
-	std::vector<FormatInfo> types;
-	HRESULT hr = S_OK;
-	DWORD dwStreamIndex = 0;
-
-	while (SUCCEEDED(hr))
+	// Probing opens the device, which can take hundreds of milliseconds, other lookups should not wait for it
+	nos::util::Stopwatch sw;
+	std::vector<FormatInfo> formats = device.Backend->EnumerateFormats(device);
+	if (!IsJpegDecodeSupported())
+		std::erase_if(formats, [](FormatInfo const& format) { return format.FourCC == FOURCC_MJPG; });
+	std::sort(formats.begin(), formats.end(), CompareFormats);
+	nosEngine.LogI("%s: Probed %zu formats in %.1f ms", device.Name.c_str(), formats.size(), std::chrono::duration<double, std::milli>(sw.Elapsed()).count());
 	{
-		hr = EnumerateTypesForStream(pReader, dwStreamIndex, types);
-		if (hr == MF_E_INVALIDSTREAMNUMBER)
-		{
-			break;
-		}
-		++dwStreamIndex;
+		std::unique_lock lock(Instance->CacheMutex);
+		Instance->PendingProbes.erase(key);
+		auto& devices = Instance->BackendDevices[device.Backend];
+		// Failed probes are retried on the next lookup
+		if (!formats.empty() && std::ranges::any_of(devices, [&device](WebcamDevice const& known) { return known.SymLink == device.SymLink; }))
+			Instance->CachedFormats[key] = formats;
 	}
-
-	// Order formats based on NV12 > YUY2, then resolution, then frame rate
-	std::sort(types.begin(), types.end(), [](FormatInfo const& a, FormatInfo const& b) {
-		if (a.SubType != b.SubType)
-			return a.SubType == MFVideoFormat_NV12;
-		if (a.Resolution.x() != b.Resolution.x())
-			return a.Resolution.x() > b.Resolution.x();
-		if (a.Resolution.y() != b.Resolution.y())
-			return a.Resolution.y() > b.Resolution.y();
-		if (std::to_underlying(a.FrameRate) != std::to_underlying(b.FrameRate))
-			return std::to_underlying(a.FrameRate) > std::to_underlying(b.FrameRate);
-		return false;
-		});
-
-	return types;
+	probe.set_value(formats);
+	return formats;
 }
 
-std::vector<FormatInfo> WebcamStreamManager::EnumerateFormats(WebcamDevice const& device)
+std::optional<std::vector<FormatInfo>> WebcamStreamManager::GetCachedFormats(WebcamDevice const& device)
 {
-	HRESULT hr;
-	ComPtr<IMFMediaSource> pDevice = NULL;
-	ComPtr<IMFAttributes> pAttrDevice = NULL;
-	ComPtr<IMFAttributes> pAttrReader = NULL;
-	std::vector<FormatInfo> formats;
+	if (!device.Backend || !Instance)
+		return std::nullopt;
+	std::shared_lock lock(Instance->CacheMutex);
+	if (auto it = Instance->CachedFormats.find(GetCaptureKey(device)); it != Instance->CachedFormats.end())
+		return it->second;
+	return std::nullopt;
+}
 
-	hr = MFCreateAttributes(&pAttrDevice, 1);
-	if (FAILED(hr)) return formats;
+FrameCopy& WebcamStreamManager::GetFrameCopy()
+{
+	return *Instance->Copier;
+}
 
-	pAttrDevice->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
-	pAttrDevice->SetString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, device.SymLink.c_str());
+void WebcamStreamManager::RunAsync(std::function<void()> task)
+{
+	if (Instance && Instance->Tasks)
+		Instance->Tasks->Submit(std::move(task));
+}
 
-	hr = MFCreateDeviceSource(pAttrDevice.Get(), &pDevice);
-	if (FAILED(hr)) return formats;
+void WebcamStreamManager::ProbeAllDevices()
+{
+	for (auto& device : EnumerateDevices())
+		if (!GetCachedFormats(device))
+			RunAsync([device] { EnumerateFormats(device); });
+}
 
-	ComPtr<IMFSourceReader> reader = NULL;
+uint64_t WebcamStreamManager::GetDevicesVersion()
+{
+	return Instance ? Instance->DevicesVersion.load() : 0;
+}
 
-	hr = MFCreateSourceReaderFromMediaSource(pDevice.Get(), NULL, &reader);
-	if (FAILED(hr)) return formats;
+void WebcamStreamManager::RefreshDevices(CaptureBackend* backend)
+{
+	auto devices = backend->EnumerateDevices();
+	for (auto& device : devices)
+		device.Backend = backend;
+	std::unique_lock lock(CacheMutex);
+	BackendDevices[backend] = std::move(devices);
+	DevicesVersion++;
+}
 
-	formats = EnumerateMediaTypes(reader.Get());
+void WebcamStreamManager::OnDeviceChange(CaptureBackend* backend, std::string const& symLink, DeviceChange change)
+{
+	nosEngine.LogI("%s: %s %s", backend->GetName(), symLink.c_str(), change == DeviceChange::Arrived ? "arrived" : "removed");
+	// Only this backend's list is refreshed, formats of devices that stayed are kept
+	RefreshDevices(backend);
+	std::unique_lock lock(CacheMutex);
+	auto const& devices = BackendDevices[backend];
+	const std::string prefix = std::string(backend->GetName()) + ":";
+	std::erase_if(CachedFormats, [&](auto const& entry) {
+		if (!entry.first.starts_with(prefix))
+			return false;
+		if (change == DeviceChange::Removed && entry.first == prefix + symLink)
+			return true;
+		return std::ranges::none_of(devices, [&](WebcamDevice const& device) { return GetCaptureKey(device) == entry.first; });
+	});
+	lock.unlock();
+	if (change == DeviceChange::Arrived)
+		ProbeAllDevices();
+}
 
-	return formats;
+std::expected<std::shared_ptr<WebcamStream>, std::string> WebcamStreamManager::OpenStreamFromFormat(WebcamDevice const& device, FormatInfo const& formatInfo, StreamOptions const& options)
+{
+	auto stream = CreateStream(device, formatInfo, options, std::nullopt);
+	if (!stream)
+		return stream;
+	std::unique_lock lock(OpenStreamsMutex);
+	OpenStreams[(*stream)->StreamId] = *stream;
+	return stream;
 }
 
-std::string GetLastErrorAsString(HRESULT err)
+std::expected<std::shared_ptr<WebcamStream>, std::string> WebcamStreamManager::CreateStream(WebcamDevice const& device, FormatInfo const& formatInfo, StreamOptions const& options, std::optional<nosUUID> streamId)
 {
-	if (err == 0) {
-		return std::string();
+	if (!device.Backend)
+		return std::unexpected("No capture backend for device " + device.Name);
+	std::shared_ptr<DeviceCapture> capture;
+	std::unique_lock lock(CapturesMutex);
+	const std::string key = GetCaptureKey(device);
+	if (auto it = Captures.find(key); it != Captures.end())
+		capture = it->second;
+	if (capture)
+	{
+		// A camera delivers one format at a time, every stream on it has to agree
+		if (capture->Format.FourCC != formatInfo.FourCC || capture->Format.Resolution != formatInfo.Resolution || capture->Format.FrameRate != formatInfo.FrameRate)
+			return std::unexpected(device.Name + " is already in use with " + GetFormatNameFromFourCC(capture->Format.FourCC) + " " +
+				GetResolutionString(capture->Format.Resolution) + " @ " + GetFrameRateString(capture->Format.FrameRate));
+		if (options.Capture.BufferCount && options.Capture.BufferCount != capture->Options.BufferCount)
+			nosEngine.LogW("%s is shared, using the device buffer count it was opened with", device.Name.c_str());
+	}
+	else
+	{
+		auto session = device.Backend->Open(device, formatInfo, options.Capture);
+		if (!session)
+			return std::unexpected(session.error());
+		capture = std::make_shared<DeviceCapture>(device, std::move(*session), options.Capture);
+		Captures[key] = capture;
 	}
-	LPSTR messageBuffer = nullptr;
-	size_t size = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-		NULL, err, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&messageBuffer, 0, NULL);
-	std::string message(messageBuffer, size);
-	LocalFree(messageBuffer);
-	return message;
+	// Subscribes under the lock so a stream being deleted can not close the device underneath
+	return std::make_shared<WebcamStream>(std::move(capture), options, streamId);
 }
 
-std::expected<std::shared_ptr<WebcamStream>, std::string> WebcamStreamManager::OpenStreamFromFormat(WebcamDevice const& device, FormatInfo const& formatInfo)
+bool WebcamStreamManager::PublishStream(std::shared_ptr<WebcamStream> const& stream)
 {
-	std::expected<std::shared_ptr<WebcamStream>, std::string> result;
-	HRESULT hr;
-	ComPtr<IMFMediaSource> pDevice = NULL;
-	ComPtr<IMFAttributes> pAttrDevice = NULL;
-	ComPtr<IMFAttributes> pAttrReader = NULL;
-	hr = MFCreateAttributes(&pAttrDevice, 1);
-	if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
-
-	pAttrDevice->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
-	pAttrDevice->SetString(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK, device.SymLink.c_str());
-
-	hr = MFCreateDeviceSource(pAttrDevice.Get(), &pDevice);
-	if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
-
-	ComPtr<IMFSourceReader> reader = NULL;
-
-	hr = MFCreateSourceReaderFromMediaSource(pDevice.Get(), NULL, &reader);
-	if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
-
-	ComPtr<IMFMediaType> pTypeFormat;
-	hr = MFCreateMediaType(&pTypeFormat);
-	if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
-	hr = pTypeFormat->SetGUID(MF_MT_MAJOR_TYPE, formatInfo.MajorType);
-	hr = pTypeFormat->SetGUID(MF_MT_SUBTYPE, formatInfo.SubType);
-	hr = pTypeFormat->SetUINT64(MF_MT_FRAME_SIZE, ((UINT64)formatInfo.Resolution.x() << 32) | formatInfo.Resolution.y());
-	nos::fb::vec2u frameRate = GetFrameRateVec2(formatInfo.FrameRate);
-	hr = pTypeFormat->SetUINT64(MF_MT_FRAME_RATE, ((UINT64)frameRate.x() << 32) | frameRate.y());
-	hr = pTypeFormat->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
-
-	hr = reader->SetCurrentMediaType(formatInfo.StreamIndex, NULL, pTypeFormat.Get());
-	if (FAILED(hr)) return std::unexpected(GetLastErrorAsString(hr));
-
-	ComPtr<IMFMediaType> pGetMediaType;
-	hr = reader->GetCurrentMediaType(formatInfo.StreamIndex, &pGetMediaType);
-	FormatInfo info = FormatInfo::FromMediaType(pGetMediaType.Get(), formatInfo.StreamIndex);
-
-	std::shared_ptr<WebcamStream> stream = std::make_shared<WebcamStream>(device, reader, formatInfo.StreamIndex);
 	std::unique_lock lock(OpenStreamsMutex);
-	OpenStreams[stream->StreamId] = stream;
-	return stream;
+	auto it = OpenStreams.find(stream->StreamId);
+	if (it == OpenStreams.end())
+		return false;
+	it->second = stream;
+	return true;
+}
+
+std::expected<WebcamStreamManager::StreamSwitch, std::string> WebcamStreamManager::ReconfigureStream(nosUUID const& streamId, WebcamDevice const& device, FormatInfo const& formatInfo, StreamOptions const& options)
+{
+	auto old = GetStream(streamId);
+	if (!old)
+		return std::unexpected("Stream is closed");
+	if (!device.Backend)
+		return std::unexpected("No capture backend for device " + device.Name);
+	// A recording is bound to one format, and would count as another stream sharing the device
+	old->StopRecording();
+	FormatInfo const oldFormat = old->Capture->Format;
+	const bool sameDevice = GetCaptureKey(device) == GetCaptureKey(old->Device);
+	const bool sameFormat = oldFormat.FourCC == formatInfo.FourCC && oldFormat.Resolution == formatInfo.Resolution && oldFormat.FrameRate == formatInfo.FrameRate;
+	const bool sameCapture = (!options.Capture.BufferCount || options.Capture.BufferCount == old->Capture->Options.BufferCount) && options.Capture.Unpaced == old->Capture->Options.Unpaced;
+	const bool shared = old->Capture->GetConsumerCount() > 1;
+	// Another device, or only stream options changed: the new stream joins before the old one leaves, frames keep coming
+	const bool reopen = sameDevice && !(sameFormat && (sameCapture || shared));
+	if (reopen && shared)
+		return std::unexpected(device.Name + " is shared with other streams, its format can not change");
+
+	std::expected<std::shared_ptr<WebcamStream>, std::string> stream = std::unexpected("");
+	std::string error;
+	if (reopen)
+	{
+		// A camera delivers one format at a time, it has to be closed before opening it in the new one
+		ReleaseStream(old);
+		stream = CreateStream(device, formatInfo, options, streamId);
+		if (!stream)
+		{
+			error = stream.error();
+			nosEngine.LogW("%s: Switching format failed, reopening the previous format: %s", device.Name.c_str(), error.c_str());
+			stream = CreateStream(old->Device, oldFormat, old->Options, streamId);
+			if (!stream)
+			{
+				DeleteStream(streamId);
+				return std::unexpected(error + ", reopening the previous format failed too: " + stream.error());
+			}
+		}
+	}
+	else
+	{
+		stream = CreateStream(device, formatInfo, options, streamId);
+		if (!stream)
+			return std::unexpected(stream.error());
+	}
+	(*stream)->MeasureGapFrom(old->GetLastSampleTime());
+	if (!PublishStream(*stream))
+	{
+		ReleaseStream(*stream);
+		return std::unexpected("Stream was closed while switching");
+	}
+	if (!reopen)
+		ReleaseStream(old);
+	if (!error.empty())
+		return std::unexpected(error);
+	const bool sizeChanged = GetFrameBufferSize(old->Format.FourCC, old->Format.Resolution) != GetFrameBufferSize((*stream)->Format.FourCC, (*stream)->Format.Resolution);
+	return StreamSwitch{ .Stream = *stream, .FrameSizeChanged = sizeChanged };
 }
 
 void WebcamStreamManager::DeleteStream(nosUUID const& streamId)
 {
-	std::unique_lock lock(OpenStreamsMutex);
-	if (auto it = OpenStreams.find(streamId); it != OpenStreams.end())
+	std::shared_ptr<WebcamStream> stream;
 	{
-		OpenStreams.erase(it);
+		std::unique_lock lock(OpenStreamsMutex);
+		if (auto it = OpenStreams.find(streamId); it != OpenStreams.end())
+		{
+			stream = std::move(it->second);
+			OpenStreams.erase(it);
+		}
 	}
+	if (stream)
+		ReleaseStream(stream);
+}
+
+void WebcamStreamManager::ReleaseStream(std::shared_ptr<WebcamStream> const& stream)
+{
+	// Readers may still hold the stream for a moment, it stops getting frames right away
+	stream->CloseStream();
+	std::unique_lock lock(CapturesMutex);
+	if (stream->Capture->GetConsumerCount() == 0)
+	{
+		stream->Capture->Close();
+		// Only the device this stream was on, another stream may have reopened the key already
+		if (auto it = Captures.find(GetCaptureKey(stream->Device)); it != Captures.end() && it->second == stream->Capture)
+			Captures.erase(it);
+	}
+}
+
+std::string WebcamStreamManager::GetCaptureKey(WebcamDevice const& device)
+{
+	return std::string(device.Backend->GetName()) + ":" + device.SymLink;
 }
 
 std::shared_ptr<WebcamStream> WebcamStreamManager::GetStream(nosUUID const& streamId)
@@ -383,4 +496,11 @@ std::shared_ptr<WebcamStream> WebcamStreamManager::GetStream(nosUUID const& stre
 	return nullptr;
 }
 
-}; // namespace nos::webcam
\ No newline at end of file
+std::shared_ptr<StreamStats const> WebcamStreamManager::GetStreamStats(nosUUID const& streamId)
+{
+	if (auto stream = GetStream(streamId))
+		return std::shared_ptr<StreamStats const>(stream, &stream->Stats);
+	return nullptr;
+}
+
+}; // namespace nos::webcam
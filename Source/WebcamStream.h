@@ -7,125 +7,153 @@
 #include <unordered_map>
 #include <string>
 #include <expected>
-
-#include <guiddef.h>
-#include <wrl.h>
-#include <mfapi.h>
+#include <thread>
+#include <atomic>
+#include <semaphore>
+#include <chrono>
+#include <shared_mutex>
+#include <mutex>
+#include <future>
 
 #include "Nodos/PluginHelpers.hpp"
 #include "Webcam_generated.h"
-
-#include <softcam.h>
-
-struct IMFSourceReader;
-struct IMFMediaType;
-struct IMFSample;
-struct IMFMediaBuffer;
+#include "CaptureBackend.h"
+#include "DeviceCapture.h"
+#include "FrameRing.h"
+#include "StreamStats.h"
+#include "TaskPool.h"
+#include "FrameCopy.h"
+#include "JpegDecoder.h"
+#include "CaptureRecorder.h"
 
 namespace nos::webcam
 {
-template<typename T>
-using ComPtr = Microsoft::WRL::ComPtr<T>;
 extern bool IS_SOFTCAM_DRIVER_FOUND;
+
+// A frame handed to one reader, the device buffer stays out of the device while any reader holds it
 struct StreamSample
 {
-	ComPtr<IMFSample> Sample{};
-	ComPtr<IMFMediaBuffer> Buffer{};
+	std::shared_ptr<FrameLease> Lease{};
+	CapturedFrame Frame{};
+	SampleInfo Info{};
 	uint8_t* Data = nullptr;
-	DWORD Size = 0;
-
-	StreamSample(ComPtr<IMFSample> sample);
-
-	StreamSample(const StreamSample& other) = delete;
-	StreamSample& operator=(const StreamSample& other) = delete;
-
-	StreamSample(StreamSample&& other) noexcept;
-	StreamSample& operator=(StreamSample&& other) noexcept;
-	~StreamSample();
+	uint32_t Size = 0;
 };
 
-struct WebcamDevice
+struct StreamOptions
 {
-	std::string Name;
-	std::wstring SymLink;
-	//scCamera virtualCamera; // If device is created by softcam
+	WebcamCaptureMode Mode = WebcamCaptureMode::QUEUED;
+	CaptureOptions Capture{};
+	// Device stops delivering when no stream of it has read for this long, 0 keeps it running
+	std::chrono::milliseconds IdleTimeout{ 2000 };
 };
 
-enum class WebcamFrameRate : uint32_t
+// One consumer of a device capture, every WebcamStream node gets its own even when they share a camera
+struct WebcamStream : FrameConsumer
 {
-	WEBCAM_FRAMERATE_1 = 0,
-	WEBCAM_FRAMERATE_5,
-	WEBCAM_FRAMERATE_7_5,
-	WEBCAM_FRAMERATE_10,
-	WEBCAM_FRAMERATE_14_98,
-	WEBCAM_FRAMERATE_15,
-	WEBCAM_FRAMERATE_20,
-	WEBCAM_FRAMERATE_23_98,
-	WEBCAM_FRAMERATE_24,
-	WEBCAM_FRAMERATE_25,
-	WEBCAM_FRAMERATE_29_97,
-	WEBCAM_FRAMERATE_30,
-	WEBCAM_FRAMERATE_47_95,
-	WEBCAM_FRAMERATE_48,
-	WEBCAM_FRAMERATE_50,
-	WEBCAM_FRAMERATE_59_94,
-	WEBCAM_FRAMERATE_60,
-	WEBCAM_FRAMERATE_119_88,
-	WEBCAM_FRAMERATE_120,
-	COUNT
-};
+	static constexpr size_t SAMPLE_RING_CAPACITY = 3;
 
-struct FormatInfo
-{
-	uint32_t StreamIndex;
-	GUID MajorType;
-	GUID SubType;
-	nos::fb::vec2u Resolution;
-	WebcamFrameRate FrameRate = WebcamFrameRate::WEBCAM_FRAMERATE_30;
-	static FormatInfo FromMediaType(IMFMediaType* mediaType, uint32_t streamIndex);
-};
-
-struct WebcamStream
-{
-	WebcamStream(WebcamDevice const& device, ComPtr<IMFSourceReader> reader, uint32_t streamIndex);
-	~WebcamStream();
+	// streamId is given when the stream replaces another one, a new id is generated otherwise
+	WebcamStream(std::shared_ptr<DeviceCapture> capture, StreamOptions const& options, std::optional<nosUUID> streamId = std::nullopt);
+	~WebcamStream() override;
+	// Returns the oldest sample delivered by the capture thread, or the newest one in LATEST_FRAME mode.
+	// Waits at most two frame intervals for a sample. Restarts the device if it was paused for being idle,
+	// the first frame then arrives when the device delivers it.
 	StreamSample ReadSample();
+	void SetIdleTimeout(std::chrono::milliseconds timeout);
+	// Host timestamp of the last sample read, 0 if none
+	uint64_t GetLastSampleTime() const { return LastSampleTime; }
+	// Logs how many frames were missed between the given time and the first sample this stream delivers
+	void MeasureGapFrom(uint64_t hostTimestamp) { GapStart = hostTimestamp; }
+	// Makes the device capture straight into the caller's host buffers, an empty list reverts to device owned buffers.
+	// Samples read afterwards have Frame.UserBuffer set and Frame.BufferIndex pointing into the given list.
+	// Fails if other streams share the device. Caller must not hold samples of this stream while switching.
+	std::expected<void, std::string> ImportUserBuffers(std::vector<UserBuffer> const& buffers);
+	// False for compressed formats, the device never writes the frames consumers get
+	bool SupportsUserBuffers() const;
+	// Records every frame the device delivers to path, replacing a recording in progress. Keeps the device running while recording
+	// and keeps other streams of the device from importing user buffers.
+	std::expected<void, std::string> StartRecording(std::string const& path);
+	void StopRecording();
 	void CloseStream();
 	TWebcamStreamInfo GetStreamInfo() const;
 
+	void OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops) override;
+	void Flush() override;
+	bool IsIdle(std::chrono::steady_clock::time_point now) const override;
+
 	nosUUID StreamId;
 	WebcamDevice Device;
-	ComPtr<IMFSourceReader> Reader{};
-	uint32_t StreamIndex = 0;
-	ComPtr<IMFMediaType> MediaType{};
+	// Format of the frames read, NV12 when the device delivers MJPEG
+	FormatInfo Format;
+	StreamOptions Options;
+	std::shared_ptr<DeviceCapture> Capture;
+	std::shared_ptr<CaptureSession> Session{};
+	StreamStats Stats;
+
+private:
+	std::optional<StreamSample> TakeSample();
+
+	// QUEUED mode
+	SPSCRing<StreamSample> Samples{SAMPLE_RING_CAPACITY};
+	// LATEST_FRAME mode, the capture thread swaps in each new sample and the reader swaps it out
+	LatestMailbox<StreamSample> LatestSample;
+	// Count of samples ready to take, at most one in LATEST_FRAME mode
+	std::counting_semaphore<> SamplesReady{0};
+	// Ring has a single consumer, flushing from another thread must not race the reader
+	std::mutex TakeMutex;
+	std::chrono::nanoseconds MaxReadWait{};
+	// Reader side, lost frames show up as gaps between the sequences of consecutive reads
+	std::optional<uint64_t> LastReadSequence;
+	// steady_clock nanoseconds of the last read and the idle timeout, read on the capture thread
+	std::atomic_int64_t LastReadTime;
+	std::atomic_int64_t IdleTimeoutNs;
+	std::atomic_uint64_t LastSampleTime = 0;
+	// Reader side, set on a stream that replaced another until its first sample
+	std::optional<uint64_t> GapStart;
+	std::atomic_bool Closed = false;
+	std::mutex RecorderMutex;
+	std::unique_ptr<CaptureRecorder> Recorder;
 };
 
-inline const GUID GetFormatSubTypeFromEnum(WebcamTextureFormat format)
+inline uint32_t GetFourCCFromFormatEnum(WebcamTextureFormat format)
 {
 	switch (format)
 	{
-	case WebcamTextureFormat::NV12: return MFVideoFormat_NV12;
-	case WebcamTextureFormat::YUY2: return MFVideoFormat_YUY2;
-	case WebcamTextureFormat::NONE: return MFVideoFormat_Base;
+	case WebcamTextureFormat::NV12: return FOURCC_NV12;
+	case WebcamTextureFormat::YUY2: return FOURCC_YUY2;
+	case WebcamTextureFormat::BGR24: return FOURCC_BGR24;
+	case WebcamTextureFormat::MJPG: return FOURCC_MJPG;
+	case WebcamTextureFormat::NONE: return FOURCC_NONE;
 	}
 	nosEngine.LogE("Unknown format!");
-	return MFVideoFormat_Base;
+	return FOURCC_NONE;
 }
-inline WebcamTextureFormat GetFormatEnumFromSubType(GUID const& subType)
+inline WebcamTextureFormat GetFormatEnumFromFourCC(uint32_t fourCC)
 {
-	if (subType == MFVideoFormat_NV12)
+	if (fourCC == FOURCC_NV12)
 		return WebcamTextureFormat::NV12;
-	if (subType == MFVideoFormat_YUY2)
+	if (fourCC == FOURCC_YUY2)
 		return WebcamTextureFormat::YUY2;
+	if (fourCC == FOURCC_BGR24)
+		return WebcamTextureFormat::BGR24;
+	if (fourCC == FOURCC_MJPG)
+		return WebcamTextureFormat::MJPG;
 	nosEngine.LogE("Unknown format!");
 	return WebcamTextureFormat::NV12;
 }
 
-inline std::string GetFormatNameFromSubType(GUID const& subType)
+inline std::string GetFormatNameFromFourCC(uint32_t fourCC)
 {
-	if (subType == MFVideoFormat_Base)
+	if (fourCC == FOURCC_NONE)
 		return "NONE";
-	return std::string((char*)&subType.Data1, 4);
+	return std::string((char*)&fourCC, 4);
+}
+inline std::optional<uint32_t> GetFourCCFromFormatName(std::string const& formatName)
+{
+	if (formatName.size() != 4 || formatName == "NONE")
+		return std::nullopt;
+	return MakeFourCC(formatName[0], formatName[1], formatName[2], formatName[3]);
 }
 inline std::string GetResolutionString(nos::fb::vec2u const& resolution)
 {
@@ -157,7 +185,6 @@ inline const char* GetFrameRateString(WebcamFrameRate frameRate)
 		default: DEBUG_BREAK;					        return "CUSTOM";
 	}
 }
-std::optional<GUID> GetSubTypeFromFormatName(std::string const& formatName);
 inline std::optional<nos::fb::vec2u> GetResolutionFromString(std::string const& resolution)
 {
 	auto pos = resolution.find('x');
@@ -167,33 +194,6 @@ inline std::optional<nos::fb::vec2u> GetResolutionFromString(std::string const&
 
 }
 
-inline nos::fb::vec2u GetFrameRateVec2(WebcamFrameRate const& frameRate)
-{
-	switch (frameRate)
-	{
-		case WebcamFrameRate::WEBCAM_FRAMERATE_1:	    return { 1, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_5:	    return { 5, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_7_5:    return { 10000000, 1333333 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_10:	    return { 10, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_14_98:  return { 5000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_15:     return { 15, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_20:     return { 20, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_23_98:  return { 24000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_24:     return { 24, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_25:     return { 25, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_29_97:  return { 30000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_30:     return { 30, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_47_95:  return { 48000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_48:		return { 48, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_50:     return { 50, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_59_94:  return { 60000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_60:     return { 60, 1 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_119_88: return { 120000, 1001 };
-		case WebcamFrameRate::WEBCAM_FRAMERATE_120:    return { 120, 1 };
-		default: DEBUG_BREAK;					        return { 1, 50 }; break;
-	}
-}
-
 inline std::optional<WebcamFrameRate> GetFrameRateFromString(std::string const& frameRate)
 {
 	for(uint32_t i = std::to_underlying(WebcamFrameRate::WEBCAM_FRAMERATE_1); i < std::to_underlying(WebcamFrameRate::COUNT); i++)
@@ -204,19 +204,71 @@ inline std::optional<WebcamFrameRate> GetFrameRateFromString(std::string const&
 
 struct WebcamStreamManager
 {
+	// Probing and opening mostly wait on the device, so every camera can be worked on at once
+	static constexpr uint32_t TASK_THREAD_COUNT = 8;
+
 	static void Start();
+	// Starts with the given backends instead of the ones of the platform
+	static void Start(std::vector<std::unique_ptr<CaptureBackend>> backends);
 	static void Stop();
 	static WebcamStreamManager& GetInstance();
 
+	// Served from a cache kept up to date by hotplug notifications, formats of a device are probed once
 	static std::vector<WebcamDevice> EnumerateDevices();
+	// Blocks until the device is probed if it is not cached, concurrent calls for the same device share one probe
 	static std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device);
-	std::expected<std::shared_ptr<WebcamStream>, std::string> OpenStreamFromFormat(WebcamDevice const& deviceId, FormatInfo const& formatInfo);
+	static std::optional<std::vector<FormatInfo>> GetCachedFormats(WebcamDevice const& device);
+	// Runs blocking device work off the calling thread, tasks still queued at shutdown are dropped
+	static void RunAsync(std::function<void()> task);
+	// Changes whenever a device is plugged in or removed
+	static uint64_t GetDevicesVersion();
+	// Shared by every reader, concurrent copies split the workers between them
+	static FrameCopy& GetFrameCopy();
+	std::expected<std::shared_ptr<WebcamStream>, std::string> OpenStreamFromFormat(WebcamDevice const& deviceId, FormatInfo const& formatInfo, StreamOptions const& options = {});
+	struct StreamSwitch
+	{
+		std::shared_ptr<WebcamStream> Stream;
+		// Frames no longer fit the buffers readers allocated for the old format
+		bool FrameSizeChanged = false;
+	};
+	// Replaces the stream behind streamId with one in the new format, readers pick it up by the same id.
+	// The new stream is opened before the old one closes unless the device has to be reopened in the new format.
+	// On failure the old stream keeps running, or is opened again if the device was already closed for the switch.
+	std::expected<StreamSwitch, std::string> ReconfigureStream(nosUUID const& streamId, WebcamDevice const& device, FormatInfo const& formatInfo, StreamOptions const& options);
 	void DeleteStream(nosUUID const& streamId);
 
 	std::shared_ptr<WebcamStream> GetStream(nosUUID const& streamId);
+	// Stays valid after the stream is deleted for as long as the caller holds it
+	std::shared_ptr<StreamStats const> GetStreamStats(nosUUID const& streamId);
 private:
+	static std::string GetCaptureKey(WebcamDevice const& device);
+	// Opens or joins the device capture without publishing the stream
+	std::expected<std::shared_ptr<WebcamStream>, std::string> CreateStream(WebcamDevice const& device, FormatInfo const& formatInfo, StreamOptions const& options, std::optional<nosUUID> streamId);
+	// Closes the stream, and the device when this was its last stream
+	void ReleaseStream(std::shared_ptr<WebcamStream> const& stream);
+	// False if the id was deleted in the meantime
+	bool PublishStream(std::shared_ptr<WebcamStream> const& stream);
+	void RefreshDevices(CaptureBackend* backend);
+	void OnDeviceChange(CaptureBackend* backend, std::string const& symLink, DeviceChange change);
+	// Warms up the format cache of every known device in parallel
+	void ProbeAllDevices();
+
 	static std::unique_ptr<WebcamStreamManager> Instance;
+	std::vector<std::unique_ptr<CaptureBackend>> Backends;
+	// Open devices by backend and path, closed when their last stream is deleted
+	std::mutex CapturesMutex;
+	std::unordered_map<std::string, std::shared_ptr<DeviceCapture>> Captures;
 	std::shared_mutex OpenStreamsMutex;
 	std::unordered_map<nosUUID, std::shared_ptr<WebcamStream>> OpenStreams;
+
+	std::vector<std::unique_ptr<DeviceWatcher>> Watchers;
+	std::shared_mutex CacheMutex;
+	std::unordered_map<CaptureBackend*, std::vector<WebcamDevice>> BackendDevices;
+	// Probed formats by capture key, dropped when the device goes away
+	std::unordered_map<std::string, std::vector<FormatInfo>> CachedFormats;
+	std::unordered_map<std::string, std::shared_future<std::vector<FormatInfo>>> PendingProbes;
+	std::atomic_uint64_t DevicesVersion = 0;
+	std::unique_ptr<TaskPool> Tasks;
+	std::unique_ptr<FrameCopy> Copier;
 };
-}
\ No newline at end of file
+}
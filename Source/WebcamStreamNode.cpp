@@ -12,6 +12,12 @@ NOS_REGISTER_NAME(Format);
 NOS_REGISTER_NAME(Resolution);
 NOS_REGISTER_NAME(FrameRate);
 NOS_REGISTER_NAME(Stream);
+NOS_REGISTER_NAME(Stats);
+NOS_REGISTER_NAME(CaptureMode);
+NOS_REGISTER_NAME(DeviceBufferCount);
+NOS_REGISTER_NAME(IdleTimeoutMs);
+NOS_REGISTER_NAME(RecordPath);
+NOS_REGISTER_NAME(ReplayAsFastAsPossible);
 namespace nos::webcam
 {
 enum class ChangedPinType
@@ -24,8 +30,25 @@ enum class ChangedPinType
 
 struct WebcamStreamNode : public nos::NodeContext
 {
+	static constexpr auto STATS_UPDATE_INTERVAL = std::chrono::milliseconds(500);
+
+	// Shared with background tasks. Their results are queued here and applied by the node on an engine thread,
+	// results arriving after the node is destroyed are dropped.
+	struct NodeHandle
+	{
+		// Guards node state against pin watchers and ExecuteNode. Recursive since setting a pin re-enters its watcher.
+		std::recursive_mutex Mutex;
+		std::mutex OpenMutex;
+		// Latest open or switch, a task that was superseded before it got to the device does not open it
+		std::atomic_uint64_t OpenGeneration = 0;
+		std::mutex ResultsMutex;
+		std::vector<std::function<void(WebcamStreamNode&)>> Results;
+		bool Alive = true;
+	};
+
 	WebcamStreamNode(const nosFbNode* node) : nos::NodeContext(node)
 	{
+		DevicesVersion = WebcamStreamManager::GetDevicesVersion();
 		DeviceList = WebcamStreamManager::EnumerateDevices();
 
 		UpdateStringList(GetDeviceStringListName(), GetDeviceList());
@@ -40,19 +63,31 @@ struct WebcamStreamNode : public nos::NodeContext
 
 		AddPinValueWatcher(NSN_Device, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
 			{
+				auto lock = LockAndApplyResults();
 				DevicePin = InterpretPinValue<char>(newVal);
 				SelectedDevice = std::nullopt;
 				CurDeviceFormats.clear();
+				ProbeGeneration++;
+				ClearNodeStatusMessages();
 				if (DevicePin != "NONE")
 				{
 					for (auto const& device : DeviceList)
 						if (device.Name == DevicePin)
 						{
 							SelectedDevice = device;
-							CurDeviceFormats = WebcamStreamManager::EnumerateFormats(*SelectedDevice);
 							break;
 						}
 				}
+				if (SelectedDevice)
+				{
+					if (auto formats = WebcamStreamManager::GetCachedFormats(*SelectedDevice))
+						CurDeviceFormats = std::move(*formats);
+					else
+					{
+						ProbeFormats(!oldValue);
+						return;
+					}
+				}
 				if (!SelectedDevice && !oldValue)
 				{
 					if (!DeviceList.empty())
@@ -71,13 +106,14 @@ struct WebcamStreamNode : public nos::NodeContext
 
 		AddPinValueWatcher(NSN_Format, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
 			{
+				auto lock = LockAndApplyResults();
 				FormatPin = InterpretPinValue<char>(newVal);
-				SelectedFormatGuid = std::nullopt;
+				SelectedFourCC = std::nullopt;
 				if (FormatPin != "NONE")
 				{
-					SelectedFormatGuid = GetSubTypeFromFormatName(FormatPin);
+					SelectedFourCC = GetFourCCFromFormatName(FormatPin);
 				}
-				if (!SelectedFormatGuid)
+				if (!SelectedFourCC)
 				{
 					if (auto formatList = GetFormatNameList(GetFormatList()); formatList.size() > 1)
 					{
@@ -95,6 +131,7 @@ struct WebcamStreamNode : public nos::NodeContext
 
 		AddPinValueWatcher(NSN_Resolution, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
 			{
+				auto lock = LockAndApplyResults();
 				ResolutionPin = InterpretPinValue<char>(newVal);
 				SelectedResolution = std::nullopt;
 				if (ResolutionPin != "NONE")
@@ -119,6 +156,7 @@ struct WebcamStreamNode : public nos::NodeContext
 
 		AddPinValueWatcher(NSN_FrameRate, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
 			{
+				auto lock = LockAndApplyResults();
 				FrameRatePin = InterpretPinValue<char>(newVal);
 				SelectedFrameRate = std::nullopt;
 				if (FrameRatePin != "NONE")
@@ -140,26 +178,221 @@ struct WebcamStreamNode : public nos::NodeContext
 				}
 				UpdateAfter(ChangedPinType::FrameRate, !oldValue);
 			});
+		AddPinValueWatcher(NSN_CaptureMode, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				auto lock = LockAndApplyResults();
+				auto mode = *InterpretPinValue<WebcamCaptureMode>(newVal);
+				if (mode == Options.Mode)
+					return;
+				Options.Mode = mode;
+				ReopenStream();
+			});
+		AddPinValueWatcher(NSN_DeviceBufferCount, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				auto lock = LockAndApplyResults();
+				auto bufferCount = *InterpretPinValue<uint32_t>(newVal);
+				if (bufferCount == Options.Capture.BufferCount)
+					return;
+				Options.Capture.BufferCount = bufferCount;
+				ReopenStream();
+			});
+		AddPinValueWatcher(NSN_IdleTimeoutMs, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				auto lock = LockAndApplyResults();
+				Options.IdleTimeout = std::chrono::milliseconds(*InterpretPinValue<uint32_t>(newVal));
+				// Applies to the open stream as is, the device does not need to be opened again
+				if (StreamId)
+					if (auto stream = WebcamStreamManager::GetInstance().GetStream(*StreamId))
+						stream->SetIdleTimeout(Options.IdleTimeout);
+			});
+		AddPinValueWatcher(NSN_ReplayAsFastAsPossible, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				auto lock = LockAndApplyResults();
+				auto unpaced = *InterpretPinValue<bool>(newVal);
+				if (unpaced == Options.Capture.Unpaced)
+					return;
+				Options.Capture.Unpaced = unpaced;
+				ReopenStream();
+			});
+		AddPinValueWatcher(NSN_RecordPath, [this](nos::Buffer const& newVal, std::optional<nos::Buffer> oldValue)
+			{
+				auto lock = LockAndApplyResults();
+				RecordPath = InterpretPinValue<char>(newVal);
+				if (StreamId)
+					if (auto stream = WebcamStreamManager::GetInstance().GetStream(*StreamId))
+						UpdateRecording(*stream);
+			});
 	}
 
 	~WebcamStreamNode()
 	{
+		std::unique_lock lock(Handle->Mutex);
 		CloseStream();
+		ProbeGeneration++;
+		std::unique_lock resultsLock(Handle->ResultsMutex);
+		Handle->Alive = false;
+		auto results = std::move(Handle->Results);
+		resultsLock.unlock();
+		// Superseded by now, a stream opened meanwhile is deleted without touching the pins
+		for (auto& result : results)
+			result(*this);
+	}
+
+	// Runs the node on its own when it starts a path, stats and the device list are kept fresh without anything
+	// downstream executing it
+	void GetScheduleInfo(nosScheduleInfo* out) override
+	{
+		SelfScheduled = true;
+		*out = nosScheduleInfo{
+			.Importance = 0,
+			.DeltaSeconds = { uint32_t(STATS_UPDATE_INTERVAL.count()), 1000 },
+			.Type = NOS_SCHEDULE_TYPE_ON_DEMAND,
+		};
+	}
+
+	void OnPathStart() override
+	{
+		if (SelfScheduled)
+			ScheduleSelf();
+	}
+
+	void ScheduleSelf()
+	{
+		nosScheduleNodeParams schedule{ .NodeId = NodeId, .AddScheduleCount = 1 };
+		nosEngine.ScheduleNode(&schedule);
+	}
+
+	virtual nosResult ExecuteNode(nosNodeExecuteParams* params)
+	{
+		if (SelfScheduled)
+			ScheduleSelf();
+		// Editor owns the node, results, stats and device list can wait a frame
+		std::unique_lock lock(Handle->Mutex, std::try_to_lock);
+		if (!lock)
+			return NOS_RESULT_SUCCESS;
+		ApplyResults();
+		if (auto version = WebcamStreamManager::GetDevicesVersion(); version != DevicesVersion)
+			RefreshDeviceList(version);
+		if (StreamId && StatsWatch && StatsWatch->Elapsed() >= STATS_UPDATE_INTERVAL)
+			UpdateStats();
+		return NOS_RESULT_SUCCESS;
+	}
+
+	// For pin watchers, background tasks that finished meanwhile are applied before the pin change
+	std::unique_lock<std::recursive_mutex> LockAndApplyResults()
+	{
+		std::unique_lock lock(Handle->Mutex);
+		ApplyResults();
+		return lock;
+	}
+
+	// Called with the node locked on an engine thread, pins and status are only touched from here
+	void ApplyResults()
+	{
+		std::unique_lock resultsLock(Handle->ResultsMutex);
+		auto results = std::move(Handle->Results);
+		Handle->Results.clear();
+		resultsLock.unlock();
+		for (auto& result : results)
+			result(*this);
+	}
+
+	// Called from a background task, false if the node is gone
+	static bool PostResult(std::shared_ptr<NodeHandle> const& handle, std::function<void(WebcamStreamNode&)> result)
+	{
+		std::unique_lock lock(handle->ResultsMutex);
+		if (!handle->Alive)
+			return false;
+		handle->Results.push_back(std::move(result));
+		return true;
+	}
+
+	// A device was plugged in or removed, the open stream is left alone
+	void RefreshDeviceList(uint64_t version)
+	{
+		DevicesVersion = version;
+		DeviceList = WebcamStreamManager::EnumerateDevices();
+		UpdateStringList(GetDeviceStringListName(), GetDeviceList());
+	}
+
+	// Probes the selected device on the task pool, format lists fill in when it is done
+	void ProbeFormats(bool first)
+	{
+		SetNodeStatusMessage("Probing " + SelectedDevice->Name, nos::fb::NodeStatusMessageType::INFO);
+		WebcamStreamManager::RunAsync([handle = Handle, generation = ProbeGeneration, device = *SelectedDevice, first] {
+			PostResult(handle, [generation, first, formats = WebcamStreamManager::EnumerateFormats(device)](WebcamStreamNode& node) mutable {
+				if (node.ProbeGeneration != generation)
+					return;
+				node.ClearNodeStatusMessages();
+				node.CurDeviceFormats = std::move(formats);
+				node.UpdateAfter(ChangedPinType::Device, first);
+				// Pins loaded with the scene were set before the formats were known, replay them now
+				if (first)
+					for (auto type : { ChangedPinType::FormatName, ChangedPinType::Resolution, ChangedPinType::FrameRate })
+						node.UpdateAfter(type, true);
+			});
+		});
+	}
+
+	void UpdateStats()
+	{
+		auto stats = WebcamStreamManager::GetInstance().GetStreamStats(*StreamId);
+		if (!stats)
+			return;
+		const double elapsedSeconds = std::chrono::duration<double>(StatsWatch->Elapsed()).count();
+		const uint64_t delivered = stats->DeliveredFrames;
+		TWebcamStreamStats out{};
+		out.fps = float(double(delivered - LastDeliveredFrames) / elapsedSeconds);
+		out.captured_frames = stats->CapturedFrames;
+		out.delivered_frames = delivered;
+		out.dropped_frames = stats->DroppedFrames;
+		out.stale_reads = stats->StaleReads;
+		out.read_sample = MakeLatencyStats(stats->ReadSample);
+		out.capture_to_read = MakeLatencyStats(stats->CaptureToRead);
+		out.map = MakeLatencyStats(stats->Map);
+		out.upload_wait = MakeLatencyStats(stats->UploadWait);
+		out.upload_submit = MakeLatencyStats(stats->UploadSubmit);
+		out.copy = MakeLatencyStats(stats->Copy);
+		out.region_copy = MakeLatencyStats(stats->RegionCopy);
+		out.uploaded_bytes = stats->UploadedBytes;
+		out.full_frame_bytes = stats->FullFrameBytes;
+		out.downscale = MakeLatencyStats(stats->Downscale);
+		out.repeated_frames = stats->RepeatedFrames;
+		out.reader_execute = MakeLatencyStats(stats->Execute);
+		out.hash = MakeLatencyStats(stats->Hash);
+		SetPinValue(NSN_Stats, nos::Buffer::From(out));
+		LastDeliveredFrames = delivered;
+		StatsWatch.emplace();
+	}
+
+	static std::unique_ptr<TWebcamLatencyStats> MakeLatencyStats(LatencyHistogram const& histogram)
+	{
+		auto out = std::make_unique<TWebcamLatencyStats>();
+		auto buckets = histogram.GetBuckets();
+		out->count = histogram.Count;
+		out->mean_us = out->count ? float(double(histogram.TotalNanoseconds) / double(out->count) / 1000.0) : 0.f;
+		out->p50_us = float(LatencyHistogram::GetPercentile(buckets, 0.5));
+		out->p99_us = float(LatencyHistogram::GetPercentile(buckets, 0.99));
+		out->max_us = float(double(histogram.MaxNanoseconds) / 1000.0);
+		out->histogram.assign(buckets.begin(), buckets.end());
+		return out;
 	}
 
 	bool TryOpenDevice()
 	{
-		CloseStream();
-		if (!SelectedDevice || !SelectedFormatGuid || !SelectedResolution || !SelectedFrameRate)
+		if (!SelectedDevice || !SelectedFourCC || !SelectedResolution || !SelectedFrameRate)
+		{
+			CloseStream();
 			return false;
+		}
 		FormatInfo info{};
-		info.SubType = *SelectedFormatGuid;
+		info.FourCC = *SelectedFourCC;
 		info.Resolution = *SelectedResolution;
 		info.FrameRate = *SelectedFrameRate;
 		bool found = false;
 		for (auto& format : CurDeviceFormats)
 		{
-			if (info.SubType == format.SubType && info.FrameRate == format.FrameRate && info.Resolution == format.Resolution)
+			if (info.FourCC == format.FourCC && info.FrameRate == format.FrameRate && info.Resolution == format.Resolution)
 			{
 				SelectedFormatInfo = format;
 				found = true;
@@ -167,30 +400,139 @@ struct WebcamStreamNode : public nos::NodeContext
 			}
 		}
 		if (!found)
+		{
+			CloseStream();
 			return false;
-			
-		if (auto res = WebcamStreamManager::GetInstance().OpenStreamFromFormat(*SelectedDevice, SelectedFormatInfo); res.has_value())
+		}
+		if (StreamId)
+			return SwitchStream();
+		CloseStream();
+
+		// Opening can block on the device for seconds, so it runs on the task pool
+		Opening = true;
+		SetNodeStatusMessage("Opening " + SelectedDevice->Name, nos::fb::NodeStatusMessageType::INFO);
+		WebcamStreamManager::RunAsync([handle = Handle, generation = Handle->OpenGeneration.load(), device = *SelectedDevice, format = SelectedFormatInfo, options = Options] {
+			// One open per node at a time, a superseded stream must be gone before the next format is opened
+			std::unique_lock openLock(handle->OpenMutex);
+			if (handle->OpenGeneration != generation)
+				return;
+			auto res = WebcamStreamManager::GetInstance().OpenStreamFromFormat(device, format, options);
+			auto posted = PostResult(handle, [generation, res](WebcamStreamNode& node) {
+				if (!node.OnStreamOpened(generation, res) && res)
+					WebcamStreamManager::GetInstance().DeleteStream((*res)->StreamId);
+			});
+			if (!posted && res)
+				WebcamStreamManager::GetInstance().DeleteStream((*res)->StreamId);
+		});
+		return true;
+	}
+
+	bool OnStreamOpened(uint64_t generation, std::expected<std::shared_ptr<WebcamStream>, std::string> const& res)
+	{
+		if (generation != Handle->OpenGeneration)
+			return false;
+		Opening = false;
+		if (!res)
 		{
-			auto openedStream = res.value();
-			StreamId = openedStream->StreamId;
-			SetPinValue(NSN_Stream, nos::Buffer::From(openedStream->GetStreamInfo()));
-			nosEngine.SendPathRestart(NodeId);
+			nosEngine.LogE("Failed to open webcam stream: %s", res.error().c_str());
+			SetNodeStatusMessage(res.error(), nos::fb::NodeStatusMessageType::FAILURE);
 			return true;
 		}
-		else
+		ClearNodeStatusMessages();
+		auto openedStream = res.value();
+		StreamId = openedStream->StreamId;
+		LastDeliveredFrames = 0;
+		StatsWatch.emplace();
+		SetPinValue(NSN_Stream, nos::Buffer::From(openedStream->GetStreamInfo()));
+		UpdateRecording(*openedStream);
+		nosEngine.SendPathRestart(NodeId);
+		return true;
+	}
+
+	// Switching the stream ends its recording, the new one starts the file over in the new format
+	void UpdateRecording(WebcamStream& stream)
+	{
+		if (RecordPath.empty())
 		{
-			nosEngine.LogE("Failed to open webcam stream: %s", res.error().c_str());
+			stream.StopRecording();
+			return;
+		}
+		if (auto res = stream.StartRecording(RecordPath); !res)
+		{
+			nosEngine.LogE("Failed to record webcam stream: %s", res.error().c_str());
+			SetNodeStatusMessage(res.error(), nos::fb::NodeStatusMessageType::FAILURE);
+		}
+	}
+
+	// Readers keep the stream id, the path restarts only if they need buffers of another size
+	bool SwitchStream()
+	{
+		// Drops the result of an open or switch still in progress
+		Handle->OpenGeneration++;
+		Opening = true;
+		SetNodeStatusMessage("Switching " + SelectedDevice->Name + " to " + GetFormatNameFromFourCC(SelectedFormatInfo.FourCC) + " " +
+			GetResolutionString(SelectedFormatInfo.Resolution) + " @ " + GetFrameRateString(SelectedFormatInfo.FrameRate), nos::fb::NodeStatusMessageType::INFO);
+		WebcamStreamManager::RunAsync([handle = Handle, generation = Handle->OpenGeneration.load(), streamId = *StreamId, device = *SelectedDevice, format = SelectedFormatInfo, options = Options] {
+			std::unique_lock openLock(handle->OpenMutex);
+			if (handle->OpenGeneration != generation)
+				return;
+			auto res = WebcamStreamManager::GetInstance().ReconfigureStream(streamId, device, format, options);
+			// Stream stays under the node's id even when the node moved on, the next switch starts from it
+			PostResult(handle, [generation, res](WebcamStreamNode& node) { node.OnStreamSwitched(generation, res); });
+		});
+		return true;
+	}
+
+	bool OnStreamSwitched(uint64_t generation, std::expected<WebcamStreamManager::StreamSwitch, std::string> const& res)
+	{
+		if (generation != Handle->OpenGeneration)
 			return false;
+		Opening = false;
+		if (!res)
+		{
+			nosEngine.LogE("Failed to switch webcam stream: %s", res.error().c_str());
+			SetNodeStatusMessage(res.error(), nos::fb::NodeStatusMessageType::FAILURE);
+			if (!StreamId)
+				return true;
+			// Previous format could not be restored either
+			if (auto stream = WebcamStreamManager::GetInstance().GetStream(*StreamId))
+				UpdateRecording(*stream);
+			else
+				CloseStream();
+			return true;
 		}
+		ClearNodeStatusMessages();
+		LastDeliveredFrames = 0;
+		StatsWatch.emplace();
+		SetPinValue(NSN_Stream, nos::Buffer::From(res->Stream->GetStreamInfo()));
+		UpdateRecording(*res->Stream);
+		if (res->FrameSizeChanged)
+			nosEngine.SendPathRestart(NodeId);
+		return true;
+	}
+
+	// Stream options only take effect on open
+	void ReopenStream()
+	{
+		if (Opening || (StreamId && WebcamStreamManager::GetInstance().GetStream(*StreamId)))
+			TryOpenDevice();
 	}
 
 	void CloseStream()
 	{
-		nosEngine.SendPathRestart(NodeId);
+		// Nothing downstream to restart when no stream was open
+		if (StreamId)
+			nosEngine.SendPathRestart(NodeId);
 		SelectedFormatInfo = {};
+		// Drops the result of an open still in progress
+		Handle->OpenGeneration++;
+		Opening = false;
 		if(StreamId)
 			WebcamStreamManager::GetInstance().DeleteStream(*StreamId);
+		StreamId = std::nullopt;
 		SetPinValue(NSN_Stream, nos::Buffer::From(TWebcamStreamInfo{}));
+		SetPinValue(NSN_Stats, nos::Buffer::From(TWebcamStreamStats{}));
+		StatsWatch.reset();
 	}
 
 	void UpdateAfter(ChangedPinType type, bool first)
@@ -212,7 +554,7 @@ struct WebcamStreamNode : public nos::NodeContext
 		{
 			auto resolutionList = GetResolutionList();
 			UpdateStringList(GetResolutionStringListName(), resolutionList);
-			if (!SelectedFormatGuid)
+			if (!SelectedFourCC)
 				SetPinValue(NSN_Resolution, nosBuffer{ .Data = (void*)"NONE", .Size = 5 });
 			else if(!first)
 				AutoSelectIfPossible(NSN_Resolution, resolutionList);
@@ -243,8 +585,8 @@ struct WebcamStreamNode : public nos::NodeContext
 	std::vector<std::string> GetDeviceList()
 	{
 		std::vector<std::string> ret = { "NONE" };
-		for (auto const& [name, id] : DeviceList)
-			ret.push_back(name);
+		for (auto const& device : DeviceList)
+			ret.push_back(device.Name);
 		return ret;
 	}
 
@@ -255,7 +597,7 @@ struct WebcamStreamNode : public nos::NodeContext
 			return ret;
 		for (auto const& format : CurDeviceFormats)
 		{
-			if (auto formatEnum = GetFormatEnumFromSubType(format.SubType); std::find(ret.begin(), ret.end(), formatEnum) == ret.end())
+			if (auto formatEnum = GetFormatEnumFromFourCC(format.FourCC); std::find(ret.begin(), ret.end(), formatEnum) == ret.end())
 				ret.push_back(formatEnum);
 		}
 		return ret;
@@ -265,7 +607,7 @@ struct WebcamStreamNode : public nos::NodeContext
 		std::vector<std::string> ret;
 		for (auto const& format : list)
 		{
-			ret.push_back(GetFormatNameFromSubType(GetFormatSubTypeFromEnum(format)));
+			ret.push_back(GetFormatNameFromFourCC(GetFourCCFromFormatEnum(format)));
 		}
 		return ret;
 	}
@@ -273,10 +615,10 @@ struct WebcamStreamNode : public nos::NodeContext
 	std::vector<std::string> GetResolutionList()
 	{
 		std::vector<std::string> ret;
-		if (!SelectedDevice || !SelectedFormatGuid)
+		if (!SelectedDevice || !SelectedFourCC)
 			return {"NONE"};
 		for (auto const& format : CurDeviceFormats)
-			if (format.SubType == *SelectedFormatGuid)
+			if (format.FourCC == *SelectedFourCC)
 				if (auto resStr = GetResolutionString(format.Resolution); std::find(ret.begin(), ret.end(), resStr) == ret.end())
 					ret.push_back(resStr);
 		return ret;
@@ -285,10 +627,10 @@ struct WebcamStreamNode : public nos::NodeContext
 	std::vector<std::string> GetFrameRateList()
 	{
 		std::vector<std::string> ret;
-		if (!SelectedDevice || !SelectedFormatGuid || !SelectedResolution)
+		if (!SelectedDevice || !SelectedFourCC || !SelectedResolution)
 			return { "NONE" };
 		for (auto const& format : CurDeviceFormats)
-			if (format.SubType == *SelectedFormatGuid && format.Resolution == *SelectedResolution)
+			if (format.FourCC == *SelectedFourCC && format.Resolution == *SelectedResolution)
 				if (auto frameRateStr = GetFrameRateString(format.FrameRate); std::find(ret.begin(), ret.end(), frameRateStr) == ret.end())
 					ret.push_back(frameRateStr);
 		return ret;
@@ -307,10 +649,15 @@ struct WebcamStreamNode : public nos::NodeContext
 
 	std::optional<nosUUID> StreamId;
 	FormatInfo SelectedFormatInfo;
+	StreamOptions Options;
+	// Empty when not recording
+	std::string RecordPath;
+	std::optional<nos::util::Stopwatch> StatsWatch;
+	uint64_t LastDeliveredFrames = 0;
 	int WebCamIndex = 0;
 
 	std::optional<WebcamDevice> SelectedDevice;
-	std::optional<GUID> SelectedFormatGuid;
+	std::optional<uint32_t> SelectedFourCC;
 	std::optional<nos::fb::vec2u> SelectedResolution;
 	std::optional<WebcamFrameRate> SelectedFrameRate;
 
@@ -321,7 +668,14 @@ struct WebcamStreamNode : public nos::NodeContext
 
 	nosResourceShareInfo _nosIntermediateTexture = {};
 	nosResourceShareInfo _nosMemoryBuffer = {};
+	std::shared_ptr<NodeHandle> Handle = std::make_shared<NodeHandle>();
+	uint64_t ProbeGeneration = 0;
+	bool Opening = false;
+	// Set when the node starts a path of its own
+	bool SelfScheduled = false;
+
 	std::vector<WebcamDevice> DeviceList;
+	uint64_t DevicesVersion = 0;
 	std::vector<FormatInfo> CurDeviceFormats;
 };
 nosResult RegisterWebcamStream(nosNodeFunctions* outFunc)
@@ -0,0 +1,84 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace nos::webcam::test
+{
+// Seconds one call of fn takes, the best of a few runs that each repeat it for at least minRunTime.
+// Best rather than mean, other work on the machine only ever adds time.
+inline double TimeBest(std::function<void()> const& fn, std::chrono::duration<double> minRunTime = std::chrono::milliseconds(200), int runs = 3)
+{
+	using Clock = std::chrono::steady_clock;
+	// Warms caches and lets the first call do its one time setup
+	fn();
+	double best = 0;
+	for (int run = 0; run < runs; run++)
+	{
+		const auto start = Clock::now();
+		uint64_t calls = 0;
+		do
+		{
+			fn();
+			calls++;
+		} while (Clock::now() - start < minRunTime);
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count() / double(calls);
+		best = run == 0 ? seconds : std::min(best, seconds);
+	}
+	return best;
+}
+
+// Median seconds one call of each function takes, over runs that each repeat it for at least minRunTime.
+// The functions take turns run by run, so a change in clock speed or load in between hits all of them alike.
+inline std::vector<double> TimeMedians(std::vector<std::function<void()>> const& fns, int runs = 9, std::chrono::duration<double> minRunTime = std::chrono::milliseconds(50))
+{
+	using Clock = std::chrono::steady_clock;
+	for (auto const& fn : fns)
+		fn();
+	std::vector<std::vector<double>> samples(fns.size());
+	for (int run = 0; run < runs; run++)
+		for (size_t f = 0; f < fns.size(); f++)
+		{
+			const auto start = Clock::now();
+			uint64_t calls = 0;
+			do
+			{
+				fns[f]();
+				calls++;
+			} while (Clock::now() - start < minRunTime);
+			samples[f].push_back(std::chrono::duration<double>(Clock::now() - start).count() / double(calls));
+		}
+	std::vector<double> medians;
+	for (auto& times : samples)
+	{
+		std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+		medians.push_back(times[times.size() / 2]);
+	}
+	return medians;
+}
+
+// Upload memory is mapped on page boundaries, benchmarks write into buffers aligned like it
+struct PageAlignedBuffer
+{
+	static constexpr size_t PAGE_SIZE = 4096;
+
+	explicit PageAlignedBuffer(size_t size) : Size(size), Bytes(size + PAGE_SIZE) {}
+	uint8_t* Data() { return Bytes.data() + (PAGE_SIZE - reinterpret_cast<uintptr_t>(Bytes.data()) % PAGE_SIZE) % PAGE_SIZE; }
+
+	size_t Size;
+	std::vector<uint8_t> Bytes;
+};
+
+inline double GigabytesPerSecond(size_t bytes, double seconds)
+{
+	return double(bytes) / seconds / 1e9;
+}
+} // namespace nos::webcam::test
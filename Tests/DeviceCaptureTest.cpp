@@ -0,0 +1,176 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "DeviceCapture.h"
+#include "TestHelpers.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace nos::webcam;
+
+namespace
+{
+// Device with a few buffers of its own that go away when it stops streaming or closes, like V4L2's mapped buffers
+struct FakeSession : CaptureSession
+{
+	static constexpr uint32_t BUFFER_COUNT = 4;
+	static constexpr uint32_t WIDTH = 16, HEIGHT = 8;
+
+	FakeSession()
+	{
+		for (auto& buffer : Buffers)
+			buffer = std::make_unique<uint8_t[]>(WIDTH * HEIGHT * 2);
+	}
+
+	FormatInfo GetFormat() const override
+	{
+		return { .FourCC = FOURCC_YUY2, .Resolution = nos::fb::vec2u(WIDTH, HEIGHT), .FrameRate = WebcamFrameRate::WEBCAM_FRAMERATE_30 };
+	}
+
+	std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds timeout) override
+	{
+		std::unique_lock lock(Mutex);
+		for (uint32_t i = 0; i < BUFFER_COUNT && !Closed && Streaming; i++)
+		{
+			if (!Queued[i])
+				continue;
+			Queued[i] = false;
+			return CapturedFrame{ .Data = Buffers[i].get(), .Size = WIDTH * HEIGHT * 2, .BufferIndex = i, .DeviceSequence = Sequence++ };
+		}
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return std::nullopt;
+	}
+
+	void Requeue(CapturedFrame const& frame) override
+	{
+		std::unique_lock lock(Mutex);
+		RequeuedAfterClose |= Closed;
+		Queued[frame.BufferIndex] = true;
+	}
+
+	void SetStreaming(bool streaming) override
+	{
+		std::unique_lock lock(Mutex);
+		Streaming = streaming;
+	}
+
+	void Close() override
+	{
+		std::unique_lock lock(Mutex);
+		Closed = true;
+		// Buffers are unmapped, a frame still read from them would read freed memory
+		for (auto& buffer : Buffers)
+			buffer.reset();
+	}
+
+	bool IsClosed()
+	{
+		std::unique_lock lock(Mutex);
+		return Closed;
+	}
+
+	std::mutex Mutex;
+	std::array<std::unique_ptr<uint8_t[]>, BUFFER_COUNT> Buffers;
+	std::array<bool, BUFFER_COUNT> Queued{ true, true, true, true };
+	uint64_t Sequence = 0;
+	bool Streaming = true;
+	bool Closed = false;
+	bool RequeuedAfterClose = false;
+};
+
+// Keeps the latest frame until told to let go, like a reader in the middle of uploading it
+struct HoldingConsumer : FrameConsumer
+{
+	void OnFrame(std::shared_ptr<FrameLease> const& lease, uint64_t deviceDrops) override
+	{
+		std::unique_lock lock(Mutex);
+		Held = lease;
+		Received.notify_all();
+	}
+
+	// Only frames taken with WaitForFrame stay in use
+	void Flush() override
+	{
+		std::unique_lock lock(Mutex);
+		Held.reset();
+	}
+
+	std::shared_ptr<FrameLease> WaitForFrame()
+	{
+		std::unique_lock lock(Mutex);
+		Received.wait(lock, [this] { return Held != nullptr; });
+		return std::move(Held);
+	}
+
+	std::mutex Mutex;
+	std::condition_variable Received;
+	std::shared_ptr<FrameLease> Held;
+};
+
+struct Fixture
+{
+	Fixture() : Session(std::make_shared<FakeSession>()), Capture(std::make_shared<DeviceCapture>(WebcamDevice{ .Name = "Fake" }, Session, CaptureOptions{})) {}
+
+	std::shared_ptr<FakeSession> Session;
+	std::shared_ptr<DeviceCapture> Capture;
+	HoldingConsumer Consumer;
+};
+
+void CloseWithoutFramesInUse()
+{
+	Fixture fixture;
+	fixture.Capture->Subscribe(&fixture.Consumer);
+	fixture.Consumer.WaitForFrame().reset();
+	fixture.Capture->Unsubscribe(&fixture.Consumer);
+	fixture.Capture->Close();
+	NOS_TEST_CHECK(fixture.Session->IsClosed());
+}
+
+void CloseWaitsForFrameInUse()
+{
+	Fixture fixture;
+	fixture.Capture->Subscribe(&fixture.Consumer);
+	auto lease = fixture.Consumer.WaitForFrame();
+	fixture.Capture->Unsubscribe(&fixture.Consumer);
+	// Held past the release timeout, the session stays open while the frame is read
+	fixture.Capture->Close();
+	NOS_TEST_CHECK(!fixture.Session->IsClosed());
+	NOS_TEST_CHECK(lease->Frame.Data == fixture.Session->Buffers[lease->Frame.BufferIndex].get());
+	// Manager lets go of the capture, the lease keeps it and the session alive
+	std::weak_ptr<DeviceCapture> capture = fixture.Capture;
+	fixture.Capture.reset();
+	NOS_TEST_CHECK(!capture.expired());
+	lease.reset();
+	NOS_TEST_CHECK(fixture.Session->IsClosed());
+	NOS_TEST_CHECK(!fixture.Session->RequeuedAfterClose);
+	NOS_TEST_CHECK(capture.expired());
+}
+
+void FrameGivenBackWhileClosing()
+{
+	Fixture fixture;
+	fixture.Capture->Subscribe(&fixture.Consumer);
+	auto lease = fixture.Consumer.WaitForFrame();
+	fixture.Capture->Unsubscribe(&fixture.Consumer);
+	// Given back during the wait, the session closes right away
+	std::thread reader([&lease] {
+		std::this_thread::sleep_for(DeviceCapture::LEASE_RELEASE_TIMEOUT / 4);
+		lease.reset();
+	});
+	fixture.Capture->Close();
+	reader.join();
+	NOS_TEST_CHECK(fixture.Session->IsClosed());
+	NOS_TEST_CHECK(!fixture.Session->RequeuedAfterClose);
+}
+} // namespace
+
+int main()
+{
+	return test::RunTests({
+		{ "CloseWithoutFramesInUse", CloseWithoutFramesInUse },
+		{ "CloseWaitsForFrameInUse", CloseWaitsForFrameInUse },
+		{ "FrameGivenBackWhileClosing", FrameGivenBackWhileClosing },
+	});
+}
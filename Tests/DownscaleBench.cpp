@@ -0,0 +1,48 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Throughput of the 2x and 4x downscale on every instruction set the CPU supports, in GB/s of source frame read.
+// The upload column is the share of the full frame the GPU still receives.
+#include "BenchHelpers.h"
+#include "CaptureBackend.h"
+#include "PixelConvert.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+int main()
+{
+	const std::pair<uint32_t, uint32_t> resolutions[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	std::vector<PixelIsa> isas;
+	for (PixelIsa isa : { PixelIsa::Scalar, PixelIsa::SSE41, PixelIsa::AVX2, PixelIsa::NEON })
+		if (IsPixelIsaSupported(isa))
+			isas.push_back(isa);
+
+	std::mt19937 random(1);
+	std::printf("%-10s %-8s %-8s %-8s %10s %10s %8s\n", "Size", "Format", "Factor", "ISA", "ms", "GB/s", "Upload");
+	for (auto [width, height] : resolutions)
+	{
+		const size_t pixels = size_t(width) * height;
+		std::vector<uint8_t> nv12(pixels * 3 / 2), yuy2(pixels * 2), out(pixels * 2);
+		for (auto& byte : nv12)
+			byte = uint8_t(random());
+		for (auto& byte : yuy2)
+			byte = uint8_t(random());
+		const std::string size = std::to_string(width) + "x" + std::to_string(height);
+		for (uint32_t factor : { 2u, 4u })
+			for (PixelIsa isa : isas)
+			{
+				const double nv12Seconds = test::TimeBest([&] { (void)DownscaleNV12(nv12.data(), nv12.data() + pixels, width, height, 0, factor, out.data(), isa); });
+				const nos::fb::vec2u nv12Size = GetDownscaledResolution(FOURCC_NV12, nos::fb::vec2u(width, height), factor);
+				std::printf("%-10s %-8s %-8u %-8s %10.3f %10.2f %7.1f%%\n", size.c_str(), "NV12", factor, GetPixelIsaName(isa), nv12Seconds * 1e3,
+					test::GigabytesPerSecond(nv12.size(), nv12Seconds), 100.0 * nv12Size.x() * nv12Size.y() / double(pixels));
+				const double yuy2Seconds = test::TimeBest([&] { (void)DownscaleYUY2(yuy2.data(), width, height, 0, factor, out.data(), isa); });
+				const nos::fb::vec2u yuy2Size = GetDownscaledResolution(FOURCC_YUY2, nos::fb::vec2u(width, height), factor);
+				std::printf("%-10s %-8s %-8u %-8s %10.3f %10.2f %7.1f%%\n", size.c_str(), "YUY2", factor, GetPixelIsaName(isa), yuy2Seconds * 1e3,
+					test::GigabytesPerSecond(yuy2.size(), yuy2Seconds), 100.0 * yuy2Size.x() * yuy2Size.y() / double(pixels));
+			}
+	}
+	return 0;
+}
@@ -0,0 +1,227 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "CaptureBackend.h"
+#include "PixelConvert.h"
+#include "TestHelpers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+// Bytes past each output that must be left alone
+constexpr size_t GUARD = 64;
+constexpr uint8_t GUARD_BYTE = 0xA5;
+
+std::mt19937 Random(2323);
+
+// Every instruction set that can run here, the scalar one included since it is checked against the reference too
+std::vector<PixelIsa> GetIsas()
+{
+	std::vector<PixelIsa> isas;
+	for (PixelIsa isa : { PixelIsa::Scalar, PixelIsa::SSE41, PixelIsa::AVX2, PixelIsa::NEON })
+		if (IsPixelIsaSupported(isa))
+			isas.push_back(isa);
+	return isas;
+}
+
+uint8_t Average(uint32_t sum, uint32_t factor)
+{
+	const uint32_t count = factor * factor;
+	return uint8_t((sum + count / 2) / count);
+}
+
+// Box filter written in pixel coordinates, one sample at a time, independent of the row kernels
+std::vector<uint8_t> ReferenceNV12(uint8_t const* luma, uint8_t const* chroma, uint32_t width, uint32_t height, size_t stride, uint32_t factor)
+{
+	const nos::fb::vec2u size = GetDownscaledResolution(FOURCC_NV12, nos::fb::vec2u(width, height), factor);
+	const uint32_t outWidth = size.x(), outHeight = size.y();
+	std::vector<uint8_t> out(size_t(outWidth) * outHeight * 3 / 2);
+	for (uint32_t y = 0; y < outHeight; y++)
+		for (uint32_t x = 0; x < outWidth; x++)
+		{
+			uint32_t sum = 0;
+			for (uint32_t dy = 0; dy < factor; dy++)
+				for (uint32_t dx = 0; dx < factor; dx++)
+					sum += luma[(y * factor + dy) * stride + x * factor + dx];
+			out[size_t(y) * outWidth + x] = Average(sum, factor);
+		}
+	uint8_t* outChroma = out.data() + size_t(outWidth) * outHeight;
+	for (uint32_t y = 0; y < outHeight / 2; y++)
+		for (uint32_t x = 0; x < outWidth / 2; x++)
+			for (uint32_t c = 0; c < 2; c++)
+			{
+				uint32_t sum = 0;
+				for (uint32_t dy = 0; dy < factor; dy++)
+					for (uint32_t dx = 0; dx < factor; dx++)
+						sum += chroma[(y * factor + dy) * stride + (x * factor + dx) * 2 + c];
+				outChroma[size_t(y) * outWidth + x * 2 + c] = Average(sum, factor);
+			}
+	return out;
+}
+
+// rows[y] is source row y, so bottom-up frames are described the same way as top-down ones
+std::vector<uint8_t> ReferenceYUY2(std::vector<uint8_t const*> const& rows, uint32_t width, uint32_t factor)
+{
+	const nos::fb::vec2u size = GetDownscaledResolution(FOURCC_YUY2, nos::fb::vec2u(width, uint32_t(rows.size())), factor);
+	const uint32_t outWidth = size.x(), outHeight = size.y();
+	std::vector<uint8_t> out(size_t(outWidth) * outHeight * 2);
+	for (uint32_t y = 0; y < outHeight; y++)
+	{
+		for (uint32_t x = 0; x < outWidth; x++)
+		{
+			uint32_t sum = 0;
+			for (uint32_t dy = 0; dy < factor; dy++)
+				for (uint32_t dx = 0; dx < factor; dx++)
+					sum += rows[y * factor + dy][(x * factor + dx) * 2];
+			out[(size_t(y) * outWidth + x) * 2] = Average(sum, factor);
+		}
+		// Output pair p covers source pairs p * factor up to (p + 1) * factor
+		for (uint32_t pair = 0; pair < outWidth / 2; pair++)
+			for (uint32_t c = 0; c < 2; c++)
+			{
+				uint32_t sum = 0;
+				for (uint32_t dy = 0; dy < factor; dy++)
+					for (uint32_t dx = 0; dx < factor; dx++)
+						sum += rows[y * factor + dy][(pair * factor + dx) * 4 + 1 + c * 2];
+				out[(size_t(y) * outWidth + pair * 2) * 2 + 1 + c * 2] = Average(sum, factor);
+			}
+	}
+	return out;
+}
+
+bool Matches(std::vector<uint8_t> const& actual, std::vector<uint8_t> const& expected)
+{
+	if (std::memcmp(actual.data(), expected.data(), expected.size()))
+		return false;
+	for (size_t i = expected.size(); i < actual.size(); i++)
+		if (actual[i] != GUARD_BYTE)
+			return false;
+	return true;
+}
+
+void Report(bool matches, std::string const& what)
+{
+	if (!matches)
+		std::fprintf(stderr, "  Mismatch: %s\n", what.c_str());
+	NOS_TEST_CHECK(matches);
+}
+
+// Sizes that leave partial blocks on the right and bottom, and widths around the vector widths of every kernel set
+const std::pair<uint32_t, uint32_t> SIZES[] = { { 8, 8 }, { 10, 6 }, { 34, 18 }, { 66, 12 }, { 130, 10 }, { 258, 20 }, { 1920, 24 } };
+
+void NV12Frames()
+{
+	for (auto [width, height] : SIZES)
+		for (uint32_t factor : { 2u, 4u })
+		{
+			// Frames too small for the factor are rejected, Rejected checks that
+			if (!GetDownscaledResolution(FOURCC_NV12, nos::fb::vec2u(width, height), factor).y())
+				continue;
+			// Whole frames, frames in padded rows and frames cropped from the middle of a larger one
+			const uint32_t frameWidth = width + 40, frameHeight = height + 16;
+			std::vector<uint8_t> frame(size_t(frameWidth) * frameHeight * 3 / 2);
+			for (auto& byte : frame)
+				byte = uint8_t(Random());
+			uint8_t* frameChroma = frame.data() + size_t(frameWidth) * frameHeight;
+			struct Layout
+			{
+				const char* Name;
+				uint8_t const* Luma;
+				uint8_t const* Chroma;
+				int32_t Pitch;
+			};
+			const Layout layouts[] = {
+				{ "packed", frame.data(), frame.data() + size_t(width) * height, 0 },
+				{ "padded", frame.data(), frameChroma, int32_t(frameWidth) },
+				{ "cropped", frame.data() + 8 * frameWidth + 6, frameChroma + 4 * frameWidth + 6, int32_t(frameWidth) },
+			};
+			for (auto const& layout : layouts)
+			{
+				const size_t stride = layout.Pitch ? size_t(layout.Pitch) : width;
+				const auto expected = ReferenceNV12(layout.Luma, layout.Chroma, width, height, stride, factor);
+				for (PixelIsa isa : GetIsas())
+				{
+					std::vector<uint8_t> actual(expected.size() + GUARD, GUARD_BYTE);
+					NOS_TEST_CHECK(DownscaleNV12(layout.Luma, layout.Chroma, width, height, layout.Pitch, factor, actual.data(), isa).has_value());
+					Report(Matches(actual, expected), std::string(GetPixelIsaName(isa)) + " NV12 " + std::to_string(width) + "x" + std::to_string(height) + " " + layout.Name + " by " + std::to_string(factor));
+				}
+			}
+		}
+}
+
+void YUY2Frames()
+{
+	for (auto [width, height] : SIZES)
+		for (uint32_t factor : { 2u, 4u })
+		{
+			const size_t packedPitch = size_t(width) * 2;
+			const size_t paddedPitch = packedPitch + 24;
+			std::vector<uint8_t> frame(paddedPitch * height);
+			for (auto& byte : frame)
+				byte = uint8_t(Random());
+			for (int32_t pitch : { 0, int32_t(paddedPitch), -int32_t(paddedPitch) })
+			{
+				const size_t stride = pitch ? paddedPitch : packedPitch;
+				std::vector<uint8_t const*> rows(height);
+				for (uint32_t y = 0; y < height; y++)
+					rows[y] = frame.data() + (pitch < 0 ? height - 1 - y : y) * stride;
+				const auto expected = ReferenceYUY2(rows, width, factor);
+				for (PixelIsa isa : GetIsas())
+				{
+					std::vector<uint8_t> actual(expected.size() + GUARD, GUARD_BYTE);
+					NOS_TEST_CHECK(DownscaleYUY2(rows[0], width, height, pitch, factor, actual.data(), isa).has_value());
+					Report(Matches(actual, expected), std::string(GetPixelIsaName(isa)) + " YUY2 " + std::to_string(width) + "x" + std::to_string(height) + " pitch " + std::to_string(pitch) + " by " + std::to_string(factor));
+				}
+			}
+		}
+}
+
+void Extremes()
+{
+	// All white must stay white, a rounding bias in the sums would pull it to 254 or wrap it to 0
+	const uint32_t width = 64, height = 16;
+	for (uint8_t value : { uint8_t(0), uint8_t(255) })
+	{
+		std::vector<uint8_t> nv12(width * height * 3 / 2, value), yuy2(width * height * 2, value);
+		for (PixelIsa isa : GetIsas())
+			for (uint32_t factor : { 2u, 4u })
+			{
+				std::vector<uint8_t> out(width * height * 2, GUARD_BYTE);
+				NOS_TEST_CHECK(DownscaleNV12(nv12.data(), nv12.data() + width * height, width, height, 0, factor, out.data(), isa).has_value());
+				const size_t nv12Size = size_t(width / factor) * (height / factor) * 3 / 2;
+				NOS_TEST_CHECK(std::all_of(out.begin(), out.begin() + nv12Size, [value](uint8_t b) { return b == value; }));
+				NOS_TEST_CHECK(DownscaleYUY2(yuy2.data(), width, height, 0, factor, out.data(), isa).has_value());
+				const size_t yuy2Size = size_t(width / factor) * (height / factor) * 2;
+				NOS_TEST_CHECK(std::all_of(out.begin(), out.begin() + yuy2Size, [value](uint8_t b) { return b == value; }));
+			}
+	}
+}
+
+void Rejected()
+{
+	std::vector<uint8_t> frame(64 * 64 * 2), out(64 * 64 * 2);
+	NOS_TEST_CHECK(!DownscaleNV12(frame.data(), frame.data() + 64 * 64, 64, 64, 0, 3, out.data()).has_value());
+	NOS_TEST_CHECK(!DownscaleYUY2(frame.data(), 64, 64, 0, 8, out.data()).has_value());
+	// Too small to give a single chroma sample
+	NOS_TEST_CHECK(!DownscaleNV12(frame.data(), frame.data() + 6 * 6, 6, 6, 0, 4, out.data()).has_value());
+	NOS_TEST_CHECK(!DownscaleYUY2(frame.data(), 6, 2, 0, 4, out.data()).has_value());
+}
+} // namespace
+
+int main()
+{
+	for (PixelIsa isa : GetIsas())
+		std::printf("Checking %s\n", GetPixelIsaName(isa));
+	return test::RunTests({
+		{ "NV12Frames", NV12Frames },
+		{ "YUY2Frames", YUY2Frames },
+		{ "Extremes", Extremes },
+		{ "Rejected", Rejected },
+	});
+}
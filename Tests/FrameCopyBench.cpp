@@ -0,0 +1,89 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Frame copies of 1 to 8 streams at once, each on its own thread like the readers, with FrameCopy's shared workers against memcpy.
+// Prints the frames per second all streams copy together and the time of one frame, for YUY2 frames from 720p to 4K.
+#include "BenchHelpers.h"
+#include "FrameCopy.h"
+
+#include <atomic>
+#include <cstring>
+#include <latch>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+struct Result
+{
+	double FramesPerSecond = 0;
+	double SecondsPerFrame = 0;
+};
+
+// Every stream copies its own frame over and over for the same time, the streams start together
+Result RunStreams(uint32_t streamCount, size_t frameSize, std::function<void(uint8_t*, uint8_t const*)> const& copy)
+{
+	using Clock = std::chrono::steady_clock;
+	constexpr auto RUN_TIME = std::chrono::milliseconds(300);
+	std::vector<test::PageAlignedBuffer> sources, destinations;
+	for (uint32_t i = 0; i < streamCount; i++)
+	{
+		sources.emplace_back(frameSize);
+		destinations.emplace_back(frameSize);
+		std::memset(sources.back().Data(), int(i + 1), frameSize);
+	}
+	std::latch start(streamCount);
+	std::atomic_uint64_t frames = 0;
+	std::vector<std::thread> streams;
+	for (uint32_t i = 0; i < streamCount; i++)
+		streams.emplace_back([&, i] {
+			uint8_t* dst = destinations[i].Data();
+			uint8_t const* src = sources[i].Data();
+			// Warms the destination pages
+			copy(dst, src);
+			start.arrive_and_wait();
+			const auto begin = Clock::now();
+			uint64_t copied = 0;
+			while (Clock::now() - begin < RUN_TIME)
+			{
+				copy(dst, src);
+				copied++;
+			}
+			frames += copied;
+		});
+	for (auto& stream : streams)
+		stream.join();
+	const double seconds = std::chrono::duration<double>(RUN_TIME).count();
+	return { .FramesPerSecond = double(frames) / seconds, .SecondsPerFrame = seconds * streamCount / double(frames) };
+}
+} // namespace
+
+int main()
+{
+	const std::pair<uint32_t, uint32_t> resolutions[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	std::printf("%u cores, readers get %u copy workers\n", std::thread::hardware_concurrency(), FrameCopy::GetDefaultWorkerCount());
+	std::printf("%-10s %-8s %-18s %10s %10s %10s\n", "Size", "Streams", "Copy", "frames/s", "ms/frame", "GB/s");
+	for (auto [width, height] : resolutions)
+	{
+		const FrameLayout layout{ .FourCC = FOURCC_YUY2, .Resolution = nos::fb::vec2u(width, height) };
+		const size_t frameSize = GetFrameBufferSize(FOURCC_YUY2, layout.Resolution);
+		const std::string size = std::to_string(width) + "x" + std::to_string(height);
+		for (uint32_t streamCount : { 1u, 2u, 4u, 8u })
+		{
+			auto print = [&](std::string const& name, Result const& result) {
+				std::printf("%-10s %-8u %-18s %10.0f %10.3f %10.2f\n", size.c_str(), streamCount, name.c_str(), result.FramesPerSecond, result.SecondsPerFrame * 1e3,
+					test::GigabytesPerSecond(frameSize, 1 / result.FramesPerSecond));
+			};
+			print("memcpy", RunStreams(streamCount, frameSize, [&](uint8_t* dst, uint8_t const* src) { std::memcpy(dst, src, frameSize); }));
+			for (uint32_t workers : { 0u, 1u, 3u, 7u })
+			{
+				FrameCopy copier(workers);
+				const std::string name = "FrameCopy " + std::to_string(workers) + (workers == 1 ? " worker" : " workers");
+				print(name, RunStreams(streamCount, frameSize, [&](uint8_t* dst, uint8_t const* src) { copier.Copy(dst, frameSize, src, frameSize, layout); }));
+			}
+		}
+	}
+	return 0;
+}
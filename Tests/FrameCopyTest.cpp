@@ -0,0 +1,154 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "FrameCopy.h"
+#include "PixelConvert.h"
+#include "TestHelpers.h"
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+std::mt19937 Random(1414);
+
+std::vector<uint8_t> RandomBytes(size_t size)
+{
+	std::vector<uint8_t> bytes(size);
+	for (auto& byte : bytes)
+		byte = uint8_t(Random());
+	return bytes;
+}
+
+// Packed copy of an uncompressed frame, row by row from the top
+std::vector<uint8_t> ReferenceCopy(uint8_t const* top, FrameLayout const& layout, FrameRegion const& region)
+{
+	const size_t pixelSize = GetFrameRowSize(layout.FourCC, 1);
+	const int64_t pitch = layout.Pitch ? layout.Pitch : int64_t(GetFrameRowSize(layout.FourCC, layout.Resolution.x()));
+	std::vector<uint8_t> out;
+	for (uint32_t y = region.Y; y < region.Y + region.Height; y++)
+	{
+		uint8_t const* row = top + int64_t(y) * pitch + region.X * pixelSize;
+		out.insert(out.end(), row, row + region.Width * pixelSize);
+	}
+	if (layout.FourCC == FOURCC_NV12)
+	{
+		uint8_t const* chroma = top + int64_t(layout.Resolution.y()) * pitch;
+		for (uint32_t y = region.Y / 2; y < (region.Y + region.Height) / 2; y++)
+		{
+			uint8_t const* row = chroma + int64_t(y) * pitch + region.X;
+			out.insert(out.end(), row, row + region.Width);
+		}
+	}
+	return out;
+}
+
+// Packed, padded and bottom-up frames, whole and cropped, split into bands or not
+void CopyLayouts()
+{
+	const std::pair<uint32_t, uint32_t> sizes[] = { { 64, 8 }, { 1920, 1080 }, { 3840, 2160 } };
+	for (uint32_t workers : { 0u, 3u })
+	{
+		FrameCopy copier(workers);
+		for (uint32_t fourCC : { FOURCC_YUY2, FOURCC_NV12, FOURCC_BGR24 })
+			for (auto [width, height] : sizes)
+			{
+				const size_t rowSize = GetFrameRowSize(fourCC, width);
+				const uint32_t rows = fourCC == FOURCC_NV12 ? height + height / 2 : height;
+				for (int64_t padding : { 0, 64 })
+					for (bool bottomUp : { false, true })
+					{
+						// NV12 planes are stored top-down
+						if (bottomUp && fourCC == FOURCC_NV12)
+							continue;
+						const size_t stride = rowSize + padding;
+						const auto frame = RandomBytes(stride * rows);
+						uint8_t const* top = bottomUp ? frame.data() + stride * (rows - 1) : frame.data();
+						const int32_t pitch = bottomUp ? -int32_t(stride) : padding ? int32_t(stride) : 0;
+						const FrameLayout layout{ .FourCC = fourCC, .Resolution = nos::fb::vec2u(width, height), .Pitch = pitch };
+						for (auto region : { FrameRegion{ .Width = width, .Height = height }, FrameRegion{ .X = 2, .Y = 2, .Width = width / 2, .Height = height / 2 } })
+						{
+							const auto expected = ReferenceCopy(top, layout, region);
+							std::vector<uint8_t> actual(expected.size() + 64, 0xA5);
+							// Bottom-up buffers are passed without their extent, like the backends do
+							const size_t written = copier.Copy(actual.data(), actual.size(), top, bottomUp ? 0 : frame.size(), layout, region);
+							const bool matches = written == expected.size() && std::equal(expected.begin(), expected.end(), actual.begin()) && actual[expected.size()] == 0xA5;
+							if (!matches)
+								std::fprintf(stderr, "  Mismatch: %u workers %.4s %ux%u padding %d bottom-up %d region %ux%u\n", workers, reinterpret_cast<const char*>(&fourCC),
+									width, height, int(padding), int(bottomUp), region.Width, region.Height);
+							NOS_TEST_CHECK(matches);
+						}
+					}
+			}
+	}
+}
+
+// Skip Unchanged compares hashes of frames copied whenever their reader ran, other streams copying at the same time must not change them
+void HashesIgnoreConcurrency()
+{
+	FrameCopy copier(3);
+	const FrameLayout layout{ .FourCC = FOURCC_YUY2, .Resolution = nos::fb::vec2u(3840, 2160) };
+	const auto frame = RandomBytes(GetFrameBufferSize(FOURCC_YUY2, layout.Resolution));
+	const uint64_t alone = copier.Hash(frame.data(), frame.size(), layout);
+	std::atomic_bool same = true;
+	std::vector<std::thread> streams;
+	for (int i = 0; i < 4; i++)
+		streams.emplace_back([&] {
+			std::vector<uint8_t> copy(frame.size());
+			for (int j = 0; j < 5; j++)
+			{
+				uint64_t hash = 0;
+				copier.Copy(copy.data(), copy.size(), frame.data(), frame.size(), layout, std::nullopt, &hash);
+				same = same && hash == alone;
+			}
+		});
+	for (auto& stream : streams)
+		stream.join();
+	NOS_TEST_CHECK(same);
+}
+
+// Banded repack gives what a single pass over the whole frame gives, for any number of bands
+void RepackInBands()
+{
+	const std::pair<uint32_t, uint32_t> sizes[] = { { 2, 2 }, { 64, 6 }, { 130, 34 }, { 1920, 1080 }, { 3840, 2160 } };
+	for (uint32_t workers : { 0u, 1u, 3u, 7u })
+	{
+		FrameCopy copier(workers);
+		for (auto [width, height] : sizes)
+		{
+			const size_t packedPitch = size_t(width) * 2;
+			for (int32_t pitch : { 0, int32_t(packedPitch + 64), -int32_t(packedPitch) })
+			{
+				const size_t stride = pitch ? size_t(std::abs(pitch)) : packedPitch;
+				const auto yuy2 = RandomBytes(stride * height);
+				uint8_t const* top = pitch < 0 ? yuy2.data() + stride * (height - 1) : yuy2.data();
+				const size_t size = size_t(width) * height * 3 / 2;
+				std::vector<uint8_t> expected(size), actual(size + 64, 0xA5);
+				NOS_TEST_CHECK(ConvertYUY2ToNV12(top, width, height, expected.data(), pitch, PixelIsa::Scalar).has_value());
+				auto written = copier.Repack(actual.data(), top, width, height, pitch);
+				NOS_TEST_CHECK(written && *written == size);
+				const bool matches = std::equal(expected.begin(), expected.end(), actual.begin()) && actual[size] == 0xA5;
+				if (!matches)
+					std::fprintf(stderr, "  Mismatch: %u workers %ux%u pitch %d\n", workers, width, height, pitch);
+				NOS_TEST_CHECK(matches);
+			}
+		}
+	}
+	FrameCopy copier(1);
+	std::vector<uint8_t> frame(64);
+	NOS_TEST_CHECK(!copier.Repack(frame.data(), frame.data(), 3, 2).has_value());
+}
+} // namespace
+
+int main()
+{
+	return test::RunTests({
+		{ "CopyLayouts", CopyLayouts },
+		{ "HashesIgnoreConcurrency", HashesIgnoreConcurrency },
+		{ "RepackInBands", RepackInBands },
+	});
+}
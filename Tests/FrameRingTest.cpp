@@ -0,0 +1,186 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "FrameRing.h"
+#include "TestHelpers.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+using namespace nos::webcam;
+
+namespace
+{
+// Stand-in for a captured sample, move-only like StreamSample with its lease
+struct SyntheticFrame
+{
+	uint64_t Sequence = 0;
+	std::unique_ptr<uint8_t[]> Data;
+	static constexpr size_t SIZE = 64;
+
+	static SyntheticFrame Make(uint64_t sequence)
+	{
+		SyntheticFrame frame{ .Sequence = sequence, .Data = std::make_unique<uint8_t[]>(SIZE) };
+		for (size_t i = 0; i < SIZE; i++)
+			frame.Data[i] = uint8_t(sequence + i);
+		return frame;
+	}
+
+	bool IsIntact() const
+	{
+		for (size_t i = 0; i < SIZE; i++)
+			if (Data[i] != uint8_t(Sequence + i))
+				return false;
+		return true;
+	}
+};
+
+void PushPop()
+{
+	SPSCRing<int> ring(3);
+	NOS_TEST_CHECK(ring.Empty());
+	NOS_TEST_CHECK(!ring.TryPop());
+	NOS_TEST_CHECK(ring.TryPush(1));
+	NOS_TEST_CHECK(ring.TryPush(2));
+	NOS_TEST_CHECK(ring.Size() == 2);
+	auto first = ring.TryPop();
+	NOS_TEST_CHECK(first && *first == 1);
+	auto second = ring.TryPop();
+	NOS_TEST_CHECK(second && *second == 2);
+	NOS_TEST_CHECK(ring.Empty());
+	NOS_TEST_CHECK(!ring.TryPop());
+}
+
+void Full()
+{
+	SPSCRing<SyntheticFrame> ring(3);
+	NOS_TEST_CHECK(ring.Capacity() == 3);
+	for (uint64_t i = 0; i < 3; i++)
+		NOS_TEST_CHECK(ring.TryPush(SyntheticFrame::Make(i)));
+	NOS_TEST_CHECK(ring.Size() == 3);
+	// A rejected value stays with the caller
+	auto rejected = SyntheticFrame::Make(3);
+	NOS_TEST_CHECK(!ring.TryPush(std::move(rejected)));
+	NOS_TEST_CHECK(rejected.Data && rejected.IsIntact());
+	auto oldest = ring.TryPop();
+	NOS_TEST_CHECK(oldest && oldest->Sequence == 0);
+	NOS_TEST_CHECK(ring.TryPush(std::move(rejected)));
+	NOS_TEST_CHECK(ring.Size() == 3);
+}
+
+void WrapAround()
+{
+	SPSCRing<SyntheticFrame> ring(3);
+	uint64_t pushed = 0, popped = 0;
+	// Head and tail pass the end of the slot array many times at every fill level
+	for (int round = 0; round < 20; round++)
+	{
+		const size_t count = 1 + round % 3;
+		for (size_t i = 0; i < count; i++)
+			NOS_TEST_CHECK(ring.TryPush(SyntheticFrame::Make(pushed++)));
+		NOS_TEST_CHECK(ring.Size() == count);
+		for (size_t i = 0; i < count; i++)
+		{
+			auto frame = ring.TryPop();
+			NOS_TEST_CHECK(frame && frame->Sequence == popped++ && frame->IsIntact());
+		}
+		NOS_TEST_CHECK(ring.Empty());
+	}
+}
+
+void SyntheticProducer()
+{
+	constexpr uint64_t FRAME_COUNT = 200'000;
+	SPSCRing<SyntheticFrame> ring(3);
+	uint64_t dropped = 0;
+	std::atomic_bool done = false;
+	// Behaves like the capture thread, a full ring drops the new frame instead of waiting for the reader
+	std::thread producer([&] {
+		for (uint64_t i = 0; i < FRAME_COUNT; i++)
+			if (!ring.TryPush(SyntheticFrame::Make(i)))
+				dropped++;
+		done = true;
+	});
+	uint64_t delivered = 0, lastSequence = 0;
+	bool ordered = true, intact = true;
+	while (!done || !ring.Empty())
+	{
+		auto frame = ring.TryPop();
+		if (!frame)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		ordered &= delivered == 0 || frame->Sequence > lastSequence;
+		intact &= frame->IsIntact();
+		lastSequence = frame->Sequence;
+		delivered++;
+	}
+	producer.join();
+	NOS_TEST_CHECK(ordered);
+	NOS_TEST_CHECK(intact);
+	NOS_TEST_CHECK(delivered + dropped == FRAME_COUNT);
+	NOS_TEST_CHECK(delivered > 0);
+	std::printf("  %llu frames delivered, %llu dropped on a full ring\n", (unsigned long long)delivered, (unsigned long long)dropped);
+}
+
+void LatestFrameMailbox()
+{
+	LatestMailbox<SyntheticFrame> mailbox;
+	NOS_TEST_CHECK(mailbox.Empty());
+	NOS_TEST_CHECK(!mailbox.Take());
+	NOS_TEST_CHECK(!mailbox.Put(SyntheticFrame::Make(0)));
+	// Unread frame is replaced and reported as such
+	NOS_TEST_CHECK(mailbox.Put(SyntheticFrame::Make(1)));
+	auto latest = mailbox.Take();
+	NOS_TEST_CHECK(latest && latest->Sequence == 1 && latest->IsIntact());
+	NOS_TEST_CHECK(mailbox.Empty());
+	// An unread frame left in the mailbox is freed with it
+	NOS_TEST_CHECK(!mailbox.Put(SyntheticFrame::Make(2)));
+}
+
+void LatestFrameMailboxThreaded()
+{
+	constexpr uint64_t FRAME_COUNT = 100'000;
+	LatestMailbox<SyntheticFrame> mailbox;
+	uint64_t replaced = 0;
+	std::thread producer([&] {
+		for (uint64_t i = 0; i < FRAME_COUNT; i++)
+			replaced += mailbox.Put(SyntheticFrame::Make(i));
+	});
+	uint64_t taken = 0, lastSequence = 0;
+	bool ordered = true, intact = true;
+	// Reader may skip frames but never sees one older than what it already took
+	while (lastSequence + 1 < FRAME_COUNT)
+	{
+		auto frame = mailbox.Take();
+		if (!frame)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		ordered &= taken == 0 || frame->Sequence > lastSequence;
+		intact &= frame->IsIntact();
+		lastSequence = frame->Sequence;
+		taken++;
+	}
+	producer.join();
+	NOS_TEST_CHECK(ordered);
+	NOS_TEST_CHECK(intact);
+	NOS_TEST_CHECK(lastSequence == FRAME_COUNT - 1);
+	NOS_TEST_CHECK(taken + replaced == FRAME_COUNT);
+}
+} // namespace
+
+int main()
+{
+	return test::RunTests({
+		{ "PushPop", PushPop },
+		{ "Full", Full },
+		{ "WrapAround", WrapAround },
+		{ "SyntheticProducer", SyntheticProducer },
+		{ "LatestFrameMailbox", LatestFrameMailbox },
+		{ "LatestFrameMailboxThreaded", LatestFrameMailboxThreaded },
+	});
+}
@@ -0,0 +1,70 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// MJPEG decode throughput of FrameDecoder from 1 worker up to one per core, on a directory of JPEG files or on 4:2:2 frames encoded here.
+//   JpegDecodeBench [directory]
+#include "JpegFiles.h"
+#include "TestHelpers.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nos::webcam;
+
+int main(int argc, char** argv)
+{
+	if (!IsJpegDecodeSupported())
+	{
+		std::printf("Built without a JPEG library\n");
+		return test::SKIPPED;
+	}
+	std::vector<test::JpegFile> files;
+	if (argc > 1)
+	{
+		auto loaded = test::LoadJpegFiles(argv[1]);
+		if (!loaded)
+		{
+			std::fprintf(stderr, "%s\n", loaded.error().c_str());
+			return EXIT_FAILURE;
+		}
+		files = std::move(*loaded);
+	}
+#if defined(NOSWEBCAM_WITH_JPEG)
+	else
+		for (auto [width, height] : { std::pair{ 1280u, 720u }, std::pair{ 1920u, 1080u }, std::pair{ 3840u, 2160u } })
+			for (auto& file : test::MakeWebcamJpegFiles(width, height, 8))
+				files.push_back(std::move(file));
+#endif
+
+	// Powers of two up to the core count, and up to 4 on smaller machines to show what more workers than cores do
+	const uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threads = 1; threads < std::max(cores, 4u); threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(std::max(cores, 4u));
+
+	std::printf("%u cores, %s\n", cores, argc > 1 ? argv[1] : "4:2:2 frames encoded here");
+	std::printf("%-10s %6s %8s %10s %10s %10s %10s %12s\n", "Size", "Files", "Threads", "frames/s", "ms/frame", "MB/s in", "speedup", "per thread");
+	for (auto const& [size, group] : test::GroupByResolution(files))
+	{
+		size_t bytes = 0;
+		for (auto const& file : group)
+			bytes += file.Data.size();
+		// Enough frames for about a second on one thread, measured with a first pass
+		const auto pass = test::RunDecodeStage(group, 1, group.size());
+		const uint64_t frameCount = std::max<uint64_t>(group.size(), uint64_t(double(group.size()) / pass.Seconds));
+		double single = 0;
+		for (uint32_t threads : threadCounts)
+		{
+			const auto result = test::RunDecodeStage(group, threads, frameCount);
+			const double fps = double(result.Delivered) / result.Seconds;
+			if (threads == 1)
+				single = fps;
+			const double megabytes = double(bytes) / double(group.size()) * double(result.Delivered) / 1e6;
+			std::printf("%-10s %6zu %8u %10.1f %10.2f %10.1f %9.2fx %11.0f%%%s\n", (std::to_string(size.first) + "x" + std::to_string(size.second)).c_str(), group.size(),
+				threads, fps, 1e3 / fps, megabytes / result.Seconds, fps / single, fps / single / threads * 100, result.Dropped ? (", " + std::to_string(result.Dropped) + " dropped").c_str() : "");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// MJPEG decoding into NV12, on frames encoded here and on a directory of JPEG files decoded through FrameDecoder.
+//   JpegDecodeTest [directory], or NOSWEBCAM_JPEG_DIR. Without either, frames encoded here are written to a temporary directory.
+// Skipped when built without a JPEG library, or when the given directory does not exist.
+#include "JpegFiles.h"
+#include "TestHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+std::vector<test::JpegFile> DirectoryFiles;
+
+#if defined(NOSWEBCAM_WITH_JPEG)
+// Bytes past the frame that must be left alone
+constexpr size_t GUARD = 64;
+constexpr uint8_t GUARD_BYTE = 0xA5;
+
+struct Difference
+{
+	double Mean = 0;
+	int Max = 0;
+};
+
+Difference Compare(uint8_t const* actual, std::vector<uint8_t> const& expected)
+{
+	Difference difference;
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		const int d = std::abs(int(actual[i]) - int(expected[i]));
+		difference.Mean += d;
+		difference.Max = std::max(difference.Max, d);
+	}
+	difference.Mean /= double(expected.size());
+	return difference;
+}
+
+// Chroma of the synthetic frame averaged over 2x2 blocks, interleaved like NV12
+std::vector<uint8_t> GetExpectedChroma(test::SyntheticFrame const& frame)
+{
+	std::vector<uint8_t> uv;
+	for (uint32_t y = 0; y < frame.Height; y += 2)
+		for (uint32_t x = 0; x < frame.Width; x += 2)
+			for (auto const* plane : { &frame.Cb, &frame.Cr })
+			{
+				auto at = [&](uint32_t dx, uint32_t dy) { return uint32_t((*plane)[size_t(y + dy) * frame.Width + x + dx]); };
+				uv.push_back(uint8_t((at(0, 0) + at(1, 0) + at(0, 1) + at(1, 1) + 2) / 4));
+			}
+	return uv;
+}
+
+// Every chroma subsampling libjpeg writes, at sizes with partial MCUs on the right and bottom
+void SyntheticFrames()
+{
+	auto decoder = CreateJpegDecoder();
+	const std::pair<uint32_t, uint32_t> sizes[] = { { 64, 32 }, { 100, 50 }, { 1280, 720 } };
+	for (auto [width, height] : sizes)
+		for (auto sampling : { test::JpegSampling::Gray, test::JpegSampling::YUV420, test::JpegSampling::YUV422, test::JpegSampling::YUV444 })
+		{
+			const test::SyntheticFrame frame(width, height, 1);
+			const auto jpeg = test::EncodeJpeg(frame, sampling, 95);
+			std::vector<uint8_t> nv12(size_t(width) * height * 3 / 2 + GUARD, GUARD_BYTE);
+			auto decoded = decoder->DecodeToNV12(jpeg.data(), uint32_t(jpeg.size()), nos::fb::vec2u(width, height), nv12.data());
+			NOS_TEST_CHECK(decoded.has_value());
+			if (!decoded)
+				continue;
+			const size_t lumaSize = size_t(width) * height;
+			const Difference luma = Compare(nv12.data(), frame.Y);
+			const bool gray = sampling == test::JpegSampling::Gray;
+			const Difference chroma = gray ? Difference{} : Compare(nv12.data() + lumaSize, GetExpectedChroma(frame));
+			const bool grayChroma = !gray || std::all_of(nv12.begin() + lumaSize, nv12.begin() + lumaSize * 3 / 2, [](uint8_t b) { return b == 128; });
+			const bool guarded = std::all_of(nv12.end() - GUARD, nv12.end(), [](uint8_t b) { return b == GUARD_BYTE; });
+			// Quality 95 on smooth gradients loses under a code value on average, a few at block edges
+			const bool matches = luma.Mean < 1 && luma.Max <= 12 && chroma.Mean < 1 && chroma.Max <= 4 && grayChroma && guarded;
+			if (!matches)
+				std::fprintf(stderr, "  Mismatch: %ux%u %s luma mean %.2f max %d, chroma mean %.2f max %d\n", width, height, test::GetJpegSamplingName(sampling),
+					luma.Mean, luma.Max, chroma.Mean, chroma.Max);
+			NOS_TEST_CHECK(matches);
+		}
+}
+
+// Errors leave the decoder usable for the next frame
+void Rejected()
+{
+	auto decoder = CreateJpegDecoder();
+	const test::SyntheticFrame frame(64, 32, 2);
+	const auto jpeg = test::EncodeJpeg(frame, test::JpegSampling::YUV422, 90);
+	std::vector<uint8_t> nv12(64 * 32 * 3 / 2), expected(nv12.size());
+	NOS_TEST_CHECK(CreateJpegDecoder()->DecodeToNV12(jpeg.data(), uint32_t(jpeg.size()), nos::fb::vec2u(64, 32), expected.data()).has_value());
+
+	const std::vector<uint8_t> garbage(1000, 0x42);
+	NOS_TEST_CHECK(!decoder->DecodeToNV12(garbage.data(), uint32_t(garbage.size()), nos::fb::vec2u(64, 32), nv12.data()).has_value());
+	auto wrongSize = decoder->DecodeToNV12(jpeg.data(), uint32_t(jpeg.size()), nos::fb::vec2u(128, 32), nv12.data());
+	NOS_TEST_CHECK(!wrongSize.has_value() && wrongSize.error().find("64x32") != std::string::npos);
+	// Cut inside the header
+	NOS_TEST_CHECK(!decoder->DecodeToNV12(jpeg.data(), 40, nos::fb::vec2u(64, 32), nv12.data()).has_value());
+
+	NOS_TEST_CHECK(decoder->DecodeToNV12(jpeg.data(), uint32_t(jpeg.size()), nos::fb::vec2u(64, 32), nv12.data()).has_value());
+	NOS_TEST_CHECK(nv12 == expected);
+}
+#endif
+
+// Every file decodes, and FrameDecoder delivers them in order and unchanged on any number of workers
+void DirectoryDecodes()
+{
+	for (auto const& [size, files] : test::GroupByResolution(DirectoryFiles))
+	{
+		const size_t frameSize = GetFrameBufferSize(FOURCC_NV12, files.front().Resolution);
+		std::vector<std::vector<uint8_t>> expected;
+		auto decoder = CreateJpegDecoder();
+		for (auto const& file : files)
+		{
+			expected.emplace_back(frameSize);
+			auto decoded = decoder->DecodeToNV12(file.Data.data(), uint32_t(file.Data.size()), file.Resolution, expected.back().data());
+			if (!decoded)
+				std::fprintf(stderr, "  %s: %s\n", file.Name.c_str(), decoded.error().c_str());
+			NOS_TEST_CHECK(decoded.has_value());
+		}
+		for (uint32_t threads : { 1u, 4u })
+		{
+			uint64_t next = 0;
+			bool ordered = true, unchanged = true;
+			const auto result = test::RunDecodeStage(files, threads, files.size() * 2, [&](uint64_t number, uint8_t const* nv12) {
+				// Dropped frames leave gaps, the order must still only go forward
+				ordered = ordered && number >= next;
+				unchanged = unchanged && std::memcmp(nv12, expected[number % files.size()].data(), frameSize) == 0;
+				next = number + 1;
+			});
+			std::printf("  %ux%u: %zu files on %u threads, %llu delivered, %llu dropped\n", size.first, size.second, files.size(), threads,
+				(unsigned long long)result.Delivered, (unsigned long long)result.Dropped);
+			// More workers can finish frames out of order faster than earlier ones, the stage then runs out of buffers and drops
+			NOS_TEST_CHECK(result.Delivered + result.Dropped == files.size() * 2 && (threads > 1 || result.Dropped == 0));
+			NOS_TEST_CHECK(ordered && unchanged);
+		}
+	}
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (!IsJpegDecodeSupported())
+	{
+		std::printf("Built without a JPEG library\n");
+		return test::SKIPPED;
+	}
+	const char* directory = argc > 1 ? argv[1] : std::getenv("NOSWEBCAM_JPEG_DIR");
+	std::filesystem::path generated;
+	if (directory && !std::filesystem::is_directory(directory))
+	{
+		std::printf("No directory %s\n", directory);
+		return test::SKIPPED;
+	}
+#if defined(NOSWEBCAM_WITH_JPEG)
+	if (!directory)
+	{
+		// Files on disk so the directory is read the same way as a given one
+		generated = std::filesystem::temp_directory_path() / ("JpegDecodeTest." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+		std::filesystem::create_directories(generated);
+		for (auto [width, height] : { std::pair{ 640u, 480u }, std::pair{ 1280u, 720u } })
+			for (auto const& file : test::MakeWebcamJpegFiles(width, height, 3))
+				std::ofstream(generated / (std::to_string(width) + "x" + std::to_string(height) + "." + file.Name), std::ios::binary)
+					.write(reinterpret_cast<const char*>(file.Data.data()), std::streamsize(file.Data.size()));
+	}
+#endif
+	auto files = test::LoadJpegFiles(directory ? std::filesystem::path(directory) : generated);
+	if (!generated.empty())
+		std::filesystem::remove_all(generated);
+	if (!files)
+	{
+		std::fprintf(stderr, "%s\n", files.error().c_str());
+		return EXIT_FAILURE;
+	}
+	DirectoryFiles = std::move(*files);
+	std::printf("Decoding %zu files from %s\n", DirectoryFiles.size(), directory ? directory : "frames encoded here");
+	return test::RunTests({
+#if defined(NOSWEBCAM_WITH_JPEG)
+		{ "SyntheticFrames", SyntheticFrames },
+		{ "Rejected", Rejected },
+#endif
+		{ "DirectoryDecodes", DirectoryDecodes },
+	});
+}
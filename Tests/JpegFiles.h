@@ -0,0 +1,269 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+// JPEG frames for the decode test and benchmark, read from a directory or encoded from synthetic frames,
+// and a runner that feeds them through FrameDecoder like a device would
+
+#include "FrameDecoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <expected>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if defined(NOSWEBCAM_WITH_JPEG)
+#include <cstdio>
+#include <cstdlib>
+#include <jpeglib.h>
+#endif
+
+namespace nos::webcam::test
+{
+struct JpegFile
+{
+	std::string Name;
+	std::vector<uint8_t> Data;
+	nos::fb::vec2u Resolution;
+};
+
+// Image size from the start of frame segment, nullopt if there is none
+inline std::optional<nos::fb::vec2u> ReadJpegResolution(std::vector<uint8_t> const& data)
+{
+	if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8)
+		return std::nullopt;
+	size_t i = 2;
+	while (i + 4 <= data.size())
+	{
+		if (data[i] != 0xFF)
+			return std::nullopt;
+		const uint8_t marker = data[i + 1];
+		// Fill bytes before a marker
+		if (marker == 0xFF)
+		{
+			i++;
+			continue;
+		}
+		// SOF0 to SOF15, except DHT, JPG and DAC which share the range
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			if (i + 9 > data.size())
+				return std::nullopt;
+			return nos::fb::vec2u((data[i + 7] << 8) | data[i + 8], (data[i + 5] << 8) | data[i + 6]);
+		}
+		i += 2 + ((size_t(data[i + 2]) << 8) | data[i + 3]);
+	}
+	return std::nullopt;
+}
+
+// Every .jpg and .jpeg file in the directory, in name order
+inline std::expected<std::vector<JpegFile>, std::string> LoadJpegFiles(std::filesystem::path const& directory)
+{
+	std::error_code error;
+	std::vector<std::filesystem::path> paths;
+	for (auto const& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		std::string extension = entry.path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+		if (entry.is_regular_file() && (extension == ".jpg" || extension == ".jpeg"))
+			paths.push_back(entry.path());
+	}
+	if (error)
+		return std::unexpected("Can not read " + directory.string() + ": " + error.message());
+	std::sort(paths.begin(), paths.end());
+	std::vector<JpegFile> files;
+	for (auto const& path : paths)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		JpegFile file{ .Name = path.filename().string(), .Data = std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), {}) };
+		auto resolution = ReadJpegResolution(file.Data);
+		if (!resolution)
+			return std::unexpected(file.Name + " has no JPEG frame header");
+		file.Resolution = *resolution;
+		files.push_back(std::move(file));
+	}
+	if (files.empty())
+		return std::unexpected("No JPEG files in " + directory.string());
+	return files;
+}
+
+// Files of each resolution, FrameDecoder decodes a single one
+inline std::map<std::pair<uint32_t, uint32_t>, std::vector<JpegFile>> GroupByResolution(std::vector<JpegFile> const& files)
+{
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<JpegFile>> groups;
+	for (auto const& file : files)
+		groups[{ file.Resolution.x(), file.Resolution.y() }].push_back(file);
+	return groups;
+}
+
+#if defined(NOSWEBCAM_WITH_JPEG)
+enum class JpegSampling
+{
+	Gray,
+	YUV420,
+	YUV422,
+	YUV444,
+};
+
+inline const char* GetJpegSamplingName(JpegSampling sampling)
+{
+	switch (sampling)
+	{
+	case JpegSampling::Gray: return "gray";
+	case JpegSampling::YUV420: return "4:2:0";
+	case JpegSampling::YUV422: return "4:2:2";
+	default: return "4:4:4";
+	}
+}
+
+// Full resolution planes of a smooth frame, so compression loses little and decoded samples can be compared to these
+struct SyntheticFrame
+{
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<uint8_t> Y, Cb, Cr;
+
+	SyntheticFrame(uint32_t width, uint32_t height, uint32_t seed) : Width(width), Height(height)
+	{
+		const size_t pixels = size_t(width) * height;
+		Y.resize(pixels);
+		Cb.resize(pixels);
+		Cr.resize(pixels);
+		for (uint32_t y = 0; y < height; y++)
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const size_t i = size_t(y) * width + x;
+				Y[i] = uint8_t(16 + (x * 219 / width + y * 37 / height + seed * 13) % 220);
+				Cb[i] = uint8_t(64 + (y * 128 / height + seed * 7) % 128);
+				Cr[i] = uint8_t(64 + (x * 128 / width + seed * 11) % 128);
+			}
+	}
+};
+
+inline std::vector<uint8_t> EncodeJpeg(SyntheticFrame const& frame, JpegSampling sampling, int quality)
+{
+	jpeg_compress_struct info{};
+	jpeg_error_mgr error{};
+	info.err = jpeg_std_error(&error);
+	jpeg_create_compress(&info);
+	unsigned char* out = nullptr;
+	unsigned long outSize = 0;
+	jpeg_mem_dest(&info, &out, &outSize);
+	const bool gray = sampling == JpegSampling::Gray;
+	info.image_width = frame.Width;
+	info.image_height = frame.Height;
+	info.input_components = gray ? 1 : 3;
+	info.in_color_space = gray ? JCS_GRAYSCALE : JCS_YCbCr;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info, quality, TRUE);
+	if (!gray)
+	{
+		info.comp_info[0].h_samp_factor = sampling == JpegSampling::YUV444 ? 1 : 2;
+		info.comp_info[0].v_samp_factor = sampling == JpegSampling::YUV420 ? 2 : 1;
+		for (int c = 1; c < 3; c++)
+			info.comp_info[c].h_samp_factor = info.comp_info[c].v_samp_factor = 1;
+	}
+	jpeg_start_compress(&info, TRUE);
+	std::vector<uint8_t> row(size_t(frame.Width) * info.input_components);
+	while (info.next_scanline < info.image_height)
+	{
+		const size_t offset = size_t(info.next_scanline) * frame.Width;
+		for (uint32_t x = 0; x < frame.Width; x++)
+		{
+			if (gray)
+				row[x] = frame.Y[offset + x];
+			else
+			{
+				row[x * 3] = frame.Y[offset + x];
+				row[x * 3 + 1] = frame.Cb[offset + x];
+				row[x * 3 + 2] = frame.Cr[offset + x];
+			}
+		}
+		JSAMPROW rows[] = { row.data() };
+		jpeg_write_scanlines(&info, rows, 1);
+	}
+	jpeg_finish_compress(&info);
+	std::vector<uint8_t> jpeg(out, out + outSize);
+	jpeg_destroy_compress(&info);
+	std::free(out);
+	return jpeg;
+}
+
+// Frames like webcams send them, 4:2:2 at a quality that keeps them around the size USB 2.0 cameras produce
+inline std::vector<JpegFile> MakeWebcamJpegFiles(uint32_t width, uint32_t height, uint32_t count)
+{
+	std::vector<JpegFile> files;
+	for (uint32_t i = 0; i < count; i++)
+		files.push_back({ .Name = "synthetic" + std::to_string(i) + ".jpg", .Data = EncodeJpeg(SyntheticFrame(width, height, i), JpegSampling::YUV422, 85),
+			.Resolution = nos::fb::vec2u(width, height) });
+	return files;
+}
+#endif
+
+struct DecodeStageResult
+{
+	uint64_t Delivered = 0;
+	// Failed to decode or found no free output buffer
+	uint64_t Dropped = 0;
+	double Seconds = 0;
+};
+
+// Submits frameCount frames, cycling through files of a single resolution, to a FrameDecoder with threadCount workers.
+// Like a device with one buffer per worker and one more, a frame is only submitted when a buffer was given back.
+// onFrame gets the number of each delivered frame, its file is number % files.size(), and the decoded NV12 frame.
+inline DecodeStageResult RunDecodeStage(std::vector<JpegFile> const& files, uint32_t threadCount, uint64_t frameCount,
+	std::function<void(uint64_t number, uint8_t const* nv12)> const& onFrame = {})
+{
+	struct Device : CaptureSession
+	{
+		FormatInfo GetFormat() const override { return Format; }
+		std::optional<CapturedFrame> Dequeue(std::chrono::milliseconds) override { return std::nullopt; }
+		void Requeue(CapturedFrame const&) override
+		{
+			std::unique_lock lock(Mutex);
+			Outstanding--;
+			Returned.notify_all();
+		}
+		void Close() override {}
+
+		FormatInfo Format;
+		std::mutex Mutex;
+		std::condition_variable Returned;
+		uint32_t Outstanding = 0;
+	};
+	auto device = std::make_shared<Device>();
+	device->Format = { .FourCC = FOURCC_MJPG, .Resolution = files.front().Resolution };
+	DecodeStageResult result;
+	FrameDecoder stage(WebcamDevice{ .Name = "JPEG files" }, device->Format, device, threadCount, [&](CapturedFrame const& decoded, SampleInfo const& info, uint64_t) {
+		result.Delivered++;
+		if (onFrame)
+			onFrame(info.Sequence, decoded.Data);
+		stage.Release(decoded.BufferIndex);
+	});
+	const auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < frameCount; i++)
+	{
+		{
+			std::unique_lock lock(device->Mutex);
+			device->Returned.wait(lock, [&] { return device->Outstanding <= threadCount; });
+			device->Outstanding++;
+		}
+		JpegFile const& file = files[i % files.size()];
+		stage.Submit(CapturedFrame{ .Data = const_cast<uint8_t*>(file.Data.data()), .Size = uint32_t(file.Data.size()) }, SampleInfo{ .Sequence = i }, 0);
+	}
+	stage.Drain();
+	result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.Dropped = frameCount - result.Delivered;
+	return result;
+}
+} // namespace nos::webcam::test
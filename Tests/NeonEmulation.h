@@ -0,0 +1,215 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+// Scalar stand-ins for the NEON intrinsics PixelConvertNeon.cpp uses, with the semantics the Arm reference gives them.
+// Lets the NEON kernels be checked against the scalar ones on machines without NEON. Little endian only, like the targets.
+
+#include <cstdint>
+#include <cstring>
+
+template <typename T, int N>
+struct NeonEmulatedVector
+{
+	using Lane = T;
+	static constexpr int LANES = N;
+	T Lanes[N];
+};
+
+using uint8x8_t = NeonEmulatedVector<uint8_t, 8>;
+using uint8x16_t = NeonEmulatedVector<uint8_t, 16>;
+using int16x4_t = NeonEmulatedVector<int16_t, 4>;
+using uint16x4_t = NeonEmulatedVector<uint16_t, 4>;
+using uint16x8_t = NeonEmulatedVector<uint16_t, 8>;
+using int32x4_t = NeonEmulatedVector<int32_t, 4>;
+using uint32x2_t = NeonEmulatedVector<uint32_t, 2>;
+using uint32x4_t = NeonEmulatedVector<uint32_t, 4>;
+using uint64x2_t = NeonEmulatedVector<uint64_t, 2>;
+
+struct uint8x16x2_t { uint8x16_t val[2]; };
+struct uint8x16x3_t { uint8x16_t val[3]; };
+struct uint8x16x4_t { uint8x16_t val[4]; };
+struct uint32x4x2_t { uint32x4_t val[2]; };
+
+namespace nos::webcam::test
+{
+template <typename To, typename From>
+inline To NeonBitCast(From const& from)
+{
+	static_assert(sizeof(To) == sizeof(From));
+	To to;
+	std::memcpy(&to, &from, sizeof(to));
+	return to;
+}
+
+template <typename V>
+inline V NeonLoad(typename V::Lane const* p)
+{
+	V v;
+	std::memcpy(v.Lanes, p, sizeof(v.Lanes));
+	return v;
+}
+
+template <typename V>
+inline void NeonStore(typename V::Lane* p, V const& v)
+{
+	std::memcpy(p, v.Lanes, sizeof(v.Lanes));
+}
+
+// Loads structures of count interleaved elements into count vectors. Like the instructions, p needs no alignment.
+template <typename V, int COUNT, typename Out>
+inline Out NeonLoadInterleaved(typename V::Lane const* p)
+{
+	Out out;
+	for (int i = 0; i < V::LANES; i++)
+		for (int c = 0; c < COUNT; c++)
+			std::memcpy(&out.val[c].Lanes[i], p + i * COUNT + c, sizeof(typename V::Lane));
+	return out;
+}
+
+// Lane by lane into a vector with the same number of lanes, wider or narrower
+template <typename From, typename To>
+inline To NeonConvert(From const& v, auto&& fn)
+{
+	static_assert(From::LANES == To::LANES);
+	To out;
+	for (int i = 0; i < To::LANES; i++)
+		out.Lanes[i] = typename To::Lane(fn(v.Lanes[i]));
+	return out;
+}
+
+template <typename V>
+inline V NeonLanewise(V const& a, V const& b, auto&& fn)
+{
+	V out;
+	for (int i = 0; i < V::LANES; i++)
+		out.Lanes[i] = typename V::Lane(fn(a.Lanes[i], b.Lanes[i]));
+	return out;
+}
+
+// Pairwise sums widened to the next lane size
+template <typename V, typename Wide>
+inline Wide NeonPairwiseLong(V const& v)
+{
+	Wide out;
+	for (int i = 0; i < Wide::LANES; i++)
+		out.Lanes[i] = typename Wide::Lane(v.Lanes[i * 2]) + typename Wide::Lane(v.Lanes[i * 2 + 1]);
+	return out;
+}
+
+template <typename Half, typename Full>
+inline Half NeonHalf(Full const& v, int first)
+{
+	Half out;
+	for (int i = 0; i < Half::LANES; i++)
+		out.Lanes[i] = v.Lanes[first + i];
+	return out;
+}
+
+template <typename Full, typename Half>
+inline Full NeonCombine(Half const& lo, Half const& hi)
+{
+	Full out;
+	for (int i = 0; i < Half::LANES; i++)
+	{
+		out.Lanes[i] = lo.Lanes[i];
+		out.Lanes[Half::LANES + i] = hi.Lanes[i];
+	}
+	return out;
+}
+} // namespace nos::webcam::test
+
+// Loads and stores
+inline uint8x16_t vld1q_u8(uint8_t const* p) { return nos::webcam::test::NeonLoad<uint8x16_t>(p); }
+inline uint64x2_t vld1q_u64(uint64_t const* p) { return nos::webcam::test::NeonLoad<uint64x2_t>(p); }
+inline void vst1q_u8(uint8_t* p, uint8x16_t v) { nos::webcam::test::NeonStore(p, v); }
+inline void vst1_u8(uint8_t* p, uint8x8_t v) { nos::webcam::test::NeonStore(p, v); }
+inline void vst1q_u64(uint64_t* p, uint64x2_t v) { nos::webcam::test::NeonStore(p, v); }
+inline uint8x16x2_t vld2q_u8(uint8_t const* p) { return nos::webcam::test::NeonLoadInterleaved<uint8x16_t, 2, uint8x16x2_t>(p); }
+inline uint8x16x4_t vld4q_u8(uint8_t const* p) { return nos::webcam::test::NeonLoadInterleaved<uint8x16_t, 4, uint8x16x4_t>(p); }
+inline uint32x4x2_t vld2q_u32(uint32_t const* p) { return nos::webcam::test::NeonLoadInterleaved<uint32x4_t, 2, uint32x4x2_t>(p); }
+
+inline void vst3q_u8(uint8_t* p, uint8x16x3_t v)
+{
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			p[i * 3 + c] = v.val[c].Lanes[i];
+}
+
+// Reinterpreting casts
+inline int16x4_t vreinterpret_s16_u16(uint16x4_t v) { return nos::webcam::test::NeonBitCast<int16x4_t>(v); }
+inline uint8x16_t vreinterpretq_u8_u32(uint32x4_t v) { return nos::webcam::test::NeonBitCast<uint8x16_t>(v); }
+inline uint64x2_t vreinterpretq_u64_u8(uint8x16_t v) { return nos::webcam::test::NeonBitCast<uint64x2_t>(v); }
+
+// Halves and combining
+inline uint8x8_t vget_low_u8(uint8x16_t v) { return nos::webcam::test::NeonHalf<uint8x8_t>(v, 0); }
+inline uint8x8_t vget_high_u8(uint8x16_t v) { return nos::webcam::test::NeonHalf<uint8x8_t>(v, 8); }
+inline uint16x4_t vget_low_u16(uint16x8_t v) { return nos::webcam::test::NeonHalf<uint16x4_t>(v, 0); }
+inline uint16x4_t vget_high_u16(uint16x8_t v) { return nos::webcam::test::NeonHalf<uint16x4_t>(v, 4); }
+inline uint8x16_t vcombine_u8(uint8x8_t lo, uint8x8_t hi) { return nos::webcam::test::NeonCombine<uint8x16_t>(lo, hi); }
+inline uint16x8_t vcombine_u16(uint16x4_t lo, uint16x4_t hi) { return nos::webcam::test::NeonCombine<uint16x8_t>(lo, hi); }
+
+inline uint64x2_t vextq_u64(uint64x2_t a, uint64x2_t b, int n)
+{
+	uint64_t lanes[4] = { a.Lanes[0], a.Lanes[1], b.Lanes[0], b.Lanes[1] };
+	return { lanes[n], lanes[n + 1] };
+}
+
+inline uint8x16_t vqtbl1q_u8(uint8x16_t table, uint8x16_t index)
+{
+	uint8x16_t out;
+	for (int i = 0; i < 16; i++)
+		out.Lanes[i] = index.Lanes[i] < 16 ? table.Lanes[index.Lanes[i]] : 0;
+	return out;
+}
+
+// Arithmetic
+inline int32x4_t vdupq_n_s32(int32_t value) { return { value, value, value, value }; }
+inline uint16x8_t vaddq_u16(uint16x8_t a, uint16x8_t b) { return nos::webcam::test::NeonLanewise(a, b, [](uint32_t x, uint32_t y) { return x + y; }); }
+inline uint64x2_t vaddq_u64(uint64x2_t a, uint64x2_t b) { return nos::webcam::test::NeonLanewise(a, b, [](uint64_t x, uint64_t y) { return x + y; }); }
+inline uint64x2_t veorq_u64(uint64x2_t a, uint64x2_t b) { return nos::webcam::test::NeonLanewise(a, b, [](uint64_t x, uint64_t y) { return x ^ y; }); }
+inline uint8x16_t vrhaddq_u8(uint8x16_t a, uint8x16_t b) { return nos::webcam::test::NeonLanewise(a, b, [](uint32_t x, uint32_t y) { return (x + y + 1) >> 1; }); }
+inline uint16x8_t vpaddlq_u8(uint8x16_t v) { return nos::webcam::test::NeonPairwiseLong<uint8x16_t, uint16x8_t>(v); }
+inline uint32x4_t vpaddlq_u16(uint16x8_t v) { return nos::webcam::test::NeonPairwiseLong<uint16x8_t, uint32x4_t>(v); }
+inline int32x4_t vshrq_n_s32(int32x4_t v, int n) { return nos::webcam::test::NeonConvert<int32x4_t, int32x4_t>(v, [n](int32_t x) { return x >> n; }); }
+
+inline int32x4_t vmlal_n_s16(int32x4_t acc, int16x4_t v, int16_t scalar)
+{
+	for (int i = 0; i < 4; i++)
+		acc.Lanes[i] += int32_t(v.Lanes[i]) * int32_t(scalar);
+	return acc;
+}
+
+inline uint64x2_t vmull_u32(uint32x2_t a, uint32x2_t b)
+{
+	return { uint64_t(a.Lanes[0]) * b.Lanes[0], uint64_t(a.Lanes[1]) * b.Lanes[1] };
+}
+
+// Widening and narrowing
+inline uint16x8_t vmovl_u8(uint8x8_t v) { return nos::webcam::test::NeonConvert<uint8x8_t, uint16x8_t>(v, [](uint8_t x) { return x; }); }
+inline uint8x8_t vmovn_u16(uint16x8_t v) { return nos::webcam::test::NeonConvert<uint16x8_t, uint8x8_t>(v, [](uint16_t x) { return x & 0xFF; }); }
+inline uint32x2_t vmovn_u64(uint64x2_t v) { return nos::webcam::test::NeonConvert<uint64x2_t, uint32x2_t>(v, [](uint64_t x) { return x & 0xFFFFFFFF; }); }
+inline uint8x8_t vqmovn_u16(uint16x8_t v) { return nos::webcam::test::NeonConvert<uint16x8_t, uint8x8_t>(v, [](uint16_t x) { return x > 0xFF ? 0xFF : x; }); }
+
+inline uint16x4_t vqmovun_s32(int32x4_t v)
+{
+	return nos::webcam::test::NeonConvert<int32x4_t, uint16x4_t>(v, [](int32_t x) { return x < 0 ? 0 : x > 0xFFFF ? 0xFFFF : x; });
+}
+
+inline uint32x2_t vshrn_n_u64(uint64x2_t v, int n)
+{
+	return nos::webcam::test::NeonConvert<uint64x2_t, uint32x2_t>(v, [n](uint64_t x) { return (x >> n) & 0xFFFFFFFF; });
+}
+
+// Rounding shifts are done at full precision, then truncated to the narrow lane
+inline uint8x8_t vrshrn_n_u16(uint16x8_t v, int n)
+{
+	return nos::webcam::test::NeonConvert<uint16x8_t, uint8x8_t>(v, [n](uint32_t x) { return ((x + (1u << (n - 1))) >> n) & 0xFF; });
+}
+
+inline uint16x4_t vrshrn_n_u32(uint32x4_t v, int n)
+{
+	return nos::webcam::test::NeonConvert<uint32x4_t, uint16x4_t>(v, [n](uint64_t x) { return ((x + (1ull << (n - 1))) >> n) & 0xFFFF; });
+}
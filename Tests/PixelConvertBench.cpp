@@ -0,0 +1,54 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Throughput of the pixel converters on every instruction set the CPU supports, in GB/s of source frame read
+#include "BenchHelpers.h"
+#include "PixelConvert.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+int main()
+{
+	const std::pair<uint32_t, uint32_t> resolutions[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	std::vector<PixelIsa> isas;
+	for (PixelIsa isa : { PixelIsa::Scalar, PixelIsa::SSE41, PixelIsa::AVX2, PixelIsa::NEON })
+		if (IsPixelIsaSupported(isa))
+			isas.push_back(isa);
+
+	std::mt19937 random(1);
+	std::printf("%-10s %-12s %-8s %10s %10s\n", "Size", "Conversion", "ISA", "ms", "GB/s");
+	for (auto [width, height] : resolutions)
+	{
+		const size_t pixels = size_t(width) * height;
+		std::vector<uint8_t> rgba(pixels * 4), yuy2(pixels * 2), out(pixels * 3);
+		for (auto& byte : rgba)
+			byte = uint8_t(random());
+		for (auto& byte : yuy2)
+			byte = uint8_t(random());
+		const std::string size = std::to_string(width) + "x" + std::to_string(height);
+		for (PixelIsa isa : isas)
+		{
+			const std::pair<const char*, std::pair<size_t, std::function<void()>>> conversions[] = {
+				{ "RGBA>BGR24", { rgba.size(), [&] { ConvertRGBAToBGR24(rgba.data(), width, height, out.data(), isa); } } },
+				{ "RGBA>NV12", { rgba.size(), [&] { (void)ConvertRGBAToNV12(rgba.data(), width, height, WebcamColorMatrix::BT709, WebcamColorRange::LIMITED, out.data(), isa); } } },
+				{ "RGBA>YUY2", { rgba.size(), [&] { (void)ConvertRGBAToYUY2(rgba.data(), width, height, WebcamColorMatrix::BT709, WebcamColorRange::LIMITED, out.data(), isa); } } },
+				{ "YUY2>NV12", { yuy2.size(), [&] { (void)ConvertYUY2ToNV12(yuy2.data(), width, height, out.data(), 0, isa); } } },
+				{ "Hash", { yuy2.size(), [&] {
+					FrameHasher hasher(isa);
+					hasher.Update(yuy2.data(), yuy2.size());
+					volatile uint64_t hash = hasher.Finish();
+					(void)hash;
+				} } },
+			};
+			for (auto const& [name, conversion] : conversions)
+			{
+				const double seconds = test::TimeBest(conversion.second);
+				std::printf("%-10s %-12s %-8s %10.3f %10.2f\n", size.c_str(), name, GetPixelIsaName(isa), seconds * 1e3, test::GigabytesPerSecond(conversion.first, seconds));
+			}
+		}
+	}
+	return 0;
+}
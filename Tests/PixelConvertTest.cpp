@@ -0,0 +1,288 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "PixelConvert.h"
+#include "PixelKernels.h"
+#include "TestHelpers.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+// Row lengths around every vector width the kernels step by, so each main loop and each tail is hit
+constexpr uint32_t ROW_COUNTS[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 100, 257 };
+// Sources start this far into their buffer, kernels must not assume aligned rows
+constexpr size_t MISALIGNMENT = 3;
+// Bytes past each output that must be left alone
+constexpr size_t GUARD = 64;
+constexpr uint8_t GUARD_BYTE = 0xA5;
+
+struct KernelSet
+{
+	const char* Name;
+	PixelKernels const* Kernels;
+};
+
+// Every SIMD kernel set that can run here. NEON kernels run on other machines through the emulated intrinsics.
+std::vector<KernelSet> GetKernelSets()
+{
+	std::vector<KernelSet> sets;
+	if (IsPixelIsaSupported(PixelIsa::SSE41) && GetSSE41Kernels())
+		sets.push_back({ "SSE4.1", GetSSE41Kernels() });
+	if (IsPixelIsaSupported(PixelIsa::AVX2) && GetAVX2Kernels())
+		sets.push_back({ "AVX2", GetAVX2Kernels() });
+	if (GetNeonKernels())
+		sets.push_back({ "NEON", GetNeonKernels() });
+	return sets;
+}
+
+std::vector<PixelIsa> GetSimdIsas()
+{
+	std::vector<PixelIsa> isas;
+	for (PixelIsa isa : { PixelIsa::SSE41, PixelIsa::AVX2, PixelIsa::NEON })
+		if (IsPixelIsaSupported(isa))
+			isas.push_back(isa);
+	return isas;
+}
+
+std::mt19937 Random(1234);
+
+// Random bytes with MISALIGNMENT bytes in front, Data() is where the content starts
+struct Source
+{
+	explicit Source(size_t size) : Bytes(size + MISALIGNMENT)
+	{
+		for (auto& byte : Bytes)
+			byte = uint8_t(Random());
+	}
+	uint8_t* Data() { return Bytes.data() + MISALIGNMENT; }
+	std::vector<uint8_t> Bytes;
+};
+
+struct Output
+{
+	explicit Output(size_t size) : Bytes(size + GUARD, GUARD_BYTE) {}
+	uint8_t* Data() { return Bytes.data(); }
+	bool Matches(Output const& reference) const
+	{
+		return Bytes == reference.Bytes;
+	}
+	std::vector<uint8_t> Bytes;
+};
+
+void Report(bool matches, std::string const& what)
+{
+	if (!matches)
+		std::fprintf(stderr, "  Mismatch: %s\n", what.c_str());
+	NOS_TEST_CHECK(matches);
+}
+
+std::string Describe(KernelSet const& set, const char* kernel, uint32_t count)
+{
+	return std::string(set.Name) + " " + kernel + " count " + std::to_string(count);
+}
+
+void RGBAToBGRKernels()
+{
+	for (auto const& set : GetKernelSets())
+		for (uint32_t count : ROW_COUNTS)
+		{
+			Source src(count * 4);
+			Output expected(count * 3), actual(count * 3);
+			ScalarRGBAToBGR(src.Data(), expected.Data(), count);
+			set.Kernels->RGBAToBGR(src.Data(), actual.Data(), count);
+			Report(actual.Matches(expected), Describe(set, "RGBAToBGR", count));
+		}
+}
+
+void DotKernels()
+{
+	// Weights of real matrices, and extremes that push every lane past both ends of the clamp
+	const YuvCoefficients coefficients[] = {
+		{ .R = 3483, .G = 11718, .B = 1183, .Offset = (16 << 14) + (1 << 13) },
+		{ .R = -1920, .G = -6459, .B = 8379, .Offset = (128 << 14) + (1 << 13) },
+		{ .R = 16383, .G = 16383, .B = 16383, .Offset = 0 },
+		{ .R = -16384, .G = -16384, .B = -16384, .Offset = 255 << 14 },
+	};
+	for (auto const& set : GetKernelSets())
+		for (auto const& c : coefficients)
+			for (uint32_t count : ROW_COUNTS)
+			{
+				Source src(count * 4);
+				Output expected(count), actual(count);
+				ScalarDot(src.Data(), expected.Data(), count, c);
+				set.Kernels->Dot(src.Data(), actual.Data(), count, c);
+				Report(actual.Matches(expected), Describe(set, "Dot", count) + " weights " + std::to_string(c.R) + "," + std::to_string(c.G) + "," + std::to_string(c.B));
+			}
+}
+
+void AverageKernels()
+{
+	for (auto const& set : GetKernelSets())
+		for (uint32_t count : ROW_COUNTS)
+		{
+			Source row0(count * 8), row1(count * 8);
+			Output expected(count * 4), actual(count * 4);
+			ScalarAverage2x1(row0.Data(), expected.Data(), count);
+			set.Kernels->Average2x1(row0.Data(), actual.Data(), count);
+			Report(actual.Matches(expected), Describe(set, "Average2x1", count));
+
+			Output expected2x2(count * 4), actual2x2(count * 4);
+			ScalarAverage2x2(row0.Data(), row1.Data(), expected2x2.Data(), count);
+			set.Kernels->Average2x2(row0.Data(), row1.Data(), actual2x2.Data(), count);
+			Report(actual2x2.Matches(expected2x2), Describe(set, "Average2x2", count));
+		}
+}
+
+void YUY2ToNV12Kernels()
+{
+	for (auto const& set : GetKernelSets())
+		for (uint32_t count : ROW_COUNTS)
+		{
+			Source row0(count * 2), row1(count * 2);
+			Output expected[3] = { Output(count), Output(count), Output(count) };
+			Output actual[3] = { Output(count), Output(count), Output(count) };
+			ScalarYUY2ToNV12(row0.Data(), row1.Data(), expected[0].Data(), expected[1].Data(), expected[2].Data(), count);
+			set.Kernels->YUY2ToNV12(row0.Data(), row1.Data(), actual[0].Data(), actual[1].Data(), actual[2].Data(), count);
+			Report(actual[0].Matches(expected[0]) && actual[1].Matches(expected[1]) && actual[2].Matches(expected[2]), Describe(set, "YUY2ToNV12", count));
+		}
+}
+
+void BoxDownscaleKernels()
+{
+	const std::pair<RowLayout, const char*> layouts[] = { { RowLayout::Plane, "plane" }, { RowLayout::Interleaved, "interleaved" }, { RowLayout::YUY2, "YUY2" } };
+	for (auto const& set : GetKernelSets())
+		for (uint32_t factor : { 2u, 4u })
+			for (auto [layout, layoutName] : layouts)
+				for (uint32_t count : ROW_COUNTS)
+				{
+					// Whole groups of output bytes, a YUY2 pair or a chroma pair, like the frame level converters give
+					const uint32_t group = layout == RowLayout::YUY2 ? 4 : layout == RowLayout::Interleaved ? 2 : 1;
+					const uint32_t outCount = count / group * group;
+					std::vector<Source> rows;
+					for (uint32_t r = 0; r < factor; r++)
+						rows.emplace_back(size_t(outCount) * factor);
+					uint8_t const* rowPointers[4] = {};
+					for (uint32_t r = 0; r < factor; r++)
+						rowPointers[r] = rows[r].Data();
+					Output expected(outCount), actual(outCount);
+					ScalarBoxDownscale(rowPointers, expected.Data(), outCount, factor, layout);
+					set.Kernels->BoxDownscale(rowPointers, actual.Data(), outCount, factor, layout);
+					Report(actual.Matches(expected), Describe(set, "BoxDownscale", outCount) + " " + layoutName + " by " + std::to_string(factor));
+				}
+}
+
+void HashStripeKernels()
+{
+	for (auto const& set : GetKernelSets())
+		for (uint32_t count : ROW_COUNTS)
+		{
+			Source data(size_t(count) * HASH_STRIPE_SIZE);
+			uint64_t expected[4], actual[4];
+			for (int l = 0; l < 4; l++)
+				expected[l] = actual[l] = HASH_KEYS[3 - l] * (count + 1);
+			ScalarHashStripes(data.Data(), count, expected);
+			set.Kernels->HashStripes(data.Data(), count, actual);
+			Report(std::equal(expected, expected + 4, actual), Describe(set, "HashStripes", count));
+		}
+}
+
+// The frame converters on top of the kernels, each instruction set against the scalar one
+void FrameConverters()
+{
+	const std::pair<uint32_t, uint32_t> sizes[] = { { 2, 2 }, { 6, 4 }, { 34, 10 }, { 64, 2 }, { 130, 6 }, { 1282, 4 } };
+	for (PixelIsa isa : GetSimdIsas())
+		for (auto [width, height] : sizes)
+		{
+			const std::string size = std::string(GetPixelIsaName(isa)) + " " + std::to_string(width) + "x" + std::to_string(height);
+			Source rgba(size_t(width) * height * 4);
+			Output expectedBGR(width * height * 3), actualBGR(width * height * 3);
+			ConvertRGBAToBGR24(rgba.Data(), width, height, expectedBGR.Data(), PixelIsa::Scalar);
+			ConvertRGBAToBGR24(rgba.Data(), width, height, actualBGR.Data(), isa);
+			Report(actualBGR.Matches(expectedBGR), size + " RGBA to BGR24");
+			for (auto matrix : { WebcamColorMatrix::BT601, WebcamColorMatrix::BT709 })
+				for (auto range : { WebcamColorRange::LIMITED, WebcamColorRange::FULL })
+				{
+					Output expectedNV12(width * height * 3 / 2), actualNV12(width * height * 3 / 2);
+					NOS_TEST_CHECK(ConvertRGBAToNV12(rgba.Data(), width, height, matrix, range, expectedNV12.Data(), PixelIsa::Scalar).has_value());
+					NOS_TEST_CHECK(ConvertRGBAToNV12(rgba.Data(), width, height, matrix, range, actualNV12.Data(), isa).has_value());
+					Report(actualNV12.Matches(expectedNV12), size + " RGBA to NV12");
+					Output expectedYUY2(width * height * 2), actualYUY2(width * height * 2);
+					NOS_TEST_CHECK(ConvertRGBAToYUY2(rgba.Data(), width, height, matrix, range, expectedYUY2.Data(), PixelIsa::Scalar).has_value());
+					NOS_TEST_CHECK(ConvertRGBAToYUY2(rgba.Data(), width, height, matrix, range, actualYUY2.Data(), isa).has_value());
+					Report(actualYUY2.Matches(expectedYUY2), size + " RGBA to YUY2");
+				}
+			// Packed, padded and bottom-up sources
+			const int32_t packedPitch = int32_t(width * 2);
+			for (int32_t pitch : { 0, packedPitch + 12, -packedPitch })
+			{
+				Source yuy2(size_t(std::abs(pitch ? pitch : packedPitch)) * height);
+				uint8_t* top = pitch < 0 ? yuy2.Data() + size_t(-pitch) * (height - 1) : yuy2.Data();
+				Output expected(width * height * 3 / 2), actual(width * height * 3 / 2);
+				NOS_TEST_CHECK(ConvertYUY2ToNV12(top, width, height, expected.Data(), pitch, PixelIsa::Scalar).has_value());
+				NOS_TEST_CHECK(ConvertYUY2ToNV12(top, width, height, actual.Data(), pitch, isa).has_value());
+				Report(actual.Matches(expected), size + " YUY2 to NV12 pitch " + std::to_string(pitch));
+			}
+		}
+}
+
+void KnownValues()
+{
+	// White, black and two pure red pixels, BT.709 limited range
+	const uint8_t rgba[16] = { 255, 255, 255, 255, 0, 0, 0, 255, 255, 0, 0, 255, 255, 0, 0, 255 };
+	uint8_t yuy2[8] = {};
+	NOS_TEST_CHECK(ConvertRGBAToYUY2(rgba, 2, 2, WebcamColorMatrix::BT709, WebcamColorRange::LIMITED, yuy2, PixelIsa::Scalar).has_value());
+	NOS_TEST_CHECK(yuy2[0] == 235 && yuy2[2] == 16);
+	NOS_TEST_CHECK(yuy2[1] == 128 && yuy2[3] == 128);
+	NOS_TEST_CHECK(yuy2[4] == 63 && yuy2[5] == 102 && yuy2[7] == 240);
+	// Odd sizes are rejected, not written
+	NOS_TEST_CHECK(!ConvertRGBAToNV12(rgba, 3, 2, WebcamColorMatrix::BT709, WebcamColorRange::LIMITED, yuy2).has_value());
+	NOS_TEST_CHECK(!ConvertYUY2ToNV12(yuy2, 2, 3, yuy2).has_value());
+}
+
+void FrameHashes()
+{
+	Source data(100'003);
+	FrameHasher reference(PixelIsa::Scalar);
+	reference.Update(data.Data(), 100'003);
+	const uint64_t expected = reference.Finish();
+	std::vector<PixelIsa> isas = GetSimdIsas();
+	isas.push_back(PixelIsa::Scalar);
+	for (PixelIsa isa : isas)
+	{
+		// Same hash however the frame is split between updates
+		for (size_t split : { size_t(0), size_t(1), size_t(31), size_t(32), size_t(1000), size_t(65'537) })
+		{
+			FrameHasher hasher(isa);
+			hasher.Update(data.Data(), split);
+			hasher.Update(data.Data() + split, 100'003 - split);
+			Report(hasher.Finish() == expected, std::string(GetPixelIsaName(isa)) + " hash split at " + std::to_string(split));
+		}
+	}
+	// A single changed byte changes the hash
+	data.Data()[50'000] ^= 1;
+	FrameHasher changed;
+	changed.Update(data.Data(), 100'003);
+	NOS_TEST_CHECK(changed.Finish() != expected);
+}
+} // namespace
+
+int main()
+{
+	for (auto const& set : GetKernelSets())
+		std::printf("Checking %s kernels\n", set.Name);
+	return test::RunTests({
+		{ "RGBAToBGRKernels", RGBAToBGRKernels },
+		{ "DotKernels", DotKernels },
+		{ "AverageKernels", AverageKernels },
+		{ "YUY2ToNV12Kernels", YUY2ToNV12Kernels },
+		{ "BoxDownscaleKernels", BoxDownscaleKernels },
+		{ "HashStripeKernels", HashStripeKernels },
+		{ "FrameConverters", FrameConverters },
+		{ "KnownValues", KnownValues },
+		{ "FrameHashes", FrameHashes },
+	});
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+// Child processes for tests and tools that need readers outside their own process, Linux only
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace nos::webcam::test
+{
+struct ChildProcess
+{
+	pid_t Pid = -1;
+	// Read end of the child's stdout
+	int Output = -1;
+};
+
+// Starts this executable again with the given arguments
+inline std::optional<ChildProcess> SpawnSelf(std::vector<std::string> args)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		return std::nullopt;
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	std::string self = "/proc/self/exe";
+	std::vector<char*> argv{ self.data() };
+	for (auto& arg : args)
+		argv.push_back(arg.data());
+	argv.push_back(nullptr);
+	ChildProcess child;
+	const int error = posix_spawn(&child.Pid, self.c_str(), &actions, nullptr, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (error)
+	{
+		close(fds[0]);
+		return std::nullopt;
+	}
+	child.Output = fds[0];
+	return child;
+}
+
+// Everything the child printed, nullopt unless it exited with 0
+inline std::optional<std::string> WaitChild(ChildProcess const& child)
+{
+	std::string output;
+	char buffer[256];
+	for (ssize_t n; (n = read(child.Output, buffer, sizeof(buffer))) > 0;)
+		output.append(buffer, size_t(n));
+	close(child.Output);
+	int status = 0;
+	waitpid(child.Pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return std::nullopt;
+	return output;
+}
+} // namespace nos::webcam::test
+
+#endif // __linux__
@@ -0,0 +1,70 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// YUY2 to NV12 repack against the copy of the YUY2 frame it replaces in WebcamReader, a plain memcpy and FrameCopy.
+// All read the same source, the repack writes a quarter less. Ratios at or below 1 mean the repack costs nothing extra.
+// Exits with 1 when the repack WebcamReader runs is slower than either copy by more than the tolerance.
+#include "BenchHelpers.h"
+#include "FrameCopy.h"
+#include "PixelConvert.h"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+// The streaming repack and the FrameCopy copy read the same bytes and are bound by it, so they come out about even. Medians of
+// interleaved runs of either still move by up to 10% between runs of the benchmark on a shared machine.
+constexpr double TOLERANCE = 0.10;
+} // namespace
+
+int main()
+{
+	const std::pair<uint32_t, uint32_t> resolutions[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+	// Same workers as the stream manager gives the readers
+	FrameCopy copier(FrameCopy::GetDefaultWorkerCount());
+
+	std::mt19937 random(1);
+	std::printf("Medians of interleaved runs, repack slower by more than %.0f%% fails\n", TOLERANCE * 100);
+	std::printf("%-10s %-20s %10s %10s %14s %14s\n", "Size", "Pass", "ms", "GB/s", "vs memcpy", "vs FrameCopy");
+	bool slower = false;
+	for (auto [width, height] : resolutions)
+	{
+		const size_t pixels = size_t(width) * height;
+		test::PageAlignedBuffer yuy2(pixels * 2), out(pixels * 2);
+		for (size_t i = 0; i < yuy2.Size; i++)
+			yuy2.Data()[i] = uint8_t(random());
+		const std::string size = std::to_string(width) + "x" + std::to_string(height);
+		const FrameLayout layout{ .FourCC = FOURCC_YUY2, .Resolution = nos::fb::vec2u(width, height) };
+		std::vector<std::string> passes = { "memcpy", "FrameCopy" };
+		std::vector<std::function<void()>> fns = {
+			[&] { std::memcpy(out.Data(), yuy2.Data(), yuy2.Size); },
+			[&] { copier.Copy(out.Data(), out.Size, yuy2.Data(), yuy2.Size, layout); },
+		};
+		for (PixelIsa isa : { PixelIsa::Scalar, PixelIsa::SSE41, PixelIsa::AVX2, PixelIsa::NEON })
+			if (IsPixelIsaSupported(isa))
+			{
+				passes.push_back(std::string("Repack ") + GetPixelIsaName(isa));
+				fns.push_back([&, isa] { (void)ConvertYUY2ToNV12(yuy2.Data(), width, height, out.Data(), 0, isa); });
+			}
+		// What the reader runs, the best instruction set on the FrameCopy threads
+		passes.push_back("FrameCopy Repack");
+		fns.push_back([&] { (void)copier.Repack(out.Data(), yuy2.Data(), width, height); });
+
+		const std::vector<double> seconds = test::TimeMedians(fns);
+		const double copySeconds = seconds[0], frameCopySeconds = seconds[1], repackSeconds = seconds.back();
+		for (size_t i = 0; i < passes.size(); i++)
+			std::printf("%-10s %-20s %10.3f %10.2f %14.2f %14.2f\n", size.c_str(), passes[i].c_str(), seconds[i] * 1e3, test::GigabytesPerSecond(yuy2.Size, seconds[i]),
+				seconds[i] / copySeconds, seconds[i] / frameCopySeconds);
+		if (repackSeconds > copySeconds * (1 + TOLERANCE) || repackSeconds > frameCopySeconds * (1 + TOLERANCE))
+		{
+			std::printf("%-10s FrameCopy Repack is slower than %s\n", size.c_str(), repackSeconds > copySeconds * (1 + TOLERANCE) ? "memcpy" : "the FrameCopy copy");
+			slower = true;
+		}
+	}
+	std::printf("FrameCopy repack on %u threads is %s than memcpy and the FrameCopy copy\n", copier.GetThreadCount(SIZE_MAX), slower ? "slower" : "no slower");
+	return slower ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Loading a scene of webcam nodes through the device and format cache of WebcamStreamManager, cold right after start and warm
+// with every device probed, against each node listing devices and probing its own like before the cache.
+// Cameras are stood in for by a backend whose probe sleeps like opening a device does, or the machine's own cameras with --system.
+// A node is loaded the way WebcamStreamNode is: devices are listed on the editor thread, formats come from the cache or a probe
+// on the task pool. Prints the editor thread time, the time until every node has its formats and how many probes ran.
+//   SceneLoadBench [nodes] [cameras] [probe ms]
+//   SceneLoadBench --system [nodes]
+#include "WebcamStream.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <latch>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Probing a Media Foundation camera creates a media source and a source reader, a few hundred milliseconds on common webcams
+constexpr uint32_t DEFAULT_PROBE_MS = 150;
+
+struct SlowBackend : CaptureBackend
+{
+	struct Watcher : DeviceWatcher
+	{
+		SlowBackend* Backend;
+		~Watcher() override
+		{
+			std::unique_lock lock(Backend->Mutex);
+			Backend->Callback = {};
+		}
+	};
+
+	const char* GetName() const override { return "Slow"; }
+
+	std::vector<WebcamDevice> EnumerateDevices() override
+	{
+		std::unique_lock lock(Mutex);
+		std::vector<WebcamDevice> devices;
+		for (uint32_t i = 0; i < CameraCount; i++)
+			devices.push_back({ .Name = "Camera " + std::to_string(i), .SymLink = "/dev/slow" + std::to_string(i) });
+		return devices;
+	}
+
+	std::unique_ptr<DeviceWatcher> WatchDevices(DeviceChangeCallback callback) override
+	{
+		std::unique_lock lock(Mutex);
+		Callback = std::move(callback);
+		auto watcher = std::make_unique<Watcher>();
+		watcher->Backend = this;
+		return watcher;
+	}
+
+	std::vector<FormatInfo> EnumerateFormats(WebcamDevice const& device) override
+	{
+		Probes++;
+		std::this_thread::sleep_for(ProbeTime);
+		std::vector<FormatInfo> formats;
+		for (auto resolution : { nos::fb::vec2u(1920, 1080), nos::fb::vec2u(1280, 720), nos::fb::vec2u(640, 480) })
+			for (auto frameRate : { WebcamFrameRate::WEBCAM_FRAMERATE_30, WebcamFrameRate::WEBCAM_FRAMERATE_60 })
+				formats.push_back({ .FourCC = FOURCC_YUY2, .Resolution = resolution, .FrameRate = frameRate });
+		return formats;
+	}
+
+	std::expected<std::shared_ptr<CaptureSession>, std::string> Open(WebcamDevice const&, FormatInfo const&, CaptureOptions const&) override
+	{
+		return std::unexpected("Slow backend does not capture");
+	}
+
+	// Plugs in one more camera and tells the manager like a hotplug notification would
+	void PlugIn()
+	{
+		DeviceChangeCallback callback;
+		std::string symLink;
+		{
+			std::unique_lock lock(Mutex);
+			symLink = "/dev/slow" + std::to_string(CameraCount++);
+			callback = Callback;
+		}
+		if (callback)
+			callback(symLink, DeviceChange::Arrived);
+	}
+
+	std::mutex Mutex;
+	uint32_t CameraCount = 0;
+	DeviceChangeCallback Callback;
+	std::chrono::milliseconds ProbeTime{};
+	std::atomic_uint32_t Probes = 0;
+};
+
+struct SceneLoad
+{
+	double EditorMs = 0;
+	double ReadyMs = 0;
+};
+
+// Node i selects device i % device count. Editor time ends when the last node is constructed, ready when the last has its formats.
+SceneLoad LoadScene(uint32_t nodeCount, Clock::time_point start)
+{
+	std::latch ready(nodeCount);
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		auto devices = WebcamStreamManager::EnumerateDevices();
+		if (devices.empty())
+		{
+			ready.count_down();
+			continue;
+		}
+		const WebcamDevice device = devices[i % devices.size()];
+		if (WebcamStreamManager::GetCachedFormats(device))
+			ready.count_down();
+		else
+			WebcamStreamManager::RunAsync([device, &ready] {
+				(void)WebcamStreamManager::EnumerateFormats(device);
+				ready.count_down();
+			});
+	}
+	SceneLoad load;
+	load.EditorMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	ready.wait();
+	load.ReadyMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return load;
+}
+
+// Before the cache each node listed devices itself and probed the selected one on the editor thread
+SceneLoad LoadSceneUncached(std::vector<CaptureBackend*> const& backends, uint32_t nodeCount)
+{
+	const auto start = Clock::now();
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		std::vector<WebcamDevice> devices;
+		for (auto* backend : backends)
+			for (auto& device : backend->EnumerateDevices())
+			{
+				device.Backend = backend;
+				devices.push_back(std::move(device));
+			}
+		if (!devices.empty())
+		{
+			WebcamDevice const& device = devices[i % devices.size()];
+			(void)device.Backend->EnumerateFormats(device);
+		}
+	}
+	const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return { ms, ms };
+}
+
+void PrintLoad(const char* name, SceneLoad const& load, std::optional<uint32_t> probes)
+{
+	std::printf("%-24s %12.2f %12.2f %8s\n", name, load.EditorMs, load.ReadyMs, probes ? std::to_string(*probes).c_str() : "-");
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const bool system = argc > 1 && std::strcmp(argv[1], "--system") == 0;
+	const int first = system ? 2 : 1;
+	const uint32_t nodeCount = argc > first ? uint32_t(std::stoul(argv[first])) : 12;
+	const uint32_t cameraCount = !system && argc > 2 ? uint32_t(std::stoul(argv[2])) : 4;
+	const auto probeTime = std::chrono::milliseconds(!system && argc > 3 ? std::stoul(argv[3]) : DEFAULT_PROBE_MS);
+	if (!nodeCount || (!system && !cameraCount))
+	{
+		std::fprintf(stderr, "Usage: %s [nodes] [cameras] [probe ms]\n       %s --system [nodes]\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	SlowBackend* slow = nullptr;
+	auto makeBackends = [&] {
+		std::vector<std::unique_ptr<CaptureBackend>> backends;
+		if (system)
+		{
+#if defined(_WIN32)
+			backends.push_back(CreateMFCaptureBackend());
+#endif
+#if defined(__linux__)
+			backends.push_back(CreateV4L2CaptureBackend());
+#endif
+			return backends;
+		}
+		auto backend = std::make_unique<SlowBackend>();
+		backend->CameraCount = cameraCount;
+		backend->ProbeTime = probeTime;
+		slow = backend.get();
+		backends.push_back(std::move(backend));
+		return backends;
+	};
+	auto probes = [&]() -> std::optional<uint32_t> {
+		if (!slow)
+			return std::nullopt;
+		return slow->Probes.exchange(0);
+	};
+
+	if (system)
+		std::printf("%u nodes on the cameras of this machine\n", nodeCount);
+	else
+		std::printf("%u nodes on %u cameras, %lld ms per probe, %u task threads\n", nodeCount, cameraCount, (long long)probeTime.count(),
+			WebcamStreamManager::TASK_THREAD_COUNT);
+	std::printf("%-24s %12s %12s %8s\n", "Scene load", "editor ms", "ready ms", "probes");
+
+	auto uncachedBackends = makeBackends();
+	std::vector<CaptureBackend*> uncached;
+	for (auto& backend : uncachedBackends)
+		uncached.push_back(backend.get());
+	const SceneLoad uncachedLoad = LoadSceneUncached(uncached, nodeCount);
+	PrintLoad("Uncached", uncachedLoad, probes());
+	uncachedBackends.clear();
+
+	// Cold: the scene loads right after the plugin starts, while the cache is warmed up on the task pool
+	auto start = Clock::now();
+	WebcamStreamManager::Start(makeBackends());
+	const SceneLoad cold = LoadScene(nodeCount, start);
+	PrintLoad("Cold", cold, probes());
+	const SceneLoad warm = LoadScene(nodeCount, Clock::now());
+	PrintLoad("Warm", warm, probes());
+	if (slow)
+	{
+		// Only the new camera is probed, the rest stay cached. Its node is the last one, on the new last device.
+		slow->PlugIn();
+		while (WebcamStreamManager::EnumerateDevices().size() != cameraCount + 1)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		const SceneLoad hotplug = LoadScene(std::max(nodeCount, cameraCount + 1), Clock::now());
+		PrintLoad("After hotplug", hotplug, probes());
+	}
+	WebcamStreamManager::Stop();
+	return 0;
+}
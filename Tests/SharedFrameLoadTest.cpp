@@ -0,0 +1,189 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Load test of the shared memory transport: producers write stamped frames to several cameras at their rate while many reader
+// processes read them. Halfway one reader of each camera is killed, the camera must stop counting it.
+// Every reader checks each frame it copies was not torn and measures how old it is. Exits with 1 when anything is off.
+//   SharedFrameLoadTest [cameras] [readers per camera] [seconds] [width height fps]
+#include "ProcessHelpers.h"
+#include "SharedFrameRing.h"
+#include "VirtualCamera.h"
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Every page of a frame starts with the frame number, a torn copy mixes numbers
+constexpr size_t STAMP_STRIDE = 4096;
+
+void StampFrame(uint8_t* frame, size_t size, uint64_t number)
+{
+	for (size_t offset = 0; offset + sizeof(number) <= size; offset += STAMP_STRIDE)
+		std::memcpy(frame + offset, &number, sizeof(number));
+}
+
+bool IsStamped(uint8_t const* frame, size_t size, uint64_t number)
+{
+	for (size_t offset = 0; offset + sizeof(number) <= size; offset += STAMP_STRIDE)
+		if (std::memcmp(frame + offset, &number, sizeof(number)))
+			return false;
+	return true;
+}
+
+// Reader process: reads until the camera goes away, then prints frames, skipped, torn and the frame age percentiles in microseconds
+int RunReader(std::string const& cameraName)
+{
+	auto reader = SharedFrameReader::Open(cameraName);
+	if (!reader)
+	{
+		std::fprintf(stderr, "%s\n", reader.error().c_str());
+		return 1;
+	}
+	std::vector<uint8_t> frame((*reader)->GetFrameSize());
+	std::vector<uint64_t> ages;
+	uint64_t skipped = 0, torn = 0;
+	while (true)
+	{
+		const auto result = (*reader)->Read(frame.data(), std::chrono::milliseconds(100));
+		if (result.Status == SharedFrameReader::ReadStatus::Closed)
+			break;
+		if (result.Status != SharedFrameReader::ReadStatus::Frame)
+			continue;
+		ages.push_back((GetSharedFrameTime() - result.Timestamp) / 1000);
+		skipped += result.Skipped;
+		if (!IsStamped(frame.data(), frame.size(), result.FrameNumber))
+			torn++;
+	}
+	std::sort(ages.begin(), ages.end());
+	auto percentile = [&](double p) { return ages.empty() ? 0ull : (unsigned long long)ages[size_t(p * double(ages.size() - 1))]; };
+	std::printf("%zu %llu %llu %llu %llu %llu\n", ages.size(), (unsigned long long)skipped, (unsigned long long)torn, percentile(0.5), percentile(0.99),
+		percentile(1.0));
+	return 0;
+}
+
+struct Camera
+{
+	std::string Name;
+	std::unique_ptr<VirtualCameraSink> Sink;
+	std::vector<test::ChildProcess> Readers;
+	std::thread Producer;
+	uint64_t Sent = 0;
+};
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc == 3 && std::strcmp(argv[1], "--read") == 0)
+		return RunReader(argv[2]);
+
+	const uint32_t cameraCount = argc > 1 ? uint32_t(std::stoul(argv[1])) : 2;
+	const uint32_t readerCount = argc > 2 ? uint32_t(std::stoul(argv[2])) : 4;
+	const auto runTime = std::chrono::duration<double>(argc > 3 ? std::stod(argv[3]) : 4.0);
+	const VirtualCameraConfig base{ .Resolution = nos::fb::vec2u(argc > 5 ? uint32_t(std::stoul(argv[4])) : 1920, argc > 5 ? uint32_t(std::stoul(argv[5])) : 1080),
+		.FrameRate = argc > 6 ? std::stof(argv[6]) : 60.0f, .Format = WebcamTextureFormat::NV12 };
+	if (!cameraCount || !readerCount)
+	{
+		std::fprintf(stderr, "Usage: %s [cameras] [readers per camera] [seconds] [width height fps]\n", argv[0]);
+		return 1;
+	}
+	std::printf("%u cameras %ux%u@%g, %u readers each, %.1f s\n", cameraCount, base.Resolution.x(), base.Resolution.y(), base.FrameRate, readerCount, runTime.count());
+
+	auto transport = CreateSharedMemoryTransport();
+	std::vector<Camera> cameras(cameraCount);
+	for (uint32_t i = 0; i < cameraCount; i++)
+	{
+		VirtualCameraConfig config = base;
+		config.Name = "SharedFrameLoadTest." + std::to_string(getpid()) + "." + std::to_string(i);
+		auto sink = transport->CreateCamera(config);
+		if (!sink)
+		{
+			std::fprintf(stderr, "%s\n", sink.error().c_str());
+			return 1;
+		}
+		cameras[i].Name = config.Name;
+		cameras[i].Sink = std::move(*sink);
+		for (uint32_t r = 0; r < readerCount; r++)
+			if (auto reader = test::SpawnSelf({ "--read", config.Name }))
+				cameras[i].Readers.push_back(*reader);
+	}
+
+	bool ok = true;
+	const auto openDeadline = Clock::now() + std::chrono::seconds(5);
+	for (auto& camera : cameras)
+	{
+		while (camera.Sink->GetReaderCount() != camera.Readers.size() && Clock::now() < openDeadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (camera.Readers.size() != readerCount || camera.Sink->GetReaderCount() != readerCount)
+		{
+			std::fprintf(stderr, "%s: %u readers open of %u\n", camera.Name.c_str(), camera.Sink->GetReaderCount().value_or(0), readerCount);
+			ok = false;
+		}
+	}
+
+	const size_t frameSize = GetFrameSize(base);
+	const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / base.FrameRate));
+	std::atomic_bool stop = false;
+	for (auto& camera : cameras)
+		camera.Producer = std::thread([&] {
+			std::vector<uint8_t> frame(frameSize);
+			for (auto tick = Clock::now(); !stop; tick += frameTime)
+			{
+				// The sink numbers frames from 1
+				StampFrame(frame.data(), frame.size(), ++camera.Sent);
+				camera.Sink->SendFrame(frame.data());
+				std::this_thread::sleep_until(tick + frameTime);
+			}
+		});
+
+	std::this_thread::sleep_for(runTime / 2);
+	// A killed reader never closes, its slot must be found dead
+	for (auto& camera : cameras)
+	{
+		kill(camera.Readers.back().Pid, SIGKILL);
+		(void)test::WaitChild(camera.Readers.back());
+		camera.Readers.pop_back();
+		const uint32_t counted = camera.Sink->GetReaderCount().value_or(0);
+		if (counted != camera.Readers.size())
+		{
+			std::fprintf(stderr, "%s: %u readers counted after a crash, %zu alive\n", camera.Name.c_str(), counted, camera.Readers.size());
+			ok = false;
+		}
+	}
+	std::this_thread::sleep_for(runTime / 2);
+	stop = true;
+
+	std::printf("%-24s %8s %8s %8s %8s %10s %10s %10s\n", "Camera", "Sent", "Read", "Skipped", "Torn", "p50 us", "p99 us", "max us");
+	for (auto& camera : cameras)
+	{
+		camera.Producer.join();
+		// Closes the camera, the readers report and exit
+		camera.Sink.reset();
+		for (auto const& reader : camera.Readers)
+		{
+			const auto output = test::WaitChild(reader);
+			unsigned long long frames = 0, skipped = 0, torn = 0, p50 = 0, p99 = 0, max = 0;
+			if (!output || std::sscanf(output->c_str(), "%llu %llu %llu %llu %llu %llu", &frames, &skipped, &torn, &p50, &p99, &max) != 6)
+			{
+				std::fprintf(stderr, "%s: Reader %d failed\n", camera.Name.c_str(), int(reader.Pid));
+				ok = false;
+				continue;
+			}
+			std::printf("%-24s %8llu %8llu %8llu %8llu %10llu %10llu %10llu\n", camera.Name.c_str(), (unsigned long long)camera.Sent, frames, skipped, torn, p50, p99, max);
+			ok = ok && torn == 0;
+		}
+	}
+	std::printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
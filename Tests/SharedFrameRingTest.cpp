@@ -0,0 +1,136 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Shared memory cameras read through SharedFrameReader, with readers in this process and in forked ones that crash
+#include "SharedFrameRing.h"
+#include "TestHelpers.h"
+#include "VirtualCamera.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace nos::webcam;
+
+namespace
+{
+const VirtualCameraConfig CONFIG{ .Name = "SharedFrameRingTest." + std::to_string(getpid()), .Resolution = nos::fb::vec2u(64, 32), .FrameRate = 60.0f,
+	.Format = WebcamTextureFormat::NV12 };
+
+std::unique_ptr<VirtualCameraSink> CreateCamera()
+{
+	auto camera = CreateSharedMemoryTransport()->CreateCamera(CONFIG);
+	NOS_TEST_CHECK(camera.has_value());
+	return camera ? std::move(*camera) : nullptr;
+}
+
+std::unique_ptr<SharedFrameReader> OpenReader()
+{
+	auto reader = SharedFrameReader::Open(CONFIG.Name);
+	return reader ? std::move(*reader) : nullptr;
+}
+
+void SendFrame(VirtualCameraSink& camera, uint8_t value)
+{
+	std::vector<uint8_t> frame(GetFrameSize(CONFIG), value);
+	camera.SendFrame(frame.data());
+}
+
+// Opens a reader in a child process that is killed while it has the camera open, so the reader never closes
+void CrashReader()
+{
+	const pid_t child = fork();
+	if (child == 0)
+	{
+		auto reader = OpenReader();
+		if (reader)
+			raise(SIGKILL);
+		_exit(1);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	NOS_TEST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+}
+
+void FramesRoundTrip()
+{
+	auto camera = CreateCamera();
+	auto reader = OpenReader();
+	NOS_TEST_CHECK(reader && reader->GetWidth() == 64 && reader->GetHeight() == 32 && reader->GetFourCC() == FOURCC_NV12);
+	if (!camera || !reader)
+		return;
+	std::vector<uint8_t> out(reader->GetFrameSize());
+	NOS_TEST_CHECK(reader->Read(out.data(), std::chrono::milliseconds(1)).Status == SharedFrameReader::ReadStatus::Timeout);
+	SendFrame(*camera, 1);
+	SendFrame(*camera, 2);
+	// The newest frame is read, frames before the first read are not counted as skipped
+	auto result = reader->Read(out.data(), std::chrono::milliseconds(100));
+	NOS_TEST_CHECK(result.Status == SharedFrameReader::ReadStatus::Frame && result.FrameNumber == 2 && result.Skipped == 0 && out[0] == 2);
+	SendFrame(*camera, 3);
+	SendFrame(*camera, 4);
+	result = reader->Read(out.data(), std::chrono::milliseconds(100));
+	NOS_TEST_CHECK(result.Status == SharedFrameReader::ReadStatus::Frame && result.FrameNumber == 4 && result.Skipped == 1 && out[0] == 4);
+	camera.reset();
+	NOS_TEST_CHECK(reader->Read(out.data(), std::chrono::milliseconds(100)).Status == SharedFrameReader::ReadStatus::Closed);
+}
+
+void ReadersCounted()
+{
+	auto camera = CreateCamera();
+	if (!camera)
+		return;
+	NOS_TEST_CHECK(camera->GetReaderCount() == 0u);
+	auto first = OpenReader();
+	auto second = OpenReader();
+	NOS_TEST_CHECK(camera->GetReaderCount() == 2u);
+	first.reset();
+	NOS_TEST_CHECK(camera->GetReaderCount() == 1u);
+	second.reset();
+	NOS_TEST_CHECK(camera->GetReaderCount() == 0u);
+}
+
+// A crashed reader must not keep the camera watched, or frames are sent to nobody forever
+void CrashedReadersDropped()
+{
+	auto camera = CreateCamera();
+	if (!camera)
+		return;
+	auto reader = OpenReader();
+	CrashReader();
+	CrashReader();
+	NOS_TEST_CHECK(camera->GetReaderCount() == 1u);
+	reader.reset();
+	NOS_TEST_CHECK(camera->GetReaderCount() == 0u);
+}
+
+// Slots of crashed readers are taken by new ones when all are used
+void SlotsReclaimed()
+{
+	auto camera = CreateCamera();
+	if (!camera)
+		return;
+	std::vector<std::unique_ptr<SharedFrameReader>> readers;
+	for (uint32_t i = 0; i + 1 < SHARED_FRAME_READER_SLOT_COUNT; i++)
+		readers.push_back(OpenReader());
+	CrashReader();
+	readers.push_back(OpenReader());
+	NOS_TEST_CHECK(readers.back() != nullptr);
+	NOS_TEST_CHECK(camera->GetReaderCount() == SHARED_FRAME_READER_SLOT_COUNT);
+	auto extra = SharedFrameReader::Open(CONFIG.Name);
+	NOS_TEST_CHECK(!extra.has_value());
+	readers.pop_back();
+	NOS_TEST_CHECK(OpenReader() != nullptr);
+}
+} // namespace
+
+int main()
+{
+	return test::RunTests({
+		{ "FramesRoundTrip", FramesRoundTrip },
+		{ "ReadersCounted", ReadersCounted },
+		{ "CrashedReadersDropped", CrashedReadersDropped },
+		{ "SlotsReclaimed", SlotsReclaimed },
+	});
+}
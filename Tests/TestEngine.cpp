@@ -0,0 +1,36 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// Engine services for test executables that link plugin sources. Logs go to stderr, nothing else is available.
+#include <Nodos/PluginAPI.h>
+#include <Nodos/PluginHelpers.hpp>
+
+#include <cstdarg>
+#include <cstdio>
+#include <type_traits>
+
+NOS_INIT_WITH_MIN_REQUIRED_MINOR(0)
+
+namespace nos::webcam::test
+{
+template <typename R>
+static R PrintLog(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	std::vfprintf(stderr, format, args);
+	va_end(args);
+	std::fputc('\n', stderr);
+	if constexpr (!std::is_void_v<R>)
+		return R{};
+}
+
+template <typename R>
+static bool RouteLog(R (*&log)(const char*, ...))
+{
+	log = &PrintLog<R>;
+	return true;
+}
+
+// Defined after nosEngine in this file, so it is set up before any test code runs
+static const bool LOGS_ROUTED = RouteLog(nosEngine.LogE) && RouteLog(nosEngine.LogW) && RouteLog(nosEngine.LogI);
+} // namespace nos::webcam::test
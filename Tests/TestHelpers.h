@@ -0,0 +1,46 @@
+/*
+ * Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace nos::webcam::test
+{
+// CTest reports a test that exits with this code as skipped
+constexpr int SKIPPED = 77;
+
+struct TestCase
+{
+	const char* Name;
+	std::function<void()> Run;
+};
+
+inline int Failures = 0;
+
+// Runs every case and returns the exit code of the test executable
+inline int RunTests(std::vector<TestCase> const& cases)
+{
+	for (auto const& test : cases)
+	{
+		const int failures = Failures;
+		test.Run();
+		std::printf("%s %s\n", Failures == failures ? "PASS" : "FAIL", test.Name);
+	}
+	return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+} // namespace nos::webcam::test
+
+#define NOS_TEST_CHECK(condition)                                                              \
+	do                                                                                         \
+	{                                                                                          \
+		if (!(condition))                                                                      \
+		{                                                                                      \
+			std::fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+			nos::webcam::test::Failures++;                                                     \
+		}                                                                                      \
+	} while (0)
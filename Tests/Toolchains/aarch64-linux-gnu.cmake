@@ -0,0 +1,20 @@
+# Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+# Cross builds the tests for 64 bit Arm Linux so the NEON kernels are compiled and run natively, e.g. on Debian/Ubuntu with
+# the g++-aarch64-linux-gnu and qemu-user packages:
+#   cmake ... -DNOSWEBCAM_BUILD_TESTS=ON -DCMAKE_TOOLCHAIN_FILE=<this file>
+# CTest runs the test executables through qemu.
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(NOSWEBCAM_AARCH64_PREFIX aarch64-linux-gnu)
+set(CMAKE_C_COMPILER ${NOSWEBCAM_AARCH64_PREFIX}-gcc)
+set(CMAKE_CXX_COMPILER ${NOSWEBCAM_AARCH64_PREFIX}-g++)
+
+set(CMAKE_FIND_ROOT_PATH /usr/${NOSWEBCAM_AARCH64_PREFIX})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_PACKAGE ONLY)
+
+set(CMAKE_CROSSCOMPILING_EMULATOR qemu-aarch64 -L /usr/${NOSWEBCAM_AARCH64_PREFIX})
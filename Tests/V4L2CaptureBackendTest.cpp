@@ -0,0 +1,506 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+#include "V4L2CaptureBackend.h"
+#include "TestHelpers.h"
+
+#include <linux/videodev2.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+
+using namespace nos::webcam;
+
+namespace
+{
+constexpr int CAMERA_FD = 3;
+constexpr int METADATA_FD = 4;
+constexpr uint32_t WIDTH = 64;
+constexpr uint32_t HEIGHT = 32;
+constexpr uint32_t FRAME_SIZE = WIDTH * HEIGHT * 2;
+
+// Device that behaves like a UVC driver streaming YUYV, with switches to make individual calls fail
+struct FakeV4L2DeviceIo : V4L2DeviceIo
+{
+	// Requests made to fail with the given errno
+	std::map<unsigned long, int> FailingRequests;
+	bool RejectUserPtr = false;
+	// Buffers granted on REQBUFS, 0 grants what was asked for
+	uint32_t GrantedBufferCount = 0;
+	// Resolution the driver picks on S_FMT, the requested one if zero
+	uint32_t ForcedWidth = 0;
+	uint32_t BytesPerLine = WIDTH * 2;
+	// Set on the next dequeued buffer
+	uint32_t NextBufferFlags = 0;
+	uint32_t NextSequence = 0;
+
+	std::set<int> OpenFds;
+	std::map<unsigned long, int> Calls;
+	uint32_t Memory = 0;
+	bool Streaming = false;
+	std::vector<std::vector<uint8_t>> DeviceBuffers;
+	std::set<void*> Mapped;
+	// Index and user pointer of buffers owned by the driver
+	std::deque<std::pair<uint32_t, uint8_t*>> Queued;
+
+	std::vector<std::string> ListDeviceNodes() override { return { "/dev/video0", "/dev/video1", "/dev/video2" }; }
+
+	int Open(const char* path, int flags) override
+	{
+		const std::string node = path;
+		if (node == "/dev/video2")
+		{
+			errno = EACCES;
+			return -1;
+		}
+		const int fd = node == "/dev/video0" ? CAMERA_FD : METADATA_FD;
+		OpenFds.insert(fd);
+		return fd;
+	}
+
+	int Close(int fd) override { return OpenFds.erase(fd) ? 0 : -1; }
+
+	int Ioctl(int fd, unsigned long request, void* arg) override
+	{
+		Calls[request]++;
+		if (auto failing = FailingRequests.find(request); failing != FailingRequests.end())
+		{
+			errno = failing->second;
+			return -1;
+		}
+		switch (request)
+		{
+		case VIDIOC_QUERYCAP: {
+			auto* cap = static_cast<v4l2_capability*>(arg);
+			std::strcpy(reinterpret_cast<char*>(cap->card), fd == CAMERA_FD ? "Fake Camera" : "Fake Camera Metadata");
+			cap->capabilities = V4L2_CAP_DEVICE_CAPS;
+			cap->device_caps = fd == CAMERA_FD ? V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING : V4L2_CAP_META_CAPTURE;
+			return 0;
+		}
+		case VIDIOC_ENUM_FMT: {
+			auto* desc = static_cast<v4l2_fmtdesc*>(arg);
+			const uint32_t formats[] = { V4L2_PIX_FMT_H264, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_MJPEG };
+			if (desc->index >= std::size(formats))
+				return Fail(EINVAL);
+			desc->pixelformat = formats[desc->index];
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMESIZES: {
+			auto* size = static_cast<v4l2_frmsizeenum*>(arg);
+			if (size->index >= 2)
+				return Fail(EINVAL);
+			size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+			size->discrete = size->index ? v4l2_frmsize_discrete{ 640, 480 } : v4l2_frmsize_discrete{ 1280, 720 };
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMEINTERVALS: {
+			auto* interval = static_cast<v4l2_frmivalenum*>(arg);
+			// 30 and 29.97 fps, plus one that is not in the frame rate table
+			const v4l2_fract intervals[] = { { 1, 30 }, { 1001, 30000 }, { 1, 7 } };
+			if (interval->index >= std::size(intervals))
+				return Fail(EINVAL);
+			interval->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+			interval->discrete = intervals[interval->index];
+			return 0;
+		}
+		case VIDIOC_S_FMT: {
+			auto* format = static_cast<v4l2_format*>(arg);
+			if (ForcedWidth)
+				format->fmt.pix.width = ForcedWidth;
+			format->fmt.pix.bytesperline = BytesPerLine;
+			format->fmt.pix.sizeimage = BytesPerLine * format->fmt.pix.height;
+			return 0;
+		}
+		case VIDIOC_S_PARM: return 0;
+		case VIDIOC_REQBUFS: {
+			auto* req = static_cast<v4l2_requestbuffers*>(arg);
+			if (Streaming)
+				return Fail(EBUSY);
+			if (req->memory == V4L2_MEMORY_USERPTR && RejectUserPtr)
+				return Fail(EINVAL);
+			Memory = req->memory;
+			Queued.clear();
+			if (req->count && GrantedBufferCount)
+				req->count = GrantedBufferCount;
+			DeviceBuffers.assign(req->memory == V4L2_MEMORY_MMAP ? req->count : 0, std::vector<uint8_t>(BytesPerLine * HEIGHT));
+			return 0;
+		}
+		case VIDIOC_QUERYBUF: {
+			auto* buf = static_cast<v4l2_buffer*>(arg);
+			if (buf->index >= DeviceBuffers.size())
+				return Fail(EINVAL);
+			buf->length = uint32_t(DeviceBuffers[buf->index].size());
+			buf->m.offset = buf->index * 4096;
+			return 0;
+		}
+		case VIDIOC_QBUF: {
+			auto* buf = static_cast<v4l2_buffer*>(arg);
+			if (buf->memory != Memory)
+				return Fail(EINVAL);
+			if (Memory == V4L2_MEMORY_USERPTR && buf->length < BytesPerLine * HEIGHT)
+				return Fail(EINVAL);
+			Queued.emplace_back(buf->index, Memory == V4L2_MEMORY_USERPTR ? reinterpret_cast<uint8_t*>(buf->m.userptr) : nullptr);
+			return 0;
+		}
+		case VIDIOC_DQBUF: {
+			auto* buf = static_cast<v4l2_buffer*>(arg);
+			if (!Streaming || Queued.empty())
+				return Fail(EAGAIN);
+			auto [index, userPtr] = Queued.front();
+			Queued.pop_front();
+			// Device writes the frame number into the memory it captures into
+			uint8_t* memory = userPtr ? userPtr : DeviceBuffers[index].data();
+			std::memset(memory, uint8_t(NextSequence), FRAME_SIZE);
+			buf->index = index;
+			buf->bytesused = BytesPerLine * HEIGHT;
+			buf->sequence = NextSequence++;
+			buf->flags = std::exchange(NextBufferFlags, 0);
+			return 0;
+		}
+		case VIDIOC_STREAMON:
+			Streaming = true;
+			return 0;
+		case VIDIOC_STREAMOFF:
+			Streaming = false;
+			Queued.clear();
+			return 0;
+		}
+		return Fail(ENOTTY);
+	}
+
+	void* Mmap(size_t length, int prot, int flags, int fd, off_t offset) override
+	{
+		const size_t index = size_t(offset) / 4096;
+		if (fd != CAMERA_FD || index >= DeviceBuffers.size() || length != DeviceBuffers[index].size())
+			return MAP_FAILED;
+		Mapped.insert(DeviceBuffers[index].data());
+		return DeviceBuffers[index].data();
+	}
+
+	int Munmap(void* addr, size_t length) override { return Mapped.erase(addr) ? 0 : -1; }
+
+	int Poll(pollfd* fds, nfds_t count, int timeoutMs) override
+	{
+		fds[0].revents = Streaming && !Queued.empty() ? POLLIN : 0;
+		return fds[0].revents ? 1 : 0;
+	}
+
+	std::unique_ptr<DeviceWatcher> WatchDeviceNodes(DeviceChangeCallback callback) override { return nullptr; }
+
+	static int Fail(int error)
+	{
+		errno = error;
+		return -1;
+	}
+};
+
+struct Fixture
+{
+	std::shared_ptr<FakeV4L2DeviceIo> Io = std::make_shared<FakeV4L2DeviceIo>();
+	std::unique_ptr<CaptureBackend> Backend = CreateV4L2CaptureBackend(Io);
+	WebcamDevice Camera{ .Name = "Fake Camera", .SymLink = "/dev/video0" };
+	FormatInfo Format{ .FourCC = FOURCC_YUY2, .Resolution = nos::fb::vec2u(WIDTH, HEIGHT), .FrameRate = WebcamFrameRate::WEBCAM_FRAMERATE_30 };
+
+	std::shared_ptr<CaptureSession> Open(CaptureOptions const& options = {})
+	{
+		auto session = Backend->Open(Camera, Format, options);
+		NOS_TEST_CHECK(session.has_value());
+		return session ? *session : nullptr;
+	}
+
+	std::string OpenError()
+	{
+		auto session = Backend->Open(Camera, Format, {});
+		NOS_TEST_CHECK(!session.has_value());
+		return session ? std::string() : session.error();
+	}
+};
+
+void EnumerateDevices()
+{
+	Fixture fixture;
+	auto devices = fixture.Backend->EnumerateDevices();
+	// Metadata node and the node that can not be opened are left out
+	NOS_TEST_CHECK(devices.size() == 1);
+	NOS_TEST_CHECK(devices.size() == 1 && devices[0].Name == "Fake Camera" && devices[0].SymLink == "/dev/video0");
+	NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+}
+
+void EnumerateFormats()
+{
+	Fixture fixture;
+	auto formats = fixture.Backend->EnumerateFormats(fixture.Camera);
+	// H264 and the 7 fps interval are skipped: 2 formats x 2 sizes x 2 rates
+	NOS_TEST_CHECK(formats.size() == 8);
+	for (auto const& format : formats)
+	{
+		NOS_TEST_CHECK(format.FourCC == FOURCC_YUY2 || format.FourCC == FOURCC_MJPG);
+		NOS_TEST_CHECK(format.FrameRate == WebcamFrameRate::WEBCAM_FRAMERATE_30 || format.FrameRate == WebcamFrameRate::WEBCAM_FRAMERATE_29_97);
+	}
+	NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+}
+
+void StreamMmap()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	NOS_TEST_CHECK(io.Memory == V4L2_MEMORY_MMAP);
+	NOS_TEST_CHECK(io.Calls[VIDIOC_REQBUFS] == 1);
+	NOS_TEST_CHECK(io.Calls[VIDIOC_QUERYBUF] == 4);
+	NOS_TEST_CHECK(io.Mapped.size() == 4);
+	NOS_TEST_CHECK(io.Calls[VIDIOC_QBUF] == 4);
+	NOS_TEST_CHECK(io.Streaming);
+	NOS_TEST_CHECK(session->GetMaxFrameSize() == FRAME_SIZE);
+
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame.has_value());
+	if (!frame)
+		return;
+	// Zero copy, the frame points into the mapped device buffer
+	NOS_TEST_CHECK(frame->Data == io.DeviceBuffers[frame->BufferIndex].data());
+	NOS_TEST_CHECK(!frame->UserBuffer);
+	NOS_TEST_CHECK(frame->Size == FRAME_SIZE);
+	NOS_TEST_CHECK(frame->Pitch == 0);
+	NOS_TEST_CHECK(frame->DeviceSequence == 0);
+	NOS_TEST_CHECK(io.Queued.size() == 3);
+	session->Requeue(*frame);
+	NOS_TEST_CHECK(io.Queued.size() == 4);
+	// A second requeue of the same frame is ignored
+	session->Requeue(*frame);
+	NOS_TEST_CHECK(io.Queued.size() == 4);
+
+	session->Close();
+	NOS_TEST_CHECK(!io.Streaming);
+	NOS_TEST_CHECK(io.Mapped.empty());
+	NOS_TEST_CHECK(io.DeviceBuffers.empty());
+	NOS_TEST_CHECK(io.OpenFds.empty());
+	NOS_TEST_CHECK(!session->Dequeue(std::chrono::milliseconds(0)));
+}
+
+void BufferCount()
+{
+	Fixture fixture;
+	auto session = fixture.Open({ .BufferCount = 1 });
+	// Raised to the minimum the backend needs to keep streaming
+	NOS_TEST_CHECK(fixture.Io->DeviceBuffers.size() == 2);
+	session = nullptr;
+	NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	session = fixture.Open({ .BufferCount = 6 });
+	NOS_TEST_CHECK(fixture.Io->DeviceBuffers.size() == 6);
+}
+
+void StreamingOffAndOn()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	auto held = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(held.has_value());
+	session->SetStreaming(false);
+	NOS_TEST_CHECK(!io.Streaming && io.Mapped.empty());
+	session->SetStreaming(true);
+	NOS_TEST_CHECK(io.Streaming);
+	NOS_TEST_CHECK(io.Queued.size() == 4);
+	// Frame from before the restart belongs to buffers that are gone
+	if (held)
+		session->Requeue(*held);
+	NOS_TEST_CHECK(io.Queued.size() == 4);
+	// Driver restarts its sequence on STREAMON, the session keeps counting
+	io.NextSequence = 0;
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame && frame->DeviceSequence == 1);
+}
+
+void SequenceWrap()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	io.NextSequence = UINT32_MAX - 1;
+	uint64_t expected = UINT32_MAX - 1;
+	for (int i = 0; i < 4; i++)
+	{
+		auto frame = session->Dequeue(std::chrono::milliseconds(10));
+		NOS_TEST_CHECK(frame && frame->DeviceSequence == expected++);
+		if (frame)
+			session->Requeue(*frame);
+	}
+}
+
+void UserPointers()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	NOS_TEST_CHECK(session->SupportsUserBuffers());
+	std::vector<std::vector<uint8_t>> memory(3, std::vector<uint8_t>(FRAME_SIZE));
+	std::vector<UserBuffer> buffers;
+	for (auto& block : memory)
+		buffers.push_back({ block.data(), FRAME_SIZE });
+	auto result = session->SetUserBuffers(buffers);
+	NOS_TEST_CHECK(result.has_value());
+	NOS_TEST_CHECK(io.Memory == V4L2_MEMORY_USERPTR);
+	NOS_TEST_CHECK(io.Mapped.empty());
+	NOS_TEST_CHECK(io.Queued.size() == 3);
+
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame.has_value());
+	if (!frame)
+		return;
+	// Device captured straight into the caller's memory
+	NOS_TEST_CHECK(frame->UserBuffer);
+	NOS_TEST_CHECK(frame->BufferIndex < 3 && frame->Data == memory[frame->BufferIndex].data());
+	NOS_TEST_CHECK(frame->Data[0] == uint8_t(*frame->DeviceSequence));
+	session->Requeue(*frame);
+	NOS_TEST_CHECK(io.Queued.size() == 3);
+
+	// Back to device buffers
+	NOS_TEST_CHECK(session->SetUserBuffers({}).has_value());
+	NOS_TEST_CHECK(io.Memory == V4L2_MEMORY_MMAP && io.Mapped.size() == 4);
+}
+
+void UserPointerFallback()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	io.RejectUserPtr = true;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	std::vector<uint8_t> memory(2 * FRAME_SIZE);
+	auto result = session->SetUserBuffers({ { memory.data(), FRAME_SIZE }, { memory.data() + FRAME_SIZE, FRAME_SIZE } });
+	NOS_TEST_CHECK(!result.has_value());
+	NOS_TEST_CHECK(!result && result.error().find("VIDIOC_REQBUFS") != std::string::npos);
+	// Session keeps capturing into mapped device buffers
+	NOS_TEST_CHECK(io.Streaming);
+	NOS_TEST_CHECK(io.Memory == V4L2_MEMORY_MMAP);
+	NOS_TEST_CHECK(io.Mapped.size() == 4);
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame && !frame->UserBuffer && frame->Data == io.DeviceBuffers[frame->BufferIndex].data());
+}
+
+void UserBufferTooSmall()
+{
+	Fixture fixture;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	std::vector<uint8_t> memory(FRAME_SIZE);
+	auto result = session->SetUserBuffers({ { memory.data(), FRAME_SIZE - 1 }, { memory.data(), FRAME_SIZE - 1 } });
+	NOS_TEST_CHECK(!result.has_value());
+	// Nothing was touched
+	NOS_TEST_CHECK(fixture.Io->Streaming && fixture.Io->Memory == V4L2_MEMORY_MMAP);
+}
+
+void PaddedRows()
+{
+	Fixture fixture;
+	fixture.Io->BytesPerLine = WIDTH * 2 + 64;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	// Consumers of user buffers expect packed rows
+	NOS_TEST_CHECK(!session->SupportsUserBuffers());
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame && frame->Pitch == int32_t(WIDTH * 2 + 64));
+}
+
+void OpenErrors()
+{
+	{
+		Fixture fixture;
+		fixture.Camera.SymLink = "/dev/video2";
+		NOS_TEST_CHECK(fixture.OpenError().find("/dev/video2") != std::string::npos);
+	}
+	{
+		Fixture fixture;
+		fixture.Io->FailingRequests[VIDIOC_S_FMT] = EINVAL;
+		NOS_TEST_CHECK(fixture.OpenError().find("VIDIOC_S_FMT") != std::string::npos);
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	}
+	{
+		Fixture fixture;
+		fixture.Io->ForcedWidth = WIDTH / 2;
+		NOS_TEST_CHECK(fixture.OpenError().find("did not accept") != std::string::npos);
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	}
+	{
+		Fixture fixture;
+		fixture.Io->FailingRequests[VIDIOC_REQBUFS] = ENOMEM;
+		NOS_TEST_CHECK(fixture.OpenError().find("VIDIOC_REQBUFS") != std::string::npos);
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	}
+	{
+		Fixture fixture;
+		fixture.Io->GrantedBufferCount = 1;
+		NOS_TEST_CHECK(fixture.OpenError().find("Not enough capture buffers") != std::string::npos);
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	}
+	{
+		Fixture fixture;
+		fixture.Io->FailingRequests[VIDIOC_QUERYBUF] = EINVAL;
+		NOS_TEST_CHECK(fixture.OpenError().find("VIDIOC_QUERYBUF") != std::string::npos);
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+	}
+	{
+		Fixture fixture;
+		fixture.Io->FailingRequests[VIDIOC_STREAMON] = EIO;
+		NOS_TEST_CHECK(fixture.OpenError().find("VIDIOC_STREAMON") != std::string::npos);
+		// Buffers mapped before the failure are released with the session
+		NOS_TEST_CHECK(fixture.Io->OpenFds.empty());
+		NOS_TEST_CHECK(fixture.Io->Mapped.empty());
+	}
+}
+
+void DequeueErrors()
+{
+	Fixture fixture;
+	auto& io = *fixture.Io;
+	auto session = fixture.Open();
+	if (!session)
+		return;
+	// Corrupted frame goes straight back to the device
+	io.NextBufferFlags = V4L2_BUF_FLAG_ERROR;
+	NOS_TEST_CHECK(!session->Dequeue(std::chrono::milliseconds(10)));
+	NOS_TEST_CHECK(io.Queued.size() == 4);
+	io.FailingRequests[VIDIOC_DQBUF] = EIO;
+	NOS_TEST_CHECK(!session->Dequeue(std::chrono::milliseconds(10)));
+	io.FailingRequests.clear();
+	auto frame = session->Dequeue(std::chrono::milliseconds(10));
+	NOS_TEST_CHECK(frame.has_value());
+	// Failed requeue is logged and the buffer stays out of the device
+	io.FailingRequests[VIDIOC_QBUF] = EINVAL;
+	if (frame)
+		session->Requeue(*frame);
+	NOS_TEST_CHECK(io.Queued.size() == 3);
+}
+} // namespace
+
+int main()
+{
+	return test::RunTests({
+		{ "EnumerateDevices", EnumerateDevices },
+		{ "EnumerateFormats", EnumerateFormats },
+		{ "StreamMmap", StreamMmap },
+		{ "BufferCount", BufferCount },
+		{ "StreamingOffAndOn", StreamingOffAndOn },
+		{ "SequenceWrap", SequenceWrap },
+		{ "UserPointers", UserPointers },
+		{ "UserPointerFallback", UserPointerFallback },
+		{ "UserBufferTooSmall", UserBufferTooSmall },
+		{ "PaddedRows", PaddedRows },
+		{ "OpenErrors", OpenErrors },
+		{ "DequeueErrors", DequeueErrors },
+	});
+}
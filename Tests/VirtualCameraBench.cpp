@@ -0,0 +1,209 @@
+// Copyright MediaZ Teknoloji A.S. All Rights Reserved.
+
+// What each additional WebcamOut camera costs on the shared memory transport. Cameras are created through the registry like the
+// nodes do, one thread publishes a frame to every camera at the output rate like the engine thread, and one reader process per
+// camera stands in for the applications that watch them. Prints the CPU time this process and each reader use per second of output.
+#include "ProcessHelpers.h"
+#include "SharedFrameRing.h"
+#include "VirtualCamera.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <expected>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace nos::webcam;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr auto RUN_TIME = std::chrono::milliseconds(1500);
+
+double GetCpuSeconds()
+{
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Reader process: copies every frame it can until the camera goes away, then prints frames, skipped frames, CPU and wall seconds
+int RunReader(std::string const& cameraName)
+{
+	auto reader = SharedFrameReader::Open(cameraName);
+	if (!reader)
+	{
+		std::fprintf(stderr, "%s\n", reader.error().c_str());
+		return 1;
+	}
+	std::vector<uint8_t> frame((*reader)->GetFrameSize());
+	uint64_t frames = 0, skipped = 0;
+	const double cpuStart = GetCpuSeconds();
+	const auto start = Clock::now();
+	while (true)
+	{
+		const auto result = (*reader)->Read(frame.data(), std::chrono::milliseconds(100));
+		if (result.Status == SharedFrameReader::ReadStatus::Closed)
+			break;
+		if (result.Status != SharedFrameReader::ReadStatus::Frame)
+			continue;
+		frames++;
+		skipped += result.Skipped;
+	}
+	std::printf("%llu %llu %f %f\n", (unsigned long long)frames, (unsigned long long)skipped, GetCpuSeconds() - cpuStart,
+		std::chrono::duration<double>(Clock::now() - start).count());
+	return 0;
+}
+
+struct ReaderResult
+{
+	uint64_t Frames = 0;
+	uint64_t Skipped = 0;
+	double CpuSeconds = 0;
+	double WallSeconds = 0;
+};
+
+std::optional<ReaderResult> WaitReader(test::ChildProcess const& reader)
+{
+	const auto output = test::WaitChild(reader);
+	ReaderResult result;
+	unsigned long long frames = 0, skipped = 0;
+	if (!output || std::sscanf(output->c_str(), "%llu %llu %lf %lf", &frames, &skipped, &result.CpuSeconds, &result.WallSeconds) != 4)
+		return std::nullopt;
+	result.Frames = frames;
+	result.Skipped = skipped;
+	return result;
+}
+
+struct Result
+{
+	// Of one core, for this process and for an average reader
+	double ProducerLoad = 0;
+	double ReaderLoad = 0;
+	// Frames per second an average reader got
+	double ReaderFrameRate = 0;
+	uint64_t Skipped = 0;
+};
+
+std::expected<Result, std::string> RunCameras(uint32_t cameraCount, nos::fb::vec2u resolution, float frameRate)
+{
+	auto& registry = VirtualCameraRegistry::GetInstance();
+	std::vector<nosUUID> owners(cameraCount);
+	std::vector<std::shared_ptr<VirtualCamera>> cameras;
+	std::vector<test::ChildProcess> readers;
+	auto releaseAll = [&] {
+		cameras.clear();
+		for (auto const& owner : owners)
+			registry.Release(owner);
+	};
+	for (uint32_t i = 0; i < cameraCount; i++)
+	{
+		std::memset(&owners[i], 0, sizeof(nosUUID));
+		std::memcpy(&owners[i], &i, sizeof(i));
+		const VirtualCameraConfig config{ .Name = "VirtualCameraBench." + std::to_string(getpid()) + "." + std::to_string(i), .Resolution = resolution,
+			.FrameRate = frameRate, .Format = WebcamTextureFormat::NV12 };
+		auto camera = registry.Acquire(owners[i], config);
+		if (!camera)
+		{
+			releaseAll();
+			return std::unexpected(camera.error());
+		}
+		cameras.push_back(std::move(*camera));
+		if (auto reader = test::SpawnSelf({ "--read", config.Name }))
+			readers.push_back(*reader);
+	}
+	// Frames are not sent to cameras nobody has open, wait until every reader is in
+	const auto openDeadline = Clock::now() + std::chrono::seconds(5);
+	for (auto const& camera : cameras)
+		while (camera->HasNoReaders() && Clock::now() < openDeadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::vector<uint8_t> source(cameras.front()->Sender.GetFrameSize(), 0x80);
+	const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+	auto publish = [&](std::chrono::nanoseconds duration) {
+		const auto end = Clock::now() + duration;
+		for (auto tick = Clock::now(); tick < end; tick += frameTime)
+		{
+			for (auto const& camera : cameras)
+			{
+				std::memcpy(camera->Sender.GetWriteSlot(), source.data(), source.size());
+				camera->Sender.Publish();
+			}
+			std::this_thread::sleep_until(tick + frameTime);
+		}
+	};
+	// Lets the sender threads and readers settle into the rate
+	publish(std::chrono::milliseconds(200));
+	const double cpuStart = GetCpuSeconds();
+	const auto start = Clock::now();
+	publish(RUN_TIME);
+	// Runs over when the machine can not keep up with the rate
+	Result result;
+	result.ProducerLoad = (GetCpuSeconds() - cpuStart) / std::chrono::duration<double>(Clock::now() - start).count();
+
+	// Deleting the cameras closes them for the readers, which then report
+	releaseAll();
+	double readerLoad = 0, readerFrameRate = 0;
+	uint32_t reported = 0;
+	for (auto const& reader : readers)
+		if (auto readerResult = WaitReader(reader))
+		{
+			readerLoad += readerResult->CpuSeconds / readerResult->WallSeconds;
+			readerFrameRate += double(readerResult->Frames) / readerResult->WallSeconds;
+			result.Skipped += readerResult->Skipped;
+			reported++;
+		}
+	if (reported != cameraCount)
+		return std::unexpected(std::to_string(cameraCount - reported) + " reader(s) failed");
+	result.ReaderLoad = readerLoad / reported;
+	result.ReaderFrameRate = readerFrameRate / reported;
+	return result;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc == 3 && std::strcmp(argv[1], "--read") == 0)
+		return RunReader(argv[2]);
+
+	VirtualCameraRegistry::Start();
+	struct Output
+	{
+		nos::fb::vec2u Resolution;
+		float FrameRate;
+	};
+	const Output outputs[] = { { nos::fb::vec2u(1280, 720), 60.0f }, { nos::fb::vec2u(1920, 1080), 60.0f }, { nos::fb::vec2u(3840, 2160), 30.0f } };
+	std::printf("%u cores, NV12 cameras, one reader process each\n", std::thread::hardware_concurrency());
+	std::printf("%-14s %-8s %12s %12s %12s %12s %10s %10s\n", "Output", "Cameras", "producer %", "per camera", "added each", "reader %", "reader fps", "skipped");
+	int exitCode = 0;
+	for (auto const& output : outputs)
+	{
+		const std::string name = std::to_string(output.Resolution.x()) + "x" + std::to_string(output.Resolution.y()) + "@" + std::to_string(int(output.FrameRate));
+		uint32_t previousCount = 0;
+		double previousLoad = 0;
+		for (uint32_t cameraCount : { 1u, 2u, 4u, 8u })
+		{
+			auto result = RunCameras(cameraCount, output.Resolution, output.FrameRate);
+			if (!result)
+			{
+				std::fprintf(stderr, "%s with %u cameras: %s\n", name.c_str(), cameraCount, result.error().c_str());
+				exitCode = 1;
+				break;
+			}
+			const double added = (result->ProducerLoad - previousLoad) / double(cameraCount - previousCount);
+			std::printf("%-14s %-8u %12.2f %12.2f %12.2f %12.2f %10.1f %10llu\n", name.c_str(), cameraCount, result->ProducerLoad * 100,
+				result->ProducerLoad * 100 / cameraCount, added * 100, result->ReaderLoad * 100, result->ReaderFrameRate,
+				(unsigned long long)result->Skipped);
+			previousCount = cameraCount;
+			previousLoad = result->ProducerLoad;
+		}
+	}
+	VirtualCameraRegistry::Stop();
+	return exitCode;
+}